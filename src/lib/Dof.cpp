@@ -25,88 +25,65 @@ Dof::dofType Dof::label2dofType (const std::string& label) {
 void DofCollection::initDofTable(uint32 _numberOfEntities) {
   clearDofTable();
   numberOfEntities = _numberOfEntities;
-  dofPos.assign(numberOfEntities + 1, 0);
+  dofMask.assign(numberOfEntities, 0);
 }
 
 
 // n index starts from 1
-void DofCollection::addDof(uint32 n, std::initializer_list<Dof::dofType> __dofs) {
+void DofCollection::addDof(uint32 n, std::initializer_list<Dof::dofType> _dofs) {
+  assert(n > 0);
   assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-  std::set<Dof::dofType> _dofs(__dofs);
-  std::vector<Dof> newDofs;
-  // if already registered - just return
-  if (dofPos[n-1] == dofPos[n]) {
-    for (auto& v : _dofs)
-      newDofs.push_back(Dof(v));
-  } else {
-    for (auto& v : _dofs) {
-      bool isFound = false;
-      for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-        if (it->type == v) {
-          isFound = true;
-          break;
-        }
-      }
-      if (!isFound) {
-        newDofs.push_back(Dof(v));
-      }
-    }
+  assert(dofMask.size() > 0);
+  CHECK(dofPos.size() == 0) << "DoFs should be added before DofCollection::buildDofTable()";
+  DofMask mask = 0;
+  for (auto v : _dofs) {
+    assert(v < Dof::UNDEFINED);
+    mask |= static_cast<DofMask>(1u << v);
   }
+  // count only DoFs which are not registered yet
+  numberOfUsedDofs += countDofs(mask & ~dofMask[n-1]);
+  dofMask[n-1] |= mask;
+  uniqueMask |= mask;
+}
 
-  if (newDofs.size() == 0) return;
-
-  dofs.insert(dofs.begin() + dofPos[n], newDofs.begin(), newDofs.end());
-  uniqueDofTypes.insert(std::begin(_dofs), std::end(_dofs));
 
-  // incement dofPos with newDofs.size() for all above
-  uint32 i = n;
-  while (i <= numberOfEntities) dofPos[i++] += newDofs.size();
+void DofCollection::buildDofTable() {
+  dofPos.assign(numberOfEntities + 1, 0);
+  for (uint32 n = 0; n < numberOfEntities; n++) {
+    dofPos[n + 1] = dofPos[n] + countDofs(dofMask[n]);
+  }
+  assert(dofPos[numberOfEntities] == numberOfUsedDofs);
 
-  numberOfUsedDofs += newDofs.size();
+  dofs.clear();
+  dofs.reserve(numberOfUsedDofs);
+  for (uint32 n = 0; n < numberOfEntities; n++) {
+    for (uint16 t = 0; t < Dof::numberOfDofTypes; t++) {
+      if ((dofMask[n] >> t) & 1) {
+        dofs.push_back(Dof(static_cast<Dof::dofType>(t)));
+      }
+    }
+  }
 }
 
 
 void DofCollection::clearDofTable() {
   dofs.clear();
   dofPos.clear();
-  uniqueDofTypes.clear();
+  dofMask.clear();
+  uniqueMask = 0;
   numberOfUsedDofs = 0;
   numberOfEntities = 0;
 }
 
 
-// n index starts from 1
-bool DofCollection::isDofUsed(uint32 n, Dof::dofType dof) {
-  assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-  if (dofPos[n-1] == dofPos[n]) return false;
-  for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-    if (it->type == dof) return true;
-  }
-  return false;
-}
-
-
-// return nullptr if Dof was not found
-Dof* DofCollection::getDof(uint32 n, Dof::dofType dof) {
-  assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-
-  Dof* pdof = nullptr;
-
-  for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-    if (it->type == dof) {
-      pdof = &(*it);
-      break;
+std::set<Dof::dofType> DofCollection::getUniqueDofTypes() {
+  std::set<Dof::dofType> types;
+  for (uint16 t = 0; t < Dof::numberOfDofTypes; t++) {
+    if ((uniqueMask >> t) & 1) {
+      types.insert(static_cast<Dof::dofType>(t));
     }
   }
-  return pdof;
-}
-
-
-std::set<Dof::dofType> DofCollection::getUniqueDofTypes() {
-  return uniqueDofTypes;
+  return types;
 }
 
 
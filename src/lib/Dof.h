@@ -42,6 +42,10 @@ inline const char* Dof::dofType2label(const Dof::dofType t) {
 }
 
 
+// DofCollection keeps Dofs of entities (nodes or elements). The table is built in two phases:
+// addDof(..) only marks the used types in the entity's bit mask, then buildDofTable() allocates
+// Dofs of all entities at once (prefix sum of the mask sizes). Dofs of the entity n are sorted by
+// type and located from dofPos[n-1] to dofPos[n], so getDof(..) is a constant time lookup.
 class DofCollection {
   public:
     uint32 getNumberOfUsedDofs();
@@ -55,23 +59,34 @@ class DofCollection {
               std::vector<Dof>::iterator> getEntityDofs(uint32 n);
 
     void initDofTable(uint32 _numberOfEntities);
+    // register DoFs for Entity n. Should be called before buildDofTable()
     void addDof(uint32 n, std::initializer_list<Dof::dofType> _dofs);
+    // allocate Dof objects for all registered DoFs
+    void buildDofTable();
     void clearDofTable();
     bool isDofUsed(uint32 n, Dof::dofType dof);
 
     std::set<Dof::dofType> getUniqueDofTypes();
 
   private:
+    typedef uint16 DofMask;
+    static_assert(Dof::UNDEFINED <= sizeof(DofMask) * 8, "DofMask can't keep all Dof types");
+
+    // number of set bits in the mask
+    static uint16 countDofs(DofMask mask);
+
     uint32 numberOfUsedDofs = 0;
     uint32 numberOfEntities = 0;
 
+    // dofMask[n-1] has bit t set if Dof with type t is used for entity n
+    std::vector<DofMask> dofMask;
+    // all types used in the collection
+    DofMask uniqueMask = 0;
     // vector of Dof objects 
     std::vector<Dof> dofs;
     // array of indexes to find where dofs for particular entity is located in dofs
     // Dof for entity n will be located from dofPos[n-1] included to dofPos[n] excluded 
     std::vector<uint32> dofPos;
-    // set of unique dofs used in collection
-    std::set<Dof::dofType> uniqueDofTypes;
 };
 
 
@@ -85,6 +100,34 @@ inline uint32 DofCollection::getNumberOfEntities() {
 }
 
 
+inline uint16 DofCollection::countDofs(DofMask mask) {
+  uint16 count = 0;
+  for (; mask; mask &= mask - 1) count++;
+  return count;
+}
+
+
+// n index starts from 1
+inline bool DofCollection::isDofUsed(uint32 n, Dof::dofType dof) {
+  assert(n > 0);
+  assert(n <= numberOfEntities);
+  return (dofMask[n-1] >> dof) & 1;
+}
+
+
+// return nullptr if Dof was not found
+inline Dof* DofCollection::getDof(uint32 n, Dof::dofType dof) {
+  assert(n > 0);
+  assert(n <= numberOfEntities);
+  assert(dofPos.size() > 0);
+  const DofMask mask = dofMask[n-1];
+  const DofMask bit = static_cast<DofMask>(1u << dof);
+  if (!(mask & bit)) return nullptr;
+  // Dofs of the entity are sorted by type
+  return &dofs[dofPos[n-1] + countDofs(mask & (bit - 1))];
+}
+
+
 inline std::pair<std::vector<Dof>::iterator,
                  std::vector<Dof>::iterator> DofCollection::getEntityDofs(uint32 n) {
   assert(n > 0);
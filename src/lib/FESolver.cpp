@@ -3,6 +3,8 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "FESolver.h"
+#include "math/KrylovEquationSolver.h"
+#include "math/AMGPreconditioner.h"
 
 namespace nla3d {
 
@@ -126,6 +128,9 @@ FESolver::FESolver() {
 
 FESolver::~FESolver() {
   deletePostProcessors();
+  if (opK) {
+    delete opK;
+  }
 }
 
 
@@ -172,12 +177,24 @@ void FESolver::attachEquationSolver(math::EquationSolver *eq) {
   eqSolver = CHECK_NOTNULL(eq);
 }
 
+math::EquationSolver* FESolver::getEquationSolver() {
+  return eqSolver;
+}
+
 void FESolver::initSolutionData() {
   storage->initSolutionData();
 
   // make easy access to global system of equations entities
-  // pointer to stiff. matrix
-  matK = storage->getK();
+  // pointer to stiff. matrix (in matrix-free mode only the operator K * x is available)
+  if (storage->isMatrixFree()) {
+    matK = nullptr;
+    if (opK) {
+      delete opK;
+    }
+    opK = new StiffnessOperator(storage);
+  } else {
+    matK = storage->getK();
+  }
 
   // pointers to DoF values vector and it parts (c - constrained DoFs, s - to be solved (unknown)
   // DoFs, l - mpc's lambdas
@@ -215,6 +232,25 @@ void FESolver::initSolutionData() {
     vecDDUl.reinit(*(storage->getDDU()), storage->nConstrainedDofs() + storage->nUnknownDofs(), storage->nMpc());
     vecDDUsl.reinit(*(storage->getDDU()), storage->nConstrainedDofs(), storage->nUnknownDofs() + storage->nMpc());
   }
+
+  // AMG preconditioner needs the rigid body modes of the model as near-nullspace, block Jacobi -
+  // the nodal blocks of equations
+  auto krylov = dynamic_cast<math::KrylovEquationSolver*>(eqSolver);
+  if (krylov && matK) {
+    auto amg = dynamic_cast<math::AMGPreconditioner*>(krylov->getPreconditioner());
+    if (amg) {
+      std::vector<double> modes;
+      std::vector<uint32> eqNode;
+      storage->getRigidBodyModes(modes, eqNode);
+      amg->setNearNullspace(6, modes, eqNode);
+    }
+    auto blockJacobi = dynamic_cast<math::BlockJacobiPreconditioner*>(krylov->getPreconditioner());
+    if (blockJacobi) {
+      std::vector<uint32> blockFirst;
+      storage->getNodalBlocks(blockFirst);
+      blockJacobi->setBlocks(blockFirst);
+    }
+  }
 }
 
 
@@ -260,6 +296,8 @@ void FESolver::addLoad(int32 n, Dof::dofType dof, const double value) {
 
 
 void FESolver::dumpMatricesAndVectors(std::string filename) {
+  CHECK(matK) << "There are no stored matrices in matrix-free mode";
+  CHECK(!matK->bsrBlock(2)) << "Matrices in BSR format can't be dumped";
   std::ofstream out(filename);
   matK->block(1)->writeCoordinateTextFormat(out);
   matK->block(1, 2)->writeCoordinateTextFormat(out);
@@ -281,6 +319,8 @@ void FESolver::dumpMatricesAndVectors(std::string filename) {
 
 
 void FESolver::compareMatricesAndVectors(std::string filename, double th) {
+  CHECK(matK) << "There are no stored matrices in matrix-free mode";
+  CHECK(!matK->bsrBlock(2)) << "Matrices in BSR format can't be compared";
   std::ifstream in(filename);
   SparseSymMatrix K1;
   K1.readCoordinateTextFormat(in);
@@ -327,6 +367,83 @@ void FESolver::compareMatricesAndVectors(std::string filename, double th) {
 }
 
 
+void FESolver::eliminateConstrainedDofs(dVec& Uc, dVec& rhs) {
+  if (!opK) {
+    matBTVprod(*(matK->block(1,2)), Uc, -1.0, rhs);
+    return;
+  }
+  // Kcs^T * Uc is the unknowns part of K * [Uc, 0]
+  const uint32 nc = storage->nConstrainedDofs();
+  std::vector<double> x(storage->nDofs() + storage->nMpc(), 0.0);
+  std::vector<double> y(x.size());
+  std::copy(Uc.ptr(), Uc.ptr() + nc, x.begin());
+  storage->multiplyK(x.data(), y.data());
+  for (uint32 i = 0; i < rhs.size(); i++) {
+    rhs[i] -= y[nc + i];
+  }
+}
+
+
+void FESolver::restoreReactions(dVec& Uc, dVec& Usl, dVec& Rc) {
+  Rc.zero();
+  if (!opK) {
+    matBVprod(*(matK->block(1)), Uc, 1.0, Rc);
+    matBVprod(*(matK->block(1,2)), Usl, 1.0, Rc);
+  } else {
+    // Kcc * Uc + Kcs * Usl is the constrained part of K * [Uc, Usl]
+    const uint32 nc = storage->nConstrainedDofs();
+    std::vector<double> x(storage->nDofs() + storage->nMpc());
+    std::vector<double> y(x.size());
+    std::copy(Uc.ptr(), Uc.ptr() + nc, x.begin());
+    std::copy(Usl.ptr(), Usl.ptr() + Usl.size(), x.begin() + nc);
+    storage->multiplyK(x.data(), y.data());
+    for (uint32 i = 0; i < nc; i++) {
+      Rc[i] = y[i];
+    }
+  }
+  Rc -= vecFc;
+}
+
+
+void FESolver::solveStiffness(double* rhs, double* Usl) {
+  if (opK) {
+    auto krylov = dynamic_cast<math::KrylovEquationSolver*>(eqSolver);
+    CHECK(krylov) << "Matrix-free mode needs an iterative (Krylov) EquationSolver";
+    krylov->solveEquations(opK, rhs, Usl);
+  } else if (matK->bsrBlock(2)) {
+    eqSolver->solveEquations(matK->bsrBlock(2), rhs, Usl);
+  } else {
+    eqSolver->solveEquations(matK->block(2), rhs, Usl);
+  }
+}
+
+
+void FESolver::factorizeStiffness() {
+  if (opK) {
+    auto krylov = dynamic_cast<math::KrylovEquationSolver*>(eqSolver);
+    CHECK(krylov) << "Matrix-free mode needs an iterative (Krylov) EquationSolver";
+    krylov->factorizeEquations(opK);
+  } else if (matK->bsrBlock(2)) {
+    eqSolver->factorizeEquations(matK->bsrBlock(2));
+  } else {
+    eqSolver->factorizeEquations(matK->block(2));
+  }
+}
+
+
+void FESolver::substituteStiffness(double* rhs, double* Usl) {
+  if (opK) {
+    auto krylov = dynamic_cast<math::KrylovEquationSolver*>(eqSolver);
+    CHECK(krylov) << "Matrix-free mode needs an iterative (Krylov) EquationSolver";
+    krylov->substituteEquations(opK, rhs, Usl);
+  } else if (matK->bsrBlock(2)) {
+    eqSolver->substituteEquations(matK->bsrBlock(2), rhs, Usl);
+  } else {
+    eqSolver->substituteEquations(matK->block(2), rhs, Usl);
+  }
+}
+
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
 // LinearFESolver
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
@@ -362,6 +479,10 @@ void LinearFESolver::solve () {
   vecR.zero();
 
   storage->assembleGlobalEqMatrices();
+  if (loadCases.size() > 0) {
+    solveLoadCases();
+    return;
+  }
   applyBoundaryConditions(1.0);
 
   // we need to calculate RHS for unknowns Dofs and Mps eq.
@@ -371,16 +492,13 @@ void LinearFESolver::solve () {
   rhs += vecFsl;
   rhs += vecRsl;
   // need to take into account elimination of constrained DoFs:
-  matBTVprod(*(matK->block(1,2)), vecUc, -1.0, rhs);
+  eliminateConstrainedDofs(vecUc, rhs);
 
   // solve equation system
-  eqSolver->solveEquations(matK->block(2), rhs.ptr(), vecUsl.ptr());
+  solveStiffness(rhs.ptr(), vecUsl.ptr());
 
   // restore reaction loads for constrained DoFs.
-  vecRc.zero();
-  matBVprod(*(matK->block(1)), vecUc, 1.0, vecRc);
-  matBVprod(*(matK->block(1,2)), vecUsl, 1.0, vecRc);
-  vecRc -= vecFc;
+  restoreReactions(vecUc, vecUsl, vecRc);
 
   // update results for elements
   storage->updateResults();
@@ -397,6 +515,95 @@ void LinearFESolver::solve () {
 }
 
 
+void LinearFESolver::solveLoadCases() {
+  TIMED_SCOPE(timer, "solveLoadCases");
+  const uint32 nCases = static_cast<uint32>(loadCases.size());
+  const uint64 nEq = storage->nUnknownDofs() + storage->nMpc();
+  LOG(INFO) << "Solve " << nCases << " load cases with one factorization";
+
+  // RHS of all load cases one after another
+  std::vector<double> rhs(nEq * nCases, 0.0);
+  std::vector<double> unknowns(nEq * nCases, 0.0);
+  dVec caseRhs(static_cast<uint32>(nEq));
+  for (uint32 lc = 0; lc < nCases; lc++) {
+    vecR.zero();
+    applyBoundaryConditions(1.0);
+    for (auto& load : loadCases[lc].loads) {
+      storage->addValueR(load.node, load.node_dof, load.value);
+    }
+    caseRhs.zero();
+    caseRhs += vecFsl;
+    caseRhs += vecRsl;
+    eliminateConstrainedDofs(vecUc, caseRhs);
+    std::copy(caseRhs.ptr(), caseRhs.ptr() + nEq, rhs.begin() + nEq * lc);
+  }
+
+  eqSolver->setNumberOfRhs(nCases);
+  factorizeStiffness();
+  substituteStiffness(rhs.data(), unknowns.data());
+  eqSolver->setNumberOfRhs(1);
+
+  for (uint32 lc = 0; lc < nCases; lc++) {
+    LOG(INFO) << "***** Load case " << lc + 1 << " of " << nCases;
+    vecR.zero();
+    applyBoundaryConditions(1.0);
+    for (auto& load : loadCases[lc].loads) {
+      storage->addValueR(load.node, load.node_dof, load.value);
+    }
+    std::copy(unknowns.begin() + nEq * lc, unknowns.begin() + nEq * (lc + 1), vecUsl.ptr());
+
+    // restore reaction loads for constrained DoFs.
+    restoreReactions(vecUc, vecUsl, vecRc);
+
+    loadCases[lc].U = vecU;
+    loadCases[lc].R = vecR;
+
+    storage->updateResults();
+
+    for (size_t i = 0; i < getNumberOfPostProcessors(); i++) {
+      postProcessors[i]->process(static_cast<uint16>(lc + 1));
+    }
+  }
+
+  LOG(INFO) << "***** SOLVED *****";
+
+  for (size_t i = 0; i < getNumberOfPostProcessors(); i++) {
+    postProcessors[i]->post(static_cast<uint16>(nCases));
+  }
+}
+
+
+uint16 LinearFESolver::addLoadCase() {
+  loadCases.push_back(LoadCase());
+  return static_cast<uint16>(loadCases.size());
+}
+
+
+void LinearFESolver::addLoadCaseLoad(uint16 lc, int32 n, Dof::dofType dof, const double value) {
+  CHECK(lc > 0 && lc <= loadCases.size());
+  loadCases[lc - 1].loads.push_back(loadBC(n, dof, value));
+}
+
+
+uint16 LinearFESolver::getNumberOfLoadCases() {
+  return static_cast<uint16>(loadCases.size());
+}
+
+
+dVec& LinearFESolver::getLoadCaseU(uint16 lc) {
+  CHECK(lc > 0 && lc <= loadCases.size());
+  CHECK(loadCases[lc - 1].U.isInit()) << "Load case " << lc << " isn't solved yet";
+  return loadCases[lc - 1].U;
+}
+
+
+dVec& LinearFESolver::getLoadCaseR(uint16 lc) {
+  CHECK(lc > 0 && lc <= loadCases.size());
+  CHECK(loadCases[lc - 1].R.isInit()) << "Load case " << lc << " isn't solved yet";
+  return loadCases[lc - 1].R;
+}
+
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
 // NonlinearFESolver
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
@@ -414,6 +621,9 @@ void NonlinearFESolver::solve() {
   eqSolver->setSymmetric(true);
   eqSolver->setPositive(false);
 
+  // the tangent matrix is refactorized in place, matrix-free operator doesn't fit here
+  CHECK(!storage->isMatrixFree()) << "NonlinearFESolver doesn't support matrix-free mode";
+
   storage->initDofs();
   setConstrainedDofs();
   storage->assignEquationNumbers();
@@ -438,8 +648,20 @@ void NonlinearFESolver::solve() {
   double currentCriteria = 0.0;
   double timeDelta = (timeControl.getEndTime() - timeControl.getStartTime()) / numberOfLoadsteps;
 
+  // iterative equation solvers report their statistics per loadstep
+  auto krylov = dynamic_cast<math::KrylovEquationSolver*>(eqSolver);
+
+  numberOfFactorizations = 0;
+  // number of iterations since the last factorization
+  uint16 reuseCount = 0;
+  bool slowConvergence = false;
+
   while (timeControl.nextStep(timeDelta)) {
     bool converged = false;
+    uint32 linearIterations = 0;
+    double maxLinearResidual = 0.0;
+    uint32 loadstepFactorizations = 0;
+    double previousCriteria = 0.0;
     for (;;) {
       timeControl.nextEquilibriumStep();
       vecR.zero();
@@ -451,20 +673,39 @@ void NonlinearFESolver::solve() {
       rhs += vecFsl;
       rhs += vecRsl;
       // nConstr x (nUnknown + nMPC)
-      matBTVprod(*(matK->block(1,2)), deltaUc, -1.0, rhs);
+      eliminateConstrainedDofs(deltaUc, rhs);
+
+      // factorize the matrix if the iteration strategy requires it
+      bool factorize = true;
+      if (strategy == IterationStrategy::ModifiedNewton) {
+        factorize = (numberOfFactorizations == 0 || timeControl.getCurrentEquilibriumStep() == 1 ||
+                     reuseCount >= refactorizationInterval || slowConvergence);
+      } else if (strategy == IterationStrategy::InitialStiffness) {
+        factorize = (numberOfFactorizations == 0);
+      }
+      if (factorize) {
+        factorizeStiffness();
+        numberOfFactorizations++;
+        loadstepFactorizations++;
+        reuseCount = 0;
+      }
+      reuseCount++;
 
       // solve equation system
-      eqSolver->solveEquations(matK->block(2), rhs.ptr(), deltaUsl.ptr());
+      substituteStiffness(rhs.ptr(), deltaUsl.ptr());
+      if (krylov) {
+        linearIterations += krylov->getNumberOfIterations();
+        maxLinearResidual = std::max(maxLinearResidual, krylov->getResidual());
+        LOG_IF(!krylov->isConverged(), WARNING) << krylov->getName() << " didn't reach tolerance "
+          << krylov->tolerance << ", relative residual = " << krylov->getResidual();
+      }
 
       // restore DoF values from increments
       vecUs += deltaUs;
       vecUl = deltaUl;
 
       // restore constrained DoFs reactions
-      vecRc.zero();
-      matBVprod(*(matK->block(1)), deltaUc, 1.0, vecRc);
-      matBVprod(*(matK->block(1,2)), deltaUsl, 1.0, vecRc);
-      vecRc -= vecFc;
+      restoreReactions(deltaUc, deltaUsl, vecRc);
 
       Ucprev = vecUc;
 
@@ -472,6 +713,8 @@ void NonlinearFESolver::solve() {
 
       // calculate convergence criteria
       currentCriteria = calculateCriteria(deltaUs);
+      slowConvergence = (previousCriteria > 0.0 && currentCriteria > slowConvergenceRatio * previousCriteria);
+      previousCriteria = currentCriteria;
 
       // TODO: 1. It seems that currentCriteria is already normalized in calculateCriteria(). we
       //          need to compare currentCriteria with 1.0 
@@ -490,6 +733,10 @@ void NonlinearFESolver::solve() {
     LOG_IF(!converged, FATAL) << "The solution is not converged with "
         << timeControl.getCurrentEquilibriumStep() << " equilibrium iterations";
     LOG(INFO) << "Loadstep " << timeControl.getCurrentStep() << " completed with " << timeControl.getCurrentEquilibriumStep();
+    LOG_IF(strategy != IterationStrategy::FullNewton, INFO) << "Number of factorizations in the loadstep = "
+      << loadstepFactorizations;
+    LOG_IF(krylov, INFO) << krylov->getName() << " iterations in the loadstep = " << linearIterations
+      << ", max relative residual = " << maxLinearResidual;
 
     // TODO: figure out why TIMED_BLOCK doesn't work here..
     // TIMED_BLOCK(t, "PostProcessor::process") {
@@ -508,6 +755,11 @@ void NonlinearFESolver::solve() {
 }
 
 
+uint32 NonlinearFESolver::getNumberOfFactorizations() {
+  return numberOfFactorizations;
+}
+
+
 double NonlinearFESolver::calculateCriteria(dVec& delta) {
   double curCriteria = 0.0;
   for (uint32 i = 0; i < delta.size(); i++) {
@@ -571,7 +823,15 @@ void LinearTransientFESolver::solve() {
   dVec vecDUnext(nAll);
   dVec vecDDUnext(nAll);
 
-  math::SparseSymMatrix matKmod(matK->block(2)->getSparsityInfo());
+  // matKmod has the structure (and the storage format) of the block of unknowns of matK
+  math::BsrSymMatrix* bsrK = matK->bsrBlock(2);
+  math::SparseSymMatrix matKmod;
+  math::BsrSymMatrix bsrKmod;
+  if (bsrK) {
+    bsrKmod = math::BsrSymMatrix(bsrK);
+  } else {
+    matKmod.setSparsityInfo(matK->block(2)->getSparsityInfo());
+  }
 
   dVec rhs(nEq);
 
@@ -591,26 +851,49 @@ void LinearTransientFESolver::solve() {
   applyBoundaryConditions(1.0);
 
   // dummy implementation of `matKmod = a0 * matM + a1 * matC + matK`
-  for (uint32 i = 0; i < matKmod.nValues(); i++) {
-    matKmod.getValuesArray()[i] = a0 * matM->block(2)->getValuesArray()[i] +
-                                  a1 * matC->block(2)->getValuesArray()[i] +
-                                       matK->block(2)->getValuesArray()[i];
+  if (bsrK) {
+    for (uindex i = 0; i < bsrKmod.nValues(); i++) {
+      bsrKmod.getValuesArray()[i] = a0 * matM->bsrBlock(2)->getValuesArray()[i] +
+                                    a1 * matC->bsrBlock(2)->getValuesArray()[i] +
+                                         bsrK->getValuesArray()[i];
+    }
+  } else {
+    for (uindex i = 0; i < matKmod.nValues(); i++) {
+      matKmod.getValuesArray()[i] = a0 * matM->block(2)->getValuesArray()[i] +
+                                    a1 * matC->block(2)->getValuesArray()[i] +
+                                         matK->block(2)->getValuesArray()[i];
+    }
   }
 
   // factorize eKmode just once as far sa we have a deal with linear system
-  eqSolver->factorizeEquations(&matKmod);
+  if (bsrK) {
+    eqSolver->factorizeEquations(&bsrKmod);
+  } else {
+    eqSolver->factorizeEquations(&matKmod);
+  }
 
   // timestepping
   while (curTime <= time1) {
     for (;;) {
       rhs = vecFsl + vecRsl;
-      matBVprod(*(matM->block(2)), a0*vecUsl + a2*vecDUsl + a3*vecDDUsl, 1.0, rhs);
-      matBVprod(*(matC->block(2)), a1*vecUsl + a4*vecDUsl + a5*vecDDUsl, 1.0, rhs);
+      dVec vecM = a0*vecUsl + a2*vecDUsl + a3*vecDDUsl;
+      dVec vecC = a1*vecUsl + a4*vecDUsl + a5*vecDDUsl;
+      if (bsrK) {
+        matBVprod(*(matM->bsrBlock(2)), vecM.ptr(), 1.0, rhs.ptr());
+        matBVprod(*(matC->bsrBlock(2)), vecC.ptr(), 1.0, rhs.ptr());
+      } else {
+        matBVprod(*(matM->block(2)), vecM, 1.0, rhs);
+        matBVprod(*(matC->block(2)), vecC, 1.0, rhs);
+      }
 
       // copy constrained dofs values
       vecUnextc = vecUc;
       // solve equation system
-      eqSolver->substituteEquations(&matKmod, &rhs[0], &vecUnextsl[0]);
+      if (bsrK) {
+        eqSolver->substituteEquations(&bsrKmod, &rhs[0], &vecUnextsl[0]);
+      } else {
+        eqSolver->substituteEquations(&matKmod, &rhs[0], &vecUnextsl[0]);
+      }
 
       break;
     }//iterations
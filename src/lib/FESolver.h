@@ -7,6 +7,7 @@
 #include "math/Vec.h"
 #include "math/EquationSolver.h"
 #include "FEStorage.h"
+#include "StiffnessOperator.h"
 #include "PostProcessor.h"
 
 #include <Eigen/Dense>
@@ -86,6 +87,9 @@ protected:
 // on FE element formulation and on Mpc equations. Other entities (vecU, vecDU, vecDDU, vecR) are
 // fully under FESovler control. FESolver is responsible on timely updating this values.
 //
+// If FEStorage is in matrix-free mode (FEStorage::setMatrixFree(..)) matK is nullptr. Instead the
+// stiffness matrix is available as StiffnessOperator opK which multiplies by K element by element.
+// Such a model can be solved only with KrylovEquationSolver (for now only by LinearFESolver).
 class FESolver {
   public:
     FESolver ();
@@ -93,6 +97,7 @@ class FESolver {
 
     void attachFEStorage(FEStorage *st);
     void attachEquationSolver(math::EquationSolver *eq);
+    math::EquationSolver* getEquationSolver();
 
     // main method were all solution scheme specific routines are performed
     virtual void solve() = 0;
@@ -130,6 +135,18 @@ class FESolver {
     // solution instances
     void compareMatricesAndVectors(std::string filename, double th = 1.0e-9);
   protected:
+    // rhs -= Kcs^T * Uc - elimination of constrained DoFs from the RHS of the unknowns
+    void eliminateConstrainedDofs(dVec& Uc, dVec& rhs);
+    // Rc = Kcc * Uc + Kcs * Usl - Fc - reaction loads for constrained DoFs
+    void restoreReactions(dVec& Uc, dVec& Usl, dVec& Rc);
+    // solve K * Usl = rhs for the block of unknowns. In matrix-free mode opK is used, with block
+    // storage (FEStorage::setBlockStorage(..)) - BSR block of matK.
+    void solveStiffness(double* rhs, double* Usl);
+    // the same in two steps (see EquationSolver::factorizeEquations(..) and
+    // substituteEquations(..))
+    void factorizeStiffness();
+    void substituteStiffness(double* rhs, double* Usl);
+
     FEStorage* storage = nullptr;
     math::EquationSolver* eqSolver = nullptr;
 
@@ -145,6 +162,8 @@ class FESolver {
     BlockSparseSymMatrix<2>* matK = nullptr;
     BlockSparseSymMatrix<2>* matC = nullptr;
     BlockSparseSymMatrix<2>* matM = nullptr;
+    // matrix-free stiffness operator for the block of unknowns (only in matrix-free mode)
+    StiffnessOperator* opK = nullptr;
 
     // vecU is a reference on a whole DoF values vector, but vecUc, vecUs, vecUl, vecUsl are
     // references on parts of the full vector. Some times it's handy to operate with the particular
@@ -194,27 +213,78 @@ class FESolver {
 
 
 // particular realization of FESolver for linear tasks
+//
+// LinearFESolver can solve many load cases for the same model. Every load case is a set of
+// concentrated nodal loads added to the common loads (addLoad(..)) and fixations (addFix(..)). If
+// any load case is added, the stiffness matrix is factorized once and all load cases are solved
+// with one multi-rhs substitution. Then for every load case the results are restored in FEStorage
+// and PostProcessors are called with the number of the load case instead of the loadstep number.
+// DoF values and reaction loads of every load case are available after solve() by
+// getLoadCaseU(..) and getLoadCaseR(..).
 class LinearFESolver : public FESolver {
   public:
     LinearFESolver();
     virtual void solve();
+
+    // add an empty load case, returns the number of the load case (starting from 1)
+    uint16 addLoadCase();
+    // add concentrated load to load case lc
+    void addLoadCaseLoad(uint16 lc, int32 n, Dof::dofType dof, const double value = 0.0);
+    uint16 getNumberOfLoadCases();
+
+    // full vector of DoF values (constrained DoFs, unknown DoFs, Mpc lambdas) for load case lc
+    dVec& getLoadCaseU(uint16 lc);
+    // full vector of nodal loads (reactions for constrained DoFs) for load case lc
+    dVec& getLoadCaseR(uint16 lc);
+  protected:
+    void solveLoadCases();
+
+    struct LoadCase {
+      std::list<loadBC> loads;
+      dVec U;
+      dVec R;
+    };
+    std::vector<LoadCase> loadCases;
 };
 
-// Iterative solver for Full Newton-Raphson procedure
+// Iterative solver for Newton-Raphson procedure
 // The convergence is controlled by mean increment of DoF values
+//
+// The stiffness matrix and internal loads are assembled on every equilibrium iteration, but the
+// factorization of the matrix is reused by EquationSolver according to iteration strategy:
+// FullNewton - the tangent matrix is factorized on every iteration.
+// ModifiedNewton - the tangent matrix is factorized on the first iteration of every loadstep,
+//   then every refactorizationInterval iterations or when convergence is slow (the criteria
+//   decreased less than slowConvergenceRatio times since the previous iteration).
+// InitialStiffness - the matrix is factorized only once on the first iteration of the solution.
 class NonlinearFESolver : public FESolver {
   public:
     NonlinearFESolver();
 
+    enum class IterationStrategy {
+      FullNewton,
+      ModifiedNewton,
+      InitialStiffness
+    };
+
     TimeControl timeControl;
     uint16 numberOfIterations = 20;
     uint16 numberOfLoadsteps = 10;
 
     double convergenceCriteria = 1.0e-3;
 
+    IterationStrategy strategy = IterationStrategy::FullNewton;
+    uint16 refactorizationInterval = 5;
+    double slowConvergenceRatio = 0.5;
+
     virtual void solve();
+
+    // total number of factorizations in the last solve()
+    uint32 getNumberOfFactorizations();
   protected:
     double calculateCriteria(dVec& delta);
+
+    uint32 numberOfFactorizations = 0;
 };
 
 
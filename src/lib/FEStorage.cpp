@@ -4,10 +4,33 @@
 
 #include "FEStorage.h"
 #include "elements/element.h"
+#include "math/ThreadPool.h"
+#include <functional>
 
 namespace nla3d {
 using namespace math;
 
+namespace {
+
+// element loops with less elements are performed by one thread
+const uint32 minParallelElements = 100;
+// values of thread buffers are reduced by ranges of this size
+const uint32 reduceChunk = 1 << 16;
+
+
+// buffer[positions[k]] += values[k]
+void addToBuffer(std::vector<double>& buffer, const std::vector<uindex>& positions,
+                 const double* values) {
+  for (size_t k = 0; k < positions.size(); k++) {
+    buffer[positions[k]] += values[k];
+  }
+}
+
+} // namespace
+
+
+thread_local FEStorage::AssemblyBuffer* FEStorage::threadBuffer = nullptr;
+
 
 FEStorage::FEStorage()  {
 };
@@ -24,8 +47,9 @@ FEStorage::~FEStorage () {
 
 
 void FEStorage::assembleGlobalEqMatrices() {
-	assert(matK);
-  assert(matK->isCompressed());
+  // in matrix-free mode only RHS vectors are assembled
+	assert(matK || matrixFree);
+  assert(matrixFree || matK->isCompressed());
 
   TIMED_SCOPE(t, "assembleGlobalEqMatrix");
   LOG(INFO) << "Start formulation of global eq. matrices ( " << nElements() << " elements)";
@@ -33,9 +57,10 @@ void FEStorage::assembleGlobalEqMatrices() {
   zeroK();
   zeroF();
 
-  for (uint32 el = 0; el < nElements(); el++) {
-    elements[el]->buildK();
-  }
+  forEachElement(matrixFree ? TargetF : TargetK | TargetF,
+      [](const ElementKernels& k, Element* const* els, uint32 n) {
+    k.buildK(els, n);
+  });
   //t.checkpoint("Element::build()");
 
   // because of non-linear MPC we need to update
@@ -69,12 +94,133 @@ void FEStorage::assembleGlobalEqMatrices() {
     zeroC();
     zeroM();
 
-    for (uint32 el = 0; el < nElements(); el++) {
-      elements[el]->buildC();
-      elements[el]->buildM();
+    forEachElement(TargetC | TargetM, [](const ElementKernels& k, Element* const* els, uint32 n) {
+      k.buildC(els, n);
+      k.buildM(els, n);
+    });
+  }
+
+}
+
+
+uint16 FEStorage::getNumberOfThreads() {
+  if (numberOfThreads == 0) {
+    return ThreadPool::instance().getNumberOfThreads();
+  }
+  return numberOfThreads;
+}
+
+
+template <typename F>
+void FEStorage::forEachRun(Element* const* els, const std::vector<ElementRun>& runs,
+                           uint32 begin, uint32 end, F func) {
+  // the first run which ends after `begin`
+  auto run = std::upper_bound(runs.begin(), runs.end(), begin,
+      [](uint32 b, const ElementRun& r) { return b < r.end; });
+  for (; run != runs.end() && run->begin < end; run++) {
+    uint32 b = std::max(begin, run->begin);
+    uint32 e = std::min(end, run->end);
+    func(*run->kernels, els + b, e - b);
+  }
+}
+
+
+template <typename F>
+void FEStorage::forEachElement(uint16 targets, F func) {
+  uint16 threads = getNumberOfThreads();
+  const uint32 n = nElements();
+  if (n < minParallelElements) {
+    threads = 1;
+  }
+  assert(n == 0 || elementRuns.size() > 0);
+
+  if (assemblyMode == AssemblyMode::Colored && elementColors.size() > 0) {
+    // Colours are processed in the same order even by one thread. An entry gets at most one
+    // contribution per colour, therefore the order of summation for every entry is fixed and
+    // the results are bitwise identical for any number of threads.
+    for (size_t c = 0; c < elementColors.size(); c++) {
+      Element* const* color = elementColors[c].data();
+      uint32 size = static_cast<uint32>(elementColors[c].size());
+      uint16 colorThreads = static_cast<uint16>(std::min<uint32>(threads,
+            size / minElementsPerThread));
+      if (colorThreads <= 1) {
+        forEachRun(color, colorRuns[c], 0, size, func);
+        continue;
+      }
+      parallelForChunks(size, colorThreads, [&](uint16, uint32 begin, uint32 end) {
+        forEachRun(color, colorRuns[c], begin, end, func);
+      });
     }
+    return;
   }
 
+  if (threads <= 1) {
+    forEachRun(elements.data(), elementRuns, 0, n, func);
+    return;
+  }
+
+  // AssemblyMode::ThreadLocal
+  const uint32 nEq = nDofs() + nMpc();
+  if (assemblyBuffers.size() < threads) {
+    assemblyBuffers.resize(threads);
+  }
+  auto prepare = [](std::vector<double>& v, uindex size) {
+    v.assign(size, 0.0);
+  };
+  uint16 used = parallelForChunks(n, threads, [&](uint16 t, uint32 begin, uint32 end) {
+    AssemblyBuffer& buf = assemblyBuffers[t];
+    if (targets & TargetK) prepare(buf.K, matK->nValues());
+    if (targets & TargetC) prepare(buf.C, matC->nValues());
+    if (targets & TargetM) prepare(buf.M, matM->nValues());
+    if (targets & TargetF) prepare(buf.F, nEq);
+    if (targets & TargetProduct) prepare(buf.product, nEq);
+    threadBuffer = &buf;
+    forEachRun(elements.data(), elementRuns, begin, end, func);
+    threadBuffer = nullptr;
+  });
+
+  // sum up the thread copies, different ranges of values are summed up in parallel
+  auto reduce = [&](std::vector<double> AssemblyBuffer::* part, uindex size,
+                    std::function<void(uindex, uindex, const double*)> add) {
+    uint32 nChunks = static_cast<uint32>((size + reduceChunk - 1) / reduceChunk);
+    parallelForChunks(nChunks, std::min<uint32>(threads, std::max(nChunks, 1u)),
+        [&](uint16, uint32 cbegin, uint32 cend) {
+      uindex begin = static_cast<uindex>(cbegin) * reduceChunk;
+      uindex end = std::min(size, static_cast<uindex>(cend) * reduceChunk);
+      for (uint16 t = 0; t < used; t++) {
+        add(begin, end, (assemblyBuffers[t].*part).data());
+      }
+    });
+  };
+  auto addVector = [](double* dest) {
+    return [dest](uindex begin, uindex end, const double* v) {
+      for (uindex i = begin; i < end; i++) {
+        dest[i] += v[i];
+      }
+    };
+  };
+  if (targets & TargetK) {
+    reduce(&AssemblyBuffer::K, matK->nValues(), [this](uindex b, uindex e, const double* v) {
+      matK->addValuesRange(b, e, v);
+    });
+  }
+  if (targets & TargetC) {
+    reduce(&AssemblyBuffer::C, matC->nValues(), [this](uindex b, uindex e, const double* v) {
+      matC->addValuesRange(b, e, v);
+    });
+  }
+  if (targets & TargetM) {
+    reduce(&AssemblyBuffer::M, matM->nValues(), [this](uindex b, uindex e, const double* v) {
+      matM->addValuesRange(b, e, v);
+    });
+  }
+  // element loads are not needed for the product K * x (see addValueF(..))
+  if ((targets & TargetF) && !productY) {
+    reduce(&AssemblyBuffer::F, nEq, addVector(vecF.ptr()));
+  }
+  if ((targets & TargetProduct) && productY) {
+    reduce(&AssemblyBuffer::product, nEq, addVector(productY));
+  }
 }
 
 
@@ -129,7 +275,7 @@ void FEStorage::getElementNodes(uint32 el, Node** node_ptr) {
 	assert(el <= nElements());
   Element* elp = elements[el-1];
 	for (uint16 i=0; i<elp->getNNodes(); i++)
-		node_ptr[i] = nodes[elp->getNodeNumber(i)-1];
+		node_ptr[i] = &nodes[elp->getNodeNumber(i)-1];
 }
 
 
@@ -137,7 +283,7 @@ void FEStorage::getElementNodes(uint32 el, Node** node_ptr) {
 void FEStorage::getNodePosition(uint32 n, double* ptr, bool deformed) {
 	assert(n > 0 && n <= nNodes());
 	for (uint16 i = 0; i < 3; i++) {
-		ptr[i] = nodes[n-1]->pos[i];
+		ptr[i] = nodes[n-1].pos[i];
   }
 	if (deformed) {
     if (isNodeDofUsed(n, Dof::UX)) {
@@ -155,6 +301,200 @@ void FEStorage::getNodePosition(uint32 n, double* ptr, bool deformed) {
 }
 
 
+void FEStorage::getRigidBodyModes(std::vector<double>& modes, std::vector<uint32>& eqNode) {
+  const uint32 n = nUnknownDofs() + nMpc();
+  const uint32 first = nConstrainedDofs() + 1;
+  modes.assign(6 * static_cast<uint64>(n), 0.0);
+  eqNode.resize(n);
+  for (uint32 i = 0; i < n; i++) {
+    eqNode[i] = nNodes() + 1 + i;
+  }
+
+  // rotations are taken around the center of the model to keep the modes well scaled
+  double center[3] = {0.0, 0.0, 0.0};
+  for (uint32 node = 1; node <= nNodes(); node++) {
+    for (uint16 d = 0; d < 3; d++) {
+      center[d] += nodes[node - 1].pos[d] / nNodes();
+    }
+  }
+
+  auto dofTypes = getUniqueNodeDofTypes();
+  for (uint32 node = 1; node <= nNodes(); node++) {
+    double x[3];
+    getNodePosition(node, x);
+    for (uint16 d = 0; d < 3; d++) {
+      x[d] -= center[d];
+    }
+    // values of the modes (UX, UY, UZ translations and rotations around X, Y, Z) for the DoFs
+    // UX, UY, UZ, ROTX, ROTY, ROTZ of the node
+    const double values[6][6] = {
+      {1.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+      {0.0, 1.0, 0.0, 0.0, 0.0, 0.0},
+      {0.0, 0.0, 1.0, 0.0, 0.0, 0.0},
+      {0.0, -x[2], x[1], 1.0, 0.0, 0.0},
+      {x[2], 0.0, -x[0], 0.0, 1.0, 0.0},
+      {-x[1], x[0], 0.0, 0.0, 0.0, 1.0}};
+    for (auto dof : dofTypes) {
+      if (!isNodeDofUsed(node, dof)) continue;
+      uint32 eq = getNodeDofEqNumber(node, dof);
+      if (eq < first) continue;
+      uint32 i = eq - first;
+      eqNode[i] = node;
+      if (dof > Dof::ROTZ) continue;
+      for (uint16 m = 0; m < 6; m++) {
+        modes[static_cast<uint64>(m) * n + i] = values[m][dof];
+      }
+    }
+  }
+}
+
+
+void FEStorage::multiplyK(const double* x, double* y) {
+  CHECK(matrixFree) << "FEStorage::multiplyK works only in matrix-free mode";
+  const uint32 n = nDofs() + nMpc();
+  std::fill_n(y, n, 0.0);
+  productX = x;
+  productY = y;
+  forEachElement(TargetProduct, [x, y](const ElementKernels& k, Element* const* els, uint32 n) {
+    k.multiplyK(els, n, x, threadBuffer ? threadBuffer->product.data() : y);
+  });
+  productX = nullptr;
+  productY = nullptr;
+
+  // Mpc rows and columns
+  for (auto& mpc : mpcs) {
+    uint32 eqi = mpc->eqNum;
+    for (auto& term : mpc->eq) {
+      uint32 eqj = getNodeDofEqNumber(term.node, term.node_dof);
+      y[eqi - 1] += term.coef * x[eqj - 1];
+      y[eqj - 1] += term.coef * x[eqi - 1];
+    }
+  }
+}
+
+
+void FEStorage::diagonalK(double* d) {
+  CHECK(matrixFree) << "FEStorage::diagonalK works only in matrix-free mode";
+  std::fill_n(d, nDofs() + nMpc(), 0.0);
+  productX = nullptr;
+  productY = d;
+  forEachElement(TargetProduct, [](const ElementKernels& k, Element* const* els, uint32 n) {
+    k.buildK(els, n);
+  });
+  productY = nullptr;
+}
+
+
+void FEStorage::addProductK(uint32 eqi, uint32 eqj, double value) {
+  if (!productY) return;
+  double* y = threadBuffer ? threadBuffer->product.data() : productY;
+  if (!productX) {
+    if (eqi == eqj) y[eqi - 1] += value;
+    return;
+  }
+  y[eqi - 1] += value * productX[eqj - 1];
+  if (eqi != eqj) {
+    y[eqj - 1] += value * productX[eqi - 1];
+  }
+}
+
+
+void FEStorage::addElementK(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                            std::initializer_list<Dof::dofType> elementDofs, const double* Ae) {
+  ElementScatter& map = getElementScatter(el, nodeDofs, elementDofs);
+  if (matrixFree) {
+    const uint32 n = static_cast<uint32>(map.eqs.size());
+    for (uint32 i = 0; i < n; i++) {
+      for (uint32 j = i; j < n; j++) {
+        addProductK(map.eqs[i], map.eqs[j], *Ae++);
+      }
+    }
+    return;
+  }
+  if (threadBuffer) {
+    addToBuffer(threadBuffer->K, map.positions, Ae);
+    return;
+  }
+  matK->addValues(static_cast<uint32>(map.positions.size()), map.positions.data(), Ae);
+}
+
+
+void FEStorage::addElementC(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                            std::initializer_list<Dof::dofType> elementDofs, const double* Ae) {
+  assert(matC);
+  ElementScatter& map = getElementScatter(el, nodeDofs, elementDofs);
+  if (threadBuffer) {
+    addToBuffer(threadBuffer->C, map.positions, Ae);
+    return;
+  }
+  matC->addValues(static_cast<uint32>(map.positions.size()), map.positions.data(), Ae);
+}
+
+
+void FEStorage::addElementM(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                            std::initializer_list<Dof::dofType> elementDofs, const double* Ae) {
+  assert(matM);
+  ElementScatter& map = getElementScatter(el, nodeDofs, elementDofs);
+  if (threadBuffer) {
+    addToBuffer(threadBuffer->M, map.positions, Ae);
+    return;
+  }
+  matM->addValues(static_cast<uint32>(map.positions.size()), map.positions.data(), Ae);
+}
+
+
+void FEStorage::addElementF(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                            std::initializer_list<Dof::dofType> elementDofs, const double* Fe) {
+  ElementScatter& map = getElementScatter(el, nodeDofs, elementDofs);
+  for (size_t i = 0; i < map.eqs.size(); i++) {
+    addValueF(map.eqs[i], Fe[i]);
+  }
+}
+
+
+FEStorage::ElementScatter& FEStorage::getElementScatter(uint32 el,
+    std::initializer_list<Dof::dofType> nodeDofs, std::initializer_list<Dof::dofType> elementDofs) {
+  assert(el > 0 && el <= scatterMaps.size());
+  ElementScatter& map = scatterMaps[el - 1];
+  if (map.eqs.size() > 0 &&
+      nodeDofs.size() == map.nodeDofs.size() &&
+      elementDofs.size() == map.elementDofs.size() &&
+      std::equal(nodeDofs.begin(), nodeDofs.end(), map.nodeDofs.begin()) &&
+      std::equal(elementDofs.begin(), elementDofs.end(), map.elementDofs.begin())) {
+    return map;
+  }
+
+  // build the map for the layout (an element normally uses only one layout)
+  Element& element = getElement(el);
+  map.nodeDofs.assign(nodeDofs);
+  map.elementDofs.assign(elementDofs);
+  map.eqs.clear();
+  for (uint16 i = 0; i < element.getNNodes(); i++) {
+    for (auto dof : nodeDofs) {
+      map.eqs.push_back(getNodeDofEqNumber(element.getNodeNumber(i), dof));
+    }
+  }
+  for (auto dof : elementDofs) {
+    map.eqs.push_back(getElementDofEqNumber(el, dof));
+  }
+
+  map.positions.clear();
+  if (!matrixFree) {
+    const uint32 n = static_cast<uint32>(map.eqs.size());
+    map.positions.reserve(n * (n + 1) / 2);
+    for (uint32 i = 0; i < n; i++) {
+      for (uint32 j = i; j < n; j++) {
+        uindex pos = matK->getValuePosition(map.eqs[i], map.eqs[j]);
+        CHECK(pos != math::SparsityInfo::invalid) << "The entry (" << map.eqs[i] << ", "
+          << map.eqs[j] << ") of element " << el << " is absent in the stiffness matrix";
+        map.positions.push_back(pos);
+      }
+    }
+  }
+  return map;
+}
+
+
 FEComponent* FEStorage::getFEComponent(size_t i) {
   assert(i < feComponents.size());
   return feComponents[i];
@@ -191,9 +531,10 @@ void FEStorage::addFEComponent (FEComponent* comp) {
 
 
 void FEStorage::addNode (Node* node) {
-  //Node() fires Vec<3> constructor, thus Node coordinates are (0,0,0) by default
+  assert(node);
   //TODO: try-catch of memory overflow
-	nodes.push_back(node);
+	nodes.push_back(*node);
+  delete node;
 }
 
 
@@ -204,12 +545,7 @@ std::vector<uint32> FEStorage::createNodes (uint32 _nn) {
   newIndexes.reserve(_nn);
   uint32 nextNumber = nodes.size() + 1;
 
-  nodes.reserve(elements.size() + _nn);
-
-  for (uint32 i = 0; i < _nn; i++) {
-    Node* pnode = new Node;
-    nodes.push_back(pnode);
-  }
+  nodes.resize(nodes.size() + _nn);
 
   for (uint32 i = nextNumber; i <= nodes.size(); i++) {
     newIndexes.push_back(i);
@@ -218,11 +554,21 @@ std::vector<uint32> FEStorage::createNodes (uint32 _nn) {
 }
 
 
+std::vector<uint32> FEStorage::createNodes (const std::vector<math::Vec<3>>& positions) {
+  std::vector<uint32> newIndexes = createNodes(static_cast<uint32>(positions.size()));
+  for (uint32 i = 0; i < newIndexes.size(); i++) {
+    nodes[newIndexes[i] - 1].pos = positions[i];
+  }
+  return newIndexes;
+}
+
+
 void FEStorage::addElement (Element* el) {
   el->storage = this;
   el->elNum = nElements() + 1;
   //TODO: try-catch of memory overflow
 	elements.push_back(el);
+  addedElements.push_back(el);
 }
 
 
@@ -231,7 +577,10 @@ std::vector<uint32> FEStorage::createElements(uint32 _en, ElementType elType) {
   std::vector<uint32> newIndexes;
   newIndexes.reserve(_en);
   uint32 nextNumber = elements.size() + 1;
-  ElementFactory::createElements(elType, _en, elements); 
+  ElementArena* arena = ElementFactory::createElements(elType, _en, elements);
+  if (arena) {
+    elementArenas.push_back(arena);
+  }
   for (uint32 i = nextNumber; i <= elements.size(); i++) {
     //access elNum protected values as friend
     elements[i - 1]->elNum = i;
@@ -253,18 +602,22 @@ void FEStorage::deleteMesh() {
 
 
 void FEStorage::deleteNodes() {
-  for (uint32 i = 0; i < nNodes(); i++) {
-    delete nodes[i];
-  }
-  nodes.clear();
+  std::vector<Node>().swap(nodes);
 }
 
 
 void FEStorage::deleteElements() {
-  for (uint32 i = 0; i < nElements(); i++) {
-    delete elements[i];
+  // elements from arenas are destroyed with the arenas
+  for (auto el : addedElements) {
+    delete el;
   }
+  addedElements.clear();
   elements.clear();
+
+  for (auto arena : elementArenas) {
+    delete arena;
+  }
+  elementArenas.clear();
 }
 
 
@@ -319,6 +672,11 @@ void FEStorage::deleteSolutionData() {
   }
   
   deleteDofArrays();
+  scatterMaps.clear();
+  elementColors.clear();
+  colorRuns.clear();
+  elementRuns.clear();
+  assemblyBuffers.clear();
 
   vecU.clear();
   vecDU.clear();
@@ -353,6 +711,10 @@ void FEStorage::initDofs() {
     mpcCollections[i]->registerMpcsInStorage();
   }
 
+  // all DoFs are registered by elements and Mpcs, allocate them
+  nodeDofs.buildDofTable();
+  elementDofs.buildDofTable();
+
   // Total number of dofs (only registered by elements)
 	_nDofs = elementDofs.getNumberOfUsedDofs() + nodeDofs.getNumberOfUsedDofs();
   CHECK(_nDofs);
@@ -431,11 +793,43 @@ void FEStorage::assignEquationNumbers() {
       <<  nMpc() << ", TOTAL eq. = " << nUnknownDofs() + nMpc();
 }
 
+
+void FEStorage::getNodalBlocks(std::vector<uint32>& blockFirst) {
+  const uint32 nc = nConstrainedDofs();
+  const uint32 n = nUnknownDofs() + nMpc();
+  // start[i] - equation i (from 0, related to nc) starts a group
+  std::vector<bool> start(n + 1, true);
+  for (uint32 nn = 1; nn <= nNodes(); nn++) {
+    auto nn_dofs = nodeDofs.getEntityDofs(nn);
+    // unknown DoFs of the node have consecutive equation numbers (see assignEquationNumbers())
+    uint32 prev = 0;
+    uint16 size = 0;
+    for (auto d = nn_dofs.first; d != nn_dofs.second; d++) {
+      if (d->isConstrained) continue;
+      if (size > 0 && size < math::BsrSymMatrix::blockSize && d->eqNumber == prev + 1) {
+        start[d->eqNumber - nc - 1] = false;
+        size++;
+      } else {
+        size = 1;
+      }
+      prev = d->eqNumber;
+    }
+  }
+  blockFirst.clear();
+  for (uint32 i = 0; i <= n; i++) {
+    if (start[i]) blockFirst.push_back(i);
+  }
+}
+
 void FEStorage::initSolutionData () {
   TIMED_SCOPE(t, "initSolutionData");
   
   // We need to know topology of the mesh in order to determine SparsityInfo for sparse matrices
   learnTopology();
+  // elements of one colour can be assembled in parallel
+  colorElements();
+  // elements of one type are processed by one kernel call
+  batchElements();
 
 
   // In nla3d solution procedure there are 3 distinguish types of unknowns. First one "c" -
@@ -470,7 +864,22 @@ void FEStorage::initSolutionData () {
   //  | Rc | =-| Fc | + | Kcc | * | Uc | + |KcsMPCc| * |    |
   //  |    |   |    |   |     |   |    |   |       |   | Ul |
 
-  matK = new BlockSparseSymMatrix<2>({nConstrainedDofs(), nUnknownDofs() + nMpc()});
+  CHECK(!(matrixFree && transient)) << "Matrix-free mode isn't supported for transient analysis";
+
+  // element scatter maps are built on the first assembly of every element
+  scatterMaps.clear();
+  scatterMaps.resize(nElements());
+
+  CHECK(!(matrixFree && blockStorage)) << "Matrix-free mode doesn't store matrices in any format";
+  if (!matrixFree) {
+    // the sparsity is built below by matK->buildSparsity(..)
+    matK = new BlockSparseSymMatrix<2>({nConstrainedDofs(), nUnknownDofs() + nMpc()}, 0);
+    if (blockStorage) {
+      std::vector<uint32> blockFirst;
+      getNodalBlocks(blockFirst);
+      matK->setBlockRows(2, blockFirst);
+    }
+  }
 
   if (transient) {
     // share sparsity info with K matrices
@@ -493,55 +902,93 @@ void FEStorage::initSolutionData () {
 		LOG(WARNING) << "FEStorage::initializeSolutionData: material isn't defined";
 	}
 
+  if (matrixFree) {
+    // K * x is computed element by element, the sparsity of K isn't needed
+    LOG(INFO) << "Stiffness matrix won't be stored (matrix-free mode)";
+    return;
+  }
 
-  // Need to restore non-zero entries in Sparse Matrices based on mesh topology and registered Dofs
-  // As far as we know from topology which elements are neighbors to each other we can estimate
-  // quantity and positions of non-zero coef. in Sparse Matrix matK. Other matrices matC, matK will
-  // have the same sparsity as stiffness matrix matK.
 
+  // Need to restore non-zero entries in Sparse Matrices based on mesh topology and registered Dofs
+  // As far as we know from topology which elements are neighbors to each other we can find
+  // positions of non-zero coef. in Sparse Matrix matK. Other matrices matC, matK will have the same
+  // sparsity as stiffness matrix matK.
+  //
+  // The sparsity is built row by row in two passes (count, then fill) with exact memory (see
+  // BlockSparseSymMatrix::buildSparsity(..)). To find non-zero columns of an equation we need to
+  // know which entity owns it: eqOwner[eq-1] is the node number, the element number + nNodes() or
+  // the Mpc number + nNodes() + nElements().
+  const uint32 nEq = nDofs() + nMpc();
+  std::vector<uint32> eqOwner(nEq, 0);
   for (uint32 nn = 1; nn <= nNodes(); nn++) {
     auto nn_dofs = nodeDofs.getEntityDofs(nn);
-
-    for (auto& en : topology[nn-1]) {
-      // register element dofs to node nn
-      auto en_dofs = elementDofs.getEntityDofs(en);
-      for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
-        for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
-          addEntryK(d1->eqNumber, d2->eqNumber);
-
-      // cycle over element en Nodes and register nn vs nn2 nodes dofs
-      for (uint16 enn = 0; enn < getElement(en).getNNodes(); enn++) {
-        uint32 nn2 = getElement(en).getNodeNumber(enn);
-        if (nn2 < nn) continue;
-        // register node nn2 dofs to node nn dofs
-        auto nn2_dofs = nodeDofs.getEntityDofs(nn2);
-        for (auto d1 = nn2_dofs.first; d1 != nn2_dofs.second; d1++)
-          for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
-            addEntryK(d1->eqNumber, d2->eqNumber);
-      }
-    }
+    for (auto d = nn_dofs.first; d != nn_dofs.second; d++)
+      eqOwner[d->eqNumber - 1] = nn;
   }
-
-  // register element dofs vs element dofs
   for (uint32 en = 1; en <= nElements(); en++) {
     auto en_dofs = elementDofs.getEntityDofs(en);
-    for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
-      for (auto d2 = en_dofs.first; d2 != en_dofs.second; d2++)
-        addEntryK(d1->eqNumber, d2->eqNumber);
+    for (auto d = en_dofs.first; d != en_dofs.second; d++)
+      eqOwner[d->eqNumber - 1] = nNodes() + en;
+  }
+  std::vector<Mpc*> mpcByNumber(mpcs.begin(), mpcs.end());
+  for (uint32 m = 0; m < mpcByNumber.size(); m++) {
+    assert(mpcByNumber[m]->eq.size());
+    eqOwner[mpcByNumber[m]->eqNum - 1] = nNodes() + nElements() + m + 1;
   }
 
-  // register MPC coefficients
+  // Mpc equations which have a term with DoF equation eq are
+  // dofMpc[dofMpcPtr[eq-1] .. dofMpcPtr[eq]-1]
+  std::vector<uint32> dofMpcPtr(nEq + 1, 0);
+  for (auto& mpc : mpcs) {
+    for (auto& term : mpc->eq) {
+      dofMpcPtr[getNodeDofEqNumber(term.node, term.node_dof)]++;
+    }
+  }
+  for (uint32 eq = 0; eq < nEq; eq++) {
+    dofMpcPtr[eq + 1] += dofMpcPtr[eq];
+  }
+  std::vector<uint32> dofMpc(dofMpcPtr[nEq]);
+  std::vector<uint32> dofMpcNext(dofMpcPtr.begin(), dofMpcPtr.end() - 1);
   for (auto& mpc : mpcs) {
-    assert(mpc->eq.size());
-    uint32 eq_num = mpc->eqNum;
     for (auto& term : mpc->eq) {
-    uint32 eq_j = getNodeDofEqNumber(term.node, term.node_dof);
-      addEntryMPC(mpc->eqNum, eq_j);
+      dofMpc[dofMpcNext[getNodeDofEqNumber(term.node, term.node_dof) - 1]++] = mpc->eqNum;
     }
   }
 
-  // compress sparsity info. After that we can't add new position in sparse matrices
-  matK->compress();
+  auto addEntityDofs = [](DofCollection& dofs, uint32 n, std::vector<uint32>& cols) {
+    auto n_dofs = dofs.getEntityDofs(n);
+    for (auto d = n_dofs.first; d != n_dofs.second; d++)
+      cols.push_back(d->eqNumber);
+  };
+
+  matK->buildSparsity([&](uint32 eq, std::vector<uint32>& cols) {
+    uint32 owner = eqOwner[eq - 1];
+    if (owner == 0) return;
+    if (owner <= nNodes()) {
+      // node DoF: DoFs of all elements with the node and DoFs of their nodes
+      for (auto& en : topology[owner - 1]) {
+        addEntityDofs(elementDofs, en, cols);
+        for (uint16 enn = 0; enn < getElement(en).getNNodes(); enn++) {
+          addEntityDofs(nodeDofs, getElement(en).getNodeNumber(enn), cols);
+        }
+      }
+      // Mpc coefficients
+      cols.insert(cols.end(), dofMpc.begin() + dofMpcPtr[eq - 1], dofMpc.begin() + dofMpcPtr[eq]);
+    } else if (owner <= nNodes() + nElements()) {
+      // element DoF: DoFs of the element and DoFs of its nodes
+      uint32 en = owner - nNodes();
+      addEntityDofs(elementDofs, en, cols);
+      for (uint16 enn = 0; enn < getElement(en).getNNodes(); enn++) {
+        addEntityDofs(nodeDofs, getElement(en).getNodeNumber(enn), cols);
+      }
+    } else {
+      // Mpc equation: DoFs of Mpc terms
+      Mpc* mpc = mpcByNumber[owner - nNodes() - nElements() - 1];
+      for (auto& term : mpc->eq) {
+        cols.push_back(getNodeDofEqNumber(term.node, term.node_dof));
+      }
+    }
+  });
 
   if (transient) {
     matC->compress();
@@ -570,10 +1017,16 @@ void FEStorage::printDofInfo(std::ostream& out) {
 
 void FEStorage::updateResults() {
   TIMED_SCOPE(t, "updateSolutionResults");
-  // calculate element's update procedures (calculate stresses, strains, ..)
-  for (uint32 el = 0; el < nElements(); el++) {
-    elements[el]->update();
-  }
+  // calculate element's update procedures (calculate stresses, strains, ..). Element::update()
+  // only reads the solution and writes the element's own data, so elements are updated in
+  // parallel without any synchronization.
+  uint16 threads = (nElements() < minParallelElements) ? 1 : getNumberOfThreads();
+  parallelFor(nElements(), threads, [this](uint32 begin, uint32 end) {
+    forEachRun(elements.data(), elementRuns, begin, end,
+        [](const ElementKernels& k, Element* const* els, uint32 n) {
+      k.update(els, n);
+    });
+  }, minElementsPerThread);
 }
 
 
@@ -589,4 +1042,60 @@ void FEStorage::learnTopology() {
 }
 
 
+void FEStorage::colorElements() {
+  elementColors.clear();
+  // color[en-1] - colour of element en, stamp[c] == en if colour c is used by a neighbour of en
+  std::vector<uint32> color(nElements());
+  std::vector<uint32> stamp;
+  for (uint32 en = 1; en <= nElements(); en++) {
+    Element& el = getElement(en);
+    for (uint16 nn = 0; nn < el.getNNodes(); nn++) {
+      for (auto neighbour : topology[el.getNodeNumber(nn) - 1]) {
+        // elements in topology sets are sorted, only already coloured ones are interesting
+        if (neighbour >= en) break;
+        stamp[color[neighbour - 1]] = en;
+      }
+    }
+    uint32 c = 0;
+    while (c < stamp.size() && stamp[c] == en) c++;
+    if (c == stamp.size()) {
+      stamp.push_back(0);
+      elementColors.push_back(std::vector<Element*>());
+    }
+    color[en - 1] = c;
+    elementColors[c].push_back(&el);
+  }
+  LOG(INFO) << "Elements are split into " << elementColors.size() << " colours for parallel assembly";
+}
+
+
+void FEStorage::batchElements() {
+  // elements from arenas have kernels of their type, others are called through virtual functions
+  std::vector<const ElementKernels*> kernels(nElements(), &ElementBatch<Element>::kernels);
+  for (auto arena : elementArenas) {
+    for (uint32 i = 0; i < arena->size(); i++) {
+      kernels[arena->getElement(i)->getElNum() - 1] = arena->getKernels();
+    }
+  }
+
+  auto findRuns = [&kernels](const std::vector<Element*>& els, std::vector<ElementRun>& runs) {
+    runs.clear();
+    for (uint32 i = 0; i < els.size(); i++) {
+      const ElementKernels* k = kernels[els[i]->getElNum() - 1];
+      if (runs.size() > 0 && runs.back().kernels == k) {
+        runs.back().end = i + 1;
+      } else {
+        runs.push_back({k, i, i + 1});
+      }
+    }
+  };
+  findRuns(elements, elementRuns);
+  colorRuns.resize(elementColors.size());
+  for (size_t c = 0; c < elementColors.size(); c++) {
+    findRuns(elementColors[c], colorRuns[c]);
+  }
+  LOG(INFO) << "Elements are split into " << elementRuns.size() << " batches of one type";
+}
+
+
 } // namespace nla3d 
@@ -9,6 +9,7 @@
 #include "elements/ElementFactory.h"
 #include "math/BlockSparseMatrix.h"
 #include "FEComponent.h"
+#include "Node.h"
 #include "Mpc.h"
  
 namespace nla3d {
@@ -17,6 +18,8 @@ class Element;
 class Node;
 class Dof;
 class ElementFactory;
+class ElementArena;
+struct ElementKernels;
 
 
 // FEStorage - heart of the nla3d program, it contains all FE data: 
@@ -87,6 +90,22 @@ public:
   void addValueR(uint32 nodei, Dof::dofType dofi, double value);
   void addValueR(uint32 eqi, double value);
 
+  // Direct assembly of element matrices and vectors. Local DoFs of element `el` are `nodeDofs` of
+  // every element node (node by node) followed by `elementDofs` of the element. Ae is the upper
+  // triangle of the element matrix stored row by row (as in math::MatSym), Fe is the element
+  // vector. On the first call for the element its scatter map is built: equation numbers of local
+  // DoFs and positions of all Ae entries in the values of the global matrices. Then every call is a
+  // straight indexed accumulation without DoF lookups and searches in sparse matrices. Scatter maps
+  // are dropped by initSolutionData().
+  void addElementK(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                   std::initializer_list<Dof::dofType> elementDofs, const double* Ae);
+  void addElementC(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                   std::initializer_list<Dof::dofType> elementDofs, const double* Ae);
+  void addElementM(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                   std::initializer_list<Dof::dofType> elementDofs, const double* Ae);
+  void addElementF(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                   std::initializer_list<Dof::dofType> elementDofs, const double* Fe);
+
   // fill with zeros the matrices of global system of equations
 	void zeroK();
 	void zeroC();
@@ -114,6 +133,35 @@ public:
   // if isTransient() == bool then matC, matM are also assembled.
   void assembleGlobalEqMatrices();
 
+  // Parallel assembly. Element loops of assembleGlobalEqMatrices(), multiplyK(..) and
+  // diagonalK(..) are performed by numberOfThreads tasks of math::ThreadPool in one of the modes:
+  //   * Colored - initSolutionData() colours elements so that elements of one colour don't share
+  //     nodes. Colours are processed one by one, elements of a colour are processed in parallel
+  //     and write to different entries of the global matrices and vectors without any locks.
+  //     Every entry is summed up in the fixed colour order, so the results are bitwise
+  //     reproducible and don't depend on the number of threads (one thread also goes colour by
+  //     colour).
+  //   * ThreadLocal - every thread accumulates its elements into its own copies of the global
+  //     values (threads x non-zeros doubles of memory), copies are summed up at the end. The
+  //     order of summation (and the last bits of the results) depends on the number of threads.
+  // Elements should assemble by addElementK/C/M/F(..) (or addValueK/C/M/F(..)) to the entries of
+  // their own nodes and element DoFs only.
+  enum class AssemblyMode {
+    Colored,
+    ThreadLocal
+  };
+  void setAssemblyMode(AssemblyMode mode);
+  AssemblyMode getAssemblyMode();
+  // number of threads for element loops (0 - all threads of the ThreadPool, 1 - serial assembly)
+  void setNumberOfThreads(uint16 threads);
+  uint16 getNumberOfThreads();
+  // minimal number of elements of a colour (or of a range of elements in updateResults()) per
+  // thread. Smaller colours are processed by less threads.
+  void setMinElementsPerThread(uint32 elements);
+  uint32 getMinElementsPerThread();
+  // number of element colours (available after initSolutionData())
+  uint32 nElementColors();
+
   // getters to get numbers of different entities stored in FEStorage
 	uint32 nNodes();
 	uint32 nElements();
@@ -127,6 +175,32 @@ public:
   void setTransient(bool _transient);
   bool isTransient();
 
+  // Matrix-free mode: the global stiffness matrix isn't stored at all (initSolutionData() doesn't
+  // create matK and its sparsity), assembleGlobalEqMatrices() computes only the RHS vectors. The
+  // stiffness matrix is available only as a product K * x computed element by element (see
+  // multiplyK(..)). Should be set before initSolutionData(). Not compatible with transient mode.
+  void setMatrixFree(bool _matrixFree);
+  bool isMatrixFree();
+  // y = K * x for vectors of all equations of the model (nDofs() + nMpc() entries, including Mpc
+  // rows and columns). Every element contributes by Element::multiplyK(..).
+  void multiplyK(const double* x, double* y);
+  // d = diag(K) for all equations of the model
+  void diagonalK(double* d);
+
+  // Block storage: the block of unknown DoFs and Mpc equations (block(2) of K, C and M, the one
+  // solved by EquationSolver) is stored in BSR 3x3 format (see math::BsrSymMatrix and
+  // BlockSparseSymMatrix::bsrBlock(..)) instead of CSR. Unknown DoFs of a node form one block row
+  // (see getNodalBlocks(..)), elements assemble straight into the blocks by addElementK(..).
+  // Should be set before initSolutionData(). Not compatible with matrix-free mode.
+  void setBlockStorage(bool _blockStorage);
+  bool isBlockStorage();
+  // groups of equations of block(2) of K: nodal DoFs of a node which are not constrained go one
+  // after another and form a group (up to math::BsrSymMatrix::blockSize equations), element DoFs
+  // and Mpc equations form groups of one equation. Group b consists of equations
+  // [blockFirst[b], blockFirst[b+1]) (from 0 and related to the first equation of the block).
+  // Available after assignEquationNumbers().
+  void getNodalBlocks(std::vector<uint32>& blockFirst);
+
   // Operations with DoFs
   //
   // Registation of DoFs is a key moment in nla3d. Every element (and other entities like MPC
@@ -169,9 +243,12 @@ public:
   // get an instance of Material class
 	Material* getMaterial();
 
-  // get an instance of particular node
+  // get an instance of particular node. Nodes are stored contiguously, the reference is valid
+  // until new nodes are added.
   // NOTE: `_nn` > 0
 	Node& getNode(uint32 _nn);
+  // coordinates of all nodes in the initial state: x, y, z of node n are at [3*(n-1) .. 3*(n-1)+2]
+  const double* getNodeCoordinates();
   // function fills node_ptr with pointers to Node classes for element el.
   // Calling side should reserve a space for an array of pointers node_ptr.
   // size of node_ptr should be at least Element::getNNodes()
@@ -182,6 +259,13 @@ public:
   // A calling side should take care about memory allocation for ptr. Size of ptr should be at least
   // 3 as the function always return 3-dimensional coordinates.
 	void getNodePosition(uint32 n, double* ptr, bool deformed = false);
+  // Rigid body modes (3 translations and 3 rotations around the center of the model) for the
+  // equations of K block(2) (unknown DoFs and Mpc equations): modes[m * n + i] is the value of m-th
+  // mode for the equation nConstrainedDofs() + 1 + i, n = nUnknownDofs() + nMpc(). Only nodal
+  // displacements and rotations are non-zero. eqNode[i] is the node of the equation (element DoFs
+  // and Mpc equations get unique numbers greater than nNodes()). The modes are used as the
+  // near-nullspace for AMGPreconditioner.
+  void getRigidBodyModes(std::vector<double>& modes, std::vector<uint32>& eqNode);
   // NOTE: `_en` > 0
 	Element& getElement(uint32 _en);
   template<typename ET>
@@ -200,20 +284,23 @@ public:
 	void addMpcCollection(MpcCollection* mpcCol);
   // Add `comp` to `feComponents` array. FEStorage will delete FEComponent instances by itslef.
   void addFEComponent(FEComponent* comp);
-  // The function add a node to the nodes table.
-  // TODO: this is inefficient functions because we can't ensure memory localization for all nodes
-  // instanses in `nodes` array
+  // The function add a node to the nodes table. The node is copied into the table and `node` is
+  // deleted, it shouldn't be used after the call.
   void addNode(Node* node);
-  // The function creates an vector `nodes` with dynamically allocated Node instances inside.
-  // Numbers of newly created elements pass back to the caller.  
+  // The function appends nn nodes to the nodes table `nodes`.
+  // Numbers of newly created nodes pass back to the caller.  
   // NOTE: nodes will be created with default Node() constructor (node coordinates 0, 0, 0). 
   // NOTE: new nodes are concantenated to old nodes which already were in FEStorage 
 	std::vector<uint32> createNodes(uint32 nn); 
+  // The same as above, but nodes are created with `positions` coordinates (for example,
+  // MeshData::nodesPos)
+	std::vector<uint32> createNodes(const std::vector<math::Vec<3>>& positions); 
   // add an element to the element array `elements`.
   // TODO: this is inefficient functions because we can't ensure memory localization for all
   // elements instances in `elements` array
   void addElement(Element* el);
-  // The function creates a vector with dynamically allocated Element instances inside.  Particular
+  // The function creates a block of Element instances of one type in ElementArena (elements and
+  // their node numbers are contiguous in memory, see elements/ElementArena.h). Particular
   // realization of abstract Element class is chosen from elType variable by mean of ElementFactory
   // class (see elements/ElemenetFactory.h). Numbers of newly created elements pass back to the
   // caller. 
@@ -231,10 +318,9 @@ public:
   // delete all FE model things: elements, nodes, MPCs, MPC Collections, FE components, topology
   // info.
 	void deleteMesh();
-  // delete nodes table: delete all dynamically allocated Node instances,
-  // and clear vector of pointers `nodes`.
+  // delete nodes table `nodes`.
   void deleteNodes();
-  // delete elements table: delete all dynamically allocated Element instances,
+  // delete elements table: delete all dynamically allocated Element instances and element arenas,
   // and clear vector of pointers `elements`.
   void deleteElements();
   // delete MPC list: delete all dynamically allocated Mpc instances,
@@ -266,18 +352,78 @@ public:
 
   // After global equations system is solved and vecU/DU/DDU/R is updated with appropriate values
   // FESolver should call this procedure to update element solution data
-  // NOTE: actually Element::update() is called
+  // NOTE: actually Element::update() is called (in parallel, see setNumberOfThreads(..))
 	void updateResults();
 
 private:
   // fill `topology` data based on the current mesh (Element::nodes numbers)
   void learnTopology();
-
-  // these functions are used to train sparsity info for matK/C/M
-  // provide info that entry (eqi, eqj) are not zero
-  // should be called before matK->compressed()
-  void addEntryK(uint32 eqi, uint32 eqj);
-  void addEntryMPC(uint32 eq_num, uint32 eqj);
+  // fill `elementColors` by greedy colouring of elements based on `topology`
+  void colorElements();
+  // fill `elementRuns` and `colorRuns` (see ElementRun)
+  void batchElements();
+
+  // accumulators written by an element loop
+  enum AssemblyTarget : uint16 {
+    TargetK = 1,
+    TargetC = 2,
+    TargetM = 4,
+    TargetF = 8,
+    TargetProduct = 16
+  };
+  // Elements of one type are processed by statically dispatched kernels (see
+  // elements/ElementBatch.h). ElementRun is a range [begin, end) of an array of element pointers
+  // with the same kernels.
+  struct ElementRun {
+    const ElementKernels* kernels;
+    uint32 begin;
+    uint32 end;
+  };
+  // call func(kernels, els + b, e - b) for the parts of `runs` in [begin, end) of `els`
+  template <typename F>
+  static void forEachRun(Element* const* els, const std::vector<ElementRun>& runs,
+                         uint32 begin, uint32 end, F func);
+  // call func(const ElementKernels&, Element* const*, uint32 n) for batches of elements of one
+  // type in parallel (see AssemblyMode). `targets` is a combination of AssemblyTarget flags the
+  // elements write to.
+  template <typename F>
+  void forEachElement(uint16 targets, F func);
+
+  // thread copies of global values for AssemblyMode::ThreadLocal: K, C, M in the common numbering
+  // of BlockSparseSymMatrix values, F and product in equation numbering
+  struct AssemblyBuffer {
+    std::vector<double> K, C, M, F, product;
+  };
+  std::vector<AssemblyBuffer> assemblyBuffers;
+  // the buffer of the current thread inside of the element loop (nullptr otherwise)
+  static thread_local AssemblyBuffer* threadBuffer;
+
+  AssemblyMode assemblyMode = AssemblyMode::Colored;
+  uint16 numberOfThreads = 0;
+  uint32 minElementsPerThread = 16;
+  // elementColors[c] - elements of colour c (sorted by numbers)
+  std::vector<std::vector<Element*> > elementColors;
+  // colorRuns[c] - runs of elements of one type in elementColors[c]
+  std::vector<std::vector<ElementRun> > colorRuns;
+  // runs of elements of one type in `elements`
+  std::vector<ElementRun> elementRuns;
+
+  // element scatter map (see addElementK(..))
+  struct ElementScatter {
+    // the layout of local DoFs the map was built for
+    std::vector<Dof::dofType> nodeDofs;
+    std::vector<Dof::dofType> elementDofs;
+    // equation numbers of local DoFs
+    std::vector<uint32> eqs;
+    // positions of the upper triangle entries of the element matrix in values of matK/C/M (see
+    // BlockSparseSymMatrix::getValuePosition(..)). Empty in matrix-free mode.
+    std::vector<uindex> positions;
+  };
+  // return the scatter map of the element for the layout, build it if needed
+  ElementScatter& getElementScatter(uint32 el, std::initializer_list<Dof::dofType> nodeDofs,
+                                    std::initializer_list<Dof::dofType> elementDofs);
+  // scatterMaps[el-1] - the map of element el
+  std::vector<ElementScatter> scatterMaps;
 
   // Total number of DoFs (registered by FEStorage::add[Node/Element]Dof(..))
 	uint32 _nDofs = 0;
@@ -292,10 +438,17 @@ private:
   // in [1; nElements()].
   // NOTE: Elements are deleted by deleteElements() function.
 	std::vector<Element*> elements;
+  // Arenas with elements created by createElements(..). Elements added by addElement(..) are
+  // allocated by the user code.
+  std::vector<ElementArena*> elementArenas;
+  // Elements added by addElement(..), they are deleted one by one, the arenas are deleted as a whole
+  std::vector<Element*> addedElements;
 
   // Array of nodes. Nodes are created by FEStorage::createNodes(..). Nodes are created with default
   // coordinates (0,0,0). Nodes have consecutive numbering. They have numbers in [1; nNodes()]. 
-	std::vector<Node*> nodes;
+  // Node instances are kept by value, so coordinates of all nodes are in one contiguous xyz array
+  // (see getNodeCoordinates()).
+	std::vector<Node> nodes;
 
   // List of MPC equations. List is populated by FEStorage::addMpc(..). An instance of Mpc class is
   // created outside of FEStorage class. But after addMpc(..) function FEStorage takes control on
@@ -372,6 +525,17 @@ private:
   // topology[n-1] = [el1, el2, el3..]
   std::vector<std::set<uint32> > topology;
 
+  // matrix-free mode (see setMatrixFree(..))
+  bool matrixFree = false;
+  // block(2) of K, C, M in BSR format (see setBlockStorage(..))
+  bool blockStorage = false;
+  // in matrix-free mode addValueK(..) adds the element entries to the product productY +=
+  // K * productX. If productX is nullptr, only diagonal entries are added to productY. If
+  // productY is nullptr, the entries are dropped.
+  const double* productX = nullptr;
+  double* productY = nullptr;
+  void addProductK(uint32 eqi, uint32 eqj, double value);
+
   // if transient is true that means that assembleGlobalEqMatrices() should assemble M and C
   // matrices too
   bool transient = false;
@@ -388,6 +552,14 @@ inline void FEStorage::addValueK(uint32 nodei, Dof::dofType dofi, uint32 nodej,
 inline void FEStorage::addValueK(uint32 eqi, uint32 eqj, double value) {
   // eqi - row equation 
   // eqj - column equation
+  if (matrixFree) {
+    addProductK(eqi, eqj, value);
+    return;
+  }
+  if (threadBuffer) {
+    threadBuffer->K[matK->getValuePosition(eqi, eqj)] += value;
+    return;
+  }
   matK->addValue(eqi, eqj, value);
 }
 
@@ -402,6 +574,10 @@ inline void FEStorage::addValueC(uint32 nodei, Dof::dofType dofi, uint32 nodej,
 inline void FEStorage::addValueC(uint32 eqi, uint32 eqj, double value) {
   // eqi - row equation 
   // eqj - column equation
+  if (threadBuffer) {
+    threadBuffer->C[matC->getValuePosition(eqi, eqj)] += value;
+    return;
+  }
   matC->addValue(eqi, eqj, value);
 }
 
@@ -416,6 +592,10 @@ inline void FEStorage::addValueM(uint32 nodei, Dof::dofType dofi, uint32 nodej,
 inline void FEStorage::addValueM(uint32 eqi, uint32 eqj, double value) {
   // eqi - row equation 
   // eqj - column equation
+  if (threadBuffer) {
+    threadBuffer->M[matM->getValuePosition(eqi, eqj)] += value;
+    return;
+  }
   matM->addValue(eqi, eqj, value);
 }
 
@@ -427,6 +607,8 @@ inline void FEStorage::addValueMPC(uint32 eq_num, uint32 nodej, Dof::dofType dof
 
 
 inline void FEStorage::addValueMPC(uint32 eq_num, uint32 eqj, double coef) {
+  // in matrix-free mode Mpc coefficients are taken directly from mpcs in multiplyK(..)
+  if (matrixFree) return;
   matK->addValue(eq_num, eqj, coef);
 }
 
@@ -441,6 +623,12 @@ inline void FEStorage::addValueF(uint32 eqi, double value) {
   assert(eqi > 0);
 	assert(eqi <= vecF.size());
 	assert(eqi <= nDofs() + nMpc());
+  // element loads are not needed for the product K * x
+  if (productY) return;
+  if (threadBuffer) {
+    threadBuffer->F[eqi - 1] += value;
+    return;
+  }
 	vecF[eqi - 1] += value;
 }
 
@@ -460,6 +648,7 @@ inline void FEStorage::addValueR(uint32 eqi, double value) {
 
 
 inline void FEStorage::zeroK() {
+  if (matrixFree) return;
 	assert(matK);
   matK->zero();
 }
@@ -483,7 +672,8 @@ inline void FEStorage::zeroF() {
 
 
 inline math::BlockSparseSymMatrix<2>* FEStorage::getK() {
-	assert(matK->isCompressed());
+  // nullptr in matrix-free mode
+	assert(!matK || matK->isCompressed());
 	return matK;
 }
 
@@ -566,6 +756,57 @@ inline bool FEStorage::isTransient() {
   return transient;
 }
 
+
+inline void FEStorage::setMatrixFree(bool _matrixFree) {
+  matrixFree = _matrixFree;
+}
+
+
+inline bool FEStorage::isMatrixFree() {
+  return matrixFree;
+}
+
+
+inline void FEStorage::setBlockStorage(bool _blockStorage) {
+  blockStorage = _blockStorage;
+}
+
+
+inline bool FEStorage::isBlockStorage() {
+  return blockStorage;
+}
+
+
+inline void FEStorage::setAssemblyMode(AssemblyMode mode) {
+  assemblyMode = mode;
+}
+
+
+inline FEStorage::AssemblyMode FEStorage::getAssemblyMode() {
+  return assemblyMode;
+}
+
+
+inline void FEStorage::setNumberOfThreads(uint16 threads) {
+  numberOfThreads = threads;
+}
+
+
+inline void FEStorage::setMinElementsPerThread(uint32 elements) {
+  assert(elements > 0);
+  minElementsPerThread = elements;
+}
+
+
+inline uint32 FEStorage::getMinElementsPerThread() {
+  return minElementsPerThread;
+}
+
+
+inline uint32 FEStorage::nElementColors() {
+  return static_cast<uint32> (elementColors.size());
+}
+
 inline void FEStorage::addNodeDof(uint32 node, std::initializer_list<Dof::dofType> _dofs) {
   assert(nodeDofs.getNumberOfEntities() > 0);
   nodeDofs.addDof(node, _dofs);
@@ -634,7 +875,14 @@ inline double FEStorage::getElementDofSolution (uint32 el, Dof::dofType dof) {
 
 inline Node& FEStorage::getNode(uint32 _nn) {
 	assert(_nn> 0 && _nn <= nNodes());
-	return *nodes[_nn-1];
+	return nodes[_nn-1];
+}
+
+
+inline const double* FEStorage::getNodeCoordinates() {
+  static_assert(sizeof(Node) == 3 * sizeof(double), "Node should contain only coordinates");
+  assert(nodes.size() > 0);
+  return nodes[0].pos.ptr();
 }
 
 
@@ -650,26 +898,11 @@ inline ET& FEStorage::getElement(uint32 _en) {
 }
 
 
-inline void FEStorage::addEntryK(uint32 eqi, uint32 eqj) {
-  // eqi - row equation 
-  // eqj - column equation
-  matK->addEntry(eqi, eqj);
-}
-
-
-inline void FEStorage::addEntryMPC(uint32 eq_num, uint32 eqj) {
-	assert(matK);
-	assert(eq_num > nConstrainedDofs() + nUnknownDofs());
-  assert(eq_num <= nConstrainedDofs() + nUnknownDofs() + nMpc());
-  assert(eqj > 0 && eqj <= nConstrainedDofs() + nUnknownDofs());
-  matK->addEntry(eq_num, eqj);
-}
-
-
 } // namespace nla3d 
 
 // 'dirty' hack to avoid include loops (element-vs-festorage)
 #include "elements/element.h"
+#include "elements/ElementArena.h"
 
 namespace nla3d {
 template<typename T>
@@ -679,12 +912,7 @@ std::vector<uint32> FEStorage::createElements(uint32 _en, T example) {
   newIndexes.reserve(_en);
   uint32 nextNumber = elements.size() + 1;
 
-  elements.reserve(elements.size() + _en);
-
-  for (uint32 i = 0; i < _en; i++) {
-    T* els = new T;
-    elements.push_back(els);
-  }
+  elementArenas.push_back(ElementArena::create<T>(_en, elements));
 
   for (uint32 i = nextNumber; i <= elements.size(); i++) {
     //access elNum protected values as friend
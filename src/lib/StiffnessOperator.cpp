@@ -0,0 +1,35 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "StiffnessOperator.h"
+
+namespace nla3d {
+
+StiffnessOperator::StiffnessOperator(FEStorage* _storage) : storage(CHECK_NOTNULL(_storage)) {
+  CHECK(storage->isMatrixFree()) << "StiffnessOperator needs FEStorage in matrix-free mode";
+  fullX.assign(storage->nDofs() + storage->nMpc(), 0.0);
+  fullY.assign(storage->nDofs() + storage->nMpc(), 0.0);
+}
+
+
+uint32 StiffnessOperator::nRows() {
+  return storage->nUnknownDofs() + storage->nMpc();
+}
+
+
+void StiffnessOperator::multiply(const double* x, double* y) {
+  const uint32 nc = storage->nConstrainedDofs();
+  std::fill_n(fullX.begin(), nc, 0.0);
+  std::copy(x, x + nRows(), fullX.begin() + nc);
+  storage->multiplyK(fullX.data(), fullY.data());
+  std::copy(fullY.begin() + nc, fullY.end(), y);
+}
+
+
+void StiffnessOperator::diagonal(double* d) {
+  storage->diagonalK(fullY.data());
+  std::copy(fullY.begin() + storage->nConstrainedDofs(), fullY.end(), d);
+}
+
+} // namespace nla3d
@@ -0,0 +1,30 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/LinearOperator.h"
+#include "FEStorage.h"
+
+namespace nla3d {
+
+// StiffnessOperator - matrix-free stiffness matrix of the model in the block of unknown DoFs and Mpc
+// equations (the same block as matK->block(2) in FEStorage). The product K * x is computed element
+// by element by FEStorage::multiplyK(..), the constrained DoFs are taken as zeros. FEStorage should
+// be in matrix-free mode (see FEStorage::setMatrixFree(..)).
+class StiffnessOperator : public math::LinearOperator {
+public:
+  StiffnessOperator(FEStorage* _storage);
+  virtual ~StiffnessOperator() { };
+  virtual uint32 nRows();
+  virtual void multiply(const double* x, double* y);
+  virtual void diagonal(double* d);
+protected:
+  FEStorage* storage;
+  // work vectors for all equations of the model
+  std::vector<double> fullX;
+  std::vector<double> fullY;
+};
+
+} // namespace nla3d
@@ -0,0 +1,25 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d 
+
+#include "elements/ElementArena.h"
+
+namespace nla3d {
+
+ElementArena::~ElementArena() {
+  for (uint32 i = 0; i < n; i++) {
+    // virtual destructor of the particular element type
+    getElement(i)->~Element();
+  }
+  ::operator delete(memory);
+  memory = nullptr;
+  n = 0;
+}
+
+
+Element* ElementArena::getElement(uint32 i) {
+  assert(i < n);
+  return reinterpret_cast<Element*>(memory + i * stride + baseOffset);
+}
+
+} // namespace nla3d
@@ -0,0 +1,100 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d 
+
+#pragma once
+#include "sys.h"
+#include "elements/ElementBatch.h"
+#include <cstddef>
+#include <type_traits>
+
+namespace nla3d {
+class Element;
+
+// ElementArena - storage for a block of elements of one type (see FEStorage::createElements(..)).
+// Element instances are placed one after another in one memory chunk and their node numbers are
+// kept in one flat connectivity array (getNNodes() numbers per element). So there are no per
+// element heap allocations and elements of one type are contiguous in memory.
+// NOTE: elements of the arena are destroyed with the arena, they shouldn't be deleted by
+// `delete`.
+class ElementArena {
+  public:
+    // create n elements of type T, pointers to them are appended to `ptr`
+    template <typename T>
+    static ElementArena* create(uint32 n, std::vector<Element*>& ptr);
+
+    ~ElementArena();
+
+    // number of elements in the arena
+    uint32 size();
+    // node numbers of all elements in the arena: getNNodes() numbers per element
+    uint32* getConnectivity();
+    // i-th element in the arena (from 0)
+    Element* getElement(uint32 i);
+    // statically dispatched procedures of the arena's element type (see elements/ElementBatch.h)
+    const ElementKernels* getKernels();
+
+  private:
+    ElementArena() { }
+
+    const ElementKernels* kernels = nullptr;
+    char* memory = nullptr;
+    // size of one element in the memory
+    size_t stride = 0;
+    // offset of Element base in the element
+    size_t baseOffset = 0;
+    uint32 n = 0;
+    std::vector<uint32> connectivity;
+};
+
+
+inline uint32 ElementArena::size() {
+  return n;
+}
+
+
+inline uint32* ElementArena::getConnectivity() {
+  return connectivity.data();
+}
+
+
+inline const ElementKernels* ElementArena::getKernels() {
+  return kernels;
+}
+
+} // namespace nla3d
+
+#include "elements/element.h"
+
+namespace nla3d {
+
+template <typename T>
+ElementArena* ElementArena::create(uint32 n, std::vector<Element*>& ptr) {
+  static_assert(std::is_base_of<Element, T>::value, "ElementArena keeps only Element instances");
+  static_assert(alignof(T) <= alignof(std::max_align_t), "ElementArena memory isn't aligned for T");
+  ElementArena* arena = new ElementArena;
+  arena->kernels = &ElementBatch<T>::kernels;
+  if (n == 0) {
+    return arena;
+  }
+  // number of nodes is known from the shape of constructed element
+  const uint16 nNodes = T().getNNodes();
+  arena->connectivity.assign(static_cast<size_t>(n) * nNodes, 0);
+  arena->stride = sizeof(T);
+  arena->memory = static_cast<char*>(::operator new(static_cast<size_t>(n) * sizeof(T)));
+
+  ptr.reserve(ptr.size() + n);
+  // elements take their node arrays from the connectivity array (see Element::allocateNodes())
+  Element::arenaNodes = arena->connectivity.data();
+  for (uint32 i = 0; i < n; i++) {
+    T* el = new (arena->memory + i * arena->stride) T;
+    arena->n++;
+    ptr.push_back(el);
+  }
+  Element::arenaNodes = nullptr;
+  arena->baseOffset = reinterpret_cast<char*>(ptr.back()) -
+                      (arena->memory + (n - 1) * arena->stride);
+  return arena;
+}
+
+} // namespace nla3d
@@ -0,0 +1,103 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d 
+
+#pragma once
+#include "sys.h"
+
+namespace nla3d {
+class Element;
+
+// ElementKernels - element procedures (buildK(), update(), ..) applied to a batch of `n` elements
+// of one type. FEStorage calls a kernel once per batch instead of a virtual call per element.
+struct ElementKernels {
+  void (*buildK)(Element* const* els, uint32 n);
+  void (*buildC)(Element* const* els, uint32 n);
+  void (*buildM)(Element* const* els, uint32 n);
+  void (*update)(Element* const* els, uint32 n);
+  void (*multiplyK)(Element* const* els, uint32 n, const double* x, double* y);
+};
+
+
+// ElementBatch<T> - kernels for elements of exactly T type. T's procedures are called directly
+// (not through the virtual table), so the compiler can inline them into the loops. Element classes
+// known by ElementFactory instantiate ElementBatch<T> in their own translation unit (see `extern
+// template` at the end of their headers). ElementBatch<Element> uses virtual calls and is used for
+// elements of unknown type (added by FEStorage::addElement(..)).
+template <typename T>
+class ElementBatch {
+  public:
+    static void buildK(Element* const* els, uint32 n);
+    static void buildC(Element* const* els, uint32 n);
+    static void buildM(Element* const* els, uint32 n);
+    static void update(Element* const* els, uint32 n);
+    static void multiplyK(Element* const* els, uint32 n, const double* x, double* y);
+
+    static const ElementKernels kernels;
+};
+
+
+template <typename T>
+const ElementKernels ElementBatch<T>::kernels = {
+  &ElementBatch<T>::buildK,
+  &ElementBatch<T>::buildC,
+  &ElementBatch<T>::buildM,
+  &ElementBatch<T>::update,
+  &ElementBatch<T>::multiplyK
+};
+
+
+template <typename T>
+void ElementBatch<T>::buildK(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    static_cast<T*>(els[i])->T::buildK();
+  }
+}
+
+
+template <typename T>
+void ElementBatch<T>::buildC(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    static_cast<T*>(els[i])->T::buildC();
+  }
+}
+
+
+template <typename T>
+void ElementBatch<T>::buildM(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    static_cast<T*>(els[i])->T::buildM();
+  }
+}
+
+
+template <typename T>
+void ElementBatch<T>::update(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    static_cast<T*>(els[i])->T::update();
+  }
+}
+
+
+template <typename T>
+void ElementBatch<T>::multiplyK(Element* const* els, uint32 n, const double* x, double* y) {
+  for (uint32 i = 0; i < n; i++) {
+    static_cast<T*>(els[i])->T::multiplyK(x, y);
+  }
+}
+
+
+// virtual calls for elements of unknown type (defined in element.cpp)
+template <>
+void ElementBatch<Element>::buildK(Element* const* els, uint32 n);
+template <>
+void ElementBatch<Element>::buildC(Element* const* els, uint32 n);
+template <>
+void ElementBatch<Element>::buildM(Element* const* els, uint32 n);
+template <>
+void ElementBatch<Element>::update(Element* const* els, uint32 n);
+template <>
+void ElementBatch<Element>::multiplyK(Element* const* els, uint32 n,
+                                      const double* x, double* y);
+
+} // namespace nla3d
@@ -3,6 +3,7 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "elements/ElementFactory.h"
+#include "elements/ElementArena.h"
 #include "elements/PLANE41.h"
 #include "elements/SOLID81.h"
 #include "elements/TRUSS3.h"
@@ -26,70 +27,37 @@ ElementType ElementFactory::elName2elType (std::string elName) {
 }
 
 
-void ElementFactory::createElements (ElementType elId, const uint32 n, std::vector<Element*>& ptr) {
+ElementArena* ElementFactory::createElements (ElementType elId, const uint32 n,
+                                             std::vector<Element*>& ptr) {
   if (elId == ElementType::UNDEFINED) {
     LOG(FATAL) << "Element type is undefined";
   }
-  if (n == 0) {
-    return;
-  }
-  // reserve memory in the vector for newly created elements
-  ptr.reserve(ptr.size() + n);
 
   switch (elId) {
       case ElementType::PLANE41:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementPLANE41());
-        }
-        break;
+        return ElementArena::create<ElementPLANE41>(n, ptr);
       case ElementType::SOLID81:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementSOLID81());
-        }
-        break;
+        return ElementArena::create<ElementSOLID81>(n, ptr);
       case ElementType::TRUSS3:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementTRUSS3());
-        }
-        break;
+        return ElementArena::create<ElementTRUSS3>(n, ptr);
       case ElementType::TRIANGLE4:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementTRIANGLE4());
-        }
-        break;
+        return ElementArena::create<ElementTRIANGLE4>(n, ptr);
       case ElementType::TETRA0:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementTETRA0());
-        }
-        break;
+        return ElementArena::create<ElementTETRA0>(n, ptr);
       case ElementType::TETRA1:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementTETRA1());
-        }
-        break;
+        return ElementArena::create<ElementTETRA1>(n, ptr);
       case ElementType::QUADTH:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementQUADTH());
-        }
-        break;
+        return ElementArena::create<ElementQUADTH>(n, ptr);
       case ElementType::SurfaceLINETH:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new SurfaceLINETH());
-        }
-        break;
+        return ElementArena::create<SurfaceLINETH>(n, ptr);
       case ElementType::INTER0:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementINTER0());
-        }
-        break;
+        return ElementArena::create<ElementINTER0>(n, ptr);
       case ElementType::INTER3:
-        for (uint32 i = 0; i < n; i++) {
-          ptr.push_back(new ElementINTER3());
-        }
-        break;
+        return ElementArena::create<ElementINTER3>(n, ptr);
       default:
         LOG(ERROR) << "Don't have an element with id " << (uint16) elId;
     }
+  return nullptr;
 }
 
 } // namespace nla3d
@@ -7,12 +7,15 @@
 
 namespace nla3d {
 class Element;
+class ElementArena;
 
 class ElementFactory {
   public:
 
     static ElementType elName2elType (std::string elName); 
-    static void createElements (ElementType elId, const uint32 n, std::vector<Element*>& ptr); 
+    // create n elements of elId type in a new ElementArena (the caller owns it), pointers to the
+    // elements are appended to `ptr`. Return nullptr if elId is unknown.
+    static ElementArena* createElements (ElementType elId, const uint32 n, std::vector<Element*>& ptr); 
 };
 
 } // namespace nla3d
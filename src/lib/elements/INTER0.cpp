@@ -82,4 +82,6 @@ bool ElementINTER0::getTensor(math::MatSym<3>* tensor, tensorQuery query, uint16
   return false;
 }
 
+template class ElementBatch<ElementINTER0>;
+
 } //namespace nla3d
@@ -29,4 +29,9 @@ public:
   bool getTensor(math::MatSym<3>* tensor, tensorQuery query, uint16 gp, const double scale);
 };
 
+#ifndef SWIG
+// kernels are instantiated in INTER0.cpp
+extern template class ElementBatch<ElementINTER0>;
+#endif
+
 } //namespace nla3d
@@ -235,4 +235,6 @@ bool ElementINTER3::getTensor(math::MatSym<3>* tensor, tensorQuery query, uint16
 }
 
 
+template class ElementBatch<ElementINTER3>;
+
 } //namespace nla3d
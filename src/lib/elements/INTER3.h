@@ -183,4 +183,9 @@ inline double ElementINTER3::radoIntL3(uint16 np, uint16 npj){
   return 1.-radoIntL1(np)-radoIntL2(np,npj);
 }
 
+#ifndef SWIG
+// kernels are instantiated in INTER3.cpp
+extern template class ElementBatch<ElementINTER3>;
+#endif
+
 } //namespace nla3d
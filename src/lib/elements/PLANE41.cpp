@@ -3,6 +3,7 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "elements/PLANE41.h"
+#include "elements/StrainKernels.h"
 
 namespace nla3d {
 using namespace math;
@@ -13,6 +14,10 @@ const uint16 ElementPLANE41::num_components = 3;
 
 //------------------ElementPLANE41--------------------
 void ElementPLANE41::pre() {
+  // the material type is checked once here, buildK(), multiplyK() and update() use static_cast
+  CHECK(dynamic_cast<Mat_Hyper_Isotrop_General*>(storage->getMaterial()))
+    << "PLANE41 element needs Mat_Hyper_Isotrop_General material";
+
   if (det.size()==0) {
     makeJacob();
   }
@@ -28,9 +33,23 @@ void ElementPLANE41::pre() {
   storage->addElementDof(getElNum(), {Dof::HYDRO_PRESSURE});
 }
 
+namespace {
+
+// order of tensor components in PLANE41 (ElementPLANE41::components)
+struct Plane41Voigt {
+  static const uint16 dim = 2;
+  static uint16 index(uint16 i, uint16 j) {
+    return (i == j) ? i : 2;
+  }
+};
+
+} // namespace
+
+
 void ElementPLANE41::buildK() {
-  Mat<8,8> Kuu;  // displacement stiff. matrix
-  Mat<8,1> Kup;
+  typedef StrainKernels<Plane41Voigt, 4, 1> Kernels;
+  MatSym<8> KuuSym;  // displacement stiff. matrix
+  Vec<8> Kup;
   Mat<9,9> Ke;  // element stiff. matrix
   double Kpp = 0.0;
   double Fp = 0.0;
@@ -42,12 +61,15 @@ void ElementPLANE41::buildK() {
   CVec[M_ZZ] = 1.0;
   MatSym<3> matD_d;
   Vec<3> vecD_p;
+  Vec<4> F;
+  Mat<4,4> H;
   double p_e = storage->getElementDofSolution(getElNum(), Dof::HYDRO_PRESSURE);
-  Mat_Hyper_Isotrop_General* mat = dynamic_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
   CHECK_NOTNULL(mat);
 
   double k = mat->getK();
   double dWt; //Gaussian quadrature
+  KuuSym.zero();
   for (uint16 np=0; np < nOfIntPoints(); np++) {
     dWt = intWeight(np);
     // all meterial functions are waiting [C] for 3D case. So we need to use CVec here.
@@ -55,46 +77,32 @@ void ElementPLANE41::buildK() {
     CVec[M_YY] = C[np][1];
     CVec[M_XY] = C[np][2];
     mat->getDdDp_UP(num_components, components, CVec.ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
-    //matD_d will be 3x3 symmetric matrix. We need to convert it onto 3x3 usual matrix
-    Mat<3,3> matE_c = matD_d.toMat();
-    Mat<3,1> matE_p;
-    matE_p[0][0] = vecD_p[0];
-    matE_p[1][0] = vecD_p[1];
-    matE_p[2][0] = vecD_p[2];
     double J = solidmech::J_C(CVec.ptr());
 
-    Mat<3,8> matB = make_B(np);
-    //матрица S для матричного умножения
-    Mat<4,4> matS = Mat<4,4>(S[np][0],S[np][2], 0.0, 0.0, 
-                S[np][2],S[np][1], 0.0, 0.0,
-                0.0, 0.0, S[np][0],S[np][2],
-                0.0, 0.0, S[np][2],S[np][1]);
-    //матрица Омега.используется для составления 
-    //матр. накопленных линейных деформаций к текущему шагу
-    Mat<3,4> matO = Mat<3,4>(O[np][0], 0.0, O[np][2], 0.0,
-                0.0, O[np][1], 0.0, O[np][3],
-                O[np][1], O[np][0], O[np][3], O[np][2]);
-
-    Mat<4,8> matBomega = make_Bomega(np);
-    Mat<3,8> matBl = matO * matBomega;
-    matB += matBl;
-    Kuu += (matB.transpose() * matE_c * matB * 2.0 + matBomega.transpose() * matS * matBomega)*dWt;
+    // matB = make_B(np) + matO * make_Bomega(np) is W * N (see StrainKernels), so
+    // Kuu += (matB^T * matD_d * matB * 2.0 + matBomega^T * matS * matBomega) * dWt
+    Kernels::deformationGradient(O[np].ptr(), F.ptr());
+    const double coefD = 2.0*dWt;
+    Kernels::tangent(F.ptr(), matD_d.ptr(), S[np].ptr(), &coefD, &dWt, H.ptr());
+    Kernels::addStiffness(NiXj[np].ptr(), H.ptr(), KuuSym.ptr());
     Fp += (J - 1 - p_e/k)*dWt;
-    Qe += (matB.transpose() * S[np] * dWt);
-    Kup+= matB.transpose()*matE_p *dWt;
+    // Qe += matB^T * S[np] * dWt
+    Kernels::addForce(NiXj[np].ptr(), F.ptr(), S[np].ptr(), &dWt, Qe.ptr());
+    // Kup += matB^T * vecD_p * dWt
+    Kernels::addForce(NiXj[np].ptr(), F.ptr(), vecD_p.ptr(), &dWt, Kup.ptr());
     Kpp -= 1.0/k*dWt;
 
   }// loop over intergration points
-  
+  Mat<8,8> Kuu = KuuSym.toMat();
 
   //сборка в одну матрицу
   for (uint16 i=0; i < 8; i++)
     for (uint16 j=0; j < 8; j++)
       Ke[i][j] = Kuu[i][j];
   for (uint16 i=0; i<8; i++)
-    Ke[i][8] = Kup[i][0];
+    Ke[i][8] = Kup[i];
   for (uint16 i=0; i<8; i++)
-    Ke[8][i] = Kup[i][0];
+    Ke[8][i] = Kup[i];
   Ke[8][8] = Kpp;
   for (uint16 i=0; i < 8; i++)
     Fe[i] = -Qe[i];
@@ -125,7 +133,7 @@ void ElementPLANE41::update() {
     U[i*2 + 0] = storage->getNodeDofSolution(getNodeNumber(i), Dof::UX);
     U[i*2 + 1] = storage->getNodeDofSolution(getNodeNumber(i), Dof::UY);
   }
-  Mat_Hyper_Isotrop_General* mat = dynamic_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
   CHECK_NOTNULL(mat);
   Vec<6> CVec;
   CVec[M_XZ] = 0.0;
@@ -301,4 +309,6 @@ bool  ElementPLANE41::getTensor(math::MatSym<3>* tensor, tensorQuery query, uint
   return false;
 }
 
+template class ElementBatch<ElementPLANE41>;
+
 } // namespace nla3d
@@ -54,46 +54,25 @@ class ElementPLANE41 : public ElementIsoParamQUAD {
 template <uint16 el_dofs_num>
 void ElementPLANE41::assembleK(const math::Mat<el_dofs_num,el_dofs_num> &Ke, const math::Vec<el_dofs_num> &Qe)
 {
-  uint16 dim = 2;
-  uint16 eds = 8;
-  uint16 eldofs = 1;
-  Dof::dofType nodeDofVec[] = {Dof::UX, Dof::UY};
-  Dof::dofType elementDofVec[] = {Dof::HYDRO_PRESSURE};
-  assert(getNNodes() * dim + eldofs == el_dofs_num);
-  // upper diagonal process for nodal dofs
-  for (uint16 i=0; i < getNNodes(); i++)
-    for (uint16 j=i; j < getNNodes(); j++)
-      for (uint16 di=0; di < dim; di++)
-        for (uint16 dj=0; dj < dim; dj++)
-          if ((i==j) && (dj>di)) continue;
-          else
-            storage->addValueK(nodes[i], nodeDofVec[di],nodes[j],nodeDofVec[dj], Ke[i*dim+di][j*dim+dj]);
-
-  //upper diagonal process for nodes-el dofs
-  for (uint16 i=0; i < getNNodes(); i++)
-    for(uint16 di=0; di < dim; di++) {
-      uint32 noEq = storage->getNodeDofEqNumber(nodes[i], nodeDofVec[di]);
-      for (uint16 dj=0; dj < eldofs; dj++) {
-        uint32 elEq = storage->getElementDofEqNumber(getElNum(), elementDofVec[dj]);
-        storage->addValueK(noEq, elEq, Ke[i*dim+di][eds+dj]);
-      }
-    }
-  //upper diagonal process for el-el dofs
-  for (uint16 di=0; di < eldofs; di++)
-    for (uint16 dj=di; dj < eldofs; dj++) {
-      uint32 elEqi = storage->getElementDofEqNumber(getElNum(), elementDofVec[di]);
-      uint32 elEqj = storage->getElementDofEqNumber(getElNum(), elementDofVec[dj]);
-      storage->addValueK(elEqi, elEqj, Ke[eds+di][eds+dj]);
-    }
-
-  for (uint16 i=0; i < getNNodes(); i++)
-    for (uint16 di=0; di < dim; di++)
-      storage->addValueF(nodes[i], nodeDofVec[di], Qe[i*dim+di]);
-
-  for (uint16 di=0; di < eldofs; di++) {
-    uint32 elEq = storage->getElementDofEqNumber(getElNum(), elementDofVec[di]);
-    storage->addValueF(elEq, Qe[eds+di]);
+  // local DoFs: UX, UY of every node, then HYDRO_PRESSURE of the element. Pack the upper triangle
+  // of Ke row by row
+  assert(getNNodes() * 2 + 1 == el_dofs_num);
+  double Ke_packed[el_dofs_num * (el_dofs_num + 1) / 2];
+  double Qe_packed[el_dofs_num];
+  double* Ke_p = Ke_packed;
+  for (uint16 i=0; i < el_dofs_num; i++) {
+    for (uint16 j=i; j < el_dofs_num; j++)
+      *Ke_p++ = Ke[i][j];
+    Qe_packed[i] = Qe[i];
   }
+
+  storage->addElementK(getElNum(), {Dof::UX, Dof::UY}, {Dof::HYDRO_PRESSURE}, Ke_packed);
+  storage->addElementF(getElNum(), {Dof::UX, Dof::UY}, {Dof::HYDRO_PRESSURE}, Qe_packed);
 }
 
+#ifndef SWIG
+// kernels are instantiated in PLANE41.cpp
+extern template class ElementBatch<ElementPLANE41>;
+#endif
+
 } // namespace nla3d 
@@ -133,4 +133,7 @@ void SurfaceLINETH::update() {
 }
 
 
+template class ElementBatch<ElementQUADTH>;
+template class ElementBatch<SurfaceLINETH>;
+
 } // namespace nla3d
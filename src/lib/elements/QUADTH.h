@@ -53,4 +53,11 @@ class SurfaceLINETH : public ElementIsoParamLINE {
     double htc = 0.0;
     math::Vec<2> etemp = {0.0, 0.0};
 };
+
+#ifndef SWIG
+// kernels are instantiated in QUADTH.cpp
+extern template class ElementBatch<ElementQUADTH>;
+extern template class ElementBatch<SurfaceLINETH>;
+#endif
+
 } // nla3d namespace
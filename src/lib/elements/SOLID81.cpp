@@ -3,6 +3,7 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "elements/SOLID81.h"
+#include "elements/StrainKernels.h"
 
 namespace nla3d {
 using namespace math;
@@ -10,6 +11,10 @@ using namespace solidmech;
 
 
 void ElementSOLID81::pre() {
+  // the material type is checked once here, buildK(), multiplyK() and update() use static_cast
+  CHECK(dynamic_cast<Mat_Hyper_Isotrop_General*>(storage->getMaterial()))
+    << "SOLID81 element needs Mat_Hyper_Isotrop_General material";
+
   if (det.size()==0) {
     makeJacob();
   }
@@ -26,24 +31,33 @@ void ElementSOLID81::pre() {
 }
 
 
+namespace {
+
+// order of tensor components in SOLID81 (solidmech::defaultTensorComponents)
+struct Solid81Voigt {
+  static const uint16 dim = 3;
+  static uint16 index(uint16 i, uint16 j) {
+    return (i <= j) ? i*3 - i*(i-1)/2 + (j-i) : index(j, i);
+  }
+};
+
+} // namespace
+
+
 void ElementSOLID81::buildK() {
+  typedef StrainKernels<Solid81Voigt, 8, 1> Kernels;
 
   double Kpp = 0.0;
   double Fp = 0.0;
 
   Vec<24> Kup;
   Vec<24> Fu; //вектор узловых сил элемента
-  Vec<24> F_ext; //вектор внешних сил (пока не подсчитывается)
-  Mat_Hyper_Isotrop_General* mat = CHECK_NOTNULL( dynamic_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial()));
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
   double k = mat->getK();
   MatSym<6> matD_d;
   Vec<6> vecD_p;
-  Vec<6> vecC;
-
-  Mat<6,24> matB;
-  MatSym<9> matS;
-  Mat<6,9> matO;
-  Mat<9,24> matB_NL;
+  Vec<9> F;
+  Mat<9,9> H;
   MatSym<24> Kuu; //матрица жесткости перед вектором перемещений
   double p_e = storage->getElementDofSolution(getElNum(), Dof::HYDRO_PRESSURE);
   double dWt; //множитель при суммировании квадратур Гаусса
@@ -53,27 +67,20 @@ void ElementSOLID81::buildK() {
 
     mat->getDdDp_UP(6, solidmech::defaultTensorComponents, C[np].ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
     double J = solidmech::J_C(C[np].ptr());
-    matB.zero();
-    matS.zero();
-    matO.zero();
-    matB_NL.zero();
-
-    make_B_L(np, matB);
-    make_S(np, matS); //matrix 9x9 with 3x3 stress tenros blocks
-    make_Omega(np, matO);
-    make_B_NL(np, matB_NL);
-    // matB = matB + matO * matB_NL * 2
-    matABprod(matO, matB_NL, 2.0, matB);
-    // Kuu = Kuu + (matB^T * matD_d * matB) * 0.5*dWt
-    matBTDBprod(matB, matD_d, 0.5*dWt, Kuu);
-    // Kuu = Kuu + (matB_NL^T * matS * matB_NL) * dWt
-    matBTDBprod(matB_NL, matS, dWt, Kuu);
-
-    // Fu = Fu +  matB^T * S[np] * (-0.5*dWt);
-    matBTVprod(matB,S[np], -0.5*dWt, Fu);
-
-    // Kup = Kup +  matB^T * vecD_p * (dWt*0.5);
-    matBTVprod(matB,vecD_p, 0.5*dWt, Kup);
+
+    // B = B_L + Omega * B_NL * 2 is 2 * W * N (see StrainKernels), so
+    // Kuu = Kuu + (B^T * matD_d * B) * 0.5*dWt + (B_NL^T * S * B_NL) * dWt
+    Kernels::deformationGradient(O[np].ptr(), F.ptr());
+    const double coefD = 2.0*dWt;
+    Kernels::tangent(F.ptr(), matD_d.ptr(), S[np].ptr(), &coefD, &dWt, H.ptr());
+    Kernels::addStiffness(NiXj[np].ptr(), H.ptr(), Kuu.ptr());
+
+    // Fu = Fu +  B^T * S[np] * (-0.5*dWt);
+    const double coefF = -dWt;
+    Kernels::addForce(NiXj[np].ptr(), F.ptr(), S[np].ptr(), &coefF, Fu.ptr());
+
+    // Kup = Kup +  B^T * vecD_p * (dWt*0.5);
+    Kernels::addForce(NiXj[np].ptr(), F.ptr(), vecD_p.ptr(), &dWt, Kup.ptr());
 
     Fp += -(J - 1 - p_e/k)*dWt;
     Kpp += -1.0/k*dWt;
@@ -82,6 +89,222 @@ void ElementSOLID81::buildK() {
 }
 
 
+namespace {
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NLA3D_SOLID81_AVX2
+#endif
+
+const uint16 lanes = ElementSOLID81::numberOfLanes;
+// one value for every lane
+typedef double Lanes[lanes];
+
+// Integration point data of `lanes` elements (structure of arrays), element l is in lane l
+struct alignas(32) PointLanes {
+  Lanes N[8*3];  // NiXj[np]
+  Lanes D[21];   // matD_d
+  Lanes Dp[6];   // vecD_p
+  Lanes S[6];    // S[np]
+  Lanes O[9];    // O[np]
+  Lanes dWt;
+};
+
+
+// Element matrices of `lanes` elements
+struct alignas(32) ElementLanes {
+  Lanes Kuu[300];
+  Lanes Kup[24];
+  Lanes Fu[24];
+};
+
+
+// add the integration point p to the element matrices e, the same as the body of the integration
+// loop of ElementSOLID81::buildK(). StrainKernels do the same operations for every lane, so the
+// results are the same bit to bit
+NLA3D_KERNEL_INLINE void addPointLanes(const PointLanes& p, ElementLanes& e) {
+  typedef StrainKernels<Solid81Voigt, 8, lanes> Kernels;
+  Lanes F[9];
+  Lanes H[81];
+  Lanes coefD;
+  Lanes coefF;
+  for (uint16 l = 0; l < lanes; l++) {
+    coefD[l] = 2.0*p.dWt[l];
+    coefF[l] = -p.dWt[l];
+  }
+  Kernels::deformationGradient(p.O[0], F[0]);
+  Kernels::tangent(F[0], p.D[0], p.S[0], coefD, p.dWt, H[0]);
+  Kernels::addStiffness(p.N[0], H[0], e.Kuu[0]);
+  Kernels::addForce(p.N[0], F[0], p.S[0], coefF, e.Fu[0]);
+  Kernels::addForce(p.N[0], F[0], p.Dp[0], p.dWt, e.Kup[0]);
+}
+
+
+// The AVX2 version is compiled from the same code without FMA, so it gives the same results
+#ifdef NLA3D_SOLID81_AVX2
+__attribute__((target("avx2")))
+void addPointAvx2(const PointLanes& p, ElementLanes& e) {
+  addPointLanes(p, e);
+}
+
+
+bool cpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+
+void addPointDefault(const PointLanes& p, ElementLanes& e) {
+  addPointLanes(p, e);
+}
+
+
+typedef void (*AddPointKernel)(const PointLanes& p, ElementLanes& e);
+
+// kernel for the running CPU
+AddPointKernel addPointKernel() {
+#ifdef NLA3D_SOLID81_AVX2
+  static const bool hasAvx2 = cpuHasAvx2();
+  return (hasAvx2 && ElementSOLID81::useAvx2) ? addPointAvx2 : addPointDefault;
+#else
+  return addPointDefault;
+#endif
+}
+
+} // namespace
+
+
+bool ElementSOLID81::useAvx2 = true;
+
+
+void ElementSOLID81::buildKLanes(ElementSOLID81* const* els, uint16 n) {
+  assert(n > 0 && n <= lanes);
+  // free lanes repeat the first element, their results are not assembled
+  ElementSOLID81* el[lanes];
+  for (uint16 l = 0; l < lanes; l++) {
+    el[l] = els[l < n ? l : 0];
+    assert(el[l]->nOfIntPoints() == el[0]->nOfIntPoints());
+  }
+  FEStorage* storage = el[0]->storage;
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
+  double k = mat->getK();
+  double p_e[lanes];
+  double Kpp[lanes];
+  double Fp[lanes];
+  for (uint16 l = 0; l < lanes; l++) {
+    p_e[l] = storage->getElementDofSolution(el[l]->getElNum(), Dof::HYDRO_PRESSURE);
+    Kpp[l] = 0.0;
+    Fp[l] = 0.0;
+  }
+
+  AddPointKernel addPoint = addPointKernel();
+  PointLanes p;
+  ElementLanes e;
+  memset(&e, 0, sizeof(e));
+  MatSym<6> matD_d;
+  Vec<6> vecD_p;
+  for (uint16 np = 0; np < el[0]->nOfIntPoints(); np++) {
+    // gather the integration point data of the elements into the lanes
+    for (uint16 l = 0; l < lanes; l++) {
+      ElementSOLID81* e_l = el[l];
+      double dWt = e_l->intWeight(np);
+      mat->getDdDp_UP(6, solidmech::defaultTensorComponents, e_l->C[np].ptr(), p_e[l],
+                      matD_d.ptr(), vecD_p.ptr());
+      double J = solidmech::J_C(e_l->C[np].ptr());
+      const double* N = e_l->NiXj[np].ptr();
+      for (uint16 i = 0; i < 8*3; i++) {
+        p.N[i][l] = N[i];
+      }
+      for (uint16 i = 0; i < 21; i++) {
+        p.D[i][l] = matD_d.data[i];
+      }
+      for (uint16 i = 0; i < 6; i++) {
+        p.Dp[i][l] = vecD_p[i];
+        p.S[i][l] = e_l->S[np][i];
+      }
+      for (uint16 i = 0; i < 9; i++) {
+        p.O[i][l] = e_l->O[np][i];
+      }
+      p.dWt[l] = dWt;
+
+      Fp[l] += -(J - 1 - p_e[l]/k)*dWt;
+      Kpp[l] += -1.0/k*dWt;
+    }
+    addPoint(p, e);
+  }
+
+  // scatter the element matrices
+  MatSym<24> Kuu;
+  Vec<24> Kup;
+  Vec<24> Fu;
+  for (uint16 l = 0; l < n; l++) {
+    for (uint16 i = 0; i < 300; i++) {
+      Kuu.data[i] = e.Kuu[i][l];
+    }
+    for (uint16 i = 0; i < 24; i++) {
+      Kup[i] = e.Kup[i][l];
+      Fu[i] = e.Fu[i][l];
+    }
+    el[l]->assemble3(Kuu, Kup, Kpp[l], Fu, Fp[l]);
+  }
+}
+
+
+void ElementSOLID81::multiplyK(const double* x, double* y) {
+  typedef StrainKernels<Solid81Voigt, 8, 1> Kernels;
+
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
+  double k = mat->getK();
+  double p_e = storage->getElementDofSolution(getElNum(), Dof::HYDRO_PRESSURE);
+  const Dof::dofType dofVec[] = {Dof::UX, Dof::UY, Dof::UZ};
+
+  // gather the element part of x
+  uint32 eqU[24];
+  Vec<24> xu;
+  for (uint16 i = 0; i < getNNodes(); i++) {
+    for (uint16 d = 0; d < 3; d++) {
+      eqU[i*3 + d] = storage->getNodeDofEqNumber(getNodeNumber(i), dofVec[d]);
+      xu[i*3 + d] = x[eqU[i*3 + d] - 1];
+    }
+  }
+  uint32 elEq = storage->getElementDofEqNumber(getElNum(), Dof::HYDRO_PRESSURE);
+  double xp = x[elEq - 1];
+
+  MatSym<6> matD_d;
+  Vec<6> vecD_p;
+  Vec<9> F;
+  Mat<9,9> H;
+  Vec<24> yu;
+  double yp = 0.0;
+  const double one = 1.0;
+  for (uint16 np = 0; np < nOfIntPoints(); np++) {
+    double dWt = intWeight(np);
+    mat->getDdDp_UP(6, solidmech::defaultTensorComponents, C[np].ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
+
+    // Kuu * xu = N^T * H * (N * xu) with H of buildK()
+    Kernels::deformationGradient(O[np].ptr(), F.ptr());
+    const double coefD = 2.0*dWt;
+    Kernels::tangent(F.ptr(), matD_d.ptr(), S[np].ptr(), &coefD, &dWt, H.ptr());
+    Vec<9> g;
+    Kernels::gradient(NiXj[np].ptr(), xu.ptr(), g.ptr());
+    Vec<9> hg;
+    matBVprod(H, g, 1.0, hg);
+    Kernels::addGradientForce(NiXj[np].ptr(), hg.ptr(), &one, yu.ptr());
+
+    // Kup * xp, Kup^T * xu + Kpp * xp
+    Vec<24> kup;
+    Kernels::addForce(NiXj[np].ptr(), F.ptr(), vecD_p.ptr(), &dWt, kup.ptr());
+    yu += kup * xp;
+    yp += kup * xu - 1.0/k*dWt * xp;
+  }
+
+  for (uint16 i = 0; i < 24; i++) {
+    y[eqU[i] - 1] += yu[i];
+  }
+  y[elEq - 1] += yp;
+}
+
+
 void ElementSOLID81::update()
 {
   // get nodal solutions from storage
@@ -95,7 +318,7 @@ void ElementSOLID81::update()
   Vec<6> vecC;
   double p_e = storage->getElementDofSolution(getElNum(), Dof::HYDRO_PRESSURE);
 
-  Mat_Hyper_Isotrop_General* mat = CHECK_NOTNULL(dynamic_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial()));
+  Mat_Hyper_Isotrop_General* mat = static_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial());
   for (uint16 np = 0; np < nOfIntPoints(); np++) {
     B_NL.zero();
     make_B_NL(np, B_NL);
@@ -344,4 +567,23 @@ bool  ElementSOLID81::getTensor(math::MatSym<3>* tensor, tensorQuery query, uint
   return false;
 }
 
+template <>
+void ElementBatch<ElementSOLID81>::buildK(Element* const* els, uint32 n) {
+  ElementSOLID81* group[ElementSOLID81::numberOfLanes];
+  uint32 i = 0;
+  while (i < n) {
+    // elements of one group should have the same number of integration points
+    uint16 m = 0;
+    group[m++] = static_cast<ElementSOLID81*>(els[i++]);
+    while (i < n && m < ElementSOLID81::numberOfLanes &&
+           static_cast<ElementSOLID81*>(els[i])->nOfIntPoints() == group[0]->nOfIntPoints()) {
+      group[m++] = static_cast<ElementSOLID81*>(els[i++]);
+    }
+    ElementSOLID81::buildKLanes(group, m);
+  }
+}
+
+
+template class ElementBatch<ElementSOLID81>;
+
 } // namespace nla3d
@@ -25,6 +25,15 @@ class ElementSOLID81 : public ElementIsoParamHEXAHEDRON {
     void pre();
     void buildK();
     void update();
+    // buildK() for n <= numberOfLanes elements at once, one element per SIMD lane. Ke and Fe are
+    // the same as of buildK() bit to bit, they are assembled by the same assemble3(..)
+    static void buildKLanes(ElementSOLID81* const* els, uint16 n);
+    static const uint16 numberOfLanes = 4;
+    // buildKLanes(..) uses the AVX2 kernel if the CPU supports it. With false the generic kernel is
+    // used (both give the same results)
+    static bool useAvx2;
+    // K * x from the integration point data (NiXj, S, C, O) without forming Kuu
+    void multiplyK(const double* x, double* y);
 
     void make_B_L (uint16 nPoint, math::Mat<6,24> &B);	//функция создает линейную матрицу [B]
     void make_B_NL (uint16 nPoint,  math::Mat<9,24> &B); //функция создает линейную матрицу [Bomega]
@@ -53,44 +62,34 @@ class ElementSOLID81 : public ElementIsoParamHEXAHEDRON {
 
 template <uint16 dimM>
 void ElementSOLID81::assemble3(math::MatSym<dimM> &Kuu, math::Vec<dimM> &Kup, double Kpp, math::Vec<dimM> &Fu, double Fp) {
-  const uint16 dim = 3;
-	assert (getNNodes() * dim == dimM);
-	double *Kuu_p = Kuu.ptr();
-	double *Kup_p = Kup.ptr();
-	double *Fu_p = Fu.ptr();
-  Dof::dofType dofVec[] = {Dof::UX, Dof::UY, Dof::UZ};
-	for (uint16 i=0; i < getNNodes(); i++)
-		for (uint16 di=0; di < dim; di++)
-		for (uint16 j=i; j < getNNodes(); j++)
-			
-				for (uint16 dj=0; dj < dim; dj++)
-				{
-					if ((i==j) && (dj<di)) continue;
-					else
-					{
-						storage->addValueK(nodes[i],dofVec[di],nodes[j], dofVec[dj], *Kuu_p);
-						Kuu_p++;
-					}
-				}
-	//upper diagonal process for nodes-el dofs
-  uint32 elEq = storage->getElementDofEqNumber(getElNum(), Dof::HYDRO_PRESSURE);
-	for (uint16 i=0; i < getNNodes(); i++) {
-		for(uint16 di=0; di < dim; di++) {
-      uint32 rowEq = storage->getNodeDofEqNumber(nodes[i], dofVec[di]);
-      storage->addValueK(rowEq, elEq, *Kup_p);
-      Kup_p++;
+  // local DoFs: UX, UY, UZ of every node, then HYDRO_PRESSURE of the element. Pack the upper
+  // triangle of | Kuu  Kup | row by row
+  //             |      Kpp |
+  assert(getNNodes() * 3 == dimM);
+  double Ke[(dimM + 1) * (dimM + 2) / 2];
+  double Fe[dimM + 1];
+	const double *Kuu_p = Kuu.ptr();
+  double* Ke_p = Ke;
+	for (uint16 i=0; i < dimM; i++) {
+    for (uint16 j=i; j < dimM; j++) {
+      *Ke_p++ = *Kuu_p++;
     }
+    *Ke_p++ = Kup[i];
+    Fe[i] = Fu[i];
   }
-	//upper diagonal process for el-el dofs
-  storage->addValueK(elEq, elEq,  Kpp);
+  *Ke_p = Kpp;
+  Fe[dimM] = Fp;
 
-	for (uint16 i=0; i < getNNodes(); i++) {
-		for (uint16 di=0; di < dim; di++) {
-			storage->addValueF(nodes[i], dofVec[di], *Fu_p);
-			Fu_p++;
-		}
-  }
-  storage->addValueF(elEq, Fp);
+  storage->addElementK(getElNum(), {Dof::UX, Dof::UY, Dof::UZ}, {Dof::HYDRO_PRESSURE}, Ke);
+  storage->addElementF(getElNum(), {Dof::UX, Dof::UY, Dof::UZ}, {Dof::HYDRO_PRESSURE}, Fe);
 }
 
+#ifndef SWIG
+// stiffness of SOLID81 batches is built by ElementSOLID81::buildKLanes(..)
+template <>
+void ElementBatch<ElementSOLID81>::buildK(Element* const* els, uint32 n);
+// kernels are instantiated in SOLID81.cpp
+extern template class ElementBatch<ElementSOLID81>;
+#endif
+
 } // namespace nla3d
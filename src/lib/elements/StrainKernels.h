@@ -0,0 +1,265 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+
+#if defined(__GNUC__)
+#define NLA3D_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define NLA3D_KERNEL_INLINE inline
+#endif
+
+namespace nla3d {
+
+// StrainKernels - stiffness products of the total Lagrangian solid elements (SOLID81, PLANE41)
+// computed from the shape function derivatives NiXj without forming B matrices.
+//
+// Entries of B = B_L + Omega * B_NL of these elements (up to a constant factor of the element) are
+// F_mq * N_a,p + F_mp * N_a,q for the shear strain (p, q) and F_mp * N_a,p for the normal strain
+// (p, p), where a is the node, m is the displacement and F = I + grad(u). So B_a = W * N_a, where
+// W[V(p,q)][m*dim+p] = F_mq is a small matrix of the integration point with the known nonzero
+// pattern, and
+//   coefD * B^T * D * B + coefS * B_NL^T * S * B_NL = N^T * H * N,
+//   H[m*dim+j][n*dim+k] = coefD * (W^T * D * W)[m*dim+j][n*dim+k] + coefS * delta_mn * S_jk.
+// H is a dim^2 x dim^2 matrix, so Kuu takes about 2000 flops per integration point of SOLID81
+// instead of about 9000 flops of the dense products with B. The product Kuu * u doesn't need Kuu
+// at all: N^T * (H * (N * u)), where N * u is the gradient of u (see gradient(..)).
+//
+// Voigt - the order of symmetric tensor components of the element: Voigt::dim and
+// Voigt::index(i, j) - position of the component (i, j) in the element's vectors (S, C, vecD_p)
+// and in the packed symmetric matrices (matD_d).
+// lanes - number of elements processed at once (see ElementSOLID81::buildKLanes(..)). Every entry
+// of an array keeps the values of all elements in a row: x[i*lanes + l] is the entry i of the
+// element l. lanes = 1 is the usual layout of math::Vec, math::Mat and math::MatSym. Every lane
+// does the same operations in the same order, so the results don't depend on `lanes`.
+template <class Voigt, uint16 nNodes, uint16 lanes>
+class StrainKernels {
+  public:
+    static const uint16 dim = Voigt::dim;
+    static const uint16 nStrains = dim*(dim+1)/2;
+    static const uint16 nDofs = dim*nNodes;
+
+    // F = I + O, O[m*dim+j] = du_m/dx_j
+    static void deformationGradient(const double* O, double* F);
+    // H (dim^2 x dim^2) from F, the packed symmetric D (nStrains x nStrains) and the stress S
+    // (nStrains), see the comment above
+    static void tangent(const double* F, const double* D, const double* S, const double* coefD,
+                        const double* coefS, double* H);
+    // Kuu += N^T * H * N, N[a*dim+j] = N_a,j, Kuu is packed as math::MatSym<nDofs>
+    static void addStiffness(const double* N, const double* H, double* Kuu);
+    // R += coef * B^T * V for the symmetric tensor V (nStrains)
+    static void addForce(const double* N, const double* F, const double* V, const double* coef,
+                         double* R);
+    // G = N * u: G[m*dim+j] = sum_a N_a,j * u[a*dim+m] for the nodal vector u (nDofs)
+    static void gradient(const double* N, const double* u, double* G);
+    // R += coef * N^T * G: R[a*dim+m] += coef * sum_j N_a,j * G[m*dim+j]
+    static void addGradientForce(const double* N, const double* G, const double* coef, double* R);
+
+  private:
+    // position of D[r][s] in the packed symmetric matrix
+    static uint16 packed(uint16 r, uint16 s) {
+      return (r <= s) ? r*nStrains - r*(r-1)/2 + (s-r) : packed(s, r);
+    }
+};
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::deformationGradient(
+    const double* O, double* F) {
+  for (uint16 m = 0; m < dim; m++) {
+    for (uint16 j = 0; j < dim; j++) {
+      const double delta = (m == j) ? 1.0 : 0.0;
+      for (uint16 l = 0; l < lanes; l++) {
+        F[(m*dim+j)*lanes + l] = delta + O[(m*dim+j)*lanes + l];
+      }
+    }
+  }
+}
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::tangent(
+    const double* F, const double* D, const double* S, const double* coefD, const double* coefS,
+    double* H) {
+  const uint16 nGrad = dim*dim;
+  // DW = D * W: the column n*dim+k of W has F_no in the rows V(k,o)
+  double DW[nStrains*nGrad*lanes];
+  for (uint16 r = 0; r < nStrains; r++) {
+    for (uint16 n = 0; n < dim; n++) {
+      for (uint16 k = 0; k < dim; k++) {
+        double* dw = DW + (r*nGrad + n*dim+k)*lanes;
+        for (uint16 l = 0; l < lanes; l++) {
+          dw[l] = 0.0;
+        }
+        for (uint16 o = 0; o < dim; o++) {
+          const double* d = D + packed(r, Voigt::index(k, o))*lanes;
+          const double* f = F + (n*dim+o)*lanes;
+          for (uint16 l = 0; l < lanes; l++) {
+            dw[l] += d[l] * f[l];
+          }
+        }
+      }
+    }
+  }
+
+  // upper triangle of H = coefD * W^T * DW + coefS * (I x S), the lower one is mirrored
+  for (uint16 m = 0; m < dim; m++) {
+    for (uint16 j = 0; j < dim; j++) {
+      const uint16 row = m*dim+j;
+      for (uint16 col = row; col < nGrad; col++) {
+        const uint16 n = col / dim;
+        const uint16 k = col % dim;
+        double acc[lanes];
+        for (uint16 l = 0; l < lanes; l++) {
+          acc[l] = 0.0;
+        }
+        for (uint16 o = 0; o < dim; o++) {
+          const double* f = F + (m*dim+o)*lanes;
+          const double* dw = DW + (Voigt::index(j, o)*nGrad + col)*lanes;
+          for (uint16 l = 0; l < lanes; l++) {
+            acc[l] += f[l] * dw[l];
+          }
+        }
+        double* h = H + (row*nGrad + col)*lanes;
+        double* hT = H + (col*nGrad + row)*lanes;
+        if (m == n) {
+          const double* s = S + Voigt::index(j, k)*lanes;
+          for (uint16 l = 0; l < lanes; l++) {
+            h[l] = coefD[l] * acc[l] + coefS[l] * s[l];
+            hT[l] = h[l];
+          }
+        } else {
+          for (uint16 l = 0; l < lanes; l++) {
+            h[l] = coefD[l] * acc[l];
+            hT[l] = h[l];
+          }
+        }
+      }
+    }
+  }
+}
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::addStiffness(
+    const double* N, const double* H, double* Kuu) {
+  const uint16 nGrad = dim*dim;
+  double* Kp = Kuu;
+  for (uint16 a = 0; a < nNodes; a++) {
+    // T = N_a^T * H: T[m][n*dim+k] = sum_j N_a,j * H[m*dim+j][n*dim+k]
+    double T[dim*nGrad*lanes];
+    for (uint16 m = 0; m < dim; m++) {
+      for (uint16 col = 0; col < nGrad; col++) {
+        double* t = T + (m*nGrad + col)*lanes;
+        for (uint16 l = 0; l < lanes; l++) {
+          t[l] = 0.0;
+        }
+        for (uint16 j = 0; j < dim; j++) {
+          const double* na = N + (a*dim+j)*lanes;
+          const double* h = H + ((m*dim+j)*nGrad + col)*lanes;
+          for (uint16 l = 0; l < lanes; l++) {
+            t[l] += na[l] * h[l];
+          }
+        }
+      }
+    }
+
+    // rows a*dim+m of the upper triangle: Kuu[a*dim+m][b*dim+n] += sum_k T[m][n*dim+k] * N_b,k
+    for (uint16 m = 0; m < dim; m++) {
+      for (uint16 b = a; b < nNodes; b++) {
+        for (uint16 n = (b == a) ? m : 0; n < dim; n++) {
+          double acc[lanes];
+          for (uint16 l = 0; l < lanes; l++) {
+            acc[l] = 0.0;
+          }
+          for (uint16 k = 0; k < dim; k++) {
+            const double* t = T + (m*nGrad + n*dim+k)*lanes;
+            const double* nb = N + (b*dim+k)*lanes;
+            for (uint16 l = 0; l < lanes; l++) {
+              acc[l] += t[l] * nb[l];
+            }
+          }
+          for (uint16 l = 0; l < lanes; l++) {
+            Kp[l] += acc[l];
+          }
+          Kp += lanes;
+        }
+      }
+    }
+  }
+}
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::addForce(
+    const double* N, const double* F, const double* V, const double* coef, double* R) {
+  // G = F * V
+  double G[dim*dim*lanes];
+  for (uint16 m = 0; m < dim; m++) {
+    for (uint16 j = 0; j < dim; j++) {
+      double* g = G + (m*dim+j)*lanes;
+      for (uint16 l = 0; l < lanes; l++) {
+        g[l] = 0.0;
+      }
+      for (uint16 o = 0; o < dim; o++) {
+        const double* f = F + (m*dim+o)*lanes;
+        const double* v = V + Voigt::index(o, j)*lanes;
+        for (uint16 l = 0; l < lanes; l++) {
+          g[l] += f[l] * v[l];
+        }
+      }
+    }
+  }
+
+  addGradientForce(N, G, coef, R);
+}
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::gradient(
+    const double* N, const double* u, double* G) {
+  for (uint16 m = 0; m < dim; m++) {
+    for (uint16 j = 0; j < dim; j++) {
+      double* g = G + (m*dim+j)*lanes;
+      for (uint16 l = 0; l < lanes; l++) {
+        g[l] = 0.0;
+      }
+      for (uint16 a = 0; a < nNodes; a++) {
+        const double* na = N + (a*dim+j)*lanes;
+        const double* ua = u + (a*dim+m)*lanes;
+        for (uint16 l = 0; l < lanes; l++) {
+          g[l] += na[l] * ua[l];
+        }
+      }
+    }
+  }
+}
+
+
+template <class Voigt, uint16 nNodes, uint16 lanes>
+NLA3D_KERNEL_INLINE void StrainKernels<Voigt, nNodes, lanes>::addGradientForce(
+    const double* N, const double* G, const double* coef, double* R) {
+  for (uint16 a = 0; a < nNodes; a++) {
+    for (uint16 m = 0; m < dim; m++) {
+      double acc[lanes];
+      for (uint16 l = 0; l < lanes; l++) {
+        acc[l] = 0.0;
+      }
+      for (uint16 j = 0; j < dim; j++) {
+        const double* na = N + (a*dim+j)*lanes;
+        const double* g = G + (m*dim+j)*lanes;
+        for (uint16 l = 0; l < lanes; l++) {
+          acc[l] += na[l] * g[l];
+        }
+      }
+      double* r = R + (a*dim+m)*lanes;
+      for (uint16 l = 0; l < lanes; l++) {
+        r[l] += coef[l] * acc[l];
+      }
+    }
+  }
+}
+
+} // namespace nla3d
@@ -237,4 +237,7 @@ bool  ElementTETRA0::getTensor(math::MatSym<3>* tensor, tensorQuery query, uint1
   
   return false;
 }
+
+template class ElementBatch<ElementTETRA0>;
+
 } //namespace nla3d
@@ -62,4 +62,9 @@ public:
   bool getTensor(math::MatSym<3>* tensor, tensorQuery code, uint16 gp, const double scale);
 };
 
+#ifndef SWIG
+// kernels are instantiated in TETRA0.cpp
+extern template class ElementBatch<ElementTETRA0>;
+#endif
+
 } //namespace nla3d
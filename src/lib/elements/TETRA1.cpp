@@ -156,4 +156,6 @@ bool  ElementTETRA1::getVector(math::Vec<3>* vector, vectorQuery query, uint16 g
   return false;
 }
 
+template class ElementBatch<ElementTETRA1>;
+
 } //namespace nla3d
@@ -35,4 +35,9 @@ public:
   bool getVector(math::Vec<3>* vector, vectorQuery code, uint16 gp, const double scale);
 };
 
+#ifndef SWIG
+// kernels are instantiated in TETRA1.cpp
+extern template class ElementBatch<ElementTETRA1>;
+#endif
+
 } //namespace nla3d
@@ -119,4 +119,6 @@ void ElementTRIANGLE4::makeC (math::MatSym<3> &C) {
     }
 }
 
+template class ElementBatch<ElementTRIANGLE4>;
+
 } //namespace nla3d
@@ -61,4 +61,9 @@ private:
   double area;
 };
 
+#ifndef SWIG
+// kernels are instantiated in TRIANGLE4.cpp
+extern template class ElementBatch<ElementTRIANGLE4>;
+#endif
+
 } //namespace nla3d
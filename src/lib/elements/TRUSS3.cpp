@@ -96,4 +96,6 @@ void ElementTRUSS3::update() {
   S = E * (B * T * U)(0,0);
 }
 
+template class ElementBatch<ElementTRUSS3>;
+
 } //namespace nla3d
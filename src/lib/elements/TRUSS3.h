@@ -60,4 +60,9 @@ public:
   double S;
 };
 
+#ifndef SWIG
+// kernels are instantiated in TRUSS3.cpp
+extern template class ElementBatch<ElementTRUSS3>;
+#endif
+
 } //namespace nla3d
@@ -7,15 +7,30 @@
 namespace nla3d {
 
 
+thread_local uint32* Element::arenaNodes = nullptr;
+
+
 Element::Element () {
 
 }
 
 
 Element::~Element() {
-  if (nodes) {
+  if (nodes && ownNodes) {
     delete[] nodes;
-    nodes = nullptr;
+  }
+  nodes = nullptr;
+}
+
+
+void Element::allocateNodes() {
+  if (arenaNodes) {
+    nodes = arenaNodes;
+    arenaNodes += getNNodes();
+    ownNodes = false;
+  } else {
+    nodes = new uint32[getNNodes()];
+    ownNodes = true;
   }
 }
 
@@ -39,24 +54,20 @@ void Element::assembleK(Eigen::Ref<Eigen::MatrixXd> Ke,
                        std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
   assert (Ke.rows() == Ke.cols());
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == Ke.rows());
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], 
-                Ke.selfadjointView<Eigen::Upper>()(i*dim+di, j*dim +dj));
-          }
-        }
-      }
+  assert (getNNodes() * _nodeDofs.size() == Ke.rows());
+
+  // pack the upper triangle row by row. The buffer is kept by the thread, so the assembly doesn't
+  // allocate memory for every element
+  static thread_local std::vector<double> packed;
+  const uint32 n = static_cast<uint32>(Ke.rows());
+  packed.resize(n * (n + 1) / 2);
+  double* p = packed.data();
+  for (uint32 i = 0; i < n; i++) {
+    for (uint32 j = i; j < n; j++) {
+      *p++ = Ke(i, j);
     }
   }
+  storage->addElementK(getElNum(), _nodeDofs, {}, packed.data());
 }
 
 
@@ -69,6 +80,12 @@ void Element::buildM() {
   LOG(FATAL) << "buildM is not implemented";
 }
 
+
+void Element::multiplyK(const double* /*x*/, double* /*y*/) {
+  // FEStorage redirects assembleK(..) to the product with its productX/productY
+  buildK();
+}
+
 bool Element::getScalar(double* scalar, scalarQuery code, uint16 gp, const double scale) {
   // TODO: check that LOG_N_TIMES macro work correctly inside of virtual functions
   LOG_N_TIMES(10, WARNING) << "getScalar function is not implemented";
@@ -85,4 +102,44 @@ bool  Element::getTensor(math::MatSym<3>* tensor, tensorQuery code, uint16 gp, c
   return false;
 }
 
+template <>
+void ElementBatch<Element>::buildK(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    els[i]->buildK();
+  }
+}
+
+
+template <>
+void ElementBatch<Element>::buildC(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    els[i]->buildC();
+  }
+}
+
+
+template <>
+void ElementBatch<Element>::buildM(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    els[i]->buildM();
+  }
+}
+
+
+template <>
+void ElementBatch<Element>::update(Element* const* els, uint32 n) {
+  for (uint32 i = 0; i < n; i++) {
+    els[i]->update();
+  }
+}
+
+
+template <>
+void ElementBatch<Element>::multiplyK(Element* const* els, uint32 n,
+                                      const double* x, double* y) {
+  for (uint32 i = 0; i < n; i++) {
+    els[i]->multiplyK(x, y);
+  }
+}
+
 } // namespace nla3d
@@ -10,6 +10,7 @@
 #include <Eigen/Dense>
 
 #include "query.h"
+#include "elements/ElementBatch.h"
 #include "Node.h"
 #include "math/Vec.h"
 #include "math/Mat.h"
@@ -109,11 +110,20 @@ class Element {
 
     // heart of the element class
     // TODO: comment massively here
+    // NOTE: buildK(), buildC(), buildM(), multiplyK(..) and update() of different elements are
+    // called concurrently (see FEStorage::setNumberOfThreads(..)). They should change only the
+    // element's own data and contribute to the global system through FEStorage::addElement*(..).
     virtual void pre()=0;
     virtual void buildK()=0;
     virtual void buildC();
     virtual void buildM();
     virtual void update()=0;
+    // y += Ke * x for matrix-free solution (see FEStorage::multiplyK(..)). x and y are indexed by
+    // equation numbers of the model (eq - 1). By default the element stiffness matrix is rebuilt
+    // by buildK() and FEStorage adds its entries directly to the product (assembleK(..) is
+    // redirected to productX/productY), so every product costs a full buildK() of the element.
+    // Elements could override it with a cheaper product which doesn't form Ke.
+    virtual void multiplyK(const double* x, double* y);
 
     // The methods below are getters to receive solution information related to elements (like
     // stresses, strains, volume and so on). The first argument is a pointer on return value. Please
@@ -136,7 +146,8 @@ class Element {
     void print (std::ostream& out);
 
     // some general purpose assemble procedures. Particular element realization could have it own
-    // assembly procedure.
+    // assembly procedure. Local DoFs are _nodeDofs of every element node, the entries are added by
+    // FEStorage element scatter maps (see FEStorage::addElementK(..)).
     template <uint16 dimM>
     void assembleK(math::MatSym<dimM> &Ke, std::initializer_list<Dof::dofType> _nodeDofs);
     template <uint16 dimM>
@@ -151,14 +162,25 @@ class Element {
     void assembleK(Eigen::Ref<Eigen::MatrixXd> Ke, std::initializer_list<Dof::dofType> _nodeDofs);
 
     friend class FEStorage;
+    friend class ElementArena;
   protected:
+    // allocate `nodes` array for getNNodes() node numbers (called by the shape constructors). The
+    // array is taken from ElementArena connectivity if the element is created in the arena.
+    void allocateNodes();
 
     ElementType type = ElementType::UNDEFINED;
     ElementShape shape = ElementShape::UNDEFINED;
     uint16 intOrder = 0; // number of int points overall
     uint32 elNum = 0;
     uint32 *nodes = nullptr;
+    // `nodes` is allocated by the element (not by ElementArena)
+    bool ownNodes = false;
     FEStorage* storage = nullptr;
+
+#ifndef SWIG
+    // next free node numbers in ElementArena being filled (see ElementArena::create(..))
+    static thread_local uint32* arenaNodes;
+#endif
 };
 
 
@@ -167,7 +189,7 @@ class ElementVERTEX : public Element {
   public:
     ElementVERTEX() {
       shape = ElementShape::VERTEX;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementVERTEX& operator= (const ElementVERTEX& from) {
@@ -180,7 +202,7 @@ class ElementTWIN_VERTEX : public Element {
   public:
     ElementTWIN_VERTEX() {
       shape = ElementShape::TWIN_VERTEX;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementTWIN_VERTEX& operator= (const ElementTWIN_VERTEX& from) {
@@ -193,7 +215,7 @@ class ElementLINE : public Element {
   public:
     ElementLINE() {
       shape = ElementShape::LINE;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementLINE& operator= (const ElementLINE& from) {
@@ -206,7 +228,7 @@ class ElementTRIANGLE : public Element {
   public:
     ElementTRIANGLE() {
       shape = ElementShape::TRIANGLE;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementTRIANGLE& operator= (const ElementTRIANGLE& from) {
@@ -220,7 +242,7 @@ class ElementQUAD : public Element {
   public:
     ElementQUAD () {
       shape = ElementShape::QUAD;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementQUAD& operator= (const ElementQUAD& from) {
@@ -234,7 +256,7 @@ class ElementTETRA : public Element {
   public:
     ElementTETRA() {
       shape = ElementShape::TETRA;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementTETRA& operator= (const ElementTETRA& from) {
@@ -248,7 +270,7 @@ class ElementHEXAHEDRON : public Element {
   public:
     ElementHEXAHEDRON() {
       shape = ElementShape::HEXAHEDRON;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementHEXAHEDRON& operator= (const ElementHEXAHEDRON& from) {
@@ -262,7 +284,7 @@ class ElementWEDGE : public Element {
   public:
     ElementWEDGE() {
       shape = ElementShape::WEDGE;
-      nodes = new uint32[getNNodes()];
+      allocateNodes();
     }
 
     ElementWEDGE& operator= (const ElementWEDGE& from) {
@@ -281,108 +303,34 @@ namespace nla3d {
 template <uint16 dimM>
 void Element::assembleK(math::MatSym<dimM> &Ke, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ke_p = Ke.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ke_p);
-            Ke_p++;
-          }
-        }
-      }
-    }
-  }
+  assert (getNNodes() * _nodeDofs.size() == dimM);
+  // Ke is stored as upper triangle row by row, the same as FEStorage expects
+  storage->addElementK(getElNum(), _nodeDofs, {}, Ke.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleC(math::MatSym<dimM> &Ce, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ce_p = Ce.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueC(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ce_p);
-            Ce_p++;
-          }
-        }
-      }
-    }
-  }
+  assert (getNNodes() * _nodeDofs.size() == dimM);
+  storage->addElementC(getElNum(), _nodeDofs, {}, Ce.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleM(math::MatSym<dimM> &Me, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Me_p = Me.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueC(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Me_p);
-            Me_p++;
-          }
-        }
-      }
-    }
-  }
+  assert (getNNodes() * _nodeDofs.size() == dimM);
+  storage->addElementM(getElNum(), _nodeDofs, {}, Me.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleK(math::MatSym<dimM> &Ke, math::Vec<dimM> &Fe, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ke_p = Ke.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ke_p);
-            Ke_p++;
-          }
-        }
-      }
-    }
-  }
-
-  double* Fe_p = Fe.ptr();
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-            storage->addValueF(nodes[i], nodeDof[di], *Fe_p);
-            Fe_p++;
-    }
-  }
+  assert (getNNodes() * _nodeDofs.size() == dimM);
+  storage->addElementK(getElNum(), _nodeDofs, {}, Ke.ptr());
+  storage->addElementF(getElNum(), _nodeDofs, {}, Fe.ptr());
 }
 
 
@@ -0,0 +1,823 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/AMGPreconditioner.h"
+#include "math/ThreadPool.h"
+#include <numeric>
+#include <algorithm>
+#include <map>
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+// loops with less iterations are performed by one thread
+const uint32 minParallelSize = 10000;
+// number of power iterations to estimate the largest eigenvalue of D^-1 * A
+const uint16 nPowerIterations = 20;
+// the coarsening is stopped if the next level isn't smaller than this ratio of the current one
+const double minCoarseningRatio = 0.9;
+// Chebyshev smoother reduces the error in the spectrum interval
+// [lambdaMax / chebyshevRatio, chebyshevUpper * lambdaMax]
+const double chebyshevRatio = 30.0;
+const double chebyshevUpper = 1.1;
+
+
+// call func(begin, end) for [0, n) split into ranges by the ThreadPool. Loops with less than
+// minParallelSize iterations are performed by the calling thread.
+template <typename F>
+void parallelRange(uint32 n, uint16 threads, F func) {
+  parallelFor(n, threads, func, minParallelSize);
+}
+
+
+// y = A * x
+void spmv(const CsrMatrix& A, const double* x, double* y, uint16 threads) {
+  parallelRange(A.nRows, threads, [&](uint32 begin, uint32 end) {
+    for (uint32 i = begin; i < end; i++) {
+      double s = 0.0;
+      for (uindex k = A.ptr[i]; k < A.ptr[i + 1]; k++) {
+        s += A.val[k] * x[A.col[k]];
+      }
+      y[i] = s;
+    }
+  });
+}
+
+
+// r = b - A * x
+void residual(const CsrMatrix& A, const double* b, const double* x, double* r, uint16 threads) {
+  parallelRange(A.nRows, threads, [&](uint32 begin, uint32 end) {
+    for (uint32 i = begin; i < end; i++) {
+      double s = b[i];
+      for (uindex k = A.ptr[i]; k < A.ptr[i + 1]; k++) {
+        s -= A.val[k] * x[A.col[k]];
+      }
+      r[i] = s;
+    }
+  });
+}
+
+
+// C = A * B (Gustavson's row-by-row algorithm)
+void multiply(const CsrMatrix& A, const CsrMatrix& B, CsrMatrix& C, uint16 threads) {
+  CHECK(A.nCols == B.nRows);
+  C.nRows = A.nRows;
+  C.nCols = B.nCols;
+  C.ptr.assign(A.nRows + 1, 0);
+
+  // symbolic phase: number of entries in every row of C
+  parallelRange(A.nRows, threads, [&](uint32 begin, uint32 end) {
+    std::vector<uint32> marker(B.nCols, UINT32_MAX);
+    for (uint32 i = begin; i < end; i++) {
+      uint32 count = 0;
+      for (uindex ka = A.ptr[i]; ka < A.ptr[i + 1]; ka++) {
+        uint32 j = A.col[ka];
+        for (uindex kb = B.ptr[j]; kb < B.ptr[j + 1]; kb++) {
+          if (marker[B.col[kb]] != i) {
+            marker[B.col[kb]] = i;
+            count++;
+          }
+        }
+      }
+      C.ptr[i + 1] = count;
+    }
+  });
+  for (uint32 i = 0; i < A.nRows; i++) {
+    C.ptr[i + 1] += C.ptr[i];
+  }
+  C.col.resize(C.ptr.back());
+  C.val.resize(C.ptr.back());
+
+  // numeric phase
+  parallelRange(A.nRows, threads, [&](uint32 begin, uint32 end) {
+    std::vector<uindex> position(B.nCols, SparsityInfo::invalid);
+    for (uint32 i = begin; i < end; i++) {
+      uindex start = C.ptr[i];
+      uindex next = start;
+      for (uindex ka = A.ptr[i]; ka < A.ptr[i + 1]; ka++) {
+        uint32 j = A.col[ka];
+        double aij = A.val[ka];
+        for (uindex kb = B.ptr[j]; kb < B.ptr[j + 1]; kb++) {
+          uint32 c = B.col[kb];
+          if (position[c] == SparsityInfo::invalid || position[c] < start) {
+            position[c] = next;
+            C.col[next] = c;
+            C.val[next] = aij * B.val[kb];
+            next++;
+          } else {
+            C.val[position[c]] += aij * B.val[kb];
+          }
+        }
+      }
+      // sort the row by column indexes
+      std::vector<std::pair<uint32, double> > row(next - start);
+      for (uindex k = start; k < next; k++) {
+        row[k - start] = std::make_pair(C.col[k], C.val[k]);
+      }
+      std::sort(row.begin(), row.end());
+      for (uindex k = start; k < next; k++) {
+        C.col[k] = row[k - start].first;
+        C.val[k] = row[k - start].second;
+      }
+    }
+  });
+}
+
+
+// T = A^T
+void transpose(const CsrMatrix& A, CsrMatrix& T) {
+  T.nRows = A.nCols;
+  T.nCols = A.nRows;
+  T.ptr.assign(A.nCols + 1, 0);
+  for (uindex k = 0; k < A.nValues(); k++) {
+    T.ptr[A.col[k] + 1]++;
+  }
+  for (uint32 i = 0; i < A.nCols; i++) {
+    T.ptr[i + 1] += T.ptr[i];
+  }
+  T.col.resize(A.nValues());
+  T.val.resize(A.nValues());
+  std::vector<uindex> next(T.ptr.begin(), T.ptr.end() - 1);
+  for (uint32 i = 0; i < A.nRows; i++) {
+    for (uindex k = A.ptr[i]; k < A.ptr[i + 1]; k++) {
+      uindex p = next[A.col[k]]++;
+      T.col[p] = i;
+      T.val[p] = A.val[k];
+    }
+  }
+}
+
+
+// full 0-based CSR of the symmetric matrix stored by upper triangle
+void symmetricToCsr(SparseSymMatrix* matrix, CsrMatrix& A) {
+  uint32 n = matrix->nRows();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32* columns = matrix->getColumnsArray();
+  const double* values = matrix->getValuesArray();
+  A.nRows = A.nCols = n;
+  A.ptr.assign(n + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      A.ptr[i + 1]++;
+      if (j != i) A.ptr[j + 1]++;
+    }
+  }
+  for (uint32 i = 0; i < n; i++) {
+    A.ptr[i + 1] += A.ptr[i];
+  }
+  A.col.resize(A.ptr.back());
+  A.val.resize(A.ptr.back());
+  // rows are filled in increasing order of columns: first lower part (from upper triangle of
+  // previous rows), then the row itself
+  std::vector<uindex> next(A.ptr.begin(), A.ptr.end() - 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      A.col[next[i]] = j;
+      A.val[next[i]++] = values[k];
+      if (j != i) {
+        A.col[next[j]] = i;
+        A.val[next[j]++] = values[k];
+      }
+    }
+  }
+}
+
+
+// full 0-based CSR of the symmetric BSR matrix: all entries of the stored blocks (in diagonal
+// blocks - of their upper triangles) and their mirrors
+void symmetricToCsr(BsrSymMatrix* matrix, CsrMatrix& A) {
+  const uint16 bs = BsrSymMatrix::blockSize;
+  uint32 n = matrix->nRows();
+  uint32 nb = matrix->nBlocks();
+  const uindex* iofeir = matrix->getBlockIofeirArray();
+  const uint32* columns = matrix->getBlockColumnsArray();
+  const double* values = matrix->getValuesArray();
+  A.nRows = A.nCols = n;
+  A.ptr.assign(n + 1, 0);
+  for (uint32 bi = 0; bi < nb; bi++) {
+    uint32 mi = matrix->getBlockFirst(bi + 1) - matrix->getBlockFirst(bi);
+    for (uindex k = iofeir[bi] - 1; k < iofeir[bi + 1] - 1; k++) {
+      uint32 bj = columns[k] - 1;
+      uint32 mj = matrix->getBlockFirst(bj + 1) - matrix->getBlockFirst(bj);
+      for (uint32 li = 0; li < mi; li++) {
+        A.ptr[matrix->getBlockFirst(bi) + li + 1] += mj;
+      }
+      if (bj != bi) {
+        for (uint32 lj = 0; lj < mj; lj++) {
+          A.ptr[matrix->getBlockFirst(bj) + lj + 1] += mi;
+        }
+      }
+    }
+  }
+  for (uint32 i = 0; i < n; i++) {
+    A.ptr[i + 1] += A.ptr[i];
+  }
+  A.col.resize(A.ptr.back());
+  A.val.resize(A.ptr.back());
+  // as for CSR: block rows are processed in increasing order, so the mirrored blocks come first
+  // and the columns of every row are sorted
+  std::vector<uindex> next(A.ptr.begin(), A.ptr.end() - 1);
+  for (uint32 bi = 0; bi < nb; bi++) {
+    uint32 fi = matrix->getBlockFirst(bi);
+    uint32 mi = matrix->getBlockFirst(bi + 1) - fi;
+    for (uindex k = iofeir[bi] - 1; k < iofeir[bi + 1] - 1; k++) {
+      uint32 bj = columns[k] - 1;
+      uint32 fj = matrix->getBlockFirst(bj);
+      uint32 mj = matrix->getBlockFirst(bj + 1) - fj;
+      const double* B = values + k * bs * bs;
+      for (uint32 li = 0; li < mi; li++) {
+        for (uint32 lj = 0; lj < mj; lj++) {
+          double v = (bj != bi || li <= lj) ? B[li * bs + lj] : B[lj * bs + li];
+          A.col[next[fi + li]] = fj + lj;
+          A.val[next[fi + li]++] = v;
+        }
+      }
+      if (bj != bi) {
+        for (uint32 lj = 0; lj < mj; lj++) {
+          for (uint32 li = 0; li < mi; li++) {
+            A.col[next[fj + lj]] = fi + li;
+            A.val[next[fj + lj]++] = B[li * bs + lj];
+          }
+        }
+      }
+    }
+  }
+}
+
+
+// estimation of the largest eigenvalue of D^-1 * A by power iterations
+double largestEigenvalue(const CsrMatrix& A, const std::vector<double>& invDiag, uint16 threads) {
+  uint32 n = A.nRows;
+  std::vector<double> x(n), y(n);
+  // deterministic pseudo-random start vector: it should be rich in oscillatory components,
+  // otherwise the power iteration underestimates lambda and the smoother diverges
+  uint32 seed = 12345;
+  for (uint32 i = 0; i < n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    x[i] = (double) seed / 4294967296.0 - 0.5;
+  }
+  double lambda = 0.0;
+  for (uint16 it = 0; it < nPowerIterations; it++) {
+    double norm = sqrt(std::inner_product(x.begin(), x.end(), x.begin(), 0.0));
+    if (norm == 0.0) break;
+    for (uint32 i = 0; i < n; i++) {
+      x[i] /= norm;
+    }
+    spmv(A, x.data(), y.data(), threads);
+    for (uint32 i = 0; i < n; i++) {
+      y[i] *= invDiag[i];
+    }
+    lambda = sqrt(std::inner_product(y.begin(), y.end(), y.begin(), 0.0));
+    x.swap(y);
+  }
+  // Gershgorin circles give the strict upper bound
+  double gershgorin = 0.0;
+  for (uint32 i = 0; i < n; i++) {
+    double sum = 0.0;
+    for (uindex k = A.ptr[i]; k < A.ptr[i + 1]; k++) {
+      sum += fabs(A.val[k]);
+    }
+    gershgorin = std::max(gershgorin, sum * invDiag[i]);
+  }
+  return std::min(lambda, gershgorin / chebyshevUpper);
+}
+
+} // namespace
+
+
+uindex CsrMatrix::nValues() const {
+  return ptr.empty() ? 0 : ptr.back();
+}
+
+
+AMGPreconditioner::AMGPreconditioner() {
+}
+
+
+void AMGPreconditioner::setNearNullspace(uint16 _nModes, const std::vector<double>& modes,
+    const std::vector<uint32>& eqNode) {
+  nModes = _nModes;
+  nullspace = modes;
+  nodes = eqNode;
+}
+
+
+void AMGPreconditioner::setup(SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "AMGPreconditioner::setup");
+  levels.clear();
+  levels.push_back(Level());
+  symmetricToCsr(matrix, levels[0].A);
+  std::vector<uint32> node(matrix->nRows());
+  std::iota(node.begin(), node.end(), 0);
+  buildHierarchy(node);
+}
+
+
+void AMGPreconditioner::setup(BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "AMGPreconditioner::setup");
+  levels.clear();
+  levels.push_back(Level());
+  symmetricToCsr(matrix, levels[0].A);
+  // groups of rows of the BSR matrix are nodes (if they aren't given by setNearNullspace(..))
+  std::vector<uint32> node(matrix->nRows());
+  for (uint32 i = 0; i < matrix->nRows(); i++) {
+    node[i] = matrix->getRowBlock(i);
+  }
+  buildHierarchy(node);
+}
+
+
+void AMGPreconditioner::buildHierarchy(const std::vector<uint32>& defaultNodes) {
+  uint32 n = levels[0].A.nRows;
+  uint16 threads = getNumberOfThreads();
+
+  // near-nullspace of the finest level: vectors which are zero for all equations are dropped
+  std::vector<double> B;
+  uint16 m = 0;
+  if (nModes > 0) {
+    CHECK(nullspace.size() == static_cast<uint64>(nModes) * n)
+      << "Near-nullspace doesn't correspond to the matrix";
+    for (uint16 k = 0; k < nModes; k++) {
+      auto first = nullspace.begin() + static_cast<uint64>(k) * n;
+      if (std::any_of(first, first + n, [](double v) { return v != 0.0; })) {
+        B.insert(B.end(), first, first + n);
+        m++;
+      }
+    }
+  }
+  if (m == 0) {
+    B.assign(n, 1.0);
+  }
+
+  // the nodes of the finest level are renumbered consecutively
+  const std::vector<uint32>& eqNode = (nodes.size() > 0) ? nodes : defaultNodes;
+  CHECK(eqNode.size() == n) << "Nodes of equations don't correspond to the matrix";
+  std::vector<uint32> node(n);
+  uint32 nNodes = 0;
+  std::map<uint32, uint32> ids;
+  for (uint32 i = 0; i < n; i++) {
+    auto res = ids.insert(std::make_pair(eqNode[i], nNodes));
+    if (res.second) nNodes++;
+    node[i] = res.first->second;
+  }
+
+  while (true) {
+    Level& level = levels.back();
+    uint32 nl = level.A.nRows;
+    level.invDiag.resize(nl);
+    for (uint32 i = 0; i < nl; i++) {
+      double d = 0.0;
+      for (uindex k = level.A.ptr[i]; k < level.A.ptr[i + 1]; k++) {
+        if (level.A.col[k] == i) d = fabs(level.A.val[k]);
+      }
+      level.invDiag[i] = (d > 0.0) ? 1.0 / d : 1.0;
+    }
+    level.lambdaMax = largestEigenvalue(level.A, level.invDiag, threads);
+    level.x.resize(nl);
+    level.b.resize(nl);
+    level.r.resize(nl);
+    level.d.resize(nl);
+    LOG(INFO) << "AMG level " << levels.size() - 1 << ": number of equations = " << nl
+      << ", nonzeros = " << level.A.nValues();
+
+    if (nl <= coarsestSize || levels.size() >= maxLevels || !coarsen(B, node, nNodes)) {
+      break;
+    }
+  }
+
+  // direct solver for the coarsest level
+  CsrMatrix& Ac = levels.back().A;
+  uint32 maxInRow = 1;
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    maxInRow = std::max(maxInRow, static_cast<uint32>(Ac.ptr[i + 1] - Ac.ptr[i]));
+  }
+  coarseMatrix.reinit(Ac.nRows, maxInRow);
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    for (uindex k = Ac.ptr[i]; k < Ac.ptr[i + 1]; k++) {
+      if (Ac.col[k] >= i) coarseMatrix.addEntry(i + 1, Ac.col[k] + 1);
+    }
+  }
+  coarseMatrix.compress();
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    for (uindex k = Ac.ptr[i]; k < Ac.ptr[i + 1]; k++) {
+      if (Ac.col[k] >= i) coarseMatrix.addValue(i + 1, Ac.col[k] + 1, Ac.val[k]);
+    }
+  }
+  coarseSolver.clear();
+  coarseSolver.setNumberOfThreads(threads);
+  coarseSolver.analyse(&coarseMatrix);
+  coarseSolver.factorize(&coarseMatrix);
+
+  LOG(INFO) << getName() << ": " << nLevels() << " levels, operator complexity = "
+    << operatorComplexity();
+}
+
+
+bool AMGPreconditioner::coarsen(std::vector<double>& B, std::vector<uint32>& node, uint32& nNodes) {
+  uint16 threads = getNumberOfThreads();
+  Level& level = levels.back();
+  const CsrMatrix& A = level.A;
+  uint32 n = A.nRows;
+  uint16 m = static_cast<uint16>(B.size() / n);
+
+  // equations of every node: nodeEqs[nodePtr[I]] .. nodeEqs[nodePtr[I+1]-1]
+  std::vector<uint32> nodePtr(nNodes + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    nodePtr[node[i] + 1]++;
+  }
+  for (uint32 I = 0; I < nNodes; I++) {
+    nodePtr[I + 1] += nodePtr[I];
+  }
+  std::vector<uint32> nodeEqs(n);
+  {
+    std::vector<uint32> next(nodePtr.begin(), nodePtr.end() - 1);
+    for (uint32 i = 0; i < n; i++) {
+      nodeEqs[next[node[i]]++] = i;
+    }
+  }
+
+  // strength of connection between nodes by Frobenius norms of the blocks A_IJ
+  std::vector<std::vector<std::pair<uint32, double> > > connections(nNodes);
+  std::vector<double> diagNorm(nNodes, 0.0);
+  parallelRange(nNodes, threads, [&](uint32 begin, uint32 end) {
+    std::vector<uint32> position(nNodes, UINT32_MAX);
+    for (uint32 I = begin; I < end; I++) {
+      auto& conn = connections[I];
+      for (uint32 p = nodePtr[I]; p < nodePtr[I + 1]; p++) {
+        uint32 i = nodeEqs[p];
+        for (uindex k = A.ptr[i]; k < A.ptr[i + 1]; k++) {
+          uint32 J = node[A.col[k]];
+          double a2 = A.val[k] * A.val[k];
+          if (position[J] == UINT32_MAX) {
+            position[J] = static_cast<uint32>(conn.size());
+            conn.push_back(std::make_pair(J, a2));
+          } else {
+            conn[position[J]].second += a2;
+          }
+        }
+      }
+      for (auto& c : conn) {
+        position[c.first] = UINT32_MAX;
+        if (c.first == I) diagNorm[I] = sqrt(c.second);
+      }
+    }
+  });
+  // coarse operators have wider stencils with smaller entries, so the threshold is halved on
+  // every next level
+  double theta = strengthThreshold * pow(0.5, levels.size() - 1);
+  double theta2 = theta * theta;
+  parallelRange(nNodes, threads, [&](uint32 begin, uint32 end) {
+    for (uint32 I = begin; I < end; I++) {
+      auto& conn = connections[I];
+      size_t k = 0;
+      for (auto& c : conn) {
+        if (c.first != I && c.second >= theta2 * diagNorm[I] * diagNorm[c.first]) {
+          conn[k++] = c;
+        }
+      }
+      conn.resize(k);
+    }
+  });
+
+  // aggregation of nodes
+  const uint32 none = UINT32_MAX;
+  std::vector<uint32> agg(nNodes, none);
+  uint32 nAgg = 0;
+  // 1. aggregates from nodes which neighbourhood is free
+  for (uint32 I = 0; I < nNodes; I++) {
+    if (agg[I] != none) continue;
+    bool free = true;
+    for (auto& c : connections[I]) {
+      if (agg[c.first] != none) {
+        free = false;
+        break;
+      }
+    }
+    if (!free) continue;
+    agg[I] = nAgg;
+    for (auto& c : connections[I]) {
+      agg[c.first] = nAgg;
+    }
+    nAgg++;
+  }
+  // 2. the rest nodes join the strongest connected aggregate of the first pass
+  std::vector<uint32> firstPass(agg);
+  for (uint32 I = 0; I < nNodes; I++) {
+    if (agg[I] != none) continue;
+    double strongest = 0.0;
+    for (auto& c : connections[I]) {
+      if (firstPass[c.first] != none && c.second > strongest) {
+        strongest = c.second;
+        agg[I] = firstPass[c.first];
+      }
+    }
+  }
+  // 3. the nodes left form new aggregates with their free neighbours
+  for (uint32 I = 0; I < nNodes; I++) {
+    if (agg[I] != none) continue;
+    agg[I] = nAgg;
+    for (auto& c : connections[I]) {
+      if (agg[c.first] == none) agg[c.first] = nAgg;
+    }
+    nAgg++;
+  }
+  std::vector<std::vector<std::pair<uint32, double> > >().swap(connections);
+
+  // equations of every aggregate
+  std::vector<uint32> aggPtr(nAgg + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    aggPtr[agg[node[i]] + 1]++;
+  }
+  for (uint32 a = 0; a < nAgg; a++) {
+    aggPtr[a + 1] += aggPtr[a];
+  }
+  std::vector<uint32> aggEqs(n);
+  {
+    std::vector<uint32> next(aggPtr.begin(), aggPtr.end() - 1);
+    for (uint32 i = 0; i < n; i++) {
+      aggEqs[next[agg[node[i]]]++] = i;
+    }
+  }
+
+  // QR of near-nullspace restricted to every aggregate by modified Gram-Schmidt. Linearly
+  // dependent vectors (like rotations of an aggregate of one node) are dropped.
+  // Q[aggPtr[a] * m ..] - (aggregate size) x (number of kept vectors) column-major,
+  // R[a * m * m ..] - (number of kept vectors) x m row-major
+  std::vector<double> Q(static_cast<uint64>(n) * m);
+  std::vector<double> R(static_cast<uint64>(nAgg) * m * m, 0.0);
+  std::vector<uint32> kept(nAgg, 0);
+  parallelRange(nAgg, threads, [&](uint32 begin, uint32 end) {
+    std::vector<double> v;
+    for (uint32 a = begin; a < end; a++) {
+      uint32 na = aggPtr[a + 1] - aggPtr[a];
+      const uint32* eqs = &aggEqs[aggPtr[a]];
+      double* Qa = &Q[static_cast<uint64>(aggPtr[a]) * m];
+      double* Ra = &R[static_cast<uint64>(a) * m * m];
+      v.resize(na);
+      uint32 nk = 0;
+      for (uint16 k = 0; k < m; k++) {
+        double norm0 = 0.0;
+        for (uint32 i = 0; i < na; i++) {
+          v[i] = B[static_cast<uint64>(k) * n + eqs[i]];
+          norm0 += v[i] * v[i];
+        }
+        norm0 = sqrt(norm0);
+        if (norm0 == 0.0) continue;
+        // two passes of orthogonalization for stability
+        for (uint16 pass = 0; pass < 2; pass++) {
+          for (uint32 j = 0; j < nk; j++) {
+            const double* qj = Qa + static_cast<uint64>(na) * j;
+            double dot = 0.0;
+            for (uint32 i = 0; i < na; i++) {
+              dot += qj[i] * v[i];
+            }
+            for (uint32 i = 0; i < na; i++) {
+              v[i] -= dot * qj[i];
+            }
+          }
+        }
+        double norm = sqrt(std::inner_product(v.begin(), v.end(), v.begin(), 0.0));
+        if (norm <= 1.0e-10 * norm0) continue;
+        double* q = Qa + static_cast<uint64>(na) * nk;
+        for (uint32 i = 0; i < na; i++) {
+          q[i] = v[i] / norm;
+        }
+        nk++;
+      }
+      kept[a] = nk;
+      // R = Q^T * B restricted to the aggregate
+      for (uint32 j = 0; j < nk; j++) {
+        const double* qj = Qa + static_cast<uint64>(na) * j;
+        for (uint16 k = 0; k < m; k++) {
+          double dot = 0.0;
+          for (uint32 i = 0; i < na; i++) {
+            dot += qj[i] * B[static_cast<uint64>(k) * n + eqs[i]];
+          }
+          Ra[j * m + k] = dot;
+        }
+      }
+    }
+  });
+
+  // coarse DoFs of aggregate a are coarseFirst[a] .. coarseFirst[a+1]-1
+  std::vector<uint32> coarseFirst(nAgg + 1, 0);
+  for (uint32 a = 0; a < nAgg; a++) {
+    coarseFirst[a + 1] = coarseFirst[a] + kept[a];
+  }
+  uint32 nc = coarseFirst[nAgg];
+  if (nc == 0 || nc >= minCoarseningRatio * n) {
+    return false;
+  }
+
+  // tentative prolongator
+  CsrMatrix Pt;
+  Pt.nRows = n;
+  Pt.nCols = nc;
+  Pt.ptr.assign(n + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    Pt.ptr[i + 1] = Pt.ptr[i] + kept[agg[node[i]]];
+  }
+  Pt.col.resize(Pt.ptr.back());
+  Pt.val.resize(Pt.ptr.back());
+  for (uint32 a = 0; a < nAgg; a++) {
+    uint32 na = aggPtr[a + 1] - aggPtr[a];
+    const double* Qa = &Q[static_cast<uint64>(aggPtr[a]) * m];
+    for (uint32 r = 0; r < na; r++) {
+      uint32 i = aggEqs[aggPtr[a] + r];
+      for (uint32 j = 0; j < kept[a]; j++) {
+        Pt.col[Pt.ptr[i] + j] = coarseFirst[a] + j;
+        Pt.val[Pt.ptr[i] + j] = Qa[static_cast<uint64>(na) * j + r];
+      }
+    }
+  }
+
+  // coarse near-nullspace and nodes
+  std::vector<double> Bc(static_cast<uint64>(nc) * m);
+  std::vector<uint32> nodeC(nc);
+  for (uint32 a = 0; a < nAgg; a++) {
+    const double* Ra = &R[static_cast<uint64>(a) * m * m];
+    for (uint32 j = 0; j < kept[a]; j++) {
+      nodeC[coarseFirst[a] + j] = a;
+      for (uint16 k = 0; k < m; k++) {
+        Bc[static_cast<uint64>(k) * nc + coarseFirst[a] + j] = Ra[j * m + k];
+      }
+    }
+  }
+
+  // smoothed prolongator P = Pt - w * D^-1 * A * Pt, w = 4 / (3 * lambdaMax)
+  double omega = 4.0 / (3.0 * level.lambdaMax);
+  CsrMatrix APt;
+  multiply(A, Pt, APt, threads);
+  CsrMatrix& P = level.P;
+  P.nRows = n;
+  P.nCols = nc;
+  P.ptr.assign(n + 1, 0);
+  // APt includes all columns of Pt in every row (the diagonal of A is always present), so the
+  // sparsity of P is the sparsity of APt
+  P.ptr = APt.ptr;
+  P.col = APt.col;
+  P.val.resize(APt.nValues());
+  parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+    for (uint32 i = begin; i < end; i++) {
+      uindex kt = Pt.ptr[i];
+      for (uindex k = P.ptr[i]; k < P.ptr[i + 1]; k++) {
+        double v = -omega * level.invDiag[i] * APt.val[k];
+        while (kt < Pt.ptr[i + 1] && Pt.col[kt] < P.col[k]) kt++;
+        if (kt < Pt.ptr[i + 1] && Pt.col[kt] == P.col[k]) v += Pt.val[kt];
+        P.val[k] = v;
+      }
+    }
+  });
+  transpose(P, level.R);
+
+  // Galerkin coarse matrix Ac = R * A * P
+  CsrMatrix AP;
+  multiply(A, P, AP, threads);
+  levels.push_back(Level());
+  multiply(levels[levels.size() - 2].R, AP, levels.back().A, threads);
+
+  B.swap(Bc);
+  node.swap(nodeC);
+  nNodes = nAgg;
+  return true;
+}
+
+
+void AMGPreconditioner::smooth(Level& level, const double* b, double* x, bool zeroGuess) {
+  uint16 threads = getNumberOfThreads();
+  uint32 n = level.A.nRows;
+  double upper = chebyshevUpper * level.lambdaMax;
+  double lower = level.lambdaMax / chebyshevRatio;
+  double theta = 0.5 * (upper + lower);
+  double delta = 0.5 * (upper - lower);
+  double sigma = theta / delta;
+  double rho = 1.0 / sigma;
+  double* r = level.r.data();
+  double* d = level.d.data();
+
+  // r = D^-1 * (b - A * x), d = r / theta
+  if (zeroGuess) {
+    std::fill_n(x, n, 0.0);
+    parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        r[i] = level.invDiag[i] * b[i];
+        d[i] = r[i] / theta;
+      }
+    });
+  } else {
+    residual(level.A, b, x, r, threads);
+    parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        r[i] *= level.invDiag[i];
+        d[i] = r[i] / theta;
+      }
+    });
+  }
+  for (uint16 k = 1; k <= smootherDegree; k++) {
+    bool last = (k == smootherDegree);
+    double rhoNew = 1.0 / (2.0 * sigma - rho);
+    double c1 = rhoNew * rho;
+    double c2 = 2.0 * rhoNew / delta;
+    const CsrMatrix& A = level.A;
+    parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        x[i] += d[i];
+      }
+    });
+    if (last) break;
+    // r -= D^-1 * A * d, d = c1 * d + c2 * r
+    parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        double s = 0.0;
+        for (uindex p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+          s += A.val[p] * d[A.col[p]];
+        }
+        r[i] -= level.invDiag[i] * s;
+      }
+    });
+    parallelRange(n, threads, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        d[i] = c1 * d[i] + c2 * r[i];
+      }
+    });
+    rho = rhoNew;
+  }
+}
+
+
+void AMGPreconditioner::cycle(uint16 l, const double* b, double* x) {
+  if (l + 1 == nLevels()) {
+    coarseSolver.solve(b, x);
+    return;
+  }
+  uint16 threads = getNumberOfThreads();
+  Level& level = levels[l];
+  Level& coarse = levels[l + 1];
+
+  smooth(level, b, x, true);
+  residual(level.A, b, x, level.r.data(), threads);
+  spmv(level.R, level.r.data(), coarse.b.data(), threads);
+  cycle(l + 1, coarse.b.data(), coarse.x.data());
+  // x += P * xc
+  const CsrMatrix& P = level.P;
+  const double* xc = coarse.x.data();
+  parallelRange(P.nRows, threads, [&](uint32 begin, uint32 end) {
+    for (uint32 i = begin; i < end; i++) {
+      double s = 0.0;
+      for (uindex k = P.ptr[i]; k < P.ptr[i + 1]; k++) {
+        s += P.val[k] * xc[P.col[k]];
+      }
+      x[i] += s;
+    }
+  });
+  smooth(level, b, x, false);
+}
+
+
+void AMGPreconditioner::apply(const double* r, double* z) {
+  CHECK(levels.size() > 0) << "AMGPreconditioner::setup should be called before apply";
+  cycle(0, r, z);
+}
+
+
+std::string AMGPreconditioner::getName() {
+  return "AMG";
+}
+
+
+void AMGPreconditioner::setNumberOfThreads(uint16 threads) {
+  numberOfThreads = threads;
+}
+
+
+uint16 AMGPreconditioner::getNumberOfThreads() {
+  if (numberOfThreads == 0) {
+    return ThreadPool::instance().getNumberOfThreads();
+  }
+  return numberOfThreads;
+}
+
+
+uint16 AMGPreconditioner::nLevels() {
+  return static_cast<uint16>(levels.size());
+}
+
+
+double AMGPreconditioner::operatorComplexity() {
+  if (levels.empty()) return 0.0;
+  double total = 0.0;
+  for (auto& level : levels) {
+    total += level.A.nValues();
+  }
+  return total / levels[0].A.nValues();
+}
+
+} // namespace math
+
+} // namespace nla3d
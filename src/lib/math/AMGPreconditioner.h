@@ -0,0 +1,118 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/SupernodalLDLT.h"
+#include "math/Preconditioner.h"
+
+namespace nla3d {
+
+namespace math {
+
+// CsrMatrix - general sparse matrix in 0-based CSR format with sorted column indexes. Both
+// triangles of symmetric matrices are stored. Used internally by AMGPreconditioner.
+struct CsrMatrix {
+  uint32 nRows = 0;
+  uint32 nCols = 0;
+  std::vector<uindex> ptr;
+  std::vector<uint32> col;
+  std::vector<double> val;
+
+  uindex nValues() const;
+};
+
+
+// AMGPreconditioner - smoothed aggregation algebraic multigrid (Vanek, Mandel & Brezina) as a
+// preconditioner for Krylov equation solvers. The near-nullspace of the operator (for elasticity -
+// 3 translations and 3 rotations of a rigid body, see FEStorage::getRigidBodyModes(..)) is
+// interpolated exactly by the tentative prolongators. Hierarchy setup on every level:
+// 1. DoFs are grouped into nodes, strongly connected nodes are aggregated;
+// 2. near-nullspace vectors restricted to an aggregate are orthonormalized (QR): Q gives the
+//    tentative prolongator and R gives the near-nullspace of the coarse level. Coarse DoFs of an
+//    aggregate form a node of the coarse level;
+// 3. the tentative prolongator is smoothed by damped Jacobi: P = (I - w * D^-1 * A) * Ptent, the
+//    coarse matrix is the Galerkin product Ac = P^T * A * P.
+// apply(..) performs one V-cycle with Chebyshev polynomial smoother (symmetric, so the
+// preconditioner can be used with CG). The coarsest level is solved by SupernodalLDLT. If
+// near-nullspace isn't provided, the constant vector is used (scalar problems like heat transfer).
+// For BsrSymMatrix the groups of rows (nodal DoFs) are the nodes of the finest level unless nodes
+// are given by setNearNullspace(..).
+// Strength of connection, prolongator smoothing, Galerkin products and all cycle operations are
+// performed by numberOfThreads tasks of the ThreadPool.
+class AMGPreconditioner : public Preconditioner {
+public:
+  AMGPreconditioner();
+  virtual ~AMGPreconditioner() { };
+  using Preconditioner::setup;
+  virtual void setup(SparseSymMatrix* matrix);
+  virtual void setup(BsrSymMatrix* matrix);
+  virtual void apply(const double* r, double* z);
+  virtual std::string getName();
+
+  // near-nullspace vectors: modes[m * n + i] is the value of m-th vector for equation i
+  // (0-based), n is the number of equations. eqNode[i] - the node of equation i: DoFs of the same
+  // node are always aggregated together. Empty eqNode means that every equation is a node.
+  void setNearNullspace(uint16 nModes, const std::vector<double>& modes,
+      const std::vector<uint32>& eqNode = std::vector<uint32>());
+
+  // number of threads (0 - all threads of the ThreadPool)
+  void setNumberOfThreads(uint16 threads);
+  uint16 getNumberOfThreads();
+
+  // statistics of the hierarchy
+  uint16 nLevels();
+  // total number of nonzeros of all levels related to the number of nonzeros of the finest level
+  double operatorComplexity();
+
+  // nodes I and J are strongly connected if ||A_IJ|| >= theta * sqrt(||A_II|| * ||A_JJ||), where
+  // theta = strengthThreshold * 0.5^l on the level l
+  double strengthThreshold = 0.08;
+  // coarsening is stopped when the number of equations is less than coarsestSize
+  uint32 coarsestSize = 500;
+  uint16 maxLevels = 10;
+  // degree of Chebyshev polynomial smoother
+  uint16 smootherDegree = 2;
+
+protected:
+  struct Level {
+    CsrMatrix A;
+    // prolongator from the next level and restriction P^T
+    CsrMatrix P;
+    CsrMatrix R;
+    std::vector<double> invDiag;
+    // estimation of the largest eigenvalue of D^-1 * A
+    double lambdaMax = 0.0;
+    // work vectors of the cycle
+    std::vector<double> x;
+    std::vector<double> b;
+    std::vector<double> r;
+    std::vector<double> d;
+  };
+
+  // build the levels from the finest one (levels[0].A), defaultNodes - nodes of the finest level
+  // if they aren't given by setNearNullspace(..)
+  void buildHierarchy(const std::vector<uint32>& defaultNodes);
+  // build the next level from levels.back(). B and node are near-nullspace and nodes of the
+  // current level, they are replaced by coarse ones. Returns false if coarsening isn't possible.
+  bool coarsen(std::vector<double>& B, std::vector<uint32>& node, uint32& nNodes);
+  // V-cycle on the level l: x = M_l^-1 * b
+  void cycle(uint16 l, const double* b, double* x);
+  // Chebyshev smoothing of A * x = b on the level l
+  void smooth(Level& level, const double* b, double* x, bool zeroGuess);
+
+  uint16 nModes = 0;
+  std::vector<double> nullspace;
+  std::vector<uint32> nodes;
+
+  uint16 numberOfThreads = 0;
+  std::vector<Level> levels;
+  SparseSymMatrix coarseMatrix;
+  SupernodalLDLT coarseSolver;
+};
+
+} // namespace math
+
+} // namespace nla3d
@@ -6,6 +6,8 @@
 
 #include "sys.h"
 #include "math/SparseMatrix.h"
+#include "math/BsrMatrix.h"
+#include "math/ThreadPool.h"
 
 namespace nla3d {
 namespace math {
@@ -36,20 +38,60 @@ namespace math {
 // Methods addEntry(), addValue() works with global indices (in our example it's from 1 to `n`).
 // Under the hood these methods decide in which block translate your request, then modify indices to
 // local and call block's method.
+//
+// Instead of addEntry() (which needs max_in_row slots for every row) the exact sparsity can be
+// built by buildSparsity() in two passes: count entries of every row, allocate exact CSR arrays
+// once, then fill the rows. In this case the matrix should be created with max_in_row = 0.
+//
+// A diagonal block could be stored in BSR format instead of CSR (see setBlockRows(..) and
+// BsrSymMatrix): A.bsrBlock(2) is used instead of A.block(2) then. addValue(), getValuePosition()
+// and others work with such block in the same way.
 template <uint16 nb>
 class BlockSparseSymMatrix {
   public:
+    // max_in_row = 0 - the sparsity will be built by buildSparsity(..)
     BlockSparseSymMatrix(std::initializer_list<uint32> _rows_in_block, uint32 max_in_row = 100);
     BlockSparseSymMatrix(BlockSparseSymMatrix* ex);
     
     // add non-zero entry to sparse matrix. This should be called before compress(). 
     void addEntry(uint32 _i, uint32 _j);
 
+    // build the exact sparsity and compress the matrix. rowColumns(_i, cols) should put into cols
+    // global column numbers of non-zero entries in the global row _i (in any order, duplicates and
+    // entries of the lower triangle are allowed, they are dropped). rowColumns is called twice for
+    // every row (to count the entries and to fill them). Rows are processed in parallel, so
+    // rowColumns should be safe to call concurrently for different rows.
+    template <typename F>
+    void buildSparsity(F rowColumns);
+
+    // store the diagonal block _i in BSR format with groups of rows blockFirst (rows of the block
+    // from 0, see BsrSymMatrix::reinit(..)). Should be called before buildSparsity(..), the block
+    // can't be filled by addEntry(..). Matrices created by the copy constructor afterwards share
+    // the block structure.
+    void setBlockRows(uint16 _i, const std::vector<uint32>& blockFirst);
+
     // add value to the _i, _j entry. This should be called after compress().
     void addValue(uint32 _i, uint32 _j, double value);
 
+    // Values of all blocks have common numbering: values of block(1) go first, then block(2), ..,
+    // block(nb), then off-diagonal blocks block(1,2), block(1,3), .. The position of the (_i, _j)
+    // entry in this numbering is found once by getValuePosition(..) (SparsityInfo::invalid if there
+    // is no such entry), then values can be added by addValues(..) without any search. The
+    // positions are valid for all matrices with the same sparsity. Should be called after
+    // compress().
+    uindex getValuePosition(uint32 _i, uint32 _j);
+    // add values[k] to the entry at positions[k] for k in [0, n)
+    void addValues(uint32 n, const uindex* positions, const double* values);
+    // add values[p] to the entry at position p for p in [begin, end). values is indexed by the
+    // common numbering, different ranges could be added in parallel
+    void addValuesRange(uindex begin, uindex end, const double* values);
+    // number of values of all blocks (the size of the common numbering)
+    uindex nValues();
+
     SparseSymMatrix* block(uint16 _i);
     SparseMatrix* block(uint16 _i, uint16 _j);
+    // the diagonal block _i in BSR format, nullptr if the block is stored in CSR
+    BsrSymMatrix* bsrBlock(uint16 _i);
 
     void zero();
     void compress();
@@ -62,6 +104,13 @@ class BlockSparseSymMatrix {
 
     SparseSymMatrix diag[nb];
     SparseMatrix upper[nb * (nb + 1) / 2 - nb];
+    // diagonal blocks in BSR format (diag[k] isn't used then)
+    std::unique_ptr<BsrSymMatrix> bsr[nb];
+
+    // common numbering of values (see getValuePosition(..)): values of k-th block are
+    // [valuePtr[k], valuePtr[k+1]), blockValues[k] is the values array of the block
+    uindex valuePtr[nb * (nb + 1) / 2 + 1];
+    double* blockValues[nb * (nb + 1) / 2];
 
     std::vector<uint32> rows_in_block;
     uint32 total_rows = 0;
@@ -76,9 +125,17 @@ BlockSparseSymMatrix<nb>::BlockSparseSymMatrix(std::initializer_list<uint32> _ro
   assert(rows_in_block.size() == nb);
 
   for (uint16 i = 0; i < nb; i++) {
-    block(i+1)->reinit(rows_in_block[i], _mat_in_row);
+    if (_mat_in_row > 0) {
+      block(i+1)->reinit(rows_in_block[i], _mat_in_row);
+    } else {
+      block(i+1)->setSparsityInfo(std::make_shared<SparsityInfo>());
+    }
     for (uint16 j = i+1; j < nb; j++) {
-      block(i+1, j+1)->reinit(rows_in_block[i], rows_in_block[j], _mat_in_row);
+      if (_mat_in_row > 0) {
+        block(i+1, j+1)->reinit(rows_in_block[i], rows_in_block[j], _mat_in_row);
+      } else {
+        block(i+1, j+1)->setSparsityInfo(std::make_shared<SparsityInfo>());
+      }
     }
     total_rows += rows_in_block[i];
   }
@@ -95,7 +152,11 @@ BlockSparseSymMatrix<nb>::BlockSparseSymMatrix(BlockSparseSymMatrix<nb>* ex) {
   compressed = ex->compressed;
 
   for (uint16 i = 0; i < nb; i++) {
-    block(i+1)->setSparsityInfo(ex->block(i+1)->getSparsityInfo());
+    if (ex->bsr[i]) {
+      bsr[i].reset(new BsrSymMatrix(ex->bsr[i].get()));
+    } else {
+      block(i+1)->setSparsityInfo(ex->block(i+1)->getSparsityInfo());
+    }
     for (uint16 j = i+1; j < nb; j++) {
       block(i+1, j+1)->setSparsityInfo(ex->block(i+1, j+1)->getSparsityInfo());
     }
@@ -111,6 +172,22 @@ inline SparseSymMatrix* BlockSparseSymMatrix<nb>::block(uint16 _i) {
 }
 
 
+template<uint16 nb>
+inline BsrSymMatrix* BlockSparseSymMatrix<nb>::bsrBlock(uint16 _i) {
+  assert(_i > 0 && _i <= nb);
+  return bsr[_i-1].get();
+}
+
+
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::setBlockRows(uint16 _i, const std::vector<uint32>& blockFirst) {
+  assert(_i > 0 && _i <= nb);
+  CHECK(blockFirst.back() == rows_in_block[_i-1]);
+  bsr[_i-1].reset(new BsrSymMatrix);
+  bsr[_i-1]->reinit(blockFirst);
+}
+
+
 template<uint16 nb>
 inline SparseMatrix* BlockSparseSymMatrix<nb>::block(uint16 _i, uint16 _j) {
   CHECK(_i != _j);
@@ -145,6 +222,7 @@ void BlockSparseSymMatrix<nb>::addEntry(uint32 _i, uint32 _j) {
   getBlockAndPosition(_j, &block_j, &pos_j);
 
   if (block_i == block_j) {
+    CHECK(!bsr[block_i-1]) << "BSR blocks are built only by buildSparsity(..)";
     block(block_i)->addEntry(pos_i, pos_j);
   } else {
     block(block_i, block_j)->addEntry(pos_i, pos_j);
@@ -152,6 +230,130 @@ void BlockSparseSymMatrix<nb>::addEntry(uint32 _i, uint32 _j) {
 }
 
 
+template<uint16 nb>
+template <typename F>
+void BlockSparseSymMatrix<nb>::buildSparsity(F rowColumns) {
+  // global rows of block b are (offset[b], offset[b+1]]
+  std::vector<uint32> offset(nb + 1, 0);
+  for (uint16 b = 0; b < nb; b++) {
+    offset[b+1] = offset[b] + rows_in_block[b];
+  }
+
+  // sorted unique columns of the upper triangle part of the global row
+  auto upperRow = [&](uint32 _i, std::vector<uint32>& cols) {
+    cols.clear();
+    rowColumns(_i, cols);
+    std::sort(cols.begin(), cols.end());
+    cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+    cols.erase(cols.begin(), std::lower_bound(cols.begin(), cols.end(), _i));
+  };
+  // rows of a block are processed in parallel ranges of at least rowGrain units, every range has
+  // its own scratch buffers. A unit is a row or a group of rows of BSR block (see setBlockRows(..)).
+  const uint32 rowGrain = 1024;
+  auto nUnits = [&](uint16 b) {
+    return bsr[b] ? bsr[b]->nBlocks() : rows_in_block[b];
+  };
+  // rows [first, last) (of the block b, from 0) of the unit u
+  auto unitRows = [&](uint16 b, uint32 u, uint32& first, uint32& last) {
+    first = bsr[b] ? bsr[b]->getBlockFirst(u) : u;
+    last = bsr[b] ? bsr[b]->getBlockFirst(u + 1) : u + 1;
+  };
+  // block columns (from 1) of the group u of BSR block: the diagonal block and blocks of the
+  // collected columns, sorted and unique
+  auto blockRow = [](uint32 u, std::vector<uint32>& blockCols) {
+    blockCols.push_back(u + 1);
+    std::sort(blockCols.begin(), blockCols.end());
+    blockCols.erase(std::unique(blockCols.begin(), blockCols.end()), blockCols.end());
+  };
+
+  // first pass: count entries of rows in blocks (b, c), c >= b (entries of groups in BSR blocks)
+  std::vector<std::vector<uint32> > rowSizes(nb * nb);
+  for (uint16 b = 0; b < nb; b++) {
+    for (uint16 c = b; c < nb; c++) {
+      rowSizes[b*nb + c].assign((c == b) ? nUnits(b) : rows_in_block[b], 0);
+    }
+    parallelFor(nUnits(b), 0, [&](uint32 begin, uint32 end) {
+      std::vector<uint32> cols;
+      std::vector<uint32> blockCols;
+      for (uint32 u = begin; u < end; u++) {
+        uint32 first, last;
+        unitRows(b, u, first, last);
+        blockCols.clear();
+        for (uint32 r = first; r < last; r++) {
+          upperRow(offset[b] + r + 1, cols);
+          uint16 c = b;
+          for (auto j : cols) {
+            while (j > offset[c+1]) c++;
+            if (c == b && bsr[b]) {
+              blockCols.push_back(bsr[b]->getRowBlock(j - offset[b] - 1) + 1);
+            } else {
+              rowSizes[b*nb + c][r]++;
+            }
+          }
+        }
+        if (bsr[b]) {
+          blockRow(u, blockCols);
+          rowSizes[b*nb + b][u] = static_cast<uint32>(blockCols.size());
+        }
+      }
+    }, rowGrain);
+  }
+
+  // allocate exact arrays. SparsityInfo objects are reused as they could be shared with other
+  // matrices
+  for (uint16 b = 0; b < nb; b++) {
+    auto si = bsr[b] ? bsr[b]->getSparsityInfo() : block(b+1)->getSparsityInfo();
+    si->reinit(nUnits(b), nUnits(b), rowSizes[b*nb + b]);
+    for (uint16 c = b+1; c < nb; c++) {
+      block(b+1, c+1)->getSparsityInfo()->reinit(rows_in_block[b], rows_in_block[c],
+          rowSizes[b*nb + c]);
+    }
+  }
+  rowSizes.clear();
+
+  // second pass: fill the rows with local column numbers (setRow(..) of different rows are
+  // independent)
+  for (uint16 b = 0; b < nb; b++) {
+    parallelFor(nUnits(b), 0, [&](uint32 begin, uint32 end) {
+      std::vector<uint32> cols;
+      std::vector<uint32> local;
+      std::vector<uint32> blockCols;
+      for (uint32 u = begin; u < end; u++) {
+        uint32 first, last;
+        unitRows(b, u, first, last);
+        blockCols.clear();
+        for (uint32 r = first; r < last; r++) {
+          upperRow(offset[b] + r + 1, cols);
+          auto it = cols.begin();
+          for (uint16 c = b; c < nb && it != cols.end(); c++) {
+            local.clear();
+            while (it != cols.end() && *it <= offset[c+1]) {
+              local.push_back(*it - offset[c]);
+              ++it;
+            }
+            if (local.size() == 0) continue;
+            if (c == b && bsr[b]) {
+              for (auto j : local) {
+                blockCols.push_back(bsr[b]->getRowBlock(j - 1) + 1);
+              }
+              continue;
+            }
+            auto si = (c == b) ? block(b+1)->getSparsityInfo() : block(b+1, c+1)->getSparsityInfo();
+            si->setRow(r + 1, local.data());
+          }
+        }
+        if (bsr[b]) {
+          blockRow(u, blockCols);
+          bsr[b]->getSparsityInfo()->setRow(u + 1, blockCols.data());
+        }
+      }
+    }, rowGrain);
+  }
+
+  compress();
+}
+
+
 template<uint16 nb>
 void BlockSparseSymMatrix<nb>::addValue(uint32 _i, uint32 _j, double value) {
   uint16 block_i, block_j;
@@ -160,17 +362,86 @@ void BlockSparseSymMatrix<nb>::addValue(uint32 _i, uint32 _j, double value) {
   getBlockAndPosition(_i, &block_i, &pos_i);
   getBlockAndPosition(_j, &block_j, &pos_j);
 
-  if (block_i == block_j) {
+  if (block_i == block_j && bsr[block_i-1]) {
+    bsr[block_i-1]->addValue(pos_i, pos_j, value);
+  } else if (block_i == block_j) {
     block(block_i)->addValue(pos_i, pos_j, value);
   } else {
     block(block_i, block_j)->addValue(pos_i, pos_j, value);
   }
 }
 
+template<uint16 nb>
+uindex BlockSparseSymMatrix<nb>::getValuePosition(uint32 _i, uint32 _j) {
+  assert(compressed);
+  uint16 block_i, block_j;
+  uint32 pos_i, pos_j;
+  if (_i > _j) std::swap(_i, _j);
+  getBlockAndPosition(_i, &block_i, &pos_i);
+  getBlockAndPosition(_j, &block_j, &pos_j);
+
+  uint16 k;
+  uindex index;
+  if (block_i == block_j && bsr[block_i-1]) {
+    k = block_i - 1;
+    index = bsr[k]->getValuePosition(pos_i, pos_j);
+  } else if (block_i == block_j) {
+    k = block_i - 1;
+    index = block(block_i)->getSparsityInfo()->getIndex(pos_i, pos_j);
+  } else {
+    k = nb + static_cast<uint16>(block(block_i, block_j) - upper);
+    index = block(block_i, block_j)->getSparsityInfo()->getIndex(pos_i, pos_j);
+  }
+  if (index == SparsityInfo::invalid) return SparsityInfo::invalid;
+  return valuePtr[k] + index;
+}
+
+
+template<uint16 nb>
+inline void BlockSparseSymMatrix<nb>::addValues(uint32 n, const uindex* positions,
+    const double* values) {
+  assert(compressed);
+  for (uint32 s = 0; s < n; s++) {
+    uindex pos = positions[s];
+    assert(pos < valuePtr[nb * (nb + 1) / 2]);
+    uint16 k = 0;
+    while (pos >= valuePtr[k + 1]) k++;
+    blockValues[k][pos - valuePtr[k]] += values[s];
+  }
+}
+
+
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::addValuesRange(uindex begin, uindex end, const double* values) {
+  assert(compressed);
+  assert(end <= valuePtr[nb * (nb + 1) / 2]);
+  for (uint16 k = 0; k < nb * (nb + 1) / 2 && begin < end; k++) {
+    if (begin >= valuePtr[k + 1]) continue;
+    uindex blockEnd = std::min(end, valuePtr[k + 1]);
+    double* v = blockValues[k];
+    for (uindex p = begin; p < blockEnd; p++) {
+      v[p - valuePtr[k]] += values[p];
+    }
+    begin = blockEnd;
+  }
+}
+
+
+template<uint16 nb>
+uindex BlockSparseSymMatrix<nb>::nValues() {
+  assert(compressed);
+  return valuePtr[nb * (nb + 1) / 2];
+}
+
+
 template<uint16 nb>
 void BlockSparseSymMatrix<nb>::zero() {
   for (uint16 i = 0; i < nb; i++) {
-    diag[i].zero();
+    if (bsr[i]) {
+      bsr[i]->zero();
+    } else {
+      diag[i].zero();
+    }
   }
 
   for (uint16 i = 0; i < nb * (nb + 1) / 2 - nb; i++) {
@@ -184,13 +455,33 @@ void BlockSparseSymMatrix<nb>::compress() {
   // NOTE: now this function can be called multiply times. We rely on underlying
   // SparseMatrix::compress()
   for (uint16 i = 0; i < nb; i++) {
-    diag[i].compress();
+    if (bsr[i]) {
+      if (!bsr[i]->isCompressed()) bsr[i]->compress();
+    } else {
+      diag[i].compress();
+    }
   }
 
   for (uint16 i = 0; i < nb * (nb + 1) / 2 - nb; i++) {
     upper[i].compress();
   }
 
+  valuePtr[0] = 0;
+  for (uint16 k = 0; k < nb * (nb + 1) / 2; k++) {
+    uindex n;
+    if (k < nb && bsr[k]) {
+      blockValues[k] = bsr[k]->getValuesArray();
+      n = bsr[k]->nValues();
+    } else {
+      BaseSparseMatrix* b = (k < nb) ? static_cast<BaseSparseMatrix*>(&diag[k]) : &upper[k - nb];
+      blockValues[k] = b->getValuesArray();
+      n = b->nValues();
+    }
+    CHECK(static_cast<uint64>(valuePtr[k]) + n < SparsityInfo::invalid)
+      << "Too many entries in the matrix, build nla3d with nla3d_64bit_index";
+    valuePtr[k + 1] = valuePtr[k] + n;
+  }
+
   compressed = true;
 }
 
@@ -0,0 +1,341 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/BsrMatrix.h"
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+const uint16 bs = BsrSymMatrix::blockSize;
+const uint16 bs2 = BsrSymMatrix::blockSize * BsrSymMatrix::blockSize;
+// multiply(..) kernels are unrolled for 3 x 3 blocks
+static_assert(BsrSymMatrix::blockSize == 3, "BsrSymMatrix kernels are written for 3 x 3 blocks");
+
+} // namespace
+
+
+BsrSymMatrix::BsrSymMatrix() {
+}
+
+
+BsrSymMatrix::BsrSymMatrix(BsrSymMatrix* ex) {
+  CHECK(ex);
+  n = ex->n;
+  blockFirst = ex->blockFirst;
+  rowBlock = ex->rowBlock;
+  si = ex->si;
+  xp.assign(static_cast<uint64>(nBlocks()) * bs, 0.0);
+  yp.assign(static_cast<uint64>(nBlocks()) * bs, 0.0);
+  if (si && si->isCompressed()) {
+    compress();
+  }
+}
+
+
+void BsrSymMatrix::reinit(const std::vector<uint32>& _blockFirst) {
+  CHECK(_blockFirst.size() > 0 && _blockFirst.front() == 0);
+  n = _blockFirst.back();
+  blockFirst = _blockFirst;
+  const uint32 nb = nBlocks();
+  rowBlock.assign(n, 0);
+  for (uint32 b = 0; b < nb; b++) {
+    CHECK(blockFirst[b] < blockFirst[b + 1] && blockFirst[b + 1] - blockFirst[b] <= bs);
+    for (uint32 i = blockFirst[b]; i < blockFirst[b + 1]; i++) {
+      rowBlock[i] = b;
+    }
+  }
+  si = std::make_shared<SparsityInfo>();
+  values.clear();
+  xp.assign(static_cast<uint64>(nb) * bs, 0.0);
+  yp.assign(static_cast<uint64>(nb) * bs, 0.0);
+}
+
+
+void BsrSymMatrix::reinit(SparseSymMatrix* matrix) {
+  std::vector<uint32> first;
+  findRowGroups(matrix, bs, first);
+  reinit(matrix, first);
+}
+
+
+void BsrSymMatrix::findRowGroups(SparseSymMatrix* matrix, uint16 maxSize,
+    std::vector<uint32>& first) {
+  CHECK(matrix);
+  CHECK(matrix->isCompressed());
+  CHECK(maxSize > 0);
+  const uint32* cols = matrix->getColumnsArray();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32 nr = matrix->nRows();
+
+  // does row r continue the entries of row s (0-based rows, 1-based columns)?
+  auto continues = [&](uint32 s, uint32 r) {
+    const uint32* begin = cols + iofeir[s] - 1;
+    const uint32* end = cols + iofeir[s + 1] - 1;
+    const uint32* p = std::lower_bound(begin, end, r + 1);
+    if (p == end || *p != r + 1) return false;
+    uindex len = iofeir[r + 1] - iofeir[r];
+    return static_cast<uindex>(end - p) == len && std::equal(p, end, cols + iofeir[r] - 1);
+  };
+
+  first.clear();
+  first.reserve(nr / maxSize + 2);
+  uint32 s = 0;
+  first.push_back(0);
+  for (uint32 r = 1; r < nr; r++) {
+    if (r - s < maxSize && continues(s, r)) continue;
+    first.push_back(r);
+    s = r;
+  }
+  first.push_back(nr);
+}
+
+
+void BsrSymMatrix::reinit(SparseSymMatrix* matrix, const std::vector<uint32>& _blockFirst) {
+  CHECK(matrix);
+  CHECK(matrix->isCompressed());
+  CHECK(_blockFirst.back() == matrix->nRows());
+  reinit(_blockFirst);
+  const uint32* cols = matrix->getColumnsArray();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32 nb = nBlocks();
+
+  // block columns of block row bi (from 1, the diagonal block goes first)
+  std::vector<uint32> mark(nb, 0);
+  auto blockRow = [&](uint32 bi, std::vector<uint32>& bcols) {
+    bcols.clear();
+    // mark[bj] == bi + 1 if block (bi, bj) is already found
+    mark[bi] = bi + 1;
+    bcols.push_back(bi + 1);
+    for (uint32 i = blockFirst[bi]; i < blockFirst[bi + 1]; i++) {
+      for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+        uint32 bj = rowBlock[cols[k] - 1];
+        if (mark[bj] != bi + 1) {
+          mark[bj] = bi + 1;
+          bcols.push_back(bj + 1);
+        }
+      }
+    }
+    std::sort(bcols.begin(), bcols.end());
+  };
+
+  std::vector<uint32> bcols;
+  std::vector<uint32> rowSizes(nb);
+  for (uint32 bi = 0; bi < nb; bi++) {
+    blockRow(bi, bcols);
+    rowSizes[bi] = static_cast<uint32>(bcols.size());
+  }
+  si->reinit(nb, nb, rowSizes);
+  std::fill(mark.begin(), mark.end(), 0);
+  for (uint32 bi = 0; bi < nb; bi++) {
+    blockRow(bi, bcols);
+    si->setRow(bi + 1, bcols.data());
+  }
+  compress();
+  LOG(INFO) << "BSR " << bs << "x" << bs << ": " << nb << " block rows, " << nBlockEntries()
+    << " blocks (" << matrix->nValues() << " entries in CSR)";
+}
+
+
+void BsrSymMatrix::copyValues(SparseSymMatrix* matrix) {
+  CHECK(matrix->nRows() == n);
+  const uint32* cols = matrix->getColumnsArray();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const double* a = matrix->getValuesArray();
+  zero();
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uindex pos = getValuePosition(i + 1, cols[k]);
+      CHECK(pos != SparsityInfo::invalid) << "The entry (" << i + 1 << ", " << cols[k]
+        << ") is absent in the BSR matrix";
+      values[pos] = a[k];
+    }
+  }
+}
+
+
+void BsrSymMatrix::compress() {
+  CHECK(si);
+  if (!si->isCompressed()) {
+    si->compress();
+  }
+  CHECK(static_cast<uint64>(nBlockEntries()) * bs2 < SparsityInfo::invalid)
+    << "Too many entries in the matrix, build nla3d with nla3d_64bit_index";
+  values.assign(static_cast<uint64>(nBlockEntries()) * bs2, 0.0);
+}
+
+
+bool BsrSymMatrix::isCompressed() {
+  return si && si->isCompressed() && values.size() == static_cast<uint64>(nBlockEntries()) * bs2;
+}
+
+
+void BsrSymMatrix::zero() {
+  std::fill(values.begin(), values.end(), 0.0);
+}
+
+
+uindex BsrSymMatrix::getValuePosition(uint32 _i, uint32 _j) {
+  assert(_i > 0 && _i <= n);
+  assert(_j > 0 && _j <= n);
+  if (_i > _j) std::swap(_i, _j);
+  uint32 bi = rowBlock[_i - 1];
+  uint32 bj = rowBlock[_j - 1];
+  uindex k = si->getIndex(bi + 1, bj + 1);
+  if (k == SparsityInfo::invalid) return SparsityInfo::invalid;
+  uint16 li = static_cast<uint16>(_i - 1 - blockFirst[bi]);
+  uint16 lj = static_cast<uint16>(_j - 1 - blockFirst[bj]);
+  // in the diagonal block _i <= _j gives li <= lj, the upper triangle
+  return k * bs2 + li * bs + lj;
+}
+
+
+void BsrSymMatrix::addValue(uint32 _i, uint32 _j, double value) {
+  uindex pos = getValuePosition(_i, _j);
+  if (pos == SparsityInfo::invalid) {
+    LOG(ERROR) << "The entry (" << _i << ", " << _j << ") is absent in the BSR matrix";
+    return;
+  }
+  values[pos] += value;
+}
+
+
+double* BsrSymMatrix::getBlock(uint32 bi, uint32 bj) {
+  assert(bi <= bj && bj < nBlocks());
+  uindex k = si->getIndex(bi + 1, bj + 1);
+  if (k == SparsityInfo::invalid) return nullptr;
+  return &values[k * bs2];
+}
+
+
+uint32 BsrSymMatrix::nRows() {
+  return n;
+}
+
+
+void BsrSymMatrix::multiply(const double* x, double* y) {
+  std::fill_n(y, n, 0.0);
+  matBVprod(*this, x, 1.0, y);
+}
+
+
+void matBVprod(BsrSymMatrix &B, const double* V, const double coef, double* R) {
+  const uint32 nb = B.nBlocks();
+  const std::vector<uint32>& blockFirst = B.blockFirst;
+  std::vector<double>& xp = B.xp;
+  std::vector<double>& yp = B.yp;
+  for (uint32 b = 0; b < nb; b++) {
+    uint32 f = blockFirst[b];
+    uint16 size = static_cast<uint16>(blockFirst[b + 1] - f);
+    for (uint16 l = 0; l < bs; l++) {
+      xp[b * bs + l] = (l < size) ? V[f + l] : 0.0;
+    }
+  }
+  std::fill(yp.begin(), yp.end(), 0.0);
+
+  const double* v = B.values.data();
+  const uint32* cols = B.getBlockColumnsArray();
+  const uindex* iofeir = B.getBlockIofeirArray();
+  for (uint32 bi = 0; bi < nb; bi++) {
+    const double xi0 = xp[bi * bs + 0];
+    const double xi1 = xp[bi * bs + 1];
+    const double xi2 = xp[bi * bs + 2];
+    // the diagonal block (upper triangle)
+    const double* A = v + static_cast<uint64>(iofeir[bi] - 1) * bs2;
+    double yi0 = A[0] * xi0 + A[1] * xi1 + A[2] * xi2;
+    double yi1 = A[1] * xi0 + A[4] * xi1 + A[5] * xi2;
+    double yi2 = A[2] * xi0 + A[5] * xi1 + A[8] * xi2;
+    for (uindex k = iofeir[bi]; k < iofeir[bi + 1] - 1; k++) {
+      A = v + static_cast<uint64>(k) * bs2;
+      const uint32 bj = cols[k] - 1;
+      const double* xj = &xp[bj * bs];
+      double* yj = &yp[bj * bs];
+      // y_i += A * x_j
+      yi0 += A[0] * xj[0] + A[1] * xj[1] + A[2] * xj[2];
+      yi1 += A[3] * xj[0] + A[4] * xj[1] + A[5] * xj[2];
+      yi2 += A[6] * xj[0] + A[7] * xj[1] + A[8] * xj[2];
+      // y_j += A^T * x_i
+      yj[0] += A[0] * xi0 + A[3] * xi1 + A[6] * xi2;
+      yj[1] += A[1] * xi0 + A[4] * xi1 + A[7] * xi2;
+      yj[2] += A[2] * xi0 + A[5] * xi1 + A[8] * xi2;
+    }
+    yp[bi * bs + 0] += yi0;
+    yp[bi * bs + 1] += yi1;
+    yp[bi * bs + 2] += yi2;
+  }
+
+  for (uint32 b = 0; b < nb; b++) {
+    uint32 f = blockFirst[b];
+    uint16 size = static_cast<uint16>(blockFirst[b + 1] - f);
+    for (uint16 l = 0; l < size; l++) {
+      R[f + l] += coef * yp[b * bs + l];
+    }
+  }
+}
+
+
+void BsrSymMatrix::diagonal(double* d) {
+  for (uint32 b = 0; b < nBlocks(); b++) {
+    const double* B = &values[static_cast<uint64>(si->iofeir[b] - 1) * bs2];
+    for (uint32 i = blockFirst[b]; i < blockFirst[b + 1]; i++) {
+      uint16 l = static_cast<uint16>(i - blockFirst[b]);
+      d[i] = B[l * bs + l];
+    }
+  }
+}
+
+
+uint32 BsrSymMatrix::nBlocks() {
+  return blockFirst.size() > 0 ? static_cast<uint32>(blockFirst.size() - 1) : 0;
+}
+
+
+uindex BsrSymMatrix::nBlockEntries() {
+  return (si && si->isCompressed()) ? si->numberOfValues : 0;
+}
+
+
+uint32 BsrSymMatrix::getBlockFirst(uint32 b) {
+  assert(b <= nBlocks());
+  return blockFirst[b];
+}
+
+
+uint32 BsrSymMatrix::getRowBlock(uint32 i) {
+  assert(i < n);
+  return rowBlock[i];
+}
+
+
+double* BsrSymMatrix::getValuesArray() {
+  return values.data();
+}
+
+
+uindex BsrSymMatrix::nValues() {
+  return static_cast<uindex>(values.size());
+}
+
+
+std::shared_ptr<SparsityInfo> BsrSymMatrix::getSparsityInfo() {
+  return si;
+}
+
+
+const uint32* BsrSymMatrix::getBlockColumnsArray() {
+  assert(si && si->isCompressed());
+  return si->columns;
+}
+
+
+const uindex* BsrSymMatrix::getBlockIofeirArray() {
+  assert(si && si->isCompressed());
+  return si->iofeir;
+}
+
+} // namespace math
+
+} // namespace nla3d
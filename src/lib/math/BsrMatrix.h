@@ -0,0 +1,120 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/LinearOperator.h"
+
+namespace nla3d {
+
+namespace math {
+
+// BsrSymMatrix - symmetric sparse matrix in block compressed sparse row format (BSR) with dense
+// blockSize x blockSize (3 x 3) blocks. Rows are split into consecutive groups of 1..blockSize
+// rows (nodal DoFs UX, UY, UZ of a node get the same equation numbers one after another, so they
+// naturally form a group), a block (bi, bj) keeps all entries of the rows of group bi and the
+// columns of group bj. Groups with less than blockSize rows are padded by zeros. Only the upper
+// block triangle is stored, in the diagonal blocks only the upper triangle (li <= lj) is used and
+// the lower one stays zero. The format keeps one column index per block instead of one per entry
+// (about blockSize^2 times less index memory than CSR for 3D solid models) and the products are
+// done by unrolled 3 x 3 kernels.
+//
+// The block structure is kept in SparsityInfo of the block graph (nBlocks() x nBlocks(), upper
+// triangle, block numbers from 1), so it can be shared between matrices (like K, C and M of
+// FEStorage) and built exactly in two passes by SparsityInfo::reinit(..)/setRow(..) (see
+// BlockSparseSymMatrix::setBlockRows(..)). Then compress() allocates the values. Blocks are
+// stored one after another in the order of the block graph entries: block k (from 0) occupies
+// values [k * blockSize^2, (k + 1) * blockSize^2) row by row.
+//
+// Numbering: row and column numbers in addValue(..) and getValuePosition(..) start from 1 (as in
+// SparseSymMatrix), block numbers in getBlock(..) start from 0.
+class BsrSymMatrix : public LinearOperator {
+public:
+  static const uint16 blockSize = 3;
+
+  BsrSymMatrix();
+  // the matrix with the structure of `ex`: the block sparsity is shared
+  BsrSymMatrix(BsrSymMatrix* ex);
+  virtual ~BsrSymMatrix() { };
+
+  // set the groups of rows: group b consists of rows [blockFirst[b], blockFirst[b+1]) (0-based),
+  // blockFirst.back() is the number of rows. The block sparsity is new and empty, it should be
+  // filled and then compress() should be called.
+  void reinit(const std::vector<uint32>& blockFirst);
+  // build the block structure of `matrix` (the matrix is compressed, values are zeros). Groups of
+  // rows are found automatically: a row joins the group of the previous rows if its entries
+  // continue the entries of the first row of the group (the rows of one node have the same
+  // sparsity).
+  void reinit(SparseSymMatrix* matrix);
+  // the same, but groups are given as in reinit(blockFirst)
+  void reinit(SparseSymMatrix* matrix, const std::vector<uint32>& blockFirst);
+  // groups of at most maxSize rows of `matrix` found as in reinit(matrix), the result is in the
+  // form of reinit(blockFirst)
+  static void findRowGroups(SparseSymMatrix* matrix, uint16 maxSize,
+      std::vector<uint32>& blockFirst);
+  // copy values of `matrix`, all its entries should be in the block structure
+  void copyValues(SparseSymMatrix* matrix);
+
+  // compress the block sparsity (if it isn't yet) and allocate zero values
+  void compress();
+  bool isCompressed();
+
+  void zero();
+  // add value to the _i, _j entry (should be in the block structure)
+  void addValue(uint32 _i, uint32 _j, double value);
+  // position of the _i, _j entry in the values array (SparsityInfo::invalid if the entry isn't in
+  // the block structure)
+  uindex getValuePosition(uint32 _i, uint32 _j);
+  // pointer to the block (bi, bj), bi <= bj, stored row by row (blockSize x blockSize), nullptr
+  // if there is no such block
+  double* getBlock(uint32 bi, uint32 bj);
+
+  // LinearOperator interface
+  virtual uint32 nRows();
+  virtual void multiply(const double* x, double* y);
+  virtual void diagonal(double* d);
+
+  double* getValuesArray();
+  // size of the values array (nBlockEntries() * blockSize^2)
+  uindex nValues();
+  // the block graph
+  std::shared_ptr<SparsityInfo> getSparsityInfo();
+  // block columns (from 1) of block rows: blocks of block row b (from 0) are
+  // [iofeir[b] - 1, iofeir[b+1] - 1), the first one is always the diagonal block
+  const uint32* getBlockColumnsArray();
+  const uindex* getBlockIofeirArray();
+
+  // number of groups of rows (block rows)
+  uint32 nBlocks();
+  // number of stored blocks
+  uindex nBlockEntries();
+  // the first row of group b (0-based), b <= nBlocks()
+  uint32 getBlockFirst(uint32 b);
+  // the group of row i (0-based)
+  uint32 getRowBlock(uint32 i);
+
+private:
+  uint32 n = 0;
+  // blockFirst[b] - the first row of group b
+  std::vector<uint32> blockFirst;
+  // rowBlock[i] - the group of row i
+  std::vector<uint32> rowBlock;
+  std::shared_ptr<SparsityInfo> si;
+  std::vector<double> values;
+
+  // padded x and y for products
+  std::vector<double> xp, yp;
+
+  friend void matBVprod(BsrSymMatrix &B, const double* V, const double coef, double* R);
+};
+
+
+// R += coef * B * V for raw arrays of B.nRows() size (as for SparseSymMatrix). R and V shouldn't
+// overlap.
+void matBVprod(BsrSymMatrix &B, const double* V, const double coef, double* R);
+
+} // namespace math
+
+} // namespace nla3d
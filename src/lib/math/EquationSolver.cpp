@@ -3,6 +3,8 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "math/EquationSolver.h"
+#include <cfloat>
+#include <limits>
 
 #ifdef NLA3D_USE_MKL
 #include <mkl.h>
@@ -12,53 +14,186 @@ namespace nla3d {
 
 namespace math {
 
-EquationSolver* defaultEquationSolver = new GaussDenseEquationSolver;
+EquationSolver* defaultEquationSolver = new LDLTEquationSolver;
+
+void EquationSolver::solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "solveEquations");
+
+  factorizeEquations(matrix);
+  substituteEquations(matrix, rhs, unknowns);
+}
+
+
+void EquationSolver::analyseEquations(math::SparseSymMatrix* matrix) {
+  nEq = matrix->nRows();
+  analysedSparsity = matrix->getSparsityInfo();
+  numberOfAnalyses++;
+}
+
+
+bool EquationSolver::isAnalysed(math::SparseSymMatrix* matrix) {
+  return analysedSparsity && analysedSparsity == matrix->getSparsityInfo();
+}
+
+
+void EquationSolver::solveEquations(math::BsrSymMatrix* matrix, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "solveEquations");
+
+  factorizeEquations(matrix);
+  substituteEquations(matrix, rhs, unknowns);
+}
+
+
+void EquationSolver::analyseEquations(math::BsrSymMatrix* matrix) {
+  nEq = matrix->nRows();
+  analysedSparsity = matrix->getSparsityInfo();
+  numberOfAnalyses++;
+}
+
+
+void EquationSolver::factorizeEquations(math::BsrSymMatrix* /*matrix*/) {
+  LOG(FATAL) << "The equation solver doesn't support matrices in BSR format";
+}
+
+
+void EquationSolver::substituteEquations(math::BsrSymMatrix* /*matrix*/, double* /*rhs*/,
+                                         double* /*unknowns*/) {
+  LOG(FATAL) << "The equation solver doesn't support matrices in BSR format";
+}
+
+
+bool EquationSolver::isAnalysed(math::BsrSymMatrix* matrix) {
+  return analysedSparsity && analysedSparsity == matrix->getSparsityInfo();
+}
+
+
+uint32 EquationSolver::getNumberOfAnalyses() {
+  return numberOfAnalyses;
+}
+
 
 void EquationSolver::setSymmetric (bool symmetric) {
+  if (isSymmetric != symmetric) {
+    analysedSparsity.reset();
+  }
   isSymmetric = symmetric;
 }
 
 void EquationSolver::setPositive (bool positive) {
+  if (isPositive != positive) {
+    analysedSparsity.reset();
+  }
   isPositive = positive;
 }
 
+void EquationSolver::setOrdering (OrderingMethod method) {
+  CHECK(method != OrderingMethod::UNDEFINED);
+  if (ordering != method) {
+    analysedSparsity.reset();
+  }
+  ordering = method;
+}
 
-void GaussDenseEquationSolver::solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns) {
-  TIMED_SCOPE(t, "solveEquations");
-  factorizeEquations(matrix);
-  substituteEquations(matrix, rhs, unknowns);
+
+void EquationSolver::setNumberOfRhs (uint32 n) {
+  CHECK(n > 0);
+  nrhs = static_cast<int>(n);
+}
+
+
+uint32 EquationSolver::getNumberOfRhs () {
+  return static_cast<uint32>(nrhs);
+}
+
+
+void EquationSolver::setOutOfCore (bool _outOfCore, const std::string& _scratchDirectory,
+    uint64 _memoryBudget) {
+  CHECK(_memoryBudget > 0);
+  if (outOfCore != _outOfCore) {
+    analysedSparsity.reset();
+  }
+  outOfCore = _outOfCore;
+  scratchDirectory = _scratchDirectory;
+  memoryBudget = _memoryBudget;
+}
+
+
+void GaussDenseEquationSolver::analyseEquations(math::SparseSymMatrix* matrix) {
+  CHECK(matrix->nRows() < 1000) << "GaussDenseEquationSolver works only with number of equations less than 1000";
+  EquationSolver::analyseEquations(matrix);
+  matA.resize(nEq, nEq);
+  pivots.resize(nEq);
 }
 
 
 void GaussDenseEquationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
-  // nothing to do here..
-  nEq = matrix->nRows();
-  CHECK(nEq < 1000) << "GaussDenseEquationSolver works only with number of equations less than 1000";
+  if (!isAnalysed(matrix)) {
+    analyseEquations(matrix);
+  }
+
+  // fill dense matA from upper triangle of the sparse matrix
+  matA.zero();
+  double* A = matA.ptr();
+  const double* values = matrix->getValuesArray();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32* columns = matrix->getColumnsArray();
+  for (uint32 i = 0; i < nEq; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      A[i * nEq + j] = values[k];
+      A[j * nEq + i] = values[k];
+    }
+  }
+
+  // LU decomposition with partial pivoting
+  for (uint32 i = 0; i < nEq; i++) {
+    uint32 imax = i;
+    double max = 0.0;
+    for (uint32 ip = i; ip < nEq; ip++) {
+      if (fabs(A[ip * nEq + i]) > max) {
+        imax = ip;
+        max = fabs(A[ip * nEq + i]);
+      }
+    }
+    CHECK(max >= 1e-20) << "ERROR during solution: the matrix is singular";
+    pivots[i] = imax;
+    if (imax != i) {
+      std::swap_ranges(A + i * nEq, A + (i + 1) * nEq, A + imax * nEq);
+    }
+    for (uint32 ip = i + 1; ip < nEq; ip++) {
+      double temp = A[ip * nEq + i] / A[i * nEq + i];
+      A[ip * nEq + i] = temp;
+      if (temp == 0.0) continue;
+      for (uint32 jp = i + 1; jp < nEq; jp++) {
+        A[ip * nEq + jp] -= temp * A[i * nEq + jp];
+      }
+    }
+  }
 }
 
 
 void GaussDenseEquationSolver::substituteEquations(math::SparseSymMatrix* matrix,
                                                    double* rhs, double* unknowns) {
-  // NOTE: actually here we perform all steps factorization and substitution
-  // because this is simplest solver dedicated to perform functional tests
-  //
-  CHECK(nrhs == 1) << "GaussDenseEquationSolver support only 1 set of rhs values";
-  
-
-  if (matA.dM() == nEq && matA.dN() == nEq) {
-    matA.zero();
-  } else {
-    matA.resize(nEq, nEq);
+  CHECK(nEq == matrix->nRows());
+  const double* A = matA.ptr();
+  for (int r = 0; r < nrhs; r++) {
+    double* X = unknowns + static_cast<uint64>(nEq) * r;
+    std::copy(rhs + static_cast<uint64>(nEq) * r, rhs + static_cast<uint64>(nEq) * (r + 1), X);
+    for (uint32 i = 0; i < nEq; i++) {
+      if (pivots[i] != i) std::swap(X[i], X[pivots[i]]);
+    }
+    for (uint32 i = 0; i < nEq; i++) {
+      for (uint32 j = 0; j < i; j++) {
+        X[i] -= A[i * nEq + j] * X[j];
+      }
+    }
+    for (int32 i = (int32) nEq - 1; i >= 0; i--) {
+      for (uint32 j = i + 1; j < nEq; j++) {
+        X[i] -= A[i * nEq + j] * X[j];
+      }
+      X[i] /= A[i * nEq + i];
+    }
   }
-
-  // fill dense matA from sparse matrix
-  for (uint16 i = 0; i < nEq; i++)
-    for (uint16 j = 0; j < nEq; j++)
-      // NOTE: SparseMatrix getters works with indexes started from 1
-      // TODO: we can fill dense matrix from sparse one in a more optimized way
-      matA[i][j] = matrix->value(i+1, j+1);
-  bool res = _solve(unknowns, matA.ptr(), rhs, nEq);
-  CHECK(res == true) << "ERROR during solution";
 }
 
 bool GaussDenseEquationSolver::_solve(double* X, double* A,
@@ -133,32 +268,268 @@ bool GaussDenseEquationSolver::_solve(double* X, double* A,
 }
 
 
-#ifdef NLA3D_USE_MKL
-PARDISO_equationSolver::~PARDISO_equationSolver () {
-  releasePARDISO();
+namespace {
+
+// max row sum of the symmetric matrix stored by upper triangle
+double maxRowSum(math::SparseSymMatrix* matrix) {
+  const uint32 n = matrix->nRows();
+  std::vector<double> rowSum(n, 0.0);
+  const double* values = matrix->getValuesArray();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32* columns = matrix->getColumnsArray();
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      rowSum[i] += fabs(values[k]);
+      if (j != i) rowSum[j] += fabs(values[k]);
+    }
+  }
+  return (n > 0) ? *std::max_element(rowSum.begin(), rowSum.end()) : 0.0;
 }
 
-void PARDISO_equationSolver::solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns) {
-  TIMED_SCOPE(t, "solveEquations");
 
-  factorizeEquations(matrix);
-  substituteEquations(matrix, rhs, unknowns);
+// the same for BSR matrix (padding rows of the blocks are zeros)
+double maxRowSum(math::BsrSymMatrix* matrix) {
+  const uint16 bs = math::BsrSymMatrix::blockSize;
+  const uint32 nb = matrix->nBlocks();
+  std::vector<double> rowSum(static_cast<uint64>(nb) * bs, 0.0);
+  const double* values = matrix->getValuesArray();
+  const uindex* iofeir = matrix->getBlockIofeirArray();
+  const uint32* columns = matrix->getBlockColumnsArray();
+  for (uint32 bi = 0; bi < nb; bi++) {
+    for (uindex k = iofeir[bi] - 1; k < iofeir[bi + 1] - 1; k++) {
+      uint32 bj = columns[k] - 1;
+      const double* B = values + k * bs * bs;
+      for (uint16 li = 0; li < bs; li++) {
+        for (uint16 lj = (bj == bi ? li : 0); lj < bs; lj++) {
+          double a = fabs(B[li * bs + lj]);
+          rowSum[bi * bs + li] += a;
+          if (bj != bi || li != lj) rowSum[bj * bs + lj] += a;
+        }
+      }
+    }
+  }
+  return (nb > 0) ? *std::max_element(rowSum.begin(), rowSum.end()) : 0.0;
+}
+
+
+// the copy of `matrix` with the same sparsity
+math::SparseSymMatrix* newMatrix(math::SparseSymMatrix* matrix) {
+  return new math::SparseSymMatrix(matrix->getSparsityInfo());
+}
+
+
+math::BsrSymMatrix* newMatrix(math::BsrSymMatrix* matrix) {
+  return new math::BsrSymMatrix(matrix);
+}
+
+
+// LinearOperator of the matrix for the residuals of iterative refinement (CSR matrix is wrapped
+// into `wrapper`)
+math::LinearOperator* asOperator(math::SparseSymMatrix* matrix,
+    std::unique_ptr<math::SparseMatrixOperator>& wrapper) {
+  wrapper.reset(new math::SparseMatrixOperator(matrix));
+  return wrapper.get();
 }
 
 
+math::LinearOperator* asOperator(math::BsrSymMatrix* matrix,
+    std::unique_ptr<math::SparseMatrixOperator>& /*wrapper*/) {
+  return matrix;
+}
+
+} // anonymous namespace
+
+
+void LDLTEquationSolver::analyseEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "analyseEquations");
+  LOG_IF(!isSymmetric, FATAL) << "For now LDLTEquationSolver doesn't support non-symmetric matrices";
+  if (isPositive) {
+    LOG(INFO) << "EquationSolver will use positive symmetric solver";
+  } else {
+    LOG(INFO) << "EquationSolver will use non-positive symmetric solver";
+  }
+  ldlt.ordering = ordering;
+  ldlt.analyse(matrix);
+  EquationSolver::analyseEquations(matrix);
+}
+
+
+void LDLTEquationSolver::analyseEquations(math::BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "analyseEquations");
+  LOG_IF(!isSymmetric, FATAL) << "For now LDLTEquationSolver doesn't support non-symmetric matrices";
+  if (isPositive) {
+    LOG(INFO) << "EquationSolver will use positive symmetric solver";
+  } else {
+    LOG(INFO) << "EquationSolver will use non-positive symmetric solver";
+  }
+  ldlt.ordering = ordering;
+  ldlt.analyse(matrix);
+  EquationSolver::analyseEquations(matrix);
+}
+
+
+void LDLTEquationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  factorizeMatrix(matrix, factorizedMatrix);
+}
+
+
+void LDLTEquationSolver::factorizeEquations(math::BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  factorizeMatrix(matrix, factorizedBlockMatrix);
+}
+
+
+void LDLTEquationSolver::substituteEquations(math::SparseSymMatrix* matrix,
+                                             double* rhs, double* unknowns) {
+  substituteMatrix(matrix, factorizedMatrix, rhs, unknowns);
+}
+
+
+void LDLTEquationSolver::substituteEquations(math::BsrSymMatrix* matrix,
+                                             double* rhs, double* unknowns) {
+  substituteMatrix(matrix, factorizedBlockMatrix, rhs, unknowns);
+}
+
+
+template <typename M>
+void LDLTEquationSolver::factorizeMatrix(M* matrix, std::unique_ptr<M>& factorized) {
+  if (!isAnalysed(matrix)) {
+    analyseEquations(matrix);
+  }
+
+  matrixNorm = maxRowSum(matrix);
+
+  ldlt.usePivoting = !isPositive;
+  ldlt.singlePrecision = mixedPrecision && !fallenBackToDouble;
+  ldlt.outOfCore = outOfCore;
+  ldlt.scratchDirectory = scratchDirectory;
+  ldlt.memoryBudget = memoryBudget;
+  ldlt.factorize(matrix);
+  LOG(INFO) << "Factor is stored in " << (ldlt.singlePrecision ? "single" : "double")
+    << " precision (" << ldlt.factorSize() / 1024 / 1024 << " MB"
+    << (outOfCore ? ", out-of-core" : "") << ")";
+
+  if (matrix == factorized.get()) {
+    return;
+  }
+  if (ldlt.singlePrecision || (ldlt.nPerturbedPivots() > 0 && maxRefinementSteps > 0)) {
+    if (!factorized || factorized->getSparsityInfo() != matrix->getSparsityInfo()) {
+      factorized.reset(newMatrix(matrix));
+    }
+    const double* values = matrix->getValuesArray();
+    std::copy(values, values + matrix->nValues(), factorized->getValuesArray());
+  } else {
+    factorized.reset();
+  }
+}
+
+
+template <typename M>
+void LDLTEquationSolver::substituteMatrix(M* matrix, std::unique_ptr<M>& factorized,
+                                          double* rhs, double* unknowns) {
+  CHECK(ldlt.isFactorized()) << "factorizeEquations should be called before substituteEquations";
+  CHECK(nEq == matrix->nRows());
+
+  ldlt.solve(rhs, unknowns, nrhs);
+  refinementSteps = 0;
+  bool mixed = ldlt.singlePrecision;
+  if (!mixed && (ldlt.nPerturbedPivots() == 0 || maxRefinementSteps == 0)) {
+    return;
+  }
+
+  // refine against the matrix which was factorized
+  assert(factorized);
+  M* factorizedCopy = factorized.get();
+  std::unique_ptr<math::SparseMatrixOperator> wrapper;
+  math::LinearOperator* op = asOperator(factorizedCopy, wrapper);
+  bool converged = true;
+  for (int r = 0; r < nrhs; r++) {
+    double* b = rhs + static_cast<uint64>(nEq) * r;
+    double* x = unknowns + static_cast<uint64>(nEq) * r;
+    converged = refineSolution(op, b, x,
+                               mixed ? maxMixedRefinementSteps : maxRefinementSteps) && converged;
+    if (mixed && !converged) break;
+  }
+  LOG_IF(mixed, INFO) << "Mixed precision solution: " << refinementSteps << " refinement steps";
+
+  if (mixed && !converged) {
+    LOG(WARNING) << "Iterative refinement stagnates with single precision factor. The matrix "
+      << "will be factorized in double precision";
+    fallenBackToDouble = true;
+    // the same (factorized) matrix is factorized again, so a reused factorization stays valid
+    factorizeEquations(factorizedCopy);
+    substituteEquations(factorizedCopy, rhs, unknowns);
+  }
+}
+
+
+bool LDLTEquationSolver::refineSolution(math::LinearOperator* op, const double* b,
+    double* x, uint16 maxSteps) {
+  std::vector<double> res(nEq);
+  std::vector<double> dx(nEq);
+  double bnorm = 0.0;
+  for (uint32 i = 0; i < nEq; i++) {
+    bnorm = std::max(bnorm, fabs(b[i]));
+  }
+  double prevRnorm = 0.0;
+  for (uint16 step = 0; ; step++) {
+    op->multiply(x, dx.data());
+    double rnorm = 0.0;
+    double xnorm = 0.0;
+    for (uint32 i = 0; i < nEq; i++) {
+      res[i] = b[i] - dx[i];
+      rnorm = std::max(rnorm, fabs(res[i]));
+      xnorm = std::max(xnorm, fabs(x[i]));
+    }
+    LOG(INFO) << "Iterative refinement step " << step << ": residual = " << rnorm;
+    // the residual is on the level of double precision rounding errors (as in LAPACK's dsgesv)
+    if (rnorm <= 1.0e-15 * bnorm ||
+        rnorm <= xnorm * matrixNorm * sqrt(static_cast<double>(nEq)) * DBL_EPSILON) {
+      return true;
+    }
+    if (step > 0 && rnorm > 0.5 * prevRnorm) {
+      return false;
+    }
+    if (step == maxSteps) {
+      return false;
+    }
+    prevRnorm = rnorm;
+    ldlt.solve(res.data(), dx.data());
+    for (uint32 i = 0; i < nEq; i++) {
+      x[i] += dx[i];
+    }
+    refinementSteps = std::max(refinementSteps, static_cast<uint16>(step + 1));
+  }
+}
+
+
+uint16 LDLTEquationSolver::getNumberOfRefinementSteps() {
+  return refinementSteps;
+}
+
+
+bool LDLTEquationSolver::isFallenBackToDouble() {
+  return fallenBackToDouble;
+}
+
+
+void LDLTEquationSolver::setNumberOfThreads(uint16 threads) {
+  ldlt.setNumberOfThreads(threads);
+}
+
+
+#ifdef NLA3D_USE_MKL
+PARDISO_equationSolver::~PARDISO_equationSolver () {
+  releasePARDISO();
+}
+
 void PARDISO_equationSolver::substituteEquations(math::SparseSymMatrix* matrix,
                                                  double* rhs, double* unknowns) {
 
 	//Back substitution and iterative refinement
-
-  // initialize error code
-	int error = 0; 
-	int phase = 33;
-  int n = static_cast<int> (nEq);
-	PARDISO(pt, &maxfct, &mnum, &mtype, &phase,	&n, matrix->getValuesArray(),
-      (int*) matrix->getIofeirArray(),
-      (int*) matrix->getColumnsArray(),
-			NULL, &nrhs, iparm, &msglvl, rhs, unknowns, &error);
+	PardisoInt error = callPARDISO(33, matrix, NULL, rhs, unknowns);
 
 	CHECK(error == 0) << "ERROR during solution. Error code = " << error;
 }
@@ -166,31 +537,33 @@ void PARDISO_equationSolver::substituteEquations(math::SparseSymMatrix* matrix,
 
 void PARDISO_equationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
   TIMED_SCOPE(t, "factorizeEquations");
-  if (firstRun) {
-    initializePARDISO(matrix);
+  if (!isAnalysed(matrix)) {
+    analyseEquations(matrix);
   }
-  firstRun = false;
 
   CHECK(nEq == matrix->nRows());
   
-	int phase;
-
-  // initialize error code
-	int error = 0; 
-
 	// phase 22 is the numerical factorization
-	phase = 22;
-  int n = static_cast<int> (nEq);
-
-	PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, matrix->getValuesArray(), 
-      (int*) matrix->getIofeirArray(),
-      (int*) matrix->getColumnsArray(),
-			NULL, &nrhs, iparm, &msglvl, NULL, NULL, &error);
+	PardisoInt error = callPARDISO(22, matrix, NULL, NULL, NULL);
   CHECK(error == 0) << "ERROR during numerical factorization. Error code = " << error;
 
 }
 
-void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
+void PARDISO_equationSolver::analyseEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "analyseEquations");
+  // drop the previous analysis (if any)
+  releasePARDISO();
+
+#ifdef NLA3D_64BIT_INDEX
+  const uint32* columns = matrix->getColumnsArray();
+  columns64.assign(columns, columns + matrix->nValues());
+#else
+  // PARDISO's int arrays can't address more entries
+  LOG_IF(matrix->nValues() >= static_cast<uindex>(std::numeric_limits<int>::max()), FATAL)
+    << "Too many entries for PARDISO (" << matrix->nValues() << "), build nla3d with "
+    << "nla3d_64bit_index";
+#endif
+
 	for (uint16 i = 0; i < 64; i++) {
     iparm[i]=0;
   }
@@ -204,6 +577,17 @@ void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
 	iparm[2] = MKL_Get_Max_Threads();
 	iparm[3] = 0; //no iterative-direct algorithm
 	iparm[4] = 0; //no user fill-in reducing permutation
+  if (ordering != OrderingMethod::Auto) {
+    // use our fill-reducing ordering instead of METIS one
+    std::vector<uint32> order;
+    fillReducingOrdering(matrix, ordering, order);
+    perm.resize(order.size());
+    for (uint32 k = 0; k < order.size(); k++) {
+      // perm[i] - position (1-based) of i-th row of A in the permuted matrix
+      perm[order[k]] = k + 1;
+    }
+    iparm[4] = 1;
+  }
 	iparm[5] = 0; //write solution into x
 	iparm[6] = 16; //default logical fortran unit number for output
 	iparm[7] = 2; //max numbers of iterative refinement steps
@@ -213,6 +597,22 @@ void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
 	iparm[17]=-1; //output: number of nonzeros in the factor LU
 	iparm[18]=-1; //output: MFLOPS for LU factorization
 	iparm[19] = 0; //output: number of CG Iterations
+  if (outOfCore) {
+    // out-of-core mode: PARDISO takes the scratch path and the memory limit (in MB) from
+    // environment variables
+    iparm[59] = 2;
+    std::string oocPath = scratchDirectory + "/nla3d_pardiso_ooc";
+    std::string oocSize = std::to_string(memoryBudget);
+#ifdef _WIN32
+    _putenv_s("MKL_PARDISO_OOC_PATH", oocPath.c_str());
+    _putenv_s("MKL_PARDISO_OOC_MAX_CORE_SIZE", oocSize.c_str());
+    _putenv_s("MKL_PARDISO_OOC_KEEP_FILE", "0");
+#else
+    setenv("MKL_PARDISO_OOC_PATH", oocPath.c_str(), 1);
+    setenv("MKL_PARDISO_OOC_MAX_CORE_SIZE", oocSize.c_str(), 1);
+    setenv("MKL_PARDISO_OOC_KEEP_FILE", "0", 1);
+#endif
+  }
 
   LOG_IF(!isSymmetric, FATAL) << "For now PARDISO_equationSolver doesn't support non-symmetric matrices";
 	if (isPositive) {
@@ -223,31 +623,47 @@ void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
     mtype = -2;
   }
 
-  nEq = matrix->nRows();
-  int n = static_cast<int> (nEq);
-
-  // initialize error code
-	int error = 0; 
+  EquationSolver::analyseEquations(matrix);
 
-  int phase = 11;
-
-  PARDISO(pt, &maxfct, &mnum, &mtype,&phase, &n, matrix->getValuesArray(),
-     (int*) matrix->getIofeirArray(), 
-     (int*) matrix->getColumnsArray(), 
-			NULL, &nrhs, iparm, &msglvl, NULL, NULL, &error);
+  PardisoInt error = callPARDISO(11, matrix, (iparm[4] == 1) ? perm.data() : NULL, NULL, NULL);
   CHECK(error == 0) << "ERROR during symbolic factorization. Error code = " << error;
+  initialized = true;
   LOG(INFO) << "Number of nonzeros in factors = " << iparm[17] << ", number of factorization MFLOPS = " << iparm[18];
 }
 
 void PARDISO_equationSolver::releasePARDISO () {
-  int phase = -1;
-  int n = static_cast<int> (nEq);
+  if (!initialized) {
+    return;
+  }
+  initialized = false;
 
-  // initialize error code
-	int error = 0; 
 	//Termination and release of memory
-	PARDISO(pt, &maxfct, &mnum, &mtype, &phase,	&n, NULL, NULL, NULL, NULL, &nrhs, iparm, &msglvl, NULL, NULL, &error);
+	PardisoInt error = callPARDISO(-1, nullptr, NULL, NULL, NULL);
   LOG_IF (error != 0, WARNING) << "ERROR during PARDISO termination. Error code = " << error;
+#ifdef NLA3D_64BIT_INDEX
+  std::vector<PardisoInt>().swap(columns64);
+#endif
+}
+
+
+PARDISO_equationSolver::PardisoInt PARDISO_equationSolver::callPARDISO(PardisoInt phase,
+    math::SparseSymMatrix* matrix, PardisoInt* permutation, double* rhs, double* unknowns) {
+  PardisoInt n = static_cast<PardisoInt>(nEq);
+  PardisoInt nrhsInt = static_cast<PardisoInt>(nrhs);
+  PardisoInt error = 0;
+  double* a = matrix ? matrix->getValuesArray() : NULL;
+  // iofeir has uindex type which has the same size as PardisoInt
+  PardisoInt* ia = matrix ? reinterpret_cast<PardisoInt*>(matrix->getIofeirArray()) : NULL;
+#ifdef NLA3D_64BIT_INDEX
+  PardisoInt* ja = matrix ? columns64.data() : NULL;
+  pardiso_64(pt, &maxfct, &mnum, &mtype, &phase, &n, a, ia, ja, permutation, &nrhsInt, iparm,
+             &msglvl, rhs, unknowns, &error);
+#else
+  PardisoInt* ja = matrix ? reinterpret_cast<PardisoInt*>(matrix->getColumnsArray()) : NULL;
+  PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, a, ia, ja, permutation, &nrhsInt, iparm,
+          &msglvl, rhs, unknowns, &error);
+#endif
+  return error;
 }
 #endif //NLA3D_USE_MKL
 
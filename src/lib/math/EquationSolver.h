@@ -6,6 +6,9 @@
 #include "sys.h"
 #include "math/Mat.h"
 #include "math/SparseMatrix.h"
+#include "math/BsrMatrix.h"
+#include "math/LinearOperator.h"
+#include "math/SupernodalLDLT.h"
 
 namespace nla3d {
 
@@ -15,15 +18,51 @@ class SparseSymMatrix;
 
 // EquationSolver - abstract class for solving a system of linear equations.
 // This class primarly used in FESolver class.
-
+//
+// The solution is split into three phases:
+// 1. analyseEquations(..) - symbolic phase which depends only on the sparsity of the matrix
+//    (ordering, elimination tree, memory allocation). It's done once for the sparsity: the
+//    sparsity of K in FEStorage never changes after FEStorage::initSolutionData().
+// 2. factorizeEquations(..) - numerical factorization for the current values of the matrix.
+//    Performs analyseEquations(..) by itself if the sparsity wasn't analysed yet.
+// 3. substituteEquations(..) - solution for right hand sides with the last factorization.
+// solveEquations(..) performs factorization and substitution.
+//
+// substituteEquations(..) solves nrhs right hand sides at once (see setNumberOfRhs(..)). Right
+// hand sides and unknowns are stored one after another: rhs[0..nEq-1] is the first one,
+// rhs[nEq..2*nEq-1] - the second one and so on.
+//
+// The matrix could be given in BSR format (see FEStorage::setBlockStorage(..)). Solvers which
+// can't work with BsrSymMatrix stop with a fatal error.
 class EquationSolver {
 public:
   virtual ~EquationSolver() { };
-  virtual void solveEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns) = 0;
+  virtual void solveEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void analyseEquations(math::SparseSymMatrix* matrix);
   virtual void factorizeEquations(math::SparseSymMatrix* matrix) = 0;
   virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns) = 0;
+  // true if the sparsity of the matrix was already analysed
+  bool isAnalysed(math::SparseSymMatrix* matrix);
+  // the same for the matrix in BSR format
+  virtual void solveEquations(math::BsrSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void analyseEquations(math::BsrSymMatrix* matrix);
+  virtual void factorizeEquations(math::BsrSymMatrix* matrix);
+  virtual void substituteEquations(math::BsrSymMatrix* matrix, double* rhs, double* unknowns);
+  bool isAnalysed(math::BsrSymMatrix* matrix);
+  // number of performed symbolic analyses
+  uint32 getNumberOfAnalyses();
+  // The properties below are used in symbolic analysis, changing them drops the analysis
   void setSymmetric (bool symmetric = true);
   void setPositive (bool positive = true);
+  // fill-reducing ordering for direct solvers (see math/Ordering.h)
+  void setOrdering (OrderingMethod method);
+  // number of right hand sides for the following substitutions
+  void setNumberOfRhs (uint32 n);
+  uint32 getNumberOfRhs ();
+  // out-of-core mode for direct solvers: the factor is kept in scratch files in scratchDirectory
+  // and only memoryBudget megabytes of it are held in memory
+  void setOutOfCore (bool outOfCore, const std::string& scratchDirectory = ".",
+      uint64 memoryBudget = 2048);
 protected:
   uint32 nEq = 0;
 
@@ -31,47 +70,137 @@ protected:
 	int nrhs = 1; 
   bool isSymmetric = true;
   bool isPositive = true;
+  OrderingMethod ordering = OrderingMethod::Auto;
+  bool outOfCore = false;
+  std::string scratchDirectory = ".";
+  // in megabytes
+  uint64 memoryBudget = 2048;
+
+  // sparsity of the matrix which was used in the last symbolic analysis (the block graph for
+  // BsrSymMatrix)
+  std::shared_ptr<SparsityInfo> analysedSparsity;
+  uint32 numberOfAnalyses = 0;
 };
 
+// GaussDenseEquationSolver - dense LU decomposition with partial pivoting. Dedicated to functional
+// tests with small number of equations.
 class GaussDenseEquationSolver : public EquationSolver {
 public:
   virtual ~GaussDenseEquationSolver() { };
-  virtual void solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void analyseEquations(math::SparseSymMatrix* matrix);
   virtual void factorizeEquations(math::SparseSymMatrix* matrix);
   virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
   static bool _solve(double* X, double* A, double* B, int n);
 protected:
 
+  // LU factors (row-major, L has unit diagonal)
   dMat matA = dMat(1, 1);
+  // pivots[i] - row which was swapped with row i on i-th step
+  std::vector<uint32> pivots;
+};
+
+// LDLTEquationSolver - native multithreaded sparse direct solver based on SupernodalLDLT. Handles
+// positive definite and indefinite (like MPC Lagrange multipliers) symmetric matrices.
+//
+// In mixed precision mode the matrix is factorized in single precision (half of the factor
+// memory) and the double precision accuracy of the solution is restored by iterative refinement
+// with the double matrix. If refinement stagnates, the matrix is refactorized in double precision
+// and the solver stays in double precision for all following factorizations.
+//
+// In out-of-core mode (see EquationSolver::setOutOfCore(..)) the factor is kept in a scratch file
+// and only the memory budget of it is held in memory (see SupernodalLDLT).
+class LDLTEquationSolver : public EquationSolver {
+public:
+  virtual ~LDLTEquationSolver() { };
+  virtual void analyseEquations(math::SparseSymMatrix* matrix);
+  virtual void factorizeEquations(math::SparseSymMatrix* matrix);
+  virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void analyseEquations(math::BsrSymMatrix* matrix);
+  virtual void factorizeEquations(math::BsrSymMatrix* matrix);
+  virtual void substituteEquations(math::BsrSymMatrix* matrix, double* rhs, double* unknowns);
+
+  // number of threads for numerical factorization (0 - all threads of the ThreadPool)
+  void setNumberOfThreads(uint16 threads);
+
+  // number of iterative refinement steps in the last substitution (maximum among all rhs)
+  uint16 getNumberOfRefinementSteps();
+  // true if mixed precision mode fell back to double precision factorization
+  bool isFallenBackToDouble();
+
+  // maximum number of iterative refinement steps. Refinement is performed only if some pivots
+  // were perturbed during factorization.
+  uint16 maxRefinementSteps = 2;
+
+  // factorize in single precision and refine the solution to double precision
+  bool mixedPrecision = false;
+  // maximum number of iterative refinement steps in mixed precision mode
+  uint16 maxMixedRefinementSteps = 30;
+protected:
+  // factorization and substitution for both matrix formats (M is SparseSymMatrix or
+  // BsrSymMatrix), `factorized` is the copy of the factorized matrix
+  template <typename M>
+  void factorizeMatrix(M* matrix, std::unique_ptr<M>& factorized);
+  template <typename M>
+  void substituteMatrix(M* matrix, std::unique_ptr<M>& factorized, double* rhs, double* unknowns);
+  // iterative refinement x += A^-1 * (b - A * x) of one rhs. Stops when the residual reaches
+  // double precision level. Returns false if the residual isn't reduced at least twice per step.
+  bool refineSolution(math::LinearOperator* op, const double* b, double* x, uint16 maxSteps);
+
+  SupernodalLDLT ldlt;
+  // copy of the factorized matrix, kept if the solution needs refinement. The matrix passed to
+  // substituteEquations(..) can have other values (reused factorization, see
+  // NonlinearFESolver::strategy), refinement is done against the factorized one.
+  std::unique_ptr<math::SparseSymMatrix> factorizedMatrix;
+  std::unique_ptr<math::BsrSymMatrix> factorizedBlockMatrix;
+  // max norm of the factorized matrix (max row sum)
+  double matrixNorm = 0.0;
+  uint16 refinementSteps = 0;
+  bool fallenBackToDouble = false;
 };
 
 #ifdef NLA3D_USE_MKL
+// PARDISO_equationSolver - MKL PARDISO direct solver. With nla3d_64bit_index the 64-bit interface
+// (pardiso_64) is used, so matrices can have more than 2^31 non-zeros.
 class PARDISO_equationSolver : public EquationSolver {
 public:
   virtual ~PARDISO_equationSolver();
-  virtual void solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void analyseEquations(math::SparseSymMatrix* matrix);
   virtual void factorizeEquations(math::SparseSymMatrix* matrix);
   virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
 protected:
-  void initializePARDISO (math::SparseSymMatrix* matrix);
+#ifdef NLA3D_64BIT_INDEX
+  typedef long long PardisoInt;
+#else
+  typedef int PardisoInt;
+#endif
   void releasePARDISO ();
+  // call PARDISO phase for the matrix (nullptr for termination), return the error code
+  PardisoInt callPARDISO(PardisoInt phase, math::SparseSymMatrix* matrix, PardisoInt* permutation,
+                         double* rhs, double* unknowns);
 
   // Internal solver memory pointer pt
 	void *pt[64]; 
   // Paramaters for PARDISO solver (see MKL manual for clarifications)
-	int iparm[64];
+	PardisoInt iparm[64];
 
   // maximum number of numerical factorizations
-	int maxfct = 1; 
+	PardisoInt maxfct = 1; 
 
   // which factorization to use
-	int mnum = 1; 
+	PardisoInt mnum = 1; 
   // don't print statistical information in file
-	int msglvl = 0; 
+	PardisoInt msglvl = 0; 
   
-  bool firstRun = true;
+  // PARDISO internal memory is initialized
+  bool initialized = false;
+  // user fill-reducing permutation (1-based), used if ordering isn't OrderingMethod::Auto
+  std::vector<PardisoInt> perm;
+#ifdef NLA3D_64BIT_INDEX
+  // 64-bit copy of the columns array of the analysed matrix (iofeir is already 64-bit)
+  std::vector<PardisoInt> columns64;
+#endif
   // real symmetric undifinite defined matrix
-	int mtype = -2; 
+	PardisoInt mtype = -2; 
 };
 #endif //NLA3D_USE_MKL
 
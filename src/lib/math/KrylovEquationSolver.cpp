@@ -0,0 +1,400 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/KrylovEquationSolver.h"
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+double dot(uint32 n, const double* a, const double* b) {
+  double s = 0.0;
+  for (uint32 i = 0; i < n; i++) {
+    s += a[i] * b[i];
+  }
+  return s;
+}
+
+
+double norm(uint32 n, const double* a) {
+  return sqrt(dot(n, a, a));
+}
+
+
+// y += alpha * x
+void axpy(uint32 n, double alpha, const double* x, double* y) {
+  for (uint32 i = 0; i < n; i++) {
+    y[i] += alpha * x[i];
+  }
+}
+
+} // anonymous namespace
+
+
+void KrylovEquationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  if (!isAnalysed(matrix)) {
+    LOG_IF(!isSymmetric, FATAL) << "For now " << getName() << " doesn't support non-symmetric matrices";
+    analyseEquations(matrix);
+  }
+  if (preconditioner) {
+    preconditioner->setup(matrix);
+  }
+}
+
+
+void KrylovEquationSolver::substituteEquations(math::SparseSymMatrix* matrix,
+                                               double* rhs, double* unknowns) {
+  SparseMatrixOperator op(matrix);
+  substituteEquations(&op, rhs, unknowns);
+}
+
+
+void KrylovEquationSolver::factorizeEquations(math::BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  if (!isAnalysed(matrix)) {
+    LOG_IF(!isSymmetric, FATAL) << "For now " << getName() << " doesn't support non-symmetric matrices";
+    analyseEquations(matrix);
+  }
+  if (preconditioner) {
+    preconditioner->setup(matrix);
+  }
+}
+
+
+void KrylovEquationSolver::substituteEquations(math::BsrSymMatrix* matrix,
+                                               double* rhs, double* unknowns) {
+  // the products are done by the BSR matrix itself
+  substituteEquations(static_cast<LinearOperator*>(matrix), rhs, unknowns);
+}
+
+
+void KrylovEquationSolver::solveEquations(LinearOperator* op, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "solveEquations");
+  factorizeEquations(op);
+  substituteEquations(op, rhs, unknowns);
+}
+
+
+void KrylovEquationSolver::factorizeEquations(LinearOperator* op) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  LOG_IF(!isSymmetric, FATAL) << "For now " << getName() << " doesn't support non-symmetric matrices";
+  // there is no sparsity to analyse
+  nEq = op->nRows();
+  analysedSparsity.reset();
+  if (preconditioner) {
+    preconditioner->setup(op);
+  }
+}
+
+
+void KrylovEquationSolver::substituteEquations(LinearOperator* op, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "substituteEquations");
+  CHECK(nEq == op->nRows());
+
+  for (int r = 0; r < nrhs; r++) {
+    double* b = rhs + static_cast<uint64>(nEq) * r;
+    double* x = unknowns + static_cast<uint64>(nEq) * r;
+    if (!useInitialGuess) {
+      std::fill_n(x, nEq, 0.0);
+    }
+    iterations = 0;
+    residualHistory.clear();
+
+    iterate(op, b, x);
+
+    // check the true residual
+    std::vector<double> res(nEq);
+    double bnorm = norm(nEq, b);
+    double rnorm = computeResidual(op, b, x, res.data());
+    residual = (bnorm > 0.0) ? rnorm / bnorm : rnorm;
+    // allow the true residual to be slightly above the tolerance due to round-off
+    converged = (residual <= 10.0 * tolerance);
+
+    LOG(INFO) << getName() << (preconditioner ? "+" + preconditioner->getName() : "")
+      << ": iterations = " << iterations << ", relative residual = " << residual;
+    if (!converged) {
+      LOG_IF(failOnDivergence, FATAL) << getName() << " didn't converge in " << maxIterations
+        << " iterations";
+      LOG(WARNING) << getName() << " didn't converge in " << maxIterations << " iterations";
+    }
+  }
+}
+
+
+void KrylovEquationSolver::attachPreconditioner(Preconditioner* prec) {
+  preconditioner = prec;
+}
+
+
+Preconditioner* KrylovEquationSolver::getPreconditioner() {
+  return preconditioner;
+}
+
+
+uint32 KrylovEquationSolver::getNumberOfIterations() {
+  return iterations;
+}
+
+
+double KrylovEquationSolver::getResidual() {
+  return residual;
+}
+
+
+const std::vector<double>& KrylovEquationSolver::getResidualHistory() {
+  return residualHistory;
+}
+
+
+bool KrylovEquationSolver::isConverged() {
+  return converged;
+}
+
+
+void KrylovEquationSolver::precondition(const double* r, double* z) {
+  if (preconditioner) {
+    preconditioner->apply(r, z);
+  } else {
+    std::copy(r, r + nEq, z);
+  }
+}
+
+
+void KrylovEquationSolver::matVec(LinearOperator* op, const double* x, double* y) {
+  op->multiply(x, y);
+}
+
+
+double KrylovEquationSolver::computeResidual(LinearOperator* op, const double* b,
+    const double* x, double* r) {
+  op->multiply(x, r);
+  for (uint32 i = 0; i < nEq; i++) {
+    r[i] = b[i] - r[i];
+  }
+  return norm(nEq, r);
+}
+
+
+std::string CGEquationSolver::getName() {
+  return "CG";
+}
+
+
+void CGEquationSolver::iterate(LinearOperator* op, const double* b, double* x) {
+  LOG_IF(preconditioner && !preconditioner->isPositive(), WARNING)
+    << "CG requires positive definite preconditioner";
+  uint32 n = nEq;
+  std::vector<double> r(n), z(n), p(n), q(n);
+
+  double bnorm = norm(n, b);
+  if (bnorm == 0.0) {
+    std::fill_n(x, n, 0.0);
+    return;
+  }
+  double rnorm = computeResidual(op, b, x, r.data());
+  residualHistory.push_back(rnorm / bnorm);
+  if (rnorm <= tolerance * bnorm) return;
+
+  precondition(r.data(), z.data());
+  p = z;
+  double rz = dot(n, r.data(), z.data());
+
+  while (iterations < maxIterations) {
+    iterations++;
+    matVec(op, p.data(), q.data());
+    double pq = dot(n, p.data(), q.data());
+    if (pq == 0.0) break;
+    double alpha = rz / pq;
+    axpy(n, alpha, p.data(), x);
+    axpy(n, -alpha, q.data(), r.data());
+
+    rnorm = norm(n, r.data());
+    residualHistory.push_back(rnorm / bnorm);
+    if (rnorm <= tolerance * bnorm) break;
+
+    precondition(r.data(), z.data());
+    double rzNew = dot(n, r.data(), z.data());
+    double beta = rzNew / rz;
+    rz = rzNew;
+    for (uint32 i = 0; i < n; i++) {
+      p[i] = z[i] + beta * p[i];
+    }
+  }
+}
+
+
+std::string MINRESEquationSolver::getName() {
+  return "MINRES";
+}
+
+
+void MINRESEquationSolver::iterate(LinearOperator* op, const double* b, double* x) {
+  LOG_IF(preconditioner && !preconditioner->isPositive(), FATAL)
+    << "MINRES requires positive definite preconditioner";
+  uint32 n = nEq;
+  std::vector<double> r1(n), r2(n), y(n), v(n), w(n, 0.0), w1(n), w2(n, 0.0);
+
+  if (norm(n, b) == 0.0) {
+    std::fill_n(x, n, 0.0);
+    return;
+  }
+  computeResidual(op, b, x, r1.data());
+  precondition(r1.data(), y.data());
+  double beta1 = dot(n, r1.data(), y.data());
+  CHECK(beta1 >= 0.0) << "MINRES: preconditioner is not positive definite";
+  beta1 = sqrt(beta1);
+  if (beta1 == 0.0) return;
+  residualHistory.push_back(1.0);
+  r2 = r1;
+
+  double oldb = 0.0;
+  double beta = beta1;
+  double dbar = 0.0;
+  double epsln = 0.0;
+  double phibar = beta1;
+  double cs = -1.0;
+  double sn = 0.0;
+  const double eps = std::numeric_limits<double>::epsilon();
+
+  while (iterations < maxIterations) {
+    iterations++;
+    // Lanczos step
+    double s = 1.0 / beta;
+    for (uint32 i = 0; i < n; i++) {
+      v[i] = s * y[i];
+    }
+    matVec(op, v.data(), y.data());
+    if (iterations >= 2) {
+      axpy(n, -beta / oldb, r1.data(), y.data());
+    }
+    double alfa = dot(n, v.data(), y.data());
+    axpy(n, -alfa / beta, r2.data(), y.data());
+    std::swap(r1, r2);
+    r2 = y;
+    precondition(r2.data(), y.data());
+    oldb = beta;
+    beta = dot(n, r2.data(), y.data());
+    CHECK(beta >= 0.0) << "MINRES: preconditioner is not positive definite";
+    beta = sqrt(beta);
+
+    // apply previous rotation and compute the new one
+    double oldeps = epsln;
+    double delta = cs * dbar + sn * alfa;
+    double gbar = sn * dbar - cs * alfa;
+    epsln = sn * beta;
+    dbar = -cs * beta;
+    double gamma = std::max(sqrt(gbar * gbar + beta * beta), eps);
+    cs = gbar / gamma;
+    sn = beta / gamma;
+    double phi = cs * phibar;
+    phibar = sn * phibar;
+
+    // update solution
+    double denom = 1.0 / gamma;
+    std::swap(w1, w2);
+    std::swap(w2, w);
+    for (uint32 i = 0; i < n; i++) {
+      w[i] = (v[i] - oldeps * w1[i] - delta * w2[i]) * denom;
+    }
+    axpy(n, phi, w.data(), x);
+
+    // phibar is the norm of preconditioned residual
+    residualHistory.push_back(phibar / beta1);
+    if (phibar <= tolerance * beta1 || beta == 0.0) break;
+  }
+}
+
+
+std::string GMRESEquationSolver::getName() {
+  return "GMRES(" + toStr(restart) + ")";
+}
+
+
+void GMRESEquationSolver::iterate(LinearOperator* op, const double* b, double* x) {
+  uint32 n = nEq;
+  uint32 m = std::max(restart, 1u);
+  // Krylov basis and Hessenberg matrix (column-major, (m + 1) x m)
+  std::vector<double> V(static_cast<uint64>(m + 1) * n);
+  std::vector<double> H(static_cast<uint64>(m + 1) * m);
+  std::vector<double> cs(m), sn(m), g(m + 1), yk(m);
+  std::vector<double> r(n), z(n), w(n);
+
+  double bnorm = norm(n, b);
+  if (bnorm == 0.0) {
+    std::fill_n(x, n, 0.0);
+    return;
+  }
+  double beta = computeResidual(op, b, x, r.data());
+  residualHistory.push_back(beta / bnorm);
+
+  while (beta > tolerance * bnorm && iterations < maxIterations) {
+    for (uint32 i = 0; i < n; i++) {
+      V[i] = r[i] / beta;
+    }
+    std::fill(g.begin(), g.end(), 0.0);
+    g[0] = beta;
+
+    uint32 k = 0;
+    while (k < m && iterations < maxIterations) {
+      iterations++;
+      double* vk = &V[static_cast<uint64>(k) * n];
+      double* vk1 = &V[static_cast<uint64>(k + 1) * n];
+      double* hk = &H[static_cast<uint64>(k) * (m + 1)];
+      // Arnoldi process with modified Gram-Schmidt
+      precondition(vk, z.data());
+      matVec(op, z.data(), w.data());
+      for (uint32 i = 0; i <= k; i++) {
+        hk[i] = dot(n, w.data(), &V[static_cast<uint64>(i) * n]);
+        axpy(n, -hk[i], &V[static_cast<uint64>(i) * n], w.data());
+      }
+      hk[k + 1] = norm(n, w.data());
+      if (hk[k + 1] != 0.0) {
+        for (uint32 i = 0; i < n; i++) {
+          vk1[i] = w[i] / hk[k + 1];
+        }
+      }
+      // Givens rotations
+      for (uint32 i = 0; i < k; i++) {
+        double t = cs[i] * hk[i] + sn[i] * hk[i + 1];
+        hk[i + 1] = -sn[i] * hk[i] + cs[i] * hk[i + 1];
+        hk[i] = t;
+      }
+      double denom = sqrt(hk[k] * hk[k] + hk[k + 1] * hk[k + 1]);
+      cs[k] = (denom != 0.0) ? hk[k] / denom : 1.0;
+      sn[k] = (denom != 0.0) ? hk[k + 1] / denom : 0.0;
+      hk[k] = denom;
+      hk[k + 1] = 0.0;
+      g[k + 1] = -sn[k] * g[k];
+      g[k] = cs[k] * g[k];
+      k++;
+
+      residualHistory.push_back(fabs(g[k]) / bnorm);
+      if (fabs(g[k]) <= tolerance * bnorm || denom == 0.0) break;
+    }
+
+    // solve H * y = g and update x += M^-1 * V * y
+    for (int32 i = (int32) k - 1; i >= 0; i--) {
+      double s = g[i];
+      for (uint32 j = i + 1; j < k; j++) {
+        s -= H[static_cast<uint64>(j) * (m + 1) + i] * yk[j];
+      }
+      yk[i] = s / H[static_cast<uint64>(i) * (m + 1) + i];
+    }
+    std::fill(w.begin(), w.end(), 0.0);
+    for (uint32 j = 0; j < k; j++) {
+      axpy(n, yk[j], &V[static_cast<uint64>(j) * n], w.data());
+    }
+    precondition(w.data(), z.data());
+    axpy(n, 1.0, z.data(), x);
+
+    beta = computeResidual(op, b, x, r.data());
+  }
+}
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,120 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/EquationSolver.h"
+#include "math/Preconditioner.h"
+#include "math/LinearOperator.h"
+#include "math/BsrMatrix.h"
+
+namespace nla3d {
+
+namespace math {
+
+// KrylovEquationSolver - base class for iterative (Krylov subspace) equation solvers. The solvers
+// work directly with CSR arrays of SparseSymMatrix and need only O(nnz) memory. factorizeEquations
+// only builds the attached Preconditioner (if any), substituteEquations performs the iterations.
+// Tolerance is relative to the rhs norm: ||b - A*x|| <= tolerance * ||b||. The statistics of the
+// last substitution (number of iterations, final residual and residual history) are available
+// through getters.
+//
+// The solvers need only products A * x, so they could work with a LinearOperator which isn't
+// assembled into a matrix (matrix-free solution). In this case only preconditioners which can be
+// built from the operator are allowed (like JacobiPreconditioner). BsrSymMatrix is such an
+// operator with unrolled 3x3 block products; preconditioners are built from it by
+// Preconditioner::setup(BsrSymMatrix*).
+class KrylovEquationSolver : public EquationSolver {
+public:
+  virtual ~KrylovEquationSolver() { };
+  virtual void factorizeEquations(math::SparseSymMatrix* matrix);
+  virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void factorizeEquations(math::BsrSymMatrix* matrix);
+  virtual void substituteEquations(math::BsrSymMatrix* matrix, double* rhs, double* unknowns);
+
+  // the same for LinearOperator
+  using EquationSolver::solveEquations;
+  void solveEquations(LinearOperator* op, double* rhs, double* unknowns);
+  void factorizeEquations(LinearOperator* op);
+  void substituteEquations(LinearOperator* op, double* rhs, double* unknowns);
+
+  // preconditioner is not owned by the solver. nullptr means no preconditioning.
+  void attachPreconditioner(Preconditioner* prec);
+  Preconditioner* getPreconditioner();
+
+  virtual std::string getName() = 0;
+
+  // statistics of the last substitution (for the last rhs if nrhs > 1)
+  uint32 getNumberOfIterations();
+  // relative residual ||b - A*x|| / ||b||
+  double getResidual();
+  // relative residual estimate on every iteration
+  const std::vector<double>& getResidualHistory();
+  bool isConverged();
+
+  double tolerance = 1.0e-8;
+  uint32 maxIterations = 1000;
+  // use the values in unknowns as the initial guess, otherwise start from zero vector
+  bool useInitialGuess = false;
+  // fatal error if the solver doesn't converge in maxIterations
+  bool failOnDivergence = false;
+
+protected:
+  // run iterations for one rhs. Should fill iterations, residualHistory.
+  virtual void iterate(LinearOperator* op, const double* b, double* x) = 0;
+
+  // z = M^-1 * r
+  void precondition(const double* r, double* z);
+  // y = A * x
+  void matVec(LinearOperator* op, const double* x, double* y);
+  // r = b - A * x, returns ||r||
+  double computeResidual(LinearOperator* op, const double* b, const double* x, double* r);
+
+  Preconditioner* preconditioner = nullptr;
+
+  uint32 iterations = 0;
+  double residual = 0.0;
+  std::vector<double> residualHistory;
+  bool converged = false;
+};
+
+
+// Preconditioned conjugate gradient method. For symmetric positive definite matrices and
+// preconditioners.
+class CGEquationSolver : public KrylovEquationSolver {
+public:
+  virtual ~CGEquationSolver() { };
+  virtual std::string getName();
+protected:
+  virtual void iterate(LinearOperator* op, const double* b, double* x);
+};
+
+
+// Preconditioned MINRES method (Paige & Saunders). For symmetric indefinite matrices (like ones
+// with MPC Lagrange multipliers), preconditioner should be positive definite.
+class MINRESEquationSolver : public KrylovEquationSolver {
+public:
+  virtual ~MINRESEquationSolver() { };
+  virtual std::string getName();
+protected:
+  virtual void iterate(LinearOperator* op, const double* b, double* x);
+};
+
+
+// Restarted GMRES(restart) method with right preconditioning. Works with any non-singular matrix
+// and any preconditioner (like indefinite ILDL(0)).
+class GMRESEquationSolver : public KrylovEquationSolver {
+public:
+  virtual ~GMRESEquationSolver() { };
+  virtual std::string getName();
+
+  // dimension of Krylov subspace before restart
+  uint32 restart = 50;
+protected:
+  virtual void iterate(LinearOperator* op, const double* b, double* x);
+};
+
+} // namespace math
+
+} // namespace nla3d
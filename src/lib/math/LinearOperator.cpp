@@ -0,0 +1,34 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/LinearOperator.h"
+
+namespace nla3d {
+
+namespace math {
+
+SparseMatrixOperator::SparseMatrixOperator(SparseSymMatrix* _matrix) : matrix(CHECK_NOTNULL(_matrix)) {
+}
+
+
+uint32 SparseMatrixOperator::nRows() {
+  return matrix->nRows();
+}
+
+
+void SparseMatrixOperator::multiply(const double* x, double* y) {
+  std::fill_n(y, matrix->nRows(), 0.0);
+  matBVprod(*matrix, x, 1.0, y);
+}
+
+
+void SparseMatrixOperator::diagonal(double* d) {
+  for (uint32 i = 0; i < matrix->nRows(); i++) {
+    d[i] = matrix->value(i + 1, i + 1);
+  }
+}
+
+} // namespace math
+
+} // namespace nla3d
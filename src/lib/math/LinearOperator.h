@@ -0,0 +1,42 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+
+namespace nla3d {
+
+namespace math {
+
+// LinearOperator - symmetric operator A which is known only by its action on a vector y = A * x
+// (like the stiffness matrix of FE model multiplied element by element without assembly).
+// Krylov equation solvers work with LinearOperator (see KrylovEquationSolver), assembled
+// matrices are wrapped into SparseMatrixOperator.
+class LinearOperator {
+public:
+  virtual ~LinearOperator() { };
+  virtual uint32 nRows() = 0;
+  // y = A * x
+  virtual void multiply(const double* x, double* y) = 0;
+  // d[i] = A_ii
+  virtual void diagonal(double* d) = 0;
+};
+
+
+// SparseMatrixOperator - LinearOperator of the assembled SparseSymMatrix
+class SparseMatrixOperator : public LinearOperator {
+public:
+  SparseMatrixOperator(SparseSymMatrix* _matrix);
+  virtual ~SparseMatrixOperator() { };
+  virtual uint32 nRows();
+  virtual void multiply(const double* x, double* y);
+  virtual void diagonal(double* d);
+protected:
+  SparseSymMatrix* matrix;
+};
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,954 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/Ordering.h"
+#include <queue>
+#include <tuple>
+#include <algorithm>
+#include <random>
+#include <numeric>
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+// Undirected graph in CSR format (0-based, without self loops) with weights of vertices and
+// edges. Vertices of compressed and coarse graphs stand for several original vertices.
+struct Graph {
+  uint32 n = 0;
+  std::vector<uint32> ptr;
+  std::vector<uint32> adj;
+  std::vector<uint32> ewgt;
+  std::vector<uint32> vwgt;
+
+  uint64 totalWeight() const {
+    return std::accumulate(vwgt.begin(), vwgt.end(), static_cast<uint64>(0));
+  }
+};
+
+// subgraphs with less vertices are ordered by AMD in nested dissection
+const uint32 ndLeafSize = 120;
+// the graph is coarsened until the number of vertices is less than coarsestSize
+const uint32 coarsestSize = 100;
+// the heaviest part of the bisection can be maxImbalance times heavier than the half
+const double maxImbalance = 1.1;
+// number of initial bisections (from different seeds) on the coarsest graph
+const uint32 nInitialBisections = 4;
+// number of Fiduccia-Mattheyses passes on every level
+const uint32 nRefinementPasses = 6;
+// FM pass is stopped after this number of moves without improvement of the cut
+const uint32 maxMovesWithoutImprovement = 100;
+// Auto ordering uses nested dissection for graphs (after compression) with more vertices
+const uint32 autoNestedDissectionSize = 5000;
+
+
+// Approximate minimum degree ordering of the graph. Vertex weights are used as initial sizes of
+// supervariables. delayed[i] != 0 means that vertex i can't be eliminated until one of its
+// neighbours is eliminated. order - vertices of the graph in elimination order.
+void approximateMinimumDegree(const Graph& g, const std::vector<uint8>& delayed,
+    std::vector<uint32>& order) {
+  const uint32 n = g.n;
+  order.clear();
+  order.reserve(n);
+  if (n == 0) return;
+
+  enum : uint8 { VARIABLE, ELEMENT, ABSORBED };
+  std::vector<uint8> state(n, VARIABLE);
+  // elements adjacent to a variable
+  std::vector<std::vector<uint32>> elems(n);
+  // variables adjacent to a variable (or variables of an element)
+  std::vector<std::vector<uint32>> vars(n);
+  // variables merged into a supervariable
+  std::vector<std::vector<uint32>> members(n);
+  std::vector<uint32> nv(g.vwgt);
+  std::vector<uint32> deg(n, 0);
+  std::vector<uint8> waiting(delayed);
+
+  // dense rows are removed from the graph and ordered last
+  uint32 denseDegree = std::max(16u, static_cast<uint32>(10.0 * sqrt(static_cast<double>(n))));
+  std::vector<uint32> dense;
+  for (uint32 i = 0; i < n; i++) {
+    if (g.ptr[i + 1] - g.ptr[i] > denseDegree) {
+      state[i] = ABSORBED;
+      dense.push_back(i);
+    }
+  }
+
+  uint64 total = g.totalWeight();
+  uint64 live = 0;
+  for (uint32 i = 0; i < n; i++) {
+    if (state[i] != VARIABLE) continue;
+    for (uint32 k = g.ptr[i]; k < g.ptr[i + 1]; k++) {
+      uint32 j = g.adj[k];
+      if (state[j] != VARIABLE) continue;
+      vars[i].push_back(j);
+      deg[i] += nv[j];
+    }
+    live += nv[i];
+  }
+
+  // degree lists
+  uint64 mindeg = 0;
+  std::vector<int32> head(total + 1, -1);
+  std::vector<int32> next(n, -1);
+  std::vector<int32> prev(n, -1);
+  std::vector<uint8> inList(n, 0);
+  auto insert = [&](uint32 i) {
+    uint32 d = deg[i];
+    next[i] = head[d];
+    prev[i] = -1;
+    if (head[d] != -1) prev[head[d]] = i;
+    head[d] = i;
+    inList[i] = 1;
+    mindeg = std::min(mindeg, static_cast<uint64>(d));
+  };
+  auto remove = [&](uint32 i) {
+    if (prev[i] != -1) {
+      next[prev[i]] = next[i];
+    } else {
+      head[deg[i]] = next[i];
+    }
+    if (next[i] != -1) prev[next[i]] = prev[i];
+    inList[i] = 0;
+  };
+  for (uint32 i = 0; i < n; i++) {
+    if (state[i] == VARIABLE && !waiting[i]) insert(i);
+  }
+
+  std::vector<uint32> mark(n, 0);
+  uint32 stamp = 0;
+  std::vector<uint32> wStamp(n, 0);
+  std::vector<int64> w(n, 0);
+  std::vector<uint32> Lp;
+  std::vector<std::pair<uint64, uint32> > hashes;
+  uint64 eliminated = 0;
+
+  while (eliminated < live) {
+    while (mindeg <= total && head[mindeg] == -1) mindeg++;
+    if (mindeg > total) {
+      // only delayed variables without eliminated neighbours are left
+      for (uint32 i = 0; i < n; i++) {
+        if (state[i] == VARIABLE && !inList[i]) {
+          waiting[i] = 0;
+          insert(i);
+        }
+      }
+      continue;
+    }
+
+    // pivot p becomes the element with variables Lp. Elements adjacent to p are absorbed.
+    uint32 p = head[mindeg];
+    remove(p);
+    stamp++;
+    mark[p] = stamp;
+    Lp.clear();
+    int64 degP = 0;
+    for (uint32 e : elems[p]) {
+      if (state[e] != ELEMENT) continue;
+      for (uint32 i : vars[e]) {
+        if (state[i] == VARIABLE && mark[i] != stamp) {
+          mark[i] = stamp;
+          Lp.push_back(i);
+          degP += nv[i];
+        }
+      }
+      state[e] = ABSORBED;
+      std::vector<uint32>().swap(vars[e]);
+    }
+    for (uint32 i : vars[p]) {
+      if (state[i] == VARIABLE && mark[i] != stamp) {
+        mark[i] = stamp;
+        Lp.push_back(i);
+        degP += nv[i];
+      }
+    }
+    std::vector<uint32>().swap(elems[p]);
+    vars[p] = Lp;
+    state[p] = ELEMENT;
+    order.push_back(p);
+    order.insert(order.end(), members[p].begin(), members[p].end());
+    std::vector<uint32>().swap(members[p]);
+    eliminated += nv[p];
+
+    for (uint32 i : Lp) {
+      if (inList[i]) remove(i);
+      waiting[i] = 0;
+    }
+
+    // w[e] = |Le \ Lp| for all elements adjacent to Lp
+    for (uint32 i : Lp) {
+      for (uint32 e : elems[i]) {
+        if (state[e] != ELEMENT) continue;
+        if (wStamp[e] != stamp) {
+          wStamp[e] = stamp;
+          int64 we = 0;
+          auto& le = vars[e];
+          size_t k = 0;
+          for (uint32 j : le) {
+            if (state[j] == VARIABLE) {
+              le[k++] = j;
+              we += nv[j];
+            }
+          }
+          le.resize(k);
+          w[e] = we;
+        }
+        w[e] -= nv[i];
+      }
+    }
+
+    // approximate external degrees of Lp variables
+    for (uint32 i : Lp) {
+      int64 ext = 0;
+      auto& el = elems[i];
+      size_t k = 0;
+      for (uint32 e : el) {
+        if (state[e] != ELEMENT) continue;
+        if (w[e] <= 0) {
+          // aggressive absorption: Le is a subset of Lp
+          state[e] = ABSORBED;
+          std::vector<uint32>().swap(vars[e]);
+          continue;
+        }
+        ext += w[e];
+        el[k++] = e;
+      }
+      el.resize(k);
+      el.push_back(p);
+
+      auto& vl = vars[i];
+      k = 0;
+      for (uint32 j : vl) {
+        if (state[j] == VARIABLE && mark[j] != stamp) {
+          vl[k++] = j;
+          ext += nv[j];
+        }
+      }
+      vl.resize(k);
+
+      int64 d = ext + degP - nv[i];
+      d = std::min(d, static_cast<int64>(deg[i]) + degP - nv[i]);
+      d = std::min(d, static_cast<int64>(live - eliminated) - nv[i]);
+      deg[i] = static_cast<uint32>(std::max(d, static_cast<int64>(0)));
+    }
+
+    // mass elimination: merge indistinguishable variables of Lp into supervariables
+    hashes.clear();
+    for (uint32 i : Lp) {
+      uint64 h = 0;
+      for (uint32 e : elems[i]) h += e;
+      for (uint32 j : vars[i]) h += j;
+      hashes.push_back(std::make_pair(h, i));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    for (size_t a = 0; a < hashes.size(); ) {
+      size_t b = a + 1;
+      while (b < hashes.size() && hashes[b].first == hashes[a].first) b++;
+      for (size_t x = a; x + 1 < b; x++) {
+        uint32 i = hashes[x].second;
+        if (state[i] != VARIABLE) continue;
+        stamp++;
+        for (uint32 e : elems[i]) mark[e] = stamp;
+        for (uint32 j : vars[i]) mark[j] = stamp;
+        for (size_t y = x + 1; y < b; y++) {
+          uint32 j = hashes[y].second;
+          if (state[j] != VARIABLE || elems[j].size() != elems[i].size() ||
+              vars[j].size() != vars[i].size()) continue;
+          bool same = true;
+          for (uint32 e : elems[j]) {
+            if (mark[e] != stamp) { same = false; break; }
+          }
+          for (uint32 v : vars[j]) {
+            if (!same) break;
+            if (mark[v] != stamp) { same = false; break; }
+          }
+          if (!same) continue;
+          nv[i] += nv[j];
+          deg[i] = (deg[i] > nv[j]) ? deg[i] - nv[j] : 0;
+          state[j] = ABSORBED;
+          members[i].push_back(j);
+          members[i].insert(members[i].end(), members[j].begin(), members[j].end());
+          std::vector<uint32>().swap(members[j]);
+          std::vector<uint32>().swap(elems[j]);
+          std::vector<uint32>().swap(vars[j]);
+        }
+      }
+      a = b;
+    }
+
+    for (uint32 i : Lp) {
+      if (state[i] == VARIABLE) insert(i);
+    }
+  }
+
+  order.insert(order.end(), dense.begin(), dense.end());
+  assert(order.size() == n);
+}
+
+
+// Induced subgraph of the vertices with part[v] == side. label[k] - vertex of g which became
+// k-th vertex of sub.
+void extractSubgraph(const Graph& g, const std::vector<uint8>& part, uint8 side, Graph& sub,
+    std::vector<uint32>& label) {
+  std::vector<uint32> map(g.n, UINT32_MAX);
+  label.clear();
+  for (uint32 v = 0; v < g.n; v++) {
+    if (part[v] == side) {
+      map[v] = static_cast<uint32>(label.size());
+      label.push_back(v);
+    }
+  }
+  sub.n = static_cast<uint32>(label.size());
+  sub.ptr.assign(1, 0);
+  sub.adj.clear();
+  sub.ewgt.clear();
+  sub.vwgt.resize(sub.n);
+  for (uint32 k = 0; k < sub.n; k++) {
+    uint32 v = label[k];
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      uint32 u = map[g.adj[p]];
+      if (u == UINT32_MAX) continue;
+      sub.adj.push_back(u);
+      sub.ewgt.push_back(g.ewgt[p]);
+    }
+    sub.ptr.push_back(static_cast<uint32>(sub.adj.size()));
+    sub.vwgt[k] = g.vwgt[v];
+  }
+}
+
+
+// Coarsen the graph by heavy edge matching. cmap[v] - vertex of cg which contains v.
+void coarsen(const Graph& g, Graph& cg, std::vector<uint32>& cmap, uint64 maxVwgt, uint32 seed) {
+  const uint32 n = g.n;
+  std::vector<uint32> visit(n);
+  std::iota(visit.begin(), visit.end(), 0);
+  std::minstd_rand rng(seed);
+  std::shuffle(visit.begin(), visit.end(), rng);
+
+  std::vector<uint32> match(n, UINT32_MAX);
+  for (uint32 v : visit) {
+    if (match[v] != UINT32_MAX) continue;
+    uint32 best = v;
+    uint32 bestW = 0;
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      uint32 u = g.adj[p];
+      if (match[u] != UINT32_MAX || g.ewgt[p] <= bestW ||
+          static_cast<uint64>(g.vwgt[v]) + g.vwgt[u] > maxVwgt) continue;
+      best = u;
+      bestW = g.ewgt[p];
+    }
+    match[v] = best;
+    match[best] = v;
+  }
+
+  cmap.assign(n, UINT32_MAX);
+  std::vector<uint32> rep;
+  for (uint32 v = 0; v < n; v++) {
+    if (cmap[v] != UINT32_MAX) continue;
+    cmap[v] = cmap[match[v]] = static_cast<uint32>(rep.size());
+    rep.push_back(v);
+  }
+
+  cg.n = static_cast<uint32>(rep.size());
+  cg.ptr.assign(1, 0);
+  cg.adj.clear();
+  cg.ewgt.clear();
+  cg.vwgt.resize(cg.n);
+  std::vector<uint32> pos(cg.n, UINT32_MAX);
+  for (uint32 c = 0; c < cg.n; c++) {
+    uint32 start = static_cast<uint32>(cg.adj.size());
+    uint32 v = rep[c];
+    uint32 u = match[v];
+    cg.vwgt[c] = g.vwgt[v] + ((u != v) ? g.vwgt[u] : 0);
+    for (uint32 x : {v, u}) {
+      for (uint32 p = g.ptr[x]; p < g.ptr[x + 1]; p++) {
+        uint32 cy = cmap[g.adj[p]];
+        if (cy == c) continue;
+        if (pos[cy] != UINT32_MAX && pos[cy] >= start) {
+          cg.ewgt[pos[cy]] += g.ewgt[p];
+        } else {
+          pos[cy] = static_cast<uint32>(cg.adj.size());
+          cg.adj.push_back(cy);
+          cg.ewgt.push_back(g.ewgt[p]);
+        }
+      }
+      if (u == v) break;
+    }
+    CHECK(cg.adj.size() < UINT32_MAX) << "The compressed graph of the matrix is too big";
+    cg.ptr.push_back(static_cast<uint32>(cg.adj.size()));
+  }
+}
+
+
+// Fiduccia-Mattheyses refinement of the bisection (part[v] = 0 or 1). The weight of every part
+// is kept less or equal to maxPart if it was so before.
+void refineBisection(const Graph& g, std::vector<uint8>& part, uint64 maxPart) {
+  const uint32 n = g.n;
+  std::vector<int64> gain(n, 0);
+  uint64 pw[2] = {0, 0};
+  int64 cut = 0;
+  for (uint32 v = 0; v < n; v++) {
+    pw[part[v]] += g.vwgt[v];
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      if (part[g.adj[p]] != part[v]) {
+        gain[v] += g.ewgt[p];
+        cut += g.ewgt[p];
+      } else {
+        gain[v] -= g.ewgt[p];
+      }
+    }
+  }
+  cut /= 2;
+
+  auto move = [&](uint32 v) {
+    uint8 from = part[v];
+    part[v] = 1 - from;
+    pw[from] -= g.vwgt[v];
+    pw[1 - from] += g.vwgt[v];
+    cut -= gain[v];
+    gain[v] = -gain[v];
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      uint32 u = g.adj[p];
+      gain[u] += (part[u] == from) ? 2 * (int64) g.ewgt[p] : -2 * (int64) g.ewgt[p];
+    }
+  };
+  // infeasible bisections are worse than any feasible one, then the cut and the balance
+  // are compared
+  auto score = [&]() {
+    uint64 heavy = std::max(pw[0], pw[1]);
+    return std::make_tuple(heavy > maxPart ? 1 : 0, cut, heavy);
+  };
+
+  std::vector<uint8> locked(n);
+  std::vector<uint32> moves;
+  typedef std::pair<int64, uint32> HeapEntry;
+  for (uint32 pass = 0; pass < nRefinementPasses; pass++) {
+    std::fill(locked.begin(), locked.end(), 0);
+    moves.clear();
+    std::priority_queue<HeapEntry> heap[2];
+    for (uint32 v = 0; v < n; v++) {
+      // only boundary vertices are candidates initially
+      for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+        if (part[g.adj[p]] != part[v]) {
+          heap[part[v]].push(HeapEntry(gain[v], v));
+          break;
+        }
+      }
+    }
+    auto best = score();
+    size_t bestMoves = 0;
+    uint32 sinceBest = 0;
+    for (;;) {
+      int32 side = -1;
+      for (uint8 s = 0; s < 2; s++) {
+        while (!heap[s].empty()) {
+          const HeapEntry& top = heap[s].top();
+          if (locked[top.second] || part[top.second] != s || gain[top.second] != top.first) {
+            heap[s].pop();
+          } else {
+            break;
+          }
+        }
+        if (heap[s].empty()) continue;
+        uint32 v = heap[s].top().second;
+        bool fits = (pw[1 - s] + g.vwgt[v] <= maxPart) || (pw[s] > maxPart);
+        if (!fits) continue;
+        if (side == -1 || heap[s].top().first > heap[side].top().first ||
+            (heap[s].top().first == heap[side].top().first && pw[s] > pw[side])) {
+          side = s;
+        }
+      }
+      if (side == -1) break;
+      uint32 v = heap[side].top().second;
+      heap[side].pop();
+      locked[v] = 1;
+      move(v);
+      moves.push_back(v);
+      for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+        uint32 u = g.adj[p];
+        if (!locked[u]) heap[part[u]].push(HeapEntry(gain[u], u));
+      }
+      auto current = score();
+      if (current < best) {
+        best = current;
+        bestMoves = moves.size();
+        sinceBest = 0;
+      } else if (++sinceBest > maxMovesWithoutImprovement) {
+        break;
+      }
+    }
+    // roll back the moves after the best state
+    for (size_t k = moves.size(); k > bestMoves; k--) {
+      move(moves[k - 1]);
+    }
+    if (bestMoves == 0) break;
+  }
+}
+
+
+// Bisection of the graph by breadth first search from the seed vertex: the first visited half of
+// the weight goes to part 0.
+void growBisection(const Graph& g, uint32 seed, std::vector<uint8>& part) {
+  part.assign(g.n, 1);
+  uint64 half = g.totalWeight() / 2;
+  uint64 w0 = 0;
+  std::vector<uint8> visited(g.n, 0);
+  std::queue<uint32> queue;
+  uint32 nextStart = 0;
+  queue.push(seed);
+  visited[seed] = 1;
+  while (w0 < half) {
+    if (queue.empty()) {
+      // disconnected graph: continue from an unvisited vertex
+      while (nextStart < g.n && visited[nextStart]) nextStart++;
+      if (nextStart == g.n) break;
+      queue.push(nextStart);
+      visited[nextStart] = 1;
+    }
+    uint32 v = queue.front();
+    queue.pop();
+    part[v] = 0;
+    w0 += g.vwgt[v];
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      uint32 u = g.adj[p];
+      if (!visited[u]) {
+        visited[u] = 1;
+        queue.push(u);
+      }
+    }
+  }
+}
+
+
+// The last vertex visited by breadth first search from start
+uint32 farthestVertex(const Graph& g, uint32 start) {
+  std::vector<uint8> visited(g.n, 0);
+  std::queue<uint32> queue;
+  queue.push(start);
+  visited[start] = 1;
+  uint32 last = start;
+  while (!queue.empty()) {
+    last = queue.front();
+    queue.pop();
+    for (uint32 p = g.ptr[last]; p < g.ptr[last + 1]; p++) {
+      uint32 u = g.adj[p];
+      if (!visited[u]) {
+        visited[u] = 1;
+        queue.push(u);
+      }
+    }
+  }
+  return last;
+}
+
+
+int64 edgeCut(const Graph& g, const std::vector<uint8>& part) {
+  int64 cut = 0;
+  for (uint32 v = 0; v < g.n; v++) {
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      if (part[g.adj[p]] != part[v]) cut += g.ewgt[p];
+    }
+  }
+  return cut / 2;
+}
+
+
+// Multilevel bisection of the graph. part[v] = 0 or 1.
+void multilevelBisection(const Graph& g, std::vector<uint8>& part) {
+  uint64 total = g.totalWeight();
+  uint64 maxVwgt = std::max(static_cast<uint64>(1), static_cast<uint64>(1.5 * total / coarsestSize));
+
+  std::vector<Graph> levels;
+  std::vector<std::vector<uint32> > cmaps;
+  auto level = [&](size_t k) -> const Graph& { return (k == 0) ? g : levels[k - 1]; };
+  while (level(levels.size()).n > coarsestSize) {
+    const Graph& fine = level(levels.size());
+    Graph cg;
+    std::vector<uint32> cmap;
+    coarsen(fine, cg, cmap, maxVwgt, static_cast<uint32>(levels.size() + 1));
+    if (cg.n > 0.95 * fine.n) break;
+    levels.push_back(std::move(cg));
+    cmaps.push_back(std::move(cmap));
+  }
+
+  const Graph& coarsest = level(levels.size());
+  uint64 maxPart = std::max(static_cast<uint64>(maxImbalance * total / 2.0),
+      total / 2 + *std::max_element(coarsest.vwgt.begin(), coarsest.vwgt.end()));
+
+  // several initial bisections from different seeds, the best one is taken
+  std::vector<uint8> trial;
+  int64 bestCut = -1;
+  uint32 seed = farthestVertex(coarsest, 0);
+  for (uint32 t = 0; t < nInitialBisections && t < coarsest.n; t++) {
+    growBisection(coarsest, seed, trial);
+    refineBisection(coarsest, trial, maxPart);
+    int64 cut = edgeCut(coarsest, trial);
+    if (bestCut < 0 || cut < bestCut) {
+      bestCut = cut;
+      part = trial;
+    }
+    seed = static_cast<uint32>((static_cast<uint64>(t + 1) * coarsest.n) / nInitialBisections);
+  }
+
+  // project the bisection back to the finer levels
+  for (size_t k = levels.size(); k > 0; k--) {
+    const Graph& fine = level(k - 1);
+    const std::vector<uint32>& cmap = cmaps[k - 1];
+    trial.resize(fine.n);
+    for (uint32 v = 0; v < fine.n; v++) {
+      trial[v] = part[cmap[v]];
+    }
+    part.swap(trial);
+    refineBisection(fine, part, maxPart);
+  }
+}
+
+
+// Kuhn's augmenting path search in the bipartite graph of the cut edges
+bool augment(uint32 a, const std::vector<uint32>& bptr, const std::vector<uint32>& badj,
+    std::vector<uint32>& mateA, std::vector<uint32>& mateB, std::vector<uint32>& visited,
+    uint32 stamp) {
+  for (uint32 p = bptr[a]; p < bptr[a + 1]; p++) {
+    uint32 b = badj[p];
+    if (visited[b] == stamp) continue;
+    visited[b] = stamp;
+    if (mateB[b] == UINT32_MAX || augment(mateB[b], bptr, badj, mateA, mateB, visited, stamp)) {
+      mateA[a] = b;
+      mateB[b] = a;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Turn the edge separator into the vertex separator (part[v] = 2) by the minimum vertex cover
+// of the cut edges (Konig's theorem).
+void vertexSeparator(const Graph& g, std::vector<uint8>& part) {
+  std::vector<uint32> idx(g.n, UINT32_MAX);
+  std::vector<uint32> sideA, sideB;
+  for (uint32 v = 0; v < g.n; v++) {
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      if (part[g.adj[p]] != part[v]) {
+        if (part[v] == 0) {
+          idx[v] = static_cast<uint32>(sideA.size());
+          sideA.push_back(v);
+        } else {
+          idx[v] = static_cast<uint32>(sideB.size());
+          sideB.push_back(v);
+        }
+        break;
+      }
+    }
+  }
+  uint32 na = static_cast<uint32>(sideA.size());
+  uint32 nb = static_cast<uint32>(sideB.size());
+  std::vector<uint32> bptr(1, 0), badj;
+  for (uint32 v : sideA) {
+    for (uint32 p = g.ptr[v]; p < g.ptr[v + 1]; p++) {
+      if (part[g.adj[p]] == 1) badj.push_back(idx[g.adj[p]]);
+    }
+    bptr.push_back(static_cast<uint32>(badj.size()));
+  }
+
+  // maximum matching
+  std::vector<uint32> mateA(na, UINT32_MAX), mateB(nb, UINT32_MAX);
+  std::vector<uint32> visited(nb, 0);
+  for (uint32 a = 0; a < na; a++) {
+    augment(a, bptr, badj, mateA, mateB, visited, a + 1);
+  }
+
+  // vertices reachable from unmatched vertices of side A by alternating paths
+  std::vector<uint8> reachA(na, 0), reachB(nb, 0);
+  std::vector<uint32> stack;
+  for (uint32 a = 0; a < na; a++) {
+    if (mateA[a] == UINT32_MAX) {
+      reachA[a] = 1;
+      stack.push_back(a);
+    }
+  }
+  while (!stack.empty()) {
+    uint32 a = stack.back();
+    stack.pop_back();
+    for (uint32 p = bptr[a]; p < bptr[a + 1]; p++) {
+      uint32 b = badj[p];
+      if (reachB[b]) continue;
+      reachB[b] = 1;
+      uint32 a2 = mateB[b];
+      if (a2 != UINT32_MAX && !reachA[a2]) {
+        reachA[a2] = 1;
+        stack.push_back(a2);
+      }
+    }
+  }
+
+  // minimum vertex cover: (A \ reachable) + (B & reachable)
+  for (uint32 a = 0; a < na; a++) {
+    if (!reachA[a]) part[sideA[a]] = 2;
+  }
+  for (uint32 b = 0; b < nb; b++) {
+    if (reachB[b]) part[sideB[b]] = 2;
+  }
+}
+
+
+// Nested dissection ordering of the graph. Vertices of g are appended to order.
+void nestedDissection(const Graph& g, const std::vector<uint8>& delayed, std::vector<uint32>& order) {
+  std::vector<uint32> subOrder;
+  if (g.n <= ndLeafSize) {
+    approximateMinimumDegree(g, delayed, subOrder);
+    order.insert(order.end(), subOrder.begin(), subOrder.end());
+    return;
+  }
+
+  std::vector<uint8> part;
+  multilevelBisection(g, part);
+  vertexSeparator(g, part);
+
+  uint32 count[3] = {0, 0, 0};
+  for (uint32 v = 0; v < g.n; v++) {
+    count[part[v]]++;
+  }
+  if (count[0] == 0 || count[1] == 0) {
+    // the graph can't be dissected (like a clique)
+    approximateMinimumDegree(g, delayed, subOrder);
+    order.insert(order.end(), subOrder.begin(), subOrder.end());
+    return;
+  }
+
+  Graph sub;
+  std::vector<uint32> label;
+  std::vector<uint8> subDelayed;
+  for (uint8 side = 0; side < 2; side++) {
+    extractSubgraph(g, part, side, sub, label);
+    subDelayed.resize(sub.n);
+    for (uint32 k = 0; k < sub.n; k++) {
+      subDelayed[k] = delayed[label[k]];
+    }
+    subOrder.clear();
+    nestedDissection(sub, subDelayed, subOrder);
+    for (uint32 v : subOrder) {
+      order.push_back(label[v]);
+    }
+  }
+  // the separator is eliminated last
+  for (uint32 v = 0; v < g.n; v++) {
+    if (part[v] == 2) order.push_back(v);
+  }
+}
+
+
+// Merge indistinguishable vertices (with the same closed adjacency, like DoFs of one node) of the
+// matrix graph into one vertex of the compressed graph. members[cptr[c]] .. members[cptr[c+1]-1]
+// are the original vertices of compressed vertex c.
+void compressGraph(uint32 n, const std::vector<uindex>& ptr, const std::vector<uint32>& adj,
+    const std::vector<uint8>& delayed, Graph& cg, std::vector<uint8>& cdelayed,
+    std::vector<uint32>& cptr, std::vector<uint32>& members) {
+  std::vector<std::pair<uint64, uint32> > hashes(n);
+  for (uint32 v = 0; v < n; v++) {
+    uint64 h = v + (static_cast<uint64>(delayed[v]) << 40);
+    for (uindex p = ptr[v]; p < ptr[v + 1]; p++) {
+      h += adj[p];
+    }
+    hashes[v] = std::make_pair(h, v);
+  }
+  std::sort(hashes.begin(), hashes.end());
+
+  std::vector<uint32> cmap(n, UINT32_MAX);
+  std::vector<uint32> rep;
+  std::vector<uint32> mark(n, 0);
+  uint32 stamp = 0;
+  for (uint32 a = 0; a < n; ) {
+    uint32 b = a + 1;
+    while (b < n && hashes[b].first == hashes[a].first) b++;
+    for (uint32 x = a; x < b; x++) {
+      uint32 v = hashes[x].second;
+      if (cmap[v] != UINT32_MAX) continue;
+      cmap[v] = static_cast<uint32>(rep.size());
+      rep.push_back(v);
+      if (b - a == 1) break;
+      stamp++;
+      mark[v] = stamp;
+      for (uindex p = ptr[v]; p < ptr[v + 1]; p++) mark[adj[p]] = stamp;
+      for (uint32 y = x + 1; y < b; y++) {
+        uint32 u = hashes[y].second;
+        if (cmap[u] != UINT32_MAX || delayed[u] != delayed[v] ||
+            ptr[u + 1] - ptr[u] != ptr[v + 1] - ptr[v] || mark[u] != stamp) continue;
+        bool same = true;
+        for (uindex p = ptr[u]; p < ptr[u + 1]; p++) {
+          if (mark[adj[p]] != stamp) {
+            same = false;
+            break;
+          }
+        }
+        if (same) cmap[u] = cmap[v];
+      }
+    }
+    a = b;
+  }
+
+  uint32 nc = static_cast<uint32>(rep.size());
+  cptr.assign(nc + 1, 0);
+  for (uint32 v = 0; v < n; v++) {
+    cptr[cmap[v] + 1]++;
+  }
+  for (uint32 c = 0; c < nc; c++) {
+    cptr[c + 1] += cptr[c];
+  }
+  members.resize(n);
+  std::vector<uint32> next(cptr.begin(), cptr.end() - 1);
+  for (uint32 v = 0; v < n; v++) {
+    members[next[cmap[v]]++] = v;
+  }
+
+  cg.n = nc;
+  cg.ptr.assign(1, 0);
+  cg.adj.clear();
+  cg.vwgt.resize(nc);
+  cdelayed.resize(nc);
+  std::fill(mark.begin(), mark.end(), 0);
+  for (uint32 c = 0; c < nc; c++) {
+    uint32 v = rep[c];
+    cg.vwgt[c] = cptr[c + 1] - cptr[c];
+    cdelayed[c] = delayed[v];
+    for (uindex p = ptr[v]; p < ptr[v + 1]; p++) {
+      uint32 cu = cmap[adj[p]];
+      if (cu == c || mark[cu] == c + 1) continue;
+      mark[cu] = c + 1;
+      cg.adj.push_back(cu);
+    }
+    CHECK(cg.adj.size() < UINT32_MAX) << "The compressed graph of the matrix is too big";
+    cg.ptr.push_back(static_cast<uint32>(cg.adj.size()));
+  }
+  cg.ewgt.assign(cg.adj.size(), 1);
+}
+
+} // anonymous namespace
+
+
+OrderingMethod orderingMethodFromName(const std::string& name) {
+  std::string upper = name;
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  if (upper == "ND") {
+    return OrderingMethod::NestedDissection;
+  }
+  for (int i = 0; i < (int) OrderingMethod::UNDEFINED; i++) {
+    std::string label = orderingMethodLabels[i];
+    std::transform(label.begin(), label.end(), label.begin(), ::toupper);
+    if (upper == label) {
+      return static_cast<OrderingMethod>(i);
+    }
+  }
+  return OrderingMethod::UNDEFINED;
+}
+
+
+void fillReducingOrdering(SparseSymMatrix* matrix, OrderingMethod method, std::vector<uint32>& order) {
+  TIMED_SCOPE(t, "fillReducingOrdering");
+  CHECK(matrix->isCompressed());
+  CHECK(method != OrderingMethod::UNDEFINED);
+  const uint32 n = matrix->nRows();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32* columns = matrix->getColumnsArray();
+  const double* values = matrix->getValuesArray();
+
+  order.resize(n);
+  std::iota(order.begin(), order.end(), 0);
+  if (method == OrderingMethod::Natural || n == 0) {
+    return;
+  }
+
+  // full symmetric graph of the matrix without the diagonal
+  std::vector<uindex> ptr(n + 1, 0);
+  std::vector<uint8> zeroDiagonal(n, 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      if (i == j) {
+        zeroDiagonal[i] = (values[k] == 0.0);
+        continue;
+      }
+      ptr[i + 1]++;
+      ptr[j + 1]++;
+    }
+  }
+  for (uint32 i = 0; i < n; i++) {
+    ptr[i + 1] += ptr[i];
+  }
+  std::vector<uint32> adj(ptr[n]);
+  std::vector<uindex> next(ptr.begin(), ptr.end() - 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      if (i == j) continue;
+      adj[next[i]++] = j;
+      adj[next[j]++] = i;
+    }
+  }
+
+  Graph cg;
+  std::vector<uint8> cdelayed;
+  std::vector<uint32> cptr, members;
+  compressGraph(n, ptr, adj, zeroDiagonal, cg, cdelayed, cptr, members);
+
+  if (method == OrderingMethod::Auto) {
+    method = (cg.n > autoNestedDissectionSize) ? OrderingMethod::NestedDissection :
+      OrderingMethod::AMD;
+  }
+  std::vector<uint32> corder;
+  if (method == OrderingMethod::AMD) {
+    approximateMinimumDegree(cg, cdelayed, corder);
+  } else {
+    nestedDissection(cg, cdelayed, corder);
+  }
+  CHECK(corder.size() == cg.n);
+
+  uint32 k = 0;
+  for (uint32 c : corder) {
+    for (uint32 p = cptr[c]; p < cptr[c + 1]; p++) {
+      order[k++] = members[p];
+    }
+  }
+
+  // an equation with zero diagonal which goes before all of its neighbours is moved right after
+  // the first of them
+  std::vector<uint32> position(n);
+  for (uint32 k = 0; k < n; k++) {
+    position[order[k]] = k;
+  }
+  std::vector<uint64> key(n);
+  bool moved = false;
+  for (uint32 k = 0; k < n; k++) {
+    uint32 v = order[k];
+    key[k] = 2 * static_cast<uint64>(k);
+    if (!zeroDiagonal[v] || ptr[v] == ptr[v + 1]) continue;
+    uint32 first = UINT32_MAX;
+    for (uint32 p = ptr[v]; p < ptr[v + 1]; p++) {
+      first = std::min(first, position[adj[p]]);
+    }
+    if (first > k) {
+      key[k] = 2 * static_cast<uint64>(first) + 1;
+      moved = true;
+    }
+  }
+  if (moved) {
+    std::vector<uint32> idx(n);
+    std::iota(idx.begin(), idx.end(), 0);
+    std::stable_sort(idx.begin(), idx.end(), [&](uint32 a, uint32 b) { return key[a] < key[b]; });
+    std::vector<uint32> reordered(n);
+    for (uint32 k = 0; k < n; k++) {
+      reordered[k] = order[idx[k]];
+    }
+    order.swap(reordered);
+  }
+
+  LOG(INFO) << "Fill-reducing ordering: " << orderingMethodLabels[(int) method]
+    << " (compressed graph has " << cg.n << " vertices)";
+}
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,56 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+
+namespace nla3d {
+
+namespace math {
+
+// Fill-reducing orderings of symmetric sparse matrices for direct equation solvers.
+// AMD - approximate minimum degree (quotient graph with element absorption, mass elimination of
+// indistinguishable variables and approximate external degrees as in Amestoy, Davis & Duff).
+// NestedDissection - multilevel nested dissection: the graph is coarsened by heavy edge matching,
+// bisected by graph growing, refined by Fiduccia-Mattheyses on every level and the edge separator
+// is turned into the minimal vertex separator. Small subgraphs are ordered by AMD.
+// Auto - NestedDissection for large matrices, AMD for small ones.
+// Natural - no reordering.
+enum class OrderingMethod {
+  Auto = 0,
+  Natural,
+  AMD,
+  NestedDissection,
+  UNDEFINED
+};
+
+
+const char* const orderingMethodLabels[] = {
+  "Auto",
+  "Natural",
+  "AMD",
+  "NestedDissection",
+  "UNDEFINED"
+};
+
+#ifndef SWIG
+static_assert((int)OrderingMethod::UNDEFINED == sizeof(orderingMethodLabels)/sizeof(orderingMethodLabels[0]) - 1,
+    "OrderingMethod enumeration and orderingMethodLabels must have the same number of entries");
+#endif
+
+// case insensitive search among orderingMethodLabels ("ND" is accepted for NestedDissection).
+// Returns OrderingMethod::UNDEFINED if nothing is found.
+OrderingMethod orderingMethodFromName(const std::string& name);
+
+
+// Compute the fill-reducing ordering of the matrix: order[k] is the index (0-based) of the
+// equation which should be eliminated k-th. Only the sparsity of the matrix is used except
+// the diagonal values: equations with zero diagonal (like MPC Lagrange multipliers) are never
+// placed before all of their neighbours, otherwise they would give zero pivots.
+void fillReducingOrdering(SparseSymMatrix* matrix, OrderingMethod method, std::vector<uint32>& order);
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,282 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/OutOfCoreStorage.h"
+#include <chrono>
+#include <errno.h>
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+
+OutOfCoreStorage::OutOfCoreStorage() {
+}
+
+
+OutOfCoreStorage::~OutOfCoreStorage() {
+  close();
+}
+
+
+void OutOfCoreStorage::open(const std::string& directory, const std::vector<uint64>& _panelPtr,
+    uint64 memoryBudget) {
+  close();
+  CHECK(_panelPtr.size() > 0);
+  panelPtr = _panelPtr;
+  budget = memoryBudget;
+  mapSize = panelPtr.back();
+
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  pageSize = info.dwPageSize;
+  char name[MAX_PATH];
+  CHECK(GetTempFileNameA(directory.c_str(), "nla", 0, name) != 0)
+    << "Can't create scratch file in " << directory;
+  path = name;
+  // the file is deleted by the system when the handle is closed
+  HANDLE h = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+  CHECK(h != INVALID_HANDLE_VALUE) << "Can't open scratch file " << path;
+  file = h;
+  if (mapSize > 0) {
+    HANDLE m = CreateFileMappingA(h, NULL, PAGE_READWRITE, static_cast<DWORD>(mapSize >> 32),
+        static_cast<DWORD>(mapSize & 0xFFFFFFFF), NULL);
+    CHECK(m != NULL) << "Can't map scratch file " << path;
+    mapping = m;
+    map = static_cast<char*>(MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    CHECK(map != nullptr) << "Can't map scratch file " << path;
+  }
+#else
+  pageSize = static_cast<uint64>(sysconf(_SC_PAGESIZE));
+  std::string name = directory + "/nla3d_scratch_XXXXXX";
+  std::vector<char> buf(name.begin(), name.end());
+  buf.push_back('\0');
+  fd = mkstemp(buf.data());
+  CHECK(fd != -1) << "Can't create scratch file " << name << ": " << strerror(errno);
+  path = buf.data();
+  // the file is removed from the directory right away, its space is freed when fd is closed
+  unlink(path.c_str());
+  if (mapSize > 0) {
+    CHECK(ftruncate(fd, static_cast<off_t>(mapSize)) == 0)
+      << "Can't allocate " << mapSize << " bytes for scratch file " << path << ": " << strerror(errno);
+    void* ptr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK(ptr != MAP_FAILED) << "Can't map scratch file " << path << ": " << strerror(errno);
+    map = static_cast<char*>(ptr);
+  }
+#endif
+
+  uint32 np = nPanels();
+  useCount.assign(np, 0);
+  resident.assign(np, 0);
+  modified.assign(np, 0);
+  onDisk.assign(np, 0);
+  lru.clear();
+  lruPos.assign(np, lru.end());
+  resBytes = 0;
+  resetStatistics();
+  LOG(INFO) << "Out-of-core storage: scratch file " << path << " (" << mapSize / 1024 / 1024
+    << " MB), memory budget = " << budget / 1024 / 1024 << " MB";
+}
+
+
+void OutOfCoreStorage::close() {
+#ifdef _WIN32
+  if (map) UnmapViewOfFile(map);
+  if (mapping) CloseHandle(static_cast<HANDLE>(mapping));
+  if (file) CloseHandle(static_cast<HANDLE>(file));
+  mapping = nullptr;
+  file = nullptr;
+#else
+  if (map) munmap(map, mapSize);
+  if (fd != -1) ::close(fd);
+  fd = -1;
+#endif
+  map = nullptr;
+  mapSize = 0;
+  path.clear();
+  panelPtr.clear();
+  useCount.clear();
+  resident.clear();
+  modified.clear();
+  onDisk.clear();
+  lru.clear();
+  lruPos.clear();
+  resBytes = 0;
+}
+
+
+bool OutOfCoreStorage::isOpened() {
+  return panelPtr.size() > 0;
+}
+
+
+char* OutOfCoreStorage::data() {
+  return map;
+}
+
+
+uint32 OutOfCoreStorage::nPanels() {
+  return panelPtr.size() > 0 ? static_cast<uint32>(panelPtr.size() - 1) : 0;
+}
+
+
+void OutOfCoreStorage::acquire(uint32 p) {
+  assert(p < nPanels());
+  std::lock_guard<std::mutex> lock(mtx);
+  useCount[p]++;
+  if (resident[p]) return;
+
+  if (onDisk[p]) {
+    auto start = std::chrono::steady_clock::now();
+    uint64 begin, end;
+    alignedRange(p, begin, end);
+    if (end > begin) {
+#ifndef _WIN32
+      madvise(map + begin, end - begin, MADV_WILLNEED);
+#endif
+      // touch every page to stream the panel back
+      const volatile char* pages = map;
+      char sink = 0;
+      for (uint64 k = begin; k < end; k += pageSize) {
+        sink ^= pages[k];
+      }
+      (void) sink;
+      readBytes += end - begin;
+    }
+    readTime += secondsSince(start);
+  }
+  resident[p] = 1;
+  resBytes += panelPtr[p + 1] - panelPtr[p];
+  lruPos[p] = lru.insert(lru.end(), p);
+  evict();
+}
+
+
+void OutOfCoreStorage::release(uint32 p, bool _modified) {
+  assert(p < nPanels());
+  std::lock_guard<std::mutex> lock(mtx);
+  assert(useCount[p] > 0);
+  useCount[p]--;
+  if (_modified) modified[p] = 1;
+  lru.splice(lru.end(), lru, lruPos[p]);
+  evict();
+}
+
+
+void OutOfCoreStorage::evict() {
+  auto it = lru.begin();
+  while (resBytes > budget && it != lru.end()) {
+    uint32 p = *it;
+    if (useCount[p] > 0) {
+      ++it;
+      continue;
+    }
+    uint64 begin, end;
+    alignedRange(p, begin, end);
+    if (end > begin) {
+      char* ptr = map + begin;
+      uint64 len = end - begin;
+      if (modified[p]) {
+        auto start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+        CHECK(FlushViewOfFile(ptr, len)) << "Can't write to scratch file " << path;
+#else
+        CHECK(msync(ptr, len, MS_SYNC) == 0)
+          << "Can't write to scratch file " << path << ": " << strerror(errno);
+#endif
+        writtenBytes += len;
+        writeTime += secondsSince(start);
+      }
+      // drop the pages from memory of the process and from the file cache
+#ifdef _WIN32
+      VirtualUnlock(ptr, len);
+#else
+      madvise(ptr, len, MADV_DONTNEED);
+  #ifdef POSIX_FADV_DONTNEED
+      posix_fadvise(fd, static_cast<off_t>(begin), static_cast<off_t>(len), POSIX_FADV_DONTNEED);
+  #endif
+#endif
+    }
+    modified[p] = 0;
+    onDisk[p] = 1;
+    resident[p] = 0;
+    resBytes -= panelPtr[p + 1] - panelPtr[p];
+    lruPos[p] = lru.end();
+    it = lru.erase(it);
+  }
+}
+
+
+void OutOfCoreStorage::alignedRange(uint32 p, uint64& begin, uint64& end) {
+  begin = (panelPtr[p] + pageSize - 1) / pageSize * pageSize;
+  end = panelPtr[p + 1] / pageSize * pageSize;
+  if (end < begin) end = begin;
+}
+
+
+void OutOfCoreStorage::resetStatistics() {
+  writtenBytes = 0;
+  readBytes = 0;
+  writeTime = 0.0;
+  readTime = 0.0;
+}
+
+
+uint64 OutOfCoreStorage::bytesWritten() {
+  return writtenBytes;
+}
+
+
+uint64 OutOfCoreStorage::bytesRead() {
+  return readBytes;
+}
+
+
+double OutOfCoreStorage::secondsWriting() {
+  return writeTime;
+}
+
+
+double OutOfCoreStorage::secondsReading() {
+  return readTime;
+}
+
+
+uint64 OutOfCoreStorage::residentBytes() {
+  return resBytes;
+}
+
+
+void OutOfCoreStorage::logStatistics(const std::string& title) {
+  const double mb = 1024.0 * 1024.0;
+  auto throughput = [&](uint64 bytes, double seconds) {
+    return (seconds > 0.0) ? bytes / mb / seconds : 0.0;
+  };
+  LOG(INFO) << title << ": written " << writtenBytes / mb << " MB ("
+    << throughput(writtenBytes, writeTime) << " MB/s), read " << readBytes / mb << " MB ("
+    << throughput(readBytes, readTime) << " MB/s), in memory " << resBytes / mb << " MB";
+}
+
+} // namespace math
+
+} // namespace nla3d
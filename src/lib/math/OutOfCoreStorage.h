@@ -0,0 +1,98 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include <mutex>
+
+namespace nla3d {
+
+namespace math {
+
+// OutOfCoreStorage - large array of bytes kept in a scratch file which is mapped into memory. The
+// array is split into panels: panel p occupies bytes [panelPtr[p], panelPtr[p+1]). Only
+// memoryBudget bytes of panels are kept in memory. When the budget is exceeded, the least recently
+// used panels are written to the file (if they were modified) and dropped from memory. Dropped
+// panels are streamed back when they are acquired again.
+//
+// Every access to a panel should be enclosed by acquire(p) .. release(p, modified). Panels in use
+// are never dropped, so a panel can be acquired by several threads at once. The scratch file is
+// deleted right after creation: the disk space is returned to the system as soon as the storage
+// is closed (or the process is terminated).
+//
+// The storage counts the volume of written and streamed back data and the time spent on it.
+class OutOfCoreStorage {
+public:
+  OutOfCoreStorage();
+  ~OutOfCoreStorage();
+
+  // create the scratch file of panelPtr.back() bytes in the directory and map it into memory.
+  // memoryBudget is in bytes.
+  void open(const std::string& directory, const std::vector<uint64>& panelPtr, uint64 memoryBudget);
+  void close();
+  bool isOpened();
+
+  // beginning of the array
+  char* data();
+  uint32 nPanels();
+
+  // panel p is going to be accessed: stream it back into memory if it was dropped
+  void acquire(uint32 p);
+  // access to panel p is finished. modified should be true if the panel was written.
+  void release(uint32 p, bool modified);
+
+  // I/O statistics since the last resetStatistics()
+  void resetStatistics();
+  uint64 bytesWritten();
+  uint64 bytesRead();
+  double secondsWriting();
+  double secondsReading();
+  // bytes of panels which are currently kept in memory
+  uint64 residentBytes();
+  // log I/O volume and throughput
+  void logStatistics(const std::string& title);
+
+private:
+  // drop the least recently used panels until the resident panels fit into the budget
+  void evict();
+  // page aligned part of panel p: [begin, end) bytes. Pages shared with neighbour panels are
+  // never dropped.
+  void alignedRange(uint32 p, uint64& begin, uint64& end);
+
+  std::string path;
+#ifdef _WIN32
+  // HANDLEs of the file and the file mapping
+  void* file = nullptr;
+  void* mapping = nullptr;
+#else
+  int fd = -1;
+#endif
+  char* map = nullptr;
+  uint64 mapSize = 0;
+  uint64 pageSize = 4096;
+  uint64 budget = 0;
+
+  std::vector<uint64> panelPtr;
+  // number of threads which use the panel now
+  std::vector<uint32> useCount;
+  std::vector<uint8> resident;
+  std::vector<uint8> modified;
+  // the panel was dropped from memory and its data is in the file
+  std::vector<uint8> onDisk;
+  // least recently used panels go first
+  std::list<uint32> lru;
+  std::vector<std::list<uint32>::iterator> lruPos;
+  uint64 resBytes = 0;
+
+  uint64 writtenBytes = 0;
+  uint64 readBytes = 0;
+  double writeTime = 0.0;
+  double readTime = 0.0;
+
+  std::mutex mtx;
+};
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,319 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/Preconditioner.h"
+
+namespace nla3d {
+
+namespace math {
+
+bool Preconditioner::isPositive() {
+  return true;
+}
+
+
+void Preconditioner::setup(LinearOperator* /*op*/) {
+  LOG(FATAL) << getName() << " preconditioner needs the assembled matrix";
+}
+
+
+void Preconditioner::setup(BsrSymMatrix* matrix) {
+  // preconditioners which need only products and the diagonal work with BSR matrix as with an
+  // operator
+  setup(static_cast<LinearOperator*>(matrix));
+}
+
+
+void JacobiPreconditioner::setup(SparseSymMatrix* matrix) {
+  SparseMatrixOperator op(matrix);
+  setup(&op);
+}
+
+
+void JacobiPreconditioner::setup(LinearOperator* op) {
+  uint32 n = op->nRows();
+  invDiag.resize(n);
+  op->diagonal(invDiag.data());
+  for (uint32 i = 0; i < n; i++) {
+    double d = fabs(invDiag[i]);
+    invDiag[i] = (d > 0.0) ? 1.0 / d : 1.0;
+  }
+}
+
+
+void JacobiPreconditioner::apply(const double* r, double* z) {
+  for (size_t i = 0; i < invDiag.size(); i++) {
+    z[i] = r[i] * invDiag[i];
+  }
+}
+
+
+std::string JacobiPreconditioner::getName() {
+  return "Jacobi";
+}
+
+
+BlockJacobiPreconditioner::BlockJacobiPreconditioner(uint16 _blockSize) : blockSize(_blockSize) {
+  CHECK(blockSize > 0);
+}
+
+
+void BlockJacobiPreconditioner::setBlocks(const std::vector<uint32>& _blockFirst) {
+  givenBlocks = _blockFirst;
+}
+
+
+void BlockJacobiPreconditioner::setup(SparseSymMatrix* matrix) {
+  nEq = matrix->nRows();
+  if (givenBlocks.size() > 0) {
+    CHECK(givenBlocks.back() == nEq) << "Blocks don't correspond to the matrix";
+    blockFirst = givenBlocks;
+  } else {
+    // the rows of a node have the same entries, so nodal blocks are found from the structure
+    // (the equations of a node aren't aligned by blockSize: constrained DoFs are excluded,
+    // element DoFs go first and Mpc equations go last)
+    BsrSymMatrix::findRowGroups(matrix, blockSize, blockFirst);
+  }
+  invertBlocks([matrix](uint32 i, uint32 j) {
+    return matrix->value(i + 1, j + 1);
+  });
+}
+
+
+void BlockJacobiPreconditioner::setup(BsrSymMatrix* matrix) {
+  // the groups of the BSR matrix (nodal DoFs) are the blocks
+  nEq = matrix->nRows();
+  blockFirst.resize(matrix->nBlocks() + 1);
+  for (uint32 b = 0; b <= matrix->nBlocks(); b++) {
+    blockFirst[b] = matrix->getBlockFirst(b);
+  }
+  const uint16 bs = BsrSymMatrix::blockSize;
+  invertBlocks([matrix](uint32 i, uint32 j) {
+    uint32 b = matrix->getRowBlock(i);
+    uint32 li = i - matrix->getBlockFirst(b);
+    uint32 lj = j - matrix->getBlockFirst(b);
+    // only the upper triangle of the diagonal block is stored
+    return matrix->getBlock(b, b)[std::min(li, lj) * bs + std::max(li, lj)];
+  });
+}
+
+
+template <typename F>
+void BlockJacobiPreconditioner::invertBlocks(F value) {
+  const uint32 nBlocks = static_cast<uint32>(blockFirst.size() - 1);
+  invPtr.resize(nBlocks + 1);
+  invPtr[0] = 0;
+  for (uint32 b = 0; b < nBlocks; b++) {
+    uint64 m = blockFirst[b + 1] - blockFirst[b];
+    invPtr[b + 1] = invPtr[b] + m * m;
+  }
+  invBlocks.assign(invPtr[nBlocks], 0.0);
+
+  std::vector<double> a;
+  std::vector<double> e;
+  for (uint32 b = 0; b < nBlocks; b++) {
+    uint32 r0 = blockFirst[b];
+    uint32 m = blockFirst[b + 1] - r0;
+    double* inv = &invBlocks[invPtr[b]];
+    a.resize(m * m);
+    e.resize(m);
+
+    for (uint32 i = 0; i < m; i++) {
+      for (uint32 j = 0; j < m; j++) {
+        a[i * m + j] = value(r0 + i, r0 + j);
+      }
+    }
+    // Cholesky decomposition a = L * L^T in place (lower triangle)
+    bool positive = true;
+    for (uint32 j = 0; j < m && positive; j++) {
+      double s = a[j * m + j];
+      for (uint32 k = 0; k < j; k++) {
+        s -= a[j * m + k] * a[j * m + k];
+      }
+      if (s <= 1.0e-14 * fabs(a[j * m + j]) || s <= 0.0) {
+        positive = false;
+        break;
+      }
+      a[j * m + j] = sqrt(s);
+      for (uint32 i = j + 1; i < m; i++) {
+        double t = a[i * m + j];
+        for (uint32 k = 0; k < j; k++) {
+          t -= a[i * m + k] * a[j * m + k];
+        }
+        a[i * m + j] = t / a[j * m + j];
+      }
+    }
+
+    if (!positive) {
+      // fall back to Jacobi for this block
+      for (uint32 i = 0; i < m; i++) {
+        double d = fabs(value(r0 + i, r0 + i));
+        inv[i * m + i] = (d > 0.0) ? 1.0 / d : 1.0;
+      }
+      continue;
+    }
+    // inverse by solving L * L^T * x = e_j for every column
+    for (uint32 j = 0; j < m; j++) {
+      std::fill(e.begin(), e.begin() + m, 0.0);
+      e[j] = 1.0;
+      for (uint32 i = 0; i < m; i++) {
+        for (uint32 k = 0; k < i; k++) {
+          e[i] -= a[i * m + k] * e[k];
+        }
+        e[i] /= a[i * m + i];
+      }
+      for (int32 i = (int32) m - 1; i >= 0; i--) {
+        for (uint32 k = i + 1; k < m; k++) {
+          e[i] -= a[k * m + i] * e[k];
+        }
+        e[i] /= a[i * m + i];
+      }
+      for (uint32 i = 0; i < m; i++) {
+        inv[i * m + j] = e[i];
+      }
+    }
+  }
+}
+
+
+void BlockJacobiPreconditioner::apply(const double* r, double* z) {
+  const uint32 nBlocks = static_cast<uint32>(blockFirst.size() - 1);
+  for (uint32 b = 0; b < nBlocks; b++) {
+    uint32 r0 = blockFirst[b];
+    uint32 m = blockFirst[b + 1] - r0;
+    const double* inv = &invBlocks[invPtr[b]];
+    for (uint32 i = 0; i < m; i++) {
+      double s = 0.0;
+      for (uint32 j = 0; j < m; j++) {
+        s += inv[i * m + j] * r[r0 + j];
+      }
+      z[r0 + i] = s;
+    }
+  }
+}
+
+
+const std::vector<uint32>& BlockJacobiPreconditioner::getBlocks() {
+  return blockFirst;
+}
+
+
+std::string BlockJacobiPreconditioner::getName() {
+  return "BlockJacobi(" + toStr(blockSize) + ")";
+}
+
+
+IncompleteLDLTPreconditioner::IncompleteLDLTPreconditioner(bool _positive) : positive(_positive) {
+}
+
+
+void IncompleteLDLTPreconditioner::setup(SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "IncompleteLDLTPreconditioner::setup");
+  nEq = matrix->nRows();
+  uindex nnz = matrix->nValues();
+  const uindex* iofeir = matrix->getIofeirArray();
+  const uint32* columns = matrix->getColumnsArray();
+  const double* values = matrix->getValuesArray();
+
+  rowPtr.resize(nEq + 1);
+  colInd.resize(nnz);
+  for (uint32 i = 0; i <= nEq; i++) {
+    rowPtr[i] = iofeir[i] - 1;
+  }
+  for (uindex k = 0; k < nnz; k++) {
+    colInd[k] = columns[k] - 1;
+  }
+  u.assign(values, values + nnz);
+  d.resize(nEq);
+  modifiedPivots = 0;
+
+  // right-looking factorization: row k of U updates rows j > k, only existing entries of
+  // the sparsity are modified (zero fill-in)
+  for (uint32 k = 0; k < nEq; k++) {
+    CHECK(rowPtr[k] < rowPtr[k + 1] && colInd[rowPtr[k]] == k)
+      << "Diagonal entry is absent in the row " << k + 1;
+    double akk = values[rowPtr[k]];
+    double dk = u[rowPtr[k]];
+    bool tiny = (dk == 0.0 || fabs(dk) <= 1.0e-14 * fabs(akk));
+    if (tiny) {
+      dk = (akk != 0.0) ? (positive ? fabs(akk) : akk) : 1.0;
+      modifiedPivots++;
+    } else if (positive && dk < 0.0) {
+      // negative pivot (like in rows of hydrostatic pressure or Lagrange multipliers): keep the
+      // magnitude of the Schur complement but flip the sign
+      dk = -dk;
+      modifiedPivots++;
+    }
+    d[k] = dk;
+
+    uindex endK = rowPtr[k + 1];
+    for (uindex p = rowPtr[k] + 1; p < endK; p++) {
+      double ukj = u[p] / dk;
+      if (ukj == 0.0) continue;
+      uint32 j = colInd[p];
+      uindex q = p;
+      uindex r = rowPtr[j];
+      uindex endJ = rowPtr[j + 1];
+      while (q < endK && r < endJ) {
+        if (colInd[q] == colInd[r]) {
+          u[r] -= ukj * u[q];
+          q++;
+          r++;
+        } else if (colInd[q] < colInd[r]) {
+          q++;
+        } else {
+          r++;
+        }
+      }
+    }
+    for (uindex p = rowPtr[k] + 1; p < endK; p++) {
+      u[p] /= dk;
+    }
+  }
+  LOG_IF(modifiedPivots > 0, INFO) << getName() << ": " << modifiedPivots
+    << " pivots were modified";
+}
+
+
+void IncompleteLDLTPreconditioner::apply(const double* r, double* z) {
+  std::copy(r, r + nEq, z);
+  // U^T * y = r
+  for (uint32 k = 0; k < nEq; k++) {
+    double zk = z[k];
+    if (zk == 0.0) continue;
+    for (uindex p = rowPtr[k] + 1; p < rowPtr[k + 1]; p++) {
+      z[colInd[p]] -= u[p] * zk;
+    }
+  }
+  for (uint32 k = 0; k < nEq; k++) {
+    z[k] /= d[k];
+  }
+  // U * z = y
+  for (int32 k = (int32) nEq - 1; k >= 0; k--) {
+    double s = z[k];
+    for (uindex p = rowPtr[k] + 1; p < rowPtr[k + 1]; p++) {
+      s -= u[p] * z[colInd[p]];
+    }
+    z[k] = s;
+  }
+}
+
+
+bool IncompleteLDLTPreconditioner::isPositive() {
+  return positive;
+}
+
+
+std::string IncompleteLDLTPreconditioner::getName() {
+  return positive ? "IC(0)" : "ILDL(0)";
+}
+
+
+uint32 IncompleteLDLTPreconditioner::nModifiedPivots() {
+  return modifiedPivots;
+}
+
+} // namespace math
+
+} // namespace nla3d
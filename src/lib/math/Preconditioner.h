@@ -0,0 +1,120 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/BsrMatrix.h"
+#include "math/LinearOperator.h"
+
+namespace nla3d {
+
+namespace math {
+
+// Preconditioner - abstract class of preconditioners M ~ A for Krylov equation solvers (see
+// KrylovEquationSolver). setup(..) is called every time the matrix values are changed, apply(..)
+// is called on every iteration. Preconditioners which need only the diagonal of the matrix could be
+// also built for a matrix-free LinearOperator.
+class Preconditioner {
+public:
+  virtual ~Preconditioner() { };
+  // build the preconditioner for the matrix
+  virtual void setup(SparseSymMatrix* matrix) = 0;
+  // build the preconditioner for the operator which isn't assembled into a matrix. By default
+  // it's not supported.
+  virtual void setup(LinearOperator* op);
+  // build the preconditioner for the matrix in BSR format. By default the matrix is used as a
+  // LinearOperator.
+  virtual void setup(BsrSymMatrix* matrix);
+  // z = M^-1 * r
+  virtual void apply(const double* r, double* z) = 0;
+  // true if M is symmetric positive definite (CG and MINRES require that)
+  virtual bool isPositive();
+  virtual std::string getName() = 0;
+};
+
+
+// JacobiPreconditioner - M = diag(A). Zero diagonal entries (like in MPC rows) are replaced by 1.0
+// and absolute values are used to keep M positive.
+class JacobiPreconditioner : public Preconditioner {
+public:
+  virtual ~JacobiPreconditioner() { };
+  using Preconditioner::setup;
+  virtual void setup(SparseSymMatrix* matrix);
+  virtual void setup(LinearOperator* op);
+  virtual void apply(const double* r, double* z);
+  virtual std::string getName();
+protected:
+  std::vector<double> invDiag;
+};
+
+
+// BlockJacobiPreconditioner - M = blockdiag(A) with dense blocks of nodal equations (at most
+// blockSize equations in a block). The blocks are given by setBlocks(..) (FESolver takes them from
+// FEStorage::getNodalBlocks(..)), otherwise they are found from the structure of SparseSymMatrix
+// (see BsrSymMatrix::findRowGroups(..)). For BsrSymMatrix the blocks are the groups of rows of the
+// matrix. Every block is inverted by Cholesky decomposition; if the block isn't positive definite,
+// the block falls back to Jacobi.
+class BlockJacobiPreconditioner : public Preconditioner {
+public:
+  BlockJacobiPreconditioner(uint16 _blockSize = 3);
+  virtual ~BlockJacobiPreconditioner() { };
+  using Preconditioner::setup;
+  virtual void setup(SparseSymMatrix* matrix);
+  virtual void setup(BsrSymMatrix* matrix);
+  virtual void apply(const double* r, double* z);
+  virtual std::string getName();
+
+  // blocks of equations for setup(SparseSymMatrix*) in the form of BsrSymMatrix::reinit(..). Empty
+  // means that blocks are found from the matrix structure.
+  void setBlocks(const std::vector<uint32>& blockFirst);
+  // blocks of the last setup(..)
+  const std::vector<uint32>& getBlocks();
+protected:
+  // invert the blocks given by blockFirst, value(i, j) is the entry of the matrix (from 0)
+  template <typename F>
+  void invertBlocks(F value);
+
+  uint16 blockSize;
+  uint32 nEq = 0;
+  // block b consists of equations [blockFirst[b], blockFirst[b+1])
+  std::vector<uint32> blockFirst;
+  std::vector<uint32> givenBlocks;
+  // inverted blocks (m x m for a block of m equations) are [invPtr[b], invPtr[b+1]) of invBlocks
+  std::vector<uint64> invPtr;
+  std::vector<double> invBlocks;
+};
+
+
+// IncompleteLDLTPreconditioner - incomplete factorization with zero fill-in M = U^T * D * U, where
+// U has the sparsity of the upper triangle of A. With positive = true (IC(0)) negative pivots are
+// replaced by their absolute values to keep M positive definite (CG, MINRES). With positive = false (ILDL(0)) pivots keep their sign, so M is suitable for indefinite
+// matrices in GMRES.
+class IncompleteLDLTPreconditioner : public Preconditioner {
+public:
+  IncompleteLDLTPreconditioner(bool _positive = true);
+  virtual ~IncompleteLDLTPreconditioner() { };
+  using Preconditioner::setup;
+  virtual void setup(SparseSymMatrix* matrix);
+  virtual void apply(const double* r, double* z);
+  virtual bool isPositive();
+  virtual std::string getName();
+
+  // number of pivots which were modified in the last setup(..)
+  uint32 nModifiedPivots();
+protected:
+  bool positive;
+  uint32 nEq = 0;
+  uint32 modifiedPivots = 0;
+  // U factor in the sparsity of the matrix (diagonal entries are not used)
+  std::vector<double> u;
+  std::vector<double> d;
+  // 0-based copies of the matrix CSR arrays
+  std::vector<uindex> rowPtr;
+  std::vector<uint32> colInd;
+};
+
+} // namespace math
+
+} // namespace nla3d
@@ -3,12 +3,179 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "SparseMatrix.h"
+#include "math/ThreadPool.h"
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NLA3D_SPARSE_AVX2
+#endif
 
 namespace nla3d {
 namespace math {
 
+namespace {
+
+// products of matrices with less entries are done by the simple serial loops
+const uint32 minParallelValues = 50000;
+// minimal number of rows in a parallel range
+const uint32 rowGrain = 1024;
+
+// Row sums: sum of values[k] * x[columns[k] - 1] (or values[positions[k]] * x[columns[k] - 1]) for
+// k in [0, n). Terms are accumulated in 4 partial sums (k % 4) which are added as (s0 + s1) +
+// (s2 + s3), then the tail terms are added. The AVX2 versions follow exactly the same order of
+// operations (and don't use FMA), so the results are the same bit to bit on every CPU.
+double rowDotScalar(const double* values, const uint32* columns, uint32 n, const double* x) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  uint32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+    s0 += values[k] * x[columns[k] - 1];
+    s1 += values[k + 1] * x[columns[k + 1] - 1];
+    s2 += values[k + 2] * x[columns[k + 2] - 1];
+    s3 += values[k + 3] * x[columns[k + 3] - 1];
+  }
+  double sum = (s0 + s1) + (s2 + s3);
+  for (; k < n; k++) {
+    sum += values[k] * x[columns[k] - 1];
+  }
+  return sum;
+}
+
+
+double rowDotIndirectScalar(const double* values, const uindex* positions, const uint32* columns,
+                            uint32 n, const double* x) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  uint32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+    s0 += values[positions[k]] * x[columns[k] - 1];
+    s1 += values[positions[k + 1]] * x[columns[k + 1] - 1];
+    s2 += values[positions[k + 2]] * x[columns[k + 2] - 1];
+    s3 += values[positions[k + 3]] * x[columns[k + 3] - 1];
+  }
+  double sum = (s0 + s1) + (s2 + s3);
+  for (; k < n; k++) {
+    sum += values[positions[k]] * x[columns[k] - 1];
+  }
+  return sum;
+}
+
+
+#ifdef NLA3D_SPARSE_AVX2
+__attribute__((target("avx2")))
+double horizontalSum(__m256d acc) {
+  alignas(32) double s[4];
+  _mm256_store_pd(s, acc);
+  return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+
+// Gathers in the masked form with all lanes enabled: the plain _mm256_i32gather_pd(..) is
+// implemented by GCC 12 with an uninitialized source operand ("'__Y' may be used uninitialized")
+__attribute__((target("avx2")))
+inline __m256d gatherAvx2(const double* base, __m128i idx) {
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, idx, all, 8);
+}
+
+
+#ifdef NLA3D_64BIT_INDEX
+__attribute__((target("avx2")))
+inline __m256d gatherAvx2(const double* base, __m256i idx) {
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), base, idx, all, 8);
+}
+#endif
+
 
-const uint32 SparsityInfo::invalid = 0xFFFFFFFF;
+__attribute__((target("avx2")))
+double rowDotAvx2(const double* values, const uint32* columns, uint32 n, const double* x) {
+  // x[columns[k] - 1] == (x - 1)[columns[k]]
+  const double* xm = x - 1;
+  __m256d acc = _mm256_setzero_pd();
+  uint32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(columns + k));
+    __m256d xv = gatherAvx2(xm, idx);
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(values + k), xv));
+  }
+  double sum = horizontalSum(acc);
+  for (; k < n; k++) {
+    sum += values[k] * x[columns[k] - 1];
+  }
+  return sum;
+}
+
+
+__attribute__((target("avx2")))
+double rowDotIndirectAvx2(const double* values, const uindex* positions, const uint32* columns,
+                          uint32 n, const double* x) {
+  const double* xm = x - 1;
+  __m256d acc = _mm256_setzero_pd();
+  uint32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+#ifdef NLA3D_64BIT_INDEX
+    __m256i pos = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions + k));
+    __m256d vv = gatherAvx2(values, pos);
+#else
+    __m128i pos = _mm_loadu_si128(reinterpret_cast<const __m128i*>(positions + k));
+    __m256d vv = gatherAvx2(values, pos);
+#endif
+    __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(columns + k));
+    __m256d xv = gatherAvx2(xm, idx);
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(vv, xv));
+  }
+  double sum = horizontalSum(acc);
+  for (; k < n; k++) {
+    sum += values[positions[k]] * x[columns[k] - 1];
+  }
+  return sum;
+}
+
+
+bool cpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+
+// row sum kernels
+struct RowKernels {
+  RowKernels(bool avx2) {
+#ifdef NLA3D_SPARSE_AVX2
+    if (avx2) {
+      dot = rowDotAvx2;
+      dotIndirect = rowDotIndirectAvx2;
+    }
+#endif
+  }
+
+  double (*dot)(const double*, const uint32*, uint32, const double*) = rowDotScalar;
+  double (*dotIndirect)(const double*, const uindex*, const uint32*, uint32, const double*) =
+    rowDotIndirectScalar;
+};
+
+
+// kernels for the running CPU. AVX2 gathers take signed indexes (32-bit ones for uint32), so the
+// scalar kernels are used for matrices with positions or columns over 2^31.
+const RowKernels& rowKernels(uindex nValues, uint32 nColumns) {
+  static RowKernels scalar(false);
+#ifdef NLA3D_SPARSE_AVX2
+  static RowKernels best(cpuHasAvx2());
+  const uint64 maxIndex = 0x7FFFFFFF;
+  const uint64 maxPosition = std::numeric_limits<uindex>::max() >> 1;
+  if (nValues <= maxPosition && nColumns <= maxIndex) {
+    return best;
+  }
+#endif
+  return scalar;
+}
+
+} // namespace
+
+
+const uindex SparsityInfo::invalid = std::numeric_limits<uindex>::max();
+const uint32 SparsityInfo::noColumn = 0xFFFFFFFF;
 
 SparsityInfo::SparsityInfo() {
 
@@ -38,6 +205,11 @@ void SparsityInfo::clear() {
 
   compressed = false;
   numberOfValues = 0;
+
+  transIofeir.clear();
+  transPositions.clear();
+  transRows.clear();
+  transposed = false;
 }
 
 
@@ -49,10 +221,11 @@ void SparsityInfo::reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row) {
   nColumns = _ncols;
 
   maxInRow = _max_in_row < nColumns  ? _max_in_row : nColumns;
-	columns = new uint32[nRows * maxInRow];
-  std::fill_n(columns, nRows * maxInRow, invalid);
+  uindex size = checkCount(static_cast<uint64>(nRows) * maxInRow);
+	columns = new uint32[size];
+  std::fill_n(columns, size, noColumn);
 
-	iofeir = new uint32[nRows+1];
+	iofeir = new uindex[nRows+1];
   iofeir[0] = 1;
   for (uint32 i = 1; i <= nRows; i++) {
     iofeir[i] = iofeir[i-1] + maxInRow;
@@ -60,6 +233,40 @@ void SparsityInfo::reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row) {
 }
 
 
+void SparsityInfo::reinit(uint32 _nrows, uint32 _ncols, const std::vector<uint32>& rowSizes) {
+  assert(rowSizes.size() == _nrows);
+  clear();
+
+  nRows = _nrows;
+  nColumns = _ncols;
+
+  iofeir = new uindex[nRows+1];
+  iofeir[0] = 1;
+  maxInRow = 0;
+  uint64 total = 0;
+  for (uint32 i = 1; i <= nRows; i++) {
+    assert(rowSizes[i-1] <= nColumns);
+    total += rowSizes[i-1];
+    iofeir[i] = checkCount(total) + 1;
+    maxInRow = std::max(maxInRow, rowSizes[i-1]);
+  }
+  // all entries are counted in advance, the rows should be filled by setRow(..)
+  numberOfValues = iofeir[nRows] - 1;
+  columns = new uint32[numberOfValues];
+  std::fill_n(columns, numberOfValues, noColumn);
+}
+
+
+uindex SparsityInfo::checkCount(uint64 count) {
+  // iofeir keeps positions + 1 and `invalid` is reserved
+  if (count >= static_cast<uint64>(invalid) - 1) {
+    LOG(FATAL) << "Too many entries in the sparse matrix (" << count << "), build nla3d with "
+      << "nla3d_64bit_index";
+  }
+  return static_cast<uindex>(count);
+}
+
+
 // row and column positions are started from 1
 void SparsityInfo::addEntry(uint32 _i, uint32 _j) {
   assert(iofeir != nullptr);
@@ -68,13 +275,13 @@ void SparsityInfo::addEntry(uint32 _i, uint32 _j) {
   assert(_j > 0 && _j <= nColumns);
   assert(compressed == false);
   // NOTE: before compressions columns are not sorted
-  uint32 st = iofeir[_i-1] - 1;
-  uint32 en = iofeir[_i] - 1;
-  for (uint32 i = st; i < en; i++) {
+  uindex st = iofeir[_i-1] - 1;
+  uindex en = iofeir[_i] - 1;
+  for (uindex i = st; i < en; i++) {
     // if element already in matrix
     if (columns[i] == _j) return;
     // have a space to store new entry in the row
-    if (columns[i] == invalid) {
+    if (columns[i] == noColumn) {
       columns[i] = _j;
       numberOfValues++;
       return;
@@ -85,17 +292,42 @@ void SparsityInfo::addEntry(uint32 _i, uint32 _j) {
 }
 
 
+void SparsityInfo::setRow(uint32 _i, const uint32* _columns) {
+  assert(iofeir != nullptr);
+  assert(columns != nullptr);
+  assert(_i > 0 && _i <= nRows);
+  assert(compressed == false);
+  uindex st = iofeir[_i-1] - 1;
+  uindex en = iofeir[_i] - 1;
+  if (st == en) return;
+  assert(columns[st] == noColumn);
+  assert(std::is_sorted(_columns, _columns + (en - st)));
+  std::copy(_columns, _columns + (en - st), columns + st);
+}
+
+
 void SparsityInfo::compress() {
   if (compressed) return;
 
-  uint32 next = 0;
-  uint32 nextRow = 0;
+  // all rows are filled up: columns are already packed, only need to sort them
+  if (numberOfValues == iofeir[nRows] - 1) {
+    for (uint32 i = 0; i < nRows; i++) {
+      if (!std::is_sorted(&columns[iofeir[i] - 1], &columns[iofeir[i+1] - 1])) {
+        std::sort(&columns[iofeir[i] - 1], &columns[iofeir[i+1] - 1]);
+      }
+    }
+    compressed = true;
+    return;
+  }
+
+  uindex next = 0;
+  uindex nextRow = 0;
   uint32* old_columns = columns;
   columns = new uint32[numberOfValues];
 
   for (uint32 i = 0; i < nRows; i++) {
-    for (uint32 j = iofeir[i] - 1; j < iofeir[i+1] - 1; j++) {
-      if (old_columns[j] == invalid) break;
+    for (uindex j = iofeir[i] - 1; j < iofeir[i+1] - 1; j++) {
+      if (old_columns[j] == noColumn) break;
       columns[next++] = old_columns[j];
     }
     if ((next - nextRow) > 1) {
@@ -114,15 +346,43 @@ void SparsityInfo::compress() {
 }
 
 
-uint32 SparsityInfo::getIndex(uint32 _i, uint32 _j) {
+void SparsityInfo::buildTransposed() {
+  assert(compressed);
+  if (transposed) return;
+  std::lock_guard<std::mutex> lock(transposedMutex);
+  if (transposed) return;
+
+  transIofeir.assign(nColumns + 1, 0);
+  for (uindex k = 0; k < numberOfValues; k++) {
+    transIofeir[columns[k]]++;
+  }
+  for (uint32 j = 0; j < nColumns; j++) {
+    transIofeir[j + 1] += transIofeir[j];
+  }
+  transPositions.resize(numberOfValues);
+  transRows.resize(numberOfValues);
+  std::vector<uindex> next(transIofeir.begin(), transIofeir.end() - 1);
+  // rows are walked in order, so rows of every column are sorted
+  for (uint32 i = 0; i < nRows; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uindex p = next[columns[k] - 1]++;
+      transPositions[p] = k;
+      transRows[p] = i + 1;
+    }
+  }
+  transposed = true;
+}
+
+
+uindex SparsityInfo::getIndex(uint32 _i, uint32 _j) {
   assert(columns);
   assert(iofeir);
 	assert(_i > 0 && _i <= nRows);
 	assert(_j > 0 && _j <= nColumns);
 
-  uint32 ind;
-	uint32 st = iofeir[_i-1] - 1;
-	uint32 en = iofeir[_i] - 1;
+  uindex ind;
+	uindex st = iofeir[_i-1] - 1;
+	uindex en = iofeir[_i] - 1;
 
   if (st == en) return invalid;
 
@@ -136,7 +396,7 @@ uint32 SparsityInfo::getIndex(uint32 _i, uint32 _j) {
         return en;
 			return invalid;
 		}
-		ind = (uint32) ((en+st)*0.5);
+		ind = st + (en - st) / 2;
 		
 		if (columns[ind] == _j)
       return ind;
@@ -160,14 +420,14 @@ void BaseSparseMatrix::printInternalData(std::ostream& out) {
   assert(si->compressed);
 
 	out << "values = {";
-	for (uint32 i = 0; i < si->numberOfValues; i++) {
+	for (uindex i = 0; i < si->numberOfValues; i++) {
 		out << values[i] << "\t";
   }
 	out << "}" << std::endl;
 
 	out << "columns = {";
 	for (uint32 i = 0; i < si->nRows; i++) {
-		for (uint32 j = si->iofeir[i] - 1; j < si->iofeir[i + 1] - 1; j++) {
+		for (uindex j = si->iofeir[i] - 1; j < si->iofeir[i + 1] - 1; j++) {
 			out << si->columns[j] << "\t";
     }
 	}
@@ -190,9 +450,9 @@ void BaseSparseMatrix::writeCoordinateTextFormat(std::ostream& out) {
   auto old_flags = out.setf(std::ios_base::scientific, std::ios_base::floatfield);
   // write header: nRows, nColumns, numberOfValues
   out << si->nRows << ' ' << si->nColumns << ' ' << si->numberOfValues << std::endl;
-  uint32 total = 0;
+  uindex total = 0;
   for (uint32 i = 1; i <= si->nRows; i++) {
-    for (uint32 j = si->iofeir[i - 1] - 1; j < si->iofeir[i] - 1; j++) {
+    for (uindex j = si->iofeir[i - 1] - 1; j < si->iofeir[i] - 1; j++) {
         out << i << ' ' << si->columns[j] << ' ' << values[j] << std::endl;
         total++;
     }
@@ -206,11 +466,12 @@ void BaseSparseMatrix::writeCoordinateTextFormat(std::ostream& out) {
 
 void BaseSparseMatrix::readCoordinateTextFormat(std::istream& in) {
   std::vector<SparseEntry> entries;
-  uint32 _nrows, _ncols, _nvalues;
+  uint32 _nrows, _ncols;
+  uindex _nvalues;
   // read header: nRows, nColumns, numberOfValues
   in >> _nrows >> _ncols >> _nvalues;
   entries.reserve(_nvalues);
-  for (uint32 i = 1; i <= _nvalues; i++) {
+  for (uindex i = 1; i <= _nvalues; i++) {
     SparseEntry entry;
     in >> entry.i >> entry.j >> entry.v;
     entries.push_back(entry);
@@ -243,14 +504,14 @@ bool BaseSparseMatrix::compare(const BaseSparseMatrix& op2, double th) {
       return false;
     }
   }
-  for (uint32 i = 0; i < op1.nValues(); i++) {
+  for (uindex i = 0; i < op1.nValues(); i++) {
     if (op1.si->columns[i] != op2.si->columns[i]) {
       return false;
     }
   }
 
   // fourth round. compare values with thresholds
-  for (uint32 i = 0; i < op1.nValues(); i++) {
+  for (uindex i = 0; i < op1.nValues(); i++) {
     if (fabs(op1.values[i] - op2.values[i]) > th) {
       return false;
     }
@@ -314,7 +575,7 @@ void BaseSparseMatrix::reinit(uint32 _nrows, uint32 _ncols, const std::vector<Sp
   // write non-zero values into matrix
   for (auto& v : entries) {
     //addValue(v.i, v.j, v.v);
-    uint32 index = si->getIndex(v.i, v.j);
+    uindex index = si->getIndex(v.i, v.j);
     if (index == SparsityInfo::invalid) {
       LOG(FATAL) << "The position(" << v.i << ", " << v.j << ") is absent in the matrix";
     }
@@ -396,7 +657,7 @@ double& SparseMatrix::operator()(uint32 _i, uint32 _j) {
   assert(values);
   assert(si);
 
-	uint32 index = si->getIndex(_i, _j);
+	uindex index = si->getIndex(_i, _j);
   if (index == SparsityInfo::invalid) {
     LOG(FATAL) << "The position(" << _i << ", " << _j << ") is absent in the matrix";
   }
@@ -407,7 +668,7 @@ double SparseMatrix::value(uint32 _i, uint32 _j) const {
   assert(values);
   assert(si);
 
-	uint32 index = si->getIndex(_i, _j);
+	uindex index = si->getIndex(_i, _j);
   if (index == SparsityInfo::invalid) {
     return 0.0;
   }
@@ -471,7 +732,7 @@ double& SparseSymMatrix::operator() (uint32 _i, uint32 _j) {
   // ensure that we work in upper triangle
 	if (_i > _j) std::swap(_i, _j);
 
-	uint32 index = si->getIndex(_i, _j);
+	uindex index = si->getIndex(_i, _j);
   if (index == SparsityInfo::invalid) {
     LOG(FATAL) << "The position(" << _i << ", " << _j << ") is absent in the matrix";
   }
@@ -486,7 +747,7 @@ double SparseSymMatrix::value(uint32 _i, uint32 _j) const {
   // ensure that we work in upper triangle
 	if (_i > _j) std::swap(_i, _j);
 
-	uint32 index = si->getIndex(_i, _j);
+	uindex index = si->getIndex(_i, _j);
   if (index == SparsityInfo::invalid) {
     return 0.0;
   }
@@ -495,27 +756,55 @@ double SparseSymMatrix::value(uint32 _i, uint32 _j) const {
 
 
 void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R) {
-  assert(B.si);
-  assert(B.si->compressed);
-  assert(B.values);
   assert(B.nRows() == V.size());
   assert(R.size() >= B.nRows());
-  // TODO: Try to use BLAS routines and measure speedup
 
-	const double eps = 1e-20;
+  matBVprod(B, const_cast<dVec&>(V).ptr(), coef, R.ptr());
+}
 
-  for (uint32 i = 1; i <= B.nRows(); i++) {
-    // walk on lower triangle
-    for (uint32 j = 1; j <= i; j++)
-      if (fabs(V[j-1]) > eps)
-        R[i-1] += B.value(j, i) * V[j-1] * coef;
 
-    // walk on upper triangle
-    // TODO: could be done in more efficient way
-    for (uint32 j = i + 1; j <= B.nRows(); j++)
-      if (fabs(V[j-1]) > eps)
-        R[i-1] += B.value(i, j) * V[j-1] * coef;
+void matBVprod(SparseSymMatrix &B, const double* V, const double coef, double* R) {
+  assert(B.si);
+  assert(B.si->compressed);
+  assert(B.values);
+
+  const uindex* iofeir = B.si->iofeir;
+  const uint32* columns = B.si->columns;
+  const double* values = B.values;
+  if (B.si->numberOfValues < minParallelValues) {
+    for (uint32 i = 0; i < B.si->nRows; i++) {
+      double vi = V[i] * coef;
+      double sum = 0.0;
+      for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+        uint32 j = columns[k] - 1;
+        sum += values[k] * V[j];
+        // walk on lower triangle
+        if (j != i) R[j] += values[k] * vi;
+      }
+      R[i] += sum * coef;
+    }
+    return;
   }
+
+  B.si->buildTransposed();
+  const uindex* transIofeir = B.si->transIofeir.data();
+  const uindex* transPositions = B.si->transPositions.data();
+  const uint32* transRows = B.si->transRows.data();
+  const RowKernels& kernels = rowKernels(B.si->numberOfValues, B.si->nColumns);
+  parallelFor(B.si->nRows, 0, [&](uint32 begin, uint32 end) {
+    for (uint32 i = begin; i < end; i++) {
+      // the upper triangle part of the row
+      uindex st = iofeir[i] - 1;
+      double sum = kernels.dot(values + st, columns + st, iofeir[i + 1] - 1 - st, V);
+      // the lower triangle part is the upper triangle part of the column (without the diagonal
+      // entry, which is the last one in the column)
+      uindex tst = transIofeir[i];
+      uindex ten = transIofeir[i + 1];
+      if (ten > tst && transRows[ten - 1] == i + 1) ten--;
+      sum += kernels.dotIndirect(values, transPositions + tst, transRows + tst, ten - tst, V);
+      R[i] += sum * coef;
+    }
+  }, rowGrain);
 }
 
 
@@ -527,16 +816,32 @@ void matBVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R) {
   assert(R.size() >= B.nRows());
   // TODO: Try to use BLAS routines and measure speedup
 
+  if (B.si->numberOfValues >= minParallelValues) {
+    const uindex* iofeir = B.si->iofeir;
+    const uint32* columns = B.si->columns;
+    const double* values = B.values;
+    const double* v = const_cast<dVec&>(V).ptr();
+    double* r = R.ptr();
+    const RowKernels& kernels = rowKernels(B.si->numberOfValues, B.si->nColumns);
+    parallelFor(B.si->nRows, 0, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        uindex st = iofeir[i] - 1;
+        r[i] += kernels.dot(values + st, columns + st, iofeir[i + 1] - 1 - st, v) * coef;
+      }
+    }, rowGrain);
+    return;
+  }
+
   for (uint32 i = 1; i <= B.nRows(); i++) {
 
     //if no elements in the current row return zero res
     if (B.si->iofeir[i] - B.si->iofeir[i-1] == 0)
       continue;
 
-    uint32 st = B.si->iofeir[i-1] - 1;
-    uint32 en = B.si->iofeir[i] - 2;
+    uindex st = B.si->iofeir[i-1] - 1;
+    uindex en = B.si->iofeir[i] - 2;
 
-    for (uint32 j = st; j <= en; j++)
+    for (uindex j = st; j <= en; j++)
       R[i-1] += B.values[j] * V[B.si->columns[j]-1] * coef;
   }
 }
@@ -549,13 +854,33 @@ void matBTVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R) {
   assert(R.size() >= B.nColumns());
   // TODO: Try to use BLAS routines and measure speedup
 
+  if (B.si->numberOfValues >= minParallelValues) {
+    // rows of B^T are the columns of B
+    B.si->buildTransposed();
+    const uindex* transIofeir = B.si->transIofeir.data();
+    const uindex* transPositions = B.si->transPositions.data();
+    const uint32* transRows = B.si->transRows.data();
+    const double* values = B.values;
+    const double* v = const_cast<dVec&>(V).ptr();
+    double* r = R.ptr();
+    const RowKernels& kernels = rowKernels(B.si->numberOfValues, B.si->nColumns);
+    parallelFor(B.si->nColumns, 0, [&](uint32 begin, uint32 end) {
+      for (uint32 j = begin; j < end; j++) {
+        uindex tst = transIofeir[j];
+        r[j] += kernels.dotIndirect(values, transPositions + tst, transRows + tst,
+                                    transIofeir[j + 1] - tst, v) * coef;
+      }
+    }, rowGrain);
+    return;
+  }
+
 	for (uint32 i = 1; i <= B.si->nRows; i++) {
 		if (B.si->iofeir[i] - B.si->iofeir[i-1] == 0) {
 			continue;
     }
-		uint32 st = B.si->iofeir[i-1] - 1;
-		uint32 en = B.si->iofeir[i] - 2;
-		for (uint32 j = st; j <= en; j++)
+		uindex st = B.si->iofeir[i-1] - 1;
+		uindex en = B.si->iofeir[i] - 2;
+		for (uindex j = st; j <= en; j++)
       R[B.si->columns[j] - 1] += B.values[j] * V[i-1] * coef;
 	}
 }
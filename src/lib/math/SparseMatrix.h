@@ -6,6 +6,8 @@
 
 #include "sys.h"
 #include "math/Vec.h"
+#include <atomic>
+#include <mutex>
 
 namespace nla3d {
 namespace math {
@@ -14,10 +16,11 @@ namespace math {
 
 class SparseMatrix;
 class SparseSymMatrix;
+class BsrSymMatrix;
 
-// TODO: Sparse Matrices in nla3d directly used in MKLs' PARDISO equation solver. That's why we use
-// uint32 for value indexes. More general way is to use templates with arbitrary type for entities
-// and for indexes.
+// NOTE: Sparse Matrices in nla3d are directly used in MKLs' PARDISO equation solver. Positions of
+// entries (iofeir, number of values) have uindex type (see sys.h): uint32 by default and uint64 with
+// nla3d_64bit_index, row and column numbers are uint32.
 
 // Class to hold columns and iofeir (Index Of First Element In the Row) of 3-arrays CSR storage
 // format. SparsityInfo can be shared between sparse matrices.
@@ -28,9 +31,15 @@ class SparsityInfo {
     ~SparsityInfo();
 
     void reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row);
+    // exact allocation: rowSizes[_row-1] is the number of entries in the _row. Every row should be
+    // filled by setRow(..) (not by addEntry(..)), memory is proportional to the number of non-zeros.
+    void reinit(uint32 _nrows, uint32 _ncols, const std::vector<uint32>& rowSizes);
     // add information than (_row, _column) entries has non-zero value
     // _i, _j indexes are started from 1
     void addEntry(uint32 _i, uint32 _j);
+    // fill all entries of the _row at once (after exact reinit(..)). _columns should be sorted and
+    // unique, its size is equal to the size of the row. Different rows could be filled in parallel.
+    void setRow(uint32 _i, const uint32* _columns);
     // perform compression procedure. After that positions of non-zero entries can't be changed
     void compress();
     bool isCompressed();
@@ -38,17 +47,26 @@ class SparsityInfo {
     // return number of entries in the _row (_row > 0)
     uint32 nElementsInRow(uint32 _row);
     // get index in values array (see SparseMatrix implementation) for entry position _i, _j
-    uint32 getIndex(uint32 _i, uint32 _j);
+    uindex getIndex(uint32 _i, uint32 _j);
+
+    // getIndex(..) returns invalid if the entry is absent in the sparsity
+    static const uindex invalid;
 
     friend class BaseSparseMatrix;
     friend class SparseMatrix;
     friend class SparseSymMatrix;
+    friend class BsrSymMatrix;
     friend void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R);
+    friend void matBVprod(SparseSymMatrix &B, const double* V, const double coef, double* R);
     friend void matBVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R);
     friend void matBTVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R);
 
   private:
     void clear();
+    // fatal error if `count` entries can't be addressed by uindex
+    static uindex checkCount(uint64 count);
+    // build the column-wise index below (once after compress(), thread safe)
+    void buildTransposed();
 
     // Data arrays to implement compressed sparse row format with 3 arrays (3-array CSR).
     // Format was implemented by using MKL manual.
@@ -58,9 +76,11 @@ class SparsityInfo {
     uint32* columns = nullptr;
     // index of first entry in row: iofeir[_row-1] first entry in _row,
     // iofeir[_row]-1 - last entry in _row
-    uint32* iofeir = nullptr;
+    uindex* iofeir = nullptr;
     // number of non-zero entries in the matrix. Also, the size of values array.
-    uint32 numberOfValues = 0;
+    uindex numberOfValues = 0;
+    // the column of not used entry before compress()
+    static const uint32 noColumn;
     uint32 maxInRow = 0;
     bool compressed = false;
 
@@ -68,7 +88,14 @@ class SparsityInfo {
     uint32 nRows = 0;
     uint32 nColumns = 0;
 
-    static const uint32 invalid;
+    // Column-wise index of the entries used by parallel products (see matBVprod(..)): entries of
+    // the column j (from 1) are [transIofeir[j-1], transIofeir[j]) (from 0) of transPositions
+    // (positions in values array) and transRows (row numbers, from 1, sorted).
+    std::vector<uindex> transIofeir;
+    std::vector<uindex> transPositions;
+    std::vector<uint32> transRows;
+    std::atomic<bool> transposed{false};
+    std::mutex transposedMutex;
 };
 
 // structure to describe entry in sparse matrix. Used in one of several matrix initialization
@@ -113,8 +140,8 @@ class BaseSparseMatrix {
     // getters
     double* getValuesArray();
     uint32* getColumnsArray();
-    uint32* getIofeirArray();
-    uint32 nValues() const;
+    uindex* getIofeirArray();
+    uindex nValues() const;
     uint32 nRows() const;
     uint32 nColumns() const;
     std::shared_ptr<SparsityInfo> getSparsityInfo();
@@ -183,9 +210,23 @@ class SparseSymMatrix : public BaseSparseMatrix {
     double value(uint32 _i, uint32 _j) const;
 
     friend void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R);
+    friend void matBVprod(SparseSymMatrix &B, const double* V, const double coef, double* R);
 };
 
 
+// R += coef * B * V for raw arrays of B.nRows() size. Only the upper triangle of B is stored, so
+// every off-diagonal entry contributes to two rows of R.
+//
+// Products of big matrices (see minParallelValues in SparseMatrix.cpp) are done in parallel on
+// math::ThreadPool by ranges of rows of R. Every row of R is summed by its own thread: the entries
+// which go to the other rows (the lower triangle of SparseSymMatrix, all entries in matBTVprod(..))
+// are gathered by the column-wise index of SparsityInfo instead of scattered, so there are no
+// races and the result doesn't depend on the number of threads. Row sums are vectorized (4 partial
+// sums, AVX2 gathers if the CPU supports them, checked at runtime) with the same order of
+// operations on every CPU. R and V shouldn't overlap.
+void matBVprod(SparseSymMatrix &B, const double* V, const double coef, double* R);
+
+
 inline bool SparsityInfo::isCompressed() {
     return compressed;
 }
@@ -193,7 +234,7 @@ inline bool SparsityInfo::isCompressed() {
 inline uint32 SparsityInfo::nElementsInRow(uint32 _row) {
     assert(iofeir != nullptr);
     assert(_row > 0 && _row <= nRows);
-    return iofeir[_row] - iofeir[_row-1];
+    return static_cast<uint32>(iofeir[_row] - iofeir[_row-1]);
 }
 
 
@@ -214,13 +255,13 @@ inline uint32* BaseSparseMatrix::getColumnsArray() {
   return si->columns;
 }
 
-inline uint32* BaseSparseMatrix::getIofeirArray() {
+inline uindex* BaseSparseMatrix::getIofeirArray() {
   assert(si);
   assert(si->compressed);
   return si->iofeir;
 }
 
-inline uint32 BaseSparseMatrix::nValues() const {
+inline uindex BaseSparseMatrix::nValues() const {
   assert(si);
   return si->numberOfValues;
 }
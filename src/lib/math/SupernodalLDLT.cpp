@@ -0,0 +1,1317 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/SupernodalLDLT.h"
+#include "math/ThreadPool.h"
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
+
+#ifdef NLA3D_USE_BLAS
+  #include <mkl.h>
+#endif
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+// the updates of a top supernode are split into parallelChunksPerThread column chunks per thread
+// to balance the work (the first columns get updates from more descendants)
+const uint16 parallelChunksPerThread = 4;
+// minimal number of rows of the panel below the diagonal block processed by one task
+const uint32 panelRowGrain = 64;
+
+#ifdef NLA3D_USE_BLAS
+// C = A * B^T for column-major matrices (A is m x k, B is n x k)
+inline void gemmNT(uint32 m, uint32 n, uint32 k, const double* A, uint32 lda, const double* B,
+    uint32 ldb, double* C, uint32 ldc) {
+  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, m, n, k, 1.0, A, lda, B, ldb, 0.0, C, ldc);
+}
+
+
+inline void gemmNT(uint32 m, uint32 n, uint32 k, const float* A, uint32 lda, const float* B,
+    uint32 ldb, float* C, uint32 ldc) {
+  cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, m, n, k, 1.0f, A, lda, B, ldb, 0.0f, C, ldc);
+}
+#else
+// tiles of gemmNTLower(..): gemmRowTile x gemmDepthTile block of A stays in L2 cache while it's
+// multiplied by all columns of C, 4 columns of C are computed together so every loaded entry of
+// A is used 4 times
+const uint32 gemmRowTile = 64;
+const uint32 gemmDepthTile = 128;
+
+
+// C = A * B^T for column-major matrices (A is m x k, B is n x k, n <= m), only the lower
+// trapezoid of C (i >= j) is needed. Every entry of C is summed over k in the same order whatever
+// the tiles are, so the result doesn't depend on m and n of the call.
+template <typename T>
+void gemmNTLower(uint32 m, uint32 n, uint32 k, const T* A, uint32 lda, const T* B, uint32 ldb,
+    T* C, uint32 ldc) {
+  // columns of C are zeroed from the first row of their group of 4 columns
+  for (uint32 j = 0; j < n; j++) {
+    std::fill(C + static_cast<uint64>(ldc) * j + (j & ~3u), C + static_cast<uint64>(ldc) * j + m,
+        T(0));
+  }
+  for (uint32 p0 = 0; p0 < k; p0 += gemmDepthTile) {
+    const uint32 p1 = std::min(k, p0 + gemmDepthTile);
+    for (uint32 i0 = 0; i0 < m; i0 += gemmRowTile) {
+      const uint32 i1 = std::min(m, i0 + gemmRowTile);
+      // only columns j < i1 have entries in rows [i0, i1)
+      const uint32 jEnd = std::min(n, i1);
+      uint32 j = 0;
+      for (; j + 4 <= jEnd; j += 4) {
+        const uint32 ib = std::max(i0, j);
+        T* c0 = C + static_cast<uint64>(ldc) * j;
+        T* c1 = c0 + ldc;
+        T* c2 = c1 + ldc;
+        T* c3 = c2 + ldc;
+        for (uint32 p = p0; p < p1; p++) {
+          const T* b = B + static_cast<uint64>(ldb) * p + j;
+          const T b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3];
+          if (b0 == 0.0 && b1 == 0.0 && b2 == 0.0 && b3 == 0.0) continue;
+          const T* a = A + static_cast<uint64>(lda) * p;
+          for (uint32 i = ib; i < i1; i++) {
+            const T ai = a[i];
+            c0[i] += ai * b0;
+            c1[i] += ai * b1;
+            c2[i] += ai * b2;
+            c3[i] += ai * b3;
+          }
+        }
+      }
+      for (; j < jEnd; j++) {
+        const uint32 ib = std::max(i0, j);
+        T* c0 = C + static_cast<uint64>(ldc) * j;
+        for (uint32 p = p0; p < p1; p++) {
+          const T b0 = B[static_cast<uint64>(ldb) * p + j];
+          if (b0 == 0.0) continue;
+          const T* a = A + static_cast<uint64>(lda) * p;
+          for (uint32 i = ib; i < i1; i++) {
+            c0[i] += a[i] * b0;
+          }
+        }
+      }
+    }
+  }
+}
+#endif
+
+
+// Build the pattern of lower triangle of P*A*P^T stored by columns. A is given by upper triangle
+// 3-array CSR with 1-based indexes (as in SparseSymMatrix). iperm[old] = new. colPtr/rowInd
+// describes the columns (rows in a column are not sorted), src holds index of the entry in values
+// array of A.
+void permutedLowerColumns(uint32 n, const uindex* iofeir, const uint32* columns,
+    const std::vector<uint32>& iperm, std::vector<uindex>& colPtr, std::vector<uint32>& rowInd,
+    std::vector<uindex>* src) {
+  colPtr.assign(n + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 a = iperm[i];
+      uint32 b = iperm[columns[k] - 1];
+      colPtr[std::min(a, b) + 1]++;
+    }
+  }
+  for (uint32 j = 0; j < n; j++) {
+    colPtr[j + 1] += colPtr[j];
+  }
+  rowInd.resize(colPtr[n]);
+  if (src) src->resize(colPtr[n]);
+  std::vector<uindex> next(colPtr.begin(), colPtr.end() - 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 a = iperm[i];
+      uint32 b = iperm[columns[k] - 1];
+      uindex pos = next[std::min(a, b)]++;
+      rowInd[pos] = std::max(a, b);
+      if (src) (*src)[pos] = k;
+    }
+  }
+}
+
+
+// Transpose the column pattern of the lower triangle into the row pattern (strictly lower part
+// only).
+void lowerRows(uint32 n, const std::vector<uindex>& colPtr, const std::vector<uint32>& rowInd,
+    std::vector<uindex>& rowPtr, std::vector<uint32>& colInd) {
+  rowPtr.assign(n + 1, 0);
+  for (uint32 j = 0; j < n; j++) {
+    for (uindex k = colPtr[j]; k < colPtr[j + 1]; k++) {
+      if (rowInd[k] != j) rowPtr[rowInd[k] + 1]++;
+    }
+  }
+  for (uint32 i = 0; i < n; i++) {
+    rowPtr[i + 1] += rowPtr[i];
+  }
+  colInd.resize(rowPtr[n]);
+  std::vector<uindex> next(rowPtr.begin(), rowPtr.end() - 1);
+  for (uint32 j = 0; j < n; j++) {
+    for (uindex k = colPtr[j]; k < colPtr[j + 1]; k++) {
+      if (rowInd[k] != j) colInd[next[rowInd[k]]++] = j;
+    }
+  }
+}
+
+
+// Elimination tree by Liu's algorithm with path compression. parent[j] = -1 for roots.
+void eliminationTree(uint32 n, const std::vector<uindex>& rowPtr, const std::vector<uint32>& colInd,
+    std::vector<int32>& parent) {
+  parent.assign(n, -1);
+  std::vector<int32> ancestor(n, -1);
+  for (uint32 k = 0; k < n; k++) {
+    for (uindex p = rowPtr[k]; p < rowPtr[k + 1]; p++) {
+      int32 i = colInd[p];
+      while (i != -1 && i < (int32) k) {
+        int32 inext = ancestor[i];
+        ancestor[i] = k;
+        if (inext == -1) parent[i] = k;
+        i = inext;
+      }
+    }
+  }
+}
+
+
+// Depth-first postordering of the forest. post[k] = node which goes k-th.
+void postorder(uint32 n, const std::vector<int32>& parent, std::vector<uint32>& post) {
+  std::vector<int32> head(n, -1);
+  std::vector<int32> next(n, -1);
+  // children are pushed in reverse order to visit them in ascending order
+  for (int32 j = (int32) n - 1; j >= 0; j--) {
+    if (parent[j] == -1) continue;
+    next[j] = head[parent[j]];
+    head[parent[j]] = j;
+  }
+  post.resize(n);
+  std::vector<int32> stack;
+  uint32 k = 0;
+  for (uint32 j = 0; j < n; j++) {
+    if (parent[j] != -1) continue;
+    stack.push_back(j);
+    while (!stack.empty()) {
+      int32 p = stack.back();
+      int32 i = head[p];
+      if (i == -1) {
+        stack.pop_back();
+        post[k++] = p;
+      } else {
+        head[p] = next[i];
+        stack.push_back(i);
+      }
+    }
+  }
+  assert(k == n);
+}
+
+
+// Number of nonzeros in every column of L (including the diagonal) by traversing the row
+// subtrees of the elimination tree.
+void columnCounts(uint32 n, const std::vector<uindex>& rowPtr, const std::vector<uint32>& colInd,
+    const std::vector<int32>& parent, std::vector<uint32>& colCount) {
+  colCount.assign(n, 1);
+  std::vector<uint32> mark(n, n);
+  for (uint32 k = 0; k < n; k++) {
+    mark[k] = k;
+    for (uindex p = rowPtr[k]; p < rowPtr[k + 1]; p++) {
+      int32 i = colInd[p];
+      while (i != -1 && mark[i] != k) {
+        colCount[i]++;
+        mark[i] = k;
+        i = parent[i];
+      }
+    }
+  }
+}
+
+// supernodes with up to relaxedSupernodes[0] columns are merged always, up to
+// relaxedSupernodes[1] - if the fraction of zeros is less than 80%, up to relaxedSupernodes[2] -
+// less than 10% and wider ones - less than 5% (the same strategy as CHOLMOD uses)
+const uint32 relaxedSupernodes[3] = {4, 16, 48};
+
+} // anonymous namespace
+
+
+SupernodalLDLT::SupernodalLDLT() {
+}
+
+
+SupernodalLDLT::~SupernodalLDLT() {
+  clear();
+}
+
+
+void SupernodalLDLT::clear() {
+  n = 0;
+  nnzA = 0;
+  nValuesA = 0;
+  perm.clear();
+  superFirst.clear();
+  superParent.clear();
+  rowPtr.clear();
+  rowIdx.clear();
+  lxPtr.clear();
+  updPtr.clear();
+  updSuper.clear();
+  updOffset.clear();
+  assPtr.clear();
+  assSrc.clear();
+  assDst.clear();
+  lx.clear();
+  lxSingle.clear();
+  factorSingle = false;
+  scratch.close();
+  superPanel.clear();
+  pivPerm.clear();
+  pivType.clear();
+  work.clear();
+  nnzL = 0;
+  flops = 0.0;
+  perturbedPivots = 0;
+  negativePivots = 0;
+  twoByTwoPivots = 0;
+  parallelSupernodes = 0;
+  analysed = false;
+  factorized = false;
+}
+
+
+void SupernodalLDLT::analyse(SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "SupernodalLDLT::analyse");
+  CHECK(matrix->isCompressed());
+  clear();
+
+  std::vector<uint32> order;
+  fillReducingOrdering(matrix, ordering, order);
+  analysePattern(matrix->nRows(), matrix->getIofeirArray(), matrix->getColumnsArray(), order);
+  nValuesA = matrix->nValues();
+}
+
+
+void SupernodalLDLT::analyse(BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "SupernodalLDLT::analyse");
+  CHECK(matrix->isCompressed());
+  clear();
+
+  // The fill-reducing ordering is computed for the block graph (about blockSize^2 times less
+  // entries than the graph of equations), the equations of a group are eliminated one after
+  // another. The diagonal of the block graph is the largest diagonal entry of the group: groups of
+  // one Mpc equation keep their zero diagonal.
+  const uint16 bs = BsrSymMatrix::blockSize;
+  const uint32 nb = matrix->nBlocks();
+  const uint32* bcols = matrix->getBlockColumnsArray();
+  const uindex* biofeir = matrix->getBlockIofeirArray();
+  const double* values = matrix->getValuesArray();
+  SparseSymMatrix graph(matrix->getSparsityInfo());
+  double* g = graph.getValuesArray();
+  for (uint32 b = 0; b < nb; b++) {
+    uindex k = biofeir[b] - 1;
+    uint16 size = static_cast<uint16>(matrix->getBlockFirst(b + 1) - matrix->getBlockFirst(b));
+    g[k] = 0.0;
+    for (uint16 l = 0; l < size; l++) {
+      g[k] = std::max(g[k], fabs(values[k * bs * bs + l * bs + l]));
+    }
+    for (k++; k < biofeir[b + 1] - 1; k++) {
+      g[k] = 1.0;
+    }
+  }
+  std::vector<uint32> blockOrder;
+  fillReducingOrdering(&graph, ordering, blockOrder);
+  std::vector<uint32> order;
+  order.reserve(matrix->nRows());
+  for (auto b : blockOrder) {
+    for (uint32 i = matrix->getBlockFirst(b); i < matrix->getBlockFirst(b + 1); i++) {
+      order.push_back(i);
+    }
+  }
+
+  // the pattern of the equations: all entries of the blocks (upper triangle of the diagonal
+  // blocks), src[k] is the position of k-th entry in the values of the BSR matrix
+  const uint32 nr = matrix->nRows();
+  std::vector<uindex> iofeir(nr + 1);
+  std::vector<uint32> columns;
+  std::vector<uindex> src;
+  iofeir[0] = 1;
+  for (uint32 b = 0; b < nb; b++) {
+    const uint32 f = matrix->getBlockFirst(b);
+    for (uint32 i = f; i < matrix->getBlockFirst(b + 1); i++) {
+      for (uindex k = biofeir[b] - 1; k < biofeir[b + 1] - 1; k++) {
+        const uint32 bj = bcols[k] - 1;
+        const uint32 fj = matrix->getBlockFirst(bj);
+        for (uint32 j = (bj == b ? i : fj); j < matrix->getBlockFirst(bj + 1); j++) {
+          columns.push_back(j + 1);
+          src.push_back(k * bs * bs + (i - f) * bs + (j - fj));
+        }
+      }
+      iofeir[i + 1] = static_cast<uindex>(columns.size() + 1);
+    }
+  }
+  analysePattern(nr, iofeir.data(), columns.data(), order);
+  for (auto& a : assSrc) {
+    a = src[a];
+  }
+  nValuesA = matrix->nValues();
+}
+
+
+void SupernodalLDLT::analysePattern(uint32 nr, const uindex* iofeir, const uint32* columns,
+    const std::vector<uint32>& order) {
+  n = nr;
+  nnzA = iofeir[n] - 1;
+
+  std::vector<uindex> colPtr, src, lrowPtr;
+  std::vector<uint32> rowInd, lcolInd;
+  std::vector<int32> parent;
+
+  // fill-reducing ordering followed by postordering of the elimination tree. Postordering doesn't
+  // change the fill-in but makes columns of every supernode contiguous.
+  std::vector<uint32> iperm(n);
+  for (uint32 k = 0; k < n; k++) {
+    iperm[order[k]] = k;
+  }
+  permutedLowerColumns(n, iofeir, columns, iperm, colPtr, rowInd, nullptr);
+  lowerRows(n, colPtr, rowInd, lrowPtr, lcolInd);
+  eliminationTree(n, lrowPtr, lcolInd, parent);
+  std::vector<uint32> post;
+  postorder(n, parent, post);
+
+  perm.resize(n);
+  for (uint32 k = 0; k < n; k++) {
+    perm[k] = order[post[k]];
+    iperm[perm[k]] = k;
+  }
+  permutedLowerColumns(n, iofeir, columns, iperm, colPtr, rowInd, &src);
+  lowerRows(n, colPtr, rowInd, lrowPtr, lcolInd);
+  eliminationTree(n, lrowPtr, lcolInd, parent);
+
+  std::vector<uint32> colCount;
+  columnCounts(n, lrowPtr, lcolInd, parent, colCount);
+  lrowPtr.clear();
+  lcolInd.clear();
+
+  // fundamental supernodes: column j joins supernode of column j-1 if j is the only child of j-1
+  // and L(:, j-1) has the same structure as L(:, j) plus diagonal entry.
+  std::vector<uint32> nChildren(n, 0);
+  for (uint32 j = 0; j < n; j++) {
+    if (parent[j] != -1) nChildren[parent[j]]++;
+  }
+  std::vector<uint32> fundFirst;
+  for (uint32 j = 0; j < n; j++) {
+    if (j == 0 || parent[j - 1] != (int32) j || nChildren[j] != 1 ||
+        colCount[j - 1] != colCount[j] + 1) {
+      fundFirst.push_back(j);
+    }
+  }
+  fundFirst.push_back(n);
+
+  // relaxed amalgamation: a supernode is merged with its parent which goes right after it if
+  // the number of explicitly stored zeros stays small. Wider supernodes give much better
+  // performance of dense kernels with a little bit more memory.
+  uint32 nf = static_cast<uint32>(fundFirst.size() - 1);
+  std::vector<uint32> grpLast(nf), grpNc(nf), grpNr(nf);
+  std::vector<uint64> grpNnz(nf, 0);
+  std::vector<bool> leader(nf, true);
+  for (uint32 s = 0; s < nf; s++) {
+    grpLast[s] = fundFirst[s + 1] - 1;
+    grpNc[s] = fundFirst[s + 1] - fundFirst[s];
+    grpNr[s] = colCount[fundFirst[s]];
+    for (uint32 j = fundFirst[s]; j < fundFirst[s + 1]; j++) {
+      grpNnz[s] += colCount[j];
+    }
+  }
+  for (int32 s = (int32) nf - 2; s >= 0; s--) {
+    uint32 t = s + 1;
+    int32 p = parent[grpLast[s]];
+    if (p == -1 || p > (int32) grpLast[t]) continue;
+    uint64 nc = grpNc[s] + grpNc[t];
+    uint64 nr = grpNc[s] + grpNr[t];
+    uint64 entries = nc * nr - nc * (nc - 1) / 2;
+    double zeros = static_cast<double>(entries - grpNnz[s] - grpNnz[t]) / entries;
+    bool merge = (nc <= relaxedSupernodes[0]) ||
+                 (nc <= relaxedSupernodes[1] && zeros < 0.8) ||
+                 (nc <= relaxedSupernodes[2] && zeros < 0.1) ||
+                 (zeros < 0.05);
+    if (!merge) continue;
+    leader[t] = false;
+    grpLast[s] = grpLast[t];
+    grpNc[s] = static_cast<uint32>(nc);
+    grpNr[s] = static_cast<uint32>(nr);
+    grpNnz[s] += grpNnz[t];
+  }
+  for (uint32 s = 0; s < nf; s++) {
+    if (leader[s]) superFirst.push_back(fundFirst[s]);
+  }
+  superFirst.push_back(n);
+  uint32 ns = nSupernodes();
+
+  std::vector<uint32> colToSuper(n);
+  for (uint32 s = 0; s < ns; s++) {
+    for (uint32 j = superFirst[s]; j < superFirst[s + 1]; j++) {
+      colToSuper[j] = s;
+    }
+  }
+  superParent.resize(ns);
+  std::vector<int32> childHead(ns, -1);
+  std::vector<int32> childNext(ns, -1);
+  for (int32 s = (int32) ns - 1; s >= 0; s--) {
+    int32 p = parent[superFirst[s + 1] - 1];
+    superParent[s] = (p == -1) ? -1 : (int32) colToSuper[p];
+    if (superParent[s] != -1) {
+      childNext[s] = childHead[superParent[s]];
+      childHead[superParent[s]] = s;
+    }
+  }
+
+  // row structure of supernodes: the supernode's columns, rows of A below the supernode and rows
+  // of children supernodes below the supernode
+  std::vector<uint32> mark(n, ns);
+  std::vector<uint32> extra;
+  rowPtr.resize(ns + 1);
+  rowPtr[0] = 0;
+  rowIdx.reserve(colPtr[n]);
+  for (uint32 s = 0; s < ns; s++) {
+    uint32 f = superFirst[s];
+    uint32 l = superFirst[s + 1] - 1;
+    extra.clear();
+    for (uint32 j = f; j <= l; j++) {
+      rowIdx.push_back(j);
+      mark[j] = s;
+    }
+    for (uint32 j = f; j <= l; j++) {
+      for (uindex k = colPtr[j]; k < colPtr[j + 1]; k++) {
+        uint32 i = rowInd[k];
+        if (mark[i] != s) {
+          mark[i] = s;
+          extra.push_back(i);
+        }
+      }
+    }
+    for (int32 c = childHead[s]; c != -1; c = childNext[c]) {
+      uint32 cnc = superFirst[c + 1] - superFirst[c];
+      for (uint32 r = rowPtr[c] + cnc; r < rowPtr[c + 1]; r++) {
+        uint32 i = rowIdx[r];
+        if (mark[i] != s) {
+          mark[i] = s;
+          extra.push_back(i);
+        }
+      }
+    }
+    std::sort(extra.begin(), extra.end());
+    rowIdx.insert(rowIdx.end(), extra.begin(), extra.end());
+    rowPtr[s + 1] = static_cast<uint32>(rowIdx.size());
+  }
+
+  // storage for numerical values of L and D
+  lxPtr.resize(ns + 1);
+  lxPtr[0] = 0;
+  nnzL = 0;
+  flops = 0.0;
+  for (uint32 s = 0; s < ns; s++) {
+    uint64 nr = rowPtr[s + 1] - rowPtr[s];
+    uint64 nc = superFirst[s + 1] - superFirst[s];
+    lxPtr[s + 1] = lxPtr[s] + nr * nc;
+    for (uint64 c = 0; c < nc; c++) {
+      double cc = static_cast<double>(nr - c);
+      nnzL += nr - c;
+      flops += cc * cc;
+    }
+  }
+
+  // lists of descendant supernodes which update supernode s
+  updPtr.assign(ns + 1, 0);
+  for (uint32 d = 0; d < ns; d++) {
+    uint32 dnc = superFirst[d + 1] - superFirst[d];
+    uint32 prev = ns;
+    for (uint32 r = rowPtr[d] + dnc; r < rowPtr[d + 1]; r++) {
+      uint32 s = colToSuper[rowIdx[r]];
+      if (s != prev) {
+        updPtr[s + 1]++;
+        prev = s;
+      }
+    }
+  }
+  for (uint32 s = 0; s < ns; s++) {
+    updPtr[s + 1] += updPtr[s];
+  }
+  updSuper.resize(updPtr[ns]);
+  updOffset.resize(updPtr[ns]);
+  std::vector<uint32> next(updPtr.begin(), updPtr.end() - 1);
+  for (uint32 d = 0; d < ns; d++) {
+    uint32 dnc = superFirst[d + 1] - superFirst[d];
+    uint32 prev = ns;
+    for (uint32 r = rowPtr[d] + dnc; r < rowPtr[d + 1]; r++) {
+      uint32 s = colToSuper[rowIdx[r]];
+      if (s != prev) {
+        updSuper[next[s]] = d;
+        updOffset[next[s]] = r - rowPtr[d];
+        next[s]++;
+        prev = s;
+      }
+    }
+  }
+
+  // positions of A's entries inside of supernodes' blocks
+  assPtr.resize(ns + 1);
+  assPtr[0] = 0;
+  assSrc.resize(nnzA);
+  assDst.resize(nnzA);
+  std::vector<uint32> relMap(n);
+  uindex pos = 0;
+  for (uint32 s = 0; s < ns; s++) {
+    uint32 nr = rowPtr[s + 1] - rowPtr[s];
+    for (uint32 r = 0; r < nr; r++) {
+      relMap[rowIdx[rowPtr[s] + r]] = r;
+    }
+    for (uint32 j = superFirst[s]; j < superFirst[s + 1]; j++) {
+      for (uindex k = colPtr[j]; k < colPtr[j + 1]; k++) {
+        assSrc[pos] = src[k];
+        assDst[pos] = relMap[rowInd[k]] + nr * (j - superFirst[s]);
+        pos++;
+      }
+    }
+    assPtr[s + 1] = pos;
+  }
+
+  pivPerm.resize(n);
+  pivType.resize(n);
+  analysed = true;
+
+  LOG(INFO) << "SupernodalLDLT: number of equations = " << n << ", number of supernodes = " << ns;
+  LOG(INFO) << "Number of nonzeros in factors = " << nnzL << ", number of factorization MFLOPS = "
+            << flops * 1.0e-6;
+}
+
+
+void SupernodalLDLT::factorize(SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "SupernodalLDLT::factorize");
+  CHECK(analysed) << "SupernodalLDLT::analyse should be called before factorization";
+  CHECK(matrix->nRows() == n && matrix->nValues() == nValuesA)
+    << "The matrix doesn't correspond to the analysed one";
+  factorizeValues(matrix->getValuesArray());
+}
+
+
+void SupernodalLDLT::factorize(BsrSymMatrix* matrix) {
+  TIMED_SCOPE(t, "SupernodalLDLT::factorize");
+  CHECK(analysed) << "SupernodalLDLT::analyse should be called before factorization";
+  CHECK(matrix->nRows() == n && matrix->nValues() == nValuesA)
+    << "The matrix doesn't correspond to the analysed one";
+  factorizeValues(matrix->getValuesArray());
+}
+
+
+void SupernodalLDLT::factorizeValues(const double* values) {
+  aValues = values;
+  double anorm = 0.0;
+  for (uindex k = 0; k < nValuesA; k++) {
+    anorm = std::max(anorm, fabs(aValues[k]));
+  }
+  tinyPivot = pivotThreshold * (anorm > 0.0 ? anorm : 1.0);
+
+  factorized = false;
+
+  // stats[0] - perturbed pivots, stats[1] - negative pivots, stats[2] - 2x2 pivots
+  uint32 stats[3] = {0, 0, 0};
+  factorSingle = singlePrecision;
+  if (outOfCore) {
+    std::vector<double>().swap(lx);
+    std::vector<float>().swap(lxSingle);
+    openScratch(factorSingle ? sizeof(float) : sizeof(double));
+    if (factorSingle) {
+      factorizeSupernodes(reinterpret_cast<float*>(scratch.data()), stats);
+    } else {
+      factorizeSupernodes(reinterpret_cast<double*>(scratch.data()), stats);
+    }
+    scratch.logStatistics("Out-of-core factorization");
+  } else if (factorSingle) {
+    scratch.close();
+    std::vector<double>().swap(lx);
+    lxSingle.resize(lxPtr.back());
+    factorizeSupernodes(lxSingle.data(), stats);
+  } else {
+    scratch.close();
+    std::vector<float>().swap(lxSingle);
+    lx.resize(lxPtr.back());
+    factorizeSupernodes(lx.data(), stats);
+  }
+
+  perturbedPivots = stats[0];
+  negativePivots = stats[1];
+  twoByTwoPivots = stats[2];
+  aValues = nullptr;
+  factorized = true;
+
+  LOG_IF(perturbedPivots > 0, WARNING) << "SupernodalLDLT: " << perturbedPivots
+    << " pivots were perturbed during factorization";
+}
+
+
+template <typename T>
+void SupernodalLDLT::factorizeSupernodes(T* L, uint32* stats) {
+  uint32 ns = nSupernodes();
+  uint16 threads = getNumberOfThreads();
+
+  // the top of the elimination tree: big supernodes with big ancestors. They are factorized one by
+  // one after all others, every one by all threads.
+  std::vector<bool> top(ns, false);
+  parallelSupernodes = 0;
+  if (threads > 1) {
+    for (int32 s = (int32) ns - 1; s >= 0; s--) {
+      uint64 size = static_cast<uint64>(rowPtr[s + 1] - rowPtr[s]) * (superFirst[s + 1] - superFirst[s]);
+      top[s] = (size >= parallelPanelSize && (superParent[s] == -1 || top[superParent[s]]));
+      if (top[s]) parallelSupernodes++;
+    }
+  }
+  uint32 nBottom = ns - parallelSupernodes;
+  uint16 bottomThreads = static_cast<uint16>(std::min<uint32>(threads, std::max(nBottom, 1u)));
+
+  if (bottomThreads <= 1) {
+    std::vector<uint32> relMap(n);
+    std::vector<uint32> swaps;
+    std::vector<T> W, C;
+    for (uint32 s = 0; s < ns; s++) {
+      if (!top[s]) factorizeSupernode(s, L, relMap, W, C, swaps, stats);
+    }
+  } else {
+    // Supernode can be factorized as soon as all its children are done. The ready supernodes are
+    // kept in a stack to factorize subtrees in depth-first manner.
+    std::vector<uint32> pending(ns, 0);
+    std::vector<uint32> ready;
+    for (uint32 s = 0; s < ns; s++) {
+      if (superParent[s] != -1) pending[superParent[s]]++;
+    }
+    for (int32 s = (int32) ns - 1; s >= 0; s--) {
+      if (pending[s] == 0 && !top[s]) ready.push_back(s);
+    }
+    uint32 done = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    auto worker = [&]() {
+      std::vector<uint32> relMap(n);
+      std::vector<uint32> swaps;
+      std::vector<T> W, C;
+      uint32 localStats[3] = {0, 0, 0};
+      while (true) {
+        uint32 s;
+        {
+          std::unique_lock<std::mutex> lock(mtx);
+          cv.wait(lock, [&] { return !ready.empty() || done == nBottom; });
+          if (ready.empty()) break;
+          s = ready.back();
+          ready.pop_back();
+        }
+        factorizeSupernode(s, L, relMap, W, C, swaps, localStats);
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          done++;
+          int32 p = superParent[s];
+          if (p != -1 && --pending[p] == 0 && !top[p]) ready.push_back(p);
+        }
+        cv.notify_all();
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      for (uint16 i = 0; i < 3; i++) {
+        stats[i] += localStats[i];
+      }
+    };
+
+    // `threads` long tasks of the ThreadPool share the queue of ready supernodes
+    TaskGroup group;
+    for (uint16 i = 0; i < bottomThreads; i++) {
+      group.run(worker);
+    }
+    group.wait();
+  }
+
+  if (parallelSupernodes > 0) {
+    std::vector<uint32> relMap(n);
+    std::vector<uint32> swaps;
+    std::vector<std::vector<T> > W(threads * parallelChunksPerThread);
+    std::vector<std::vector<T> > C(threads * parallelChunksPerThread);
+    for (uint32 s = 0; s < ns; s++) {
+      // children of the top supernode are either done in the tree-parallel phase or they are
+      // top supernodes with smaller numbers
+      if (!top[s]) continue;
+      factorizeSupernodeParallel(s, L, relMap, W, C, swaps, stats, threads);
+    }
+  }
+}
+
+
+template <typename T>
+void SupernodalLDLT::assembleSupernode(uint32 s, T* Ls, std::vector<uint32>& relMap) {
+  uint32 nc = superFirst[s + 1] - superFirst[s];
+  uint32 nr = rowPtr[s + 1] - rowPtr[s];
+  const uint32* rows = &rowIdx[rowPtr[s]];
+  std::fill_n(Ls, static_cast<uint64>(nr) * nc, 0.0);
+  for (uindex k = assPtr[s]; k < assPtr[s + 1]; k++) {
+    Ls[assDst[k]] += aValues[assSrc[k]];
+  }
+  for (uint32 r = 0; r < nr; r++) {
+    relMap[rows[r]] = r;
+  }
+}
+
+
+template <typename T>
+void SupernodalLDLT::factorizeSupernode(uint32 s, T* L, std::vector<uint32>& relMap,
+    std::vector<T>& W, std::vector<T>& C, std::vector<uint32>& swaps, uint32* stats) {
+  uint32 nc = superFirst[s + 1] - superFirst[s];
+  uint32 nr = rowPtr[s + 1] - rowPtr[s];
+  T* Ls = L + lxPtr[s];
+  bool ooc = scratch.isOpened();
+  if (ooc) scratch.acquire(superPanel[s]);
+
+  assembleSupernode(s, Ls, relMap);
+  updateSupernode(s, L, relMap, 0, nc, W, C);
+  factorizeDiagonalBlock(s, Ls, nr, nc, swaps, stats);
+  factorizePanelRows(s, Ls, nr, nc, swaps, nc, nr);
+
+  if (ooc) scratch.release(superPanel[s], true);
+}
+
+
+template <typename T>
+void SupernodalLDLT::factorizeSupernodeParallel(uint32 s, T* L, std::vector<uint32>& relMap,
+    std::vector<std::vector<T> >& W, std::vector<std::vector<T> >& C, std::vector<uint32>& swaps,
+    uint32* stats, uint16 threads) {
+  uint32 nc = superFirst[s + 1] - superFirst[s];
+  uint32 nr = rowPtr[s + 1] - rowPtr[s];
+  T* Ls = L + lxPtr[s];
+  bool ooc = scratch.isOpened();
+  if (ooc) scratch.acquire(superPanel[s]);
+
+  assembleSupernode(s, Ls, relMap);
+  // the updates of different columns of the supernode are independent
+  uint16 chunks = static_cast<uint16>(W.size());
+  parallelForChunks(nc, chunks, [&](uint16 chunk, uint32 c0, uint32 c1) {
+    updateSupernode(s, L, relMap, c0, c1, W[chunk], C[chunk]);
+  });
+  // pivots are chosen in the diagonal block, then the rows below it are processed in parallel
+  factorizeDiagonalBlock(s, Ls, nr, nc, swaps, stats);
+  parallelFor(nr - nc, threads, [&](uint32 begin, uint32 end) {
+    factorizePanelRows(s, Ls, nr, nc, swaps, nc + begin, nc + end);
+  }, panelRowGrain);
+
+  if (ooc) scratch.release(superPanel[s], true);
+}
+
+
+template <typename T>
+void SupernodalLDLT::updateSupernode(uint32 s, T* L, const std::vector<uint32>& relMap,
+    uint32 c0, uint32 c1, std::vector<T>& W, std::vector<T>& C) {
+  uint32 f = superFirst[s];
+  uint32 nr = rowPtr[s + 1] - rowPtr[s];
+  T* Ls = L + lxPtr[s];
+  bool ooc = scratch.isOpened();
+
+  // left-looking updates from all descendants:
+  // Ls(:, c0:c1) -= Ld(k0:, :) * Dd * Ld(k0:k1, :)^T, where k0..k1 are the rows of the descendant
+  // which fall into columns c0..c1 of the supernode
+  for (uint32 u = updPtr[s]; u < updPtr[s + 1]; u++) {
+    uint32 d = updSuper[u];
+    uint32 fd = superFirst[d];
+    uint32 ncd = superFirst[d + 1] - fd;
+    uint32 nrd = rowPtr[d + 1] - rowPtr[d];
+    const uint32* rowsD = &rowIdx[rowPtr[d]];
+
+    uint32 k0 = updOffset[u];
+    while (k0 < nrd && rowsD[k0] < f + c0) k0++;
+    uint32 k1 = k0;
+    while (k1 < nrd && rowsD[k1] < f + c1) k1++;
+    if (k1 == k0) continue;
+    uint32 m = nrd - k0;
+    uint32 q = k1 - k0;
+
+    const T* Ld = L + lxPtr[d];
+    if (ooc) scratch.acquire(superPanel[d]);
+    if (W.size() < static_cast<uint64>(m) * ncd) W.resize(static_cast<uint64>(m) * ncd);
+    if (C.size() < static_cast<uint64>(m) * q) C.resize(static_cast<uint64>(m) * q);
+
+    // W = Ld(k0:, :) * Dd
+    uint32 p = 0;
+    while (p < ncd) {
+      const T* l1 = Ld + static_cast<uint64>(nrd) * p + k0;
+      T* w1 = &W[static_cast<uint64>(m) * p];
+      if (pivType[fd + p] == 2) {
+        T d11 = Ld[p + static_cast<uint64>(nrd) * p];
+        T d21 = Ld[p + 1 + static_cast<uint64>(nrd) * p];
+        T d22 = Ld[p + 1 + static_cast<uint64>(nrd) * (p + 1)];
+        const T* l2 = l1 + nrd;
+        T* w2 = w1 + m;
+        for (uint32 i = 0; i < m; i++) {
+          w1[i] = l1[i] * d11 + l2[i] * d21;
+          w2[i] = l1[i] * d21 + l2[i] * d22;
+        }
+        p += 2;
+      } else {
+        T dp = Ld[p + static_cast<uint64>(nrd) * p];
+        for (uint32 i = 0; i < m; i++) {
+          w1[i] = l1[i] * dp;
+        }
+        p++;
+      }
+    }
+
+    // C = W * Ld(k0:k1, :)^T, only lower trapezoid is needed
+#ifdef NLA3D_USE_BLAS
+    gemmNT(m, q, ncd, &W[0], m, Ld + k0, nrd, &C[0], m);
+#else
+    gemmNTLower(m, q, ncd, &W[0], m, Ld + k0, nrd, &C[0], m);
+#endif
+
+    // scatter C into the supernode
+    for (uint32 c = 0; c < q; c++) {
+      T* Lcol = Ls + static_cast<uint64>(nr) * (rowsD[k0 + c] - f);
+      const T* Cc = &C[static_cast<uint64>(m) * c];
+      for (uint32 i = c; i < m; i++) {
+        Lcol[relMap[rowsD[k0 + i]]] -= Cc[i];
+      }
+    }
+    if (ooc) scratch.release(superPanel[d], false);
+  }
+}
+
+
+template <typename T>
+void SupernodalLDLT::factorizeDiagonalBlock(uint32 s, T* Ls, uint32 nr, uint32 nc,
+    std::vector<uint32>& swaps, uint32* stats) {
+  // Bunch-Kaufman partial pivoting (see LAPACK's dsytf2) where the pivot candidates are taken only
+  // from the diagonal block of the supernode. Only the rows of the diagonal block are updated here,
+  // the interchanges are recorded in swaps (pairs kk, kp) for factorizePanelRows(..).
+  const T alpha = (1.0 + sqrt(17.0)) / 8.0;
+  uint32* lp = &pivPerm[superFirst[s]];
+  uint8* pt = &pivType[superFirst[s]];
+  for (uint32 i = 0; i < nc; i++) {
+    lp[i] = i;
+  }
+  swaps.clear();
+
+  auto A = [Ls, nr] (uint32 i, uint32 j) -> T& {
+    return Ls[i + static_cast<uint64>(nr) * j];
+  };
+
+  uint32 k = 0;
+  while (k < nc) {
+    uint32 kstep = 1;
+    uint32 kp = k;
+    T absakk = fabs(A(k, k));
+    T colmax = 0.0;
+    uint32 imax = k;
+    if (usePivoting) {
+      for (uint32 i = k + 1; i < nc; i++) {
+        if (fabs(A(i, k)) > colmax) {
+          colmax = fabs(A(i, k));
+          imax = i;
+        }
+      }
+    }
+
+    if (std::max(absakk, colmax) <= tinyPivot) {
+      // the pivot can't be stabilized inside of the supernode
+      A(k, k) = (A(k, k) < 0.0) ? -tinyPivot : tinyPivot;
+      stats[0]++;
+    } else if (absakk < alpha * colmax) {
+      T rowmax = 0.0;
+      for (uint32 j = k; j < imax; j++) {
+        rowmax = std::max(rowmax, fabs(A(imax, j)));
+      }
+      for (uint32 j = imax + 1; j < nc; j++) {
+        rowmax = std::max(rowmax, fabs(A(j, imax)));
+      }
+      if (absakk * rowmax >= alpha * colmax * colmax) {
+        kp = k;
+      } else if (fabs(A(imax, imax)) >= alpha * rowmax) {
+        kp = imax;
+      } else {
+        kp = imax;
+        kstep = 2;
+      }
+    }
+
+    // symmetric interchange of rows and columns kk and kp
+    uint32 kk = k + kstep - 1;
+    if (kp != kk) {
+      for (uint32 j = 0; j < kk; j++) {
+        std::swap(A(kk, j), A(kp, j));
+      }
+      for (uint32 i = kp + 1; i < nc; i++) {
+        std::swap(A(i, kk), A(i, kp));
+      }
+      for (uint32 j = kk + 1; j < kp; j++) {
+        std::swap(A(j, kk), A(kp, j));
+      }
+      std::swap(A(kk, kk), A(kp, kp));
+      std::swap(lp[kk], lp[kp]);
+      swaps.push_back(kk);
+      swaps.push_back(kp);
+    }
+
+    if (kstep == 1) {
+      T d = A(k, k);
+      if (d < 0.0) stats[1]++;
+      for (uint32 j = k + 1; j < nc; j++) {
+        T ljk = A(j, k) / d;
+        if (ljk == 0.0) continue;
+        for (uint32 i = j; i < nc; i++) {
+          A(i, j) -= A(i, k) * ljk;
+        }
+      }
+      for (uint32 i = k + 1; i < nc; i++) {
+        A(i, k) /= d;
+      }
+      pt[k] = 1;
+    } else {
+      T d11 = A(k, k);
+      T d21 = A(k + 1, k);
+      T d22 = A(k + 1, k + 1);
+      T det = d11 * d22 - d21 * d21;
+      T i11 = d22 / det;
+      T i21 = -d21 / det;
+      T i22 = d11 / det;
+      for (uint32 j = k + 2; j < nc; j++) {
+        T w1 = A(j, k) * i11 + A(j, k + 1) * i21;
+        T w2 = A(j, k) * i21 + A(j, k + 1) * i22;
+        if (w1 == 0.0 && w2 == 0.0) continue;
+        for (uint32 i = j; i < nc; i++) {
+          A(i, j) -= A(i, k) * w1 + A(i, k + 1) * w2;
+        }
+      }
+      for (uint32 i = k + 2; i < nc; i++) {
+        T a1 = A(i, k);
+        T a2 = A(i, k + 1);
+        A(i, k) = a1 * i11 + a2 * i21;
+        A(i, k + 1) = a1 * i21 + a2 * i22;
+      }
+      pt[k] = 2;
+      pt[k + 1] = 0;
+      stats[2]++;
+      // 2x2 block with negative determinant has one negative eigenvalue
+      if (det < 0.0) {
+        stats[1]++;
+      } else if (d11 + d22 < 0.0) {
+        stats[1] += 2;
+      }
+    }
+    k += kstep;
+  }
+}
+
+
+template <typename T>
+void SupernodalLDLT::factorizePanelRows(uint32 s, T* Ls, uint32 nr, uint32 nc,
+    const std::vector<uint32>& swaps, uint32 i0, uint32 i1) {
+  // The rows below the diagonal block get the same column interchanges and eliminations as the
+  // rows of the diagonal block in factorizeDiagonalBlock(..): L21 = A21 * P * L11^-T * D^-1. Every
+  // row is processed independently (in the same order of operations as the diagonal block), so
+  // ranges of rows can be processed in parallel.
+  const uint8* pt = &pivType[superFirst[s]];
+  auto A = [Ls, nr] (uint32 i, uint32 j) -> T& {
+    return Ls[i + static_cast<uint64>(nr) * j];
+  };
+
+  for (size_t k = 0; k < swaps.size(); k += 2) {
+    uint32 kk = swaps[k];
+    uint32 kp = swaps[k + 1];
+    for (uint32 i = i0; i < i1; i++) {
+      std::swap(A(i, kk), A(i, kp));
+    }
+  }
+
+  uint32 k = 0;
+  while (k < nc) {
+    if (pt[k] == 1) {
+      T d = A(k, k);
+      for (uint32 j = k + 1; j < nc; j++) {
+        T ljk = A(j, k);
+        if (ljk == 0.0) continue;
+        for (uint32 i = i0; i < i1; i++) {
+          A(i, j) -= A(i, k) * ljk;
+        }
+      }
+      for (uint32 i = i0; i < i1; i++) {
+        A(i, k) /= d;
+      }
+      k++;
+    } else {
+      T d11 = A(k, k);
+      T d21 = A(k + 1, k);
+      T d22 = A(k + 1, k + 1);
+      T det = d11 * d22 - d21 * d21;
+      T i11 = d22 / det;
+      T i21 = -d21 / det;
+      T i22 = d11 / det;
+      for (uint32 j = k + 2; j < nc; j++) {
+        T w1 = A(j, k);
+        T w2 = A(j, k + 1);
+        if (w1 == 0.0 && w2 == 0.0) continue;
+        for (uint32 i = i0; i < i1; i++) {
+          A(i, j) -= A(i, k) * w1 + A(i, k + 1) * w2;
+        }
+      }
+      for (uint32 i = i0; i < i1; i++) {
+        T a1 = A(i, k);
+        T a2 = A(i, k + 1);
+        A(i, k) = a1 * i11 + a2 * i21;
+        A(i, k + 1) = a1 * i21 + a2 * i22;
+      }
+      k += 2;
+    }
+  }
+}
+
+
+void SupernodalLDLT::solve(const double* b, double* x, uint32 nrhs) {
+  TIMED_SCOPE(t, "SupernodalLDLT::solve");
+  CHECK(factorized) << "SupernodalLDLT::factorize should be called before solve";
+  if (nrhs == 0) return;
+
+  if (scratch.isOpened()) {
+    scratch.resetStatistics();
+    if (factorSingle) {
+      substitute(reinterpret_cast<const float*>(scratch.data()), b, x, nrhs);
+    } else {
+      substitute(reinterpret_cast<const double*>(scratch.data()), b, x, nrhs);
+    }
+    scratch.logStatistics("Out-of-core substitution");
+  } else if (factorSingle) {
+    substitute(lxSingle.data(), b, x, nrhs);
+  } else {
+    substitute(lx.data(), b, x, nrhs);
+  }
+}
+
+
+template <typename T>
+void SupernodalLDLT::substitute(const T* L, const double* b, double* x, uint32 nrhs) {
+  // All right hand sides are substituted at once: every column of a supernode is applied to the
+  // whole block of right hand sides. y[k * nrhs + r] is k-th variable of r-th rhs, y is kept in the
+  // symbolic ordering. Variables of a supernode are gathered into z in the pivoting order of the
+  // supernode.
+  uint32 ns = nSupernodes();
+  const uint64 n64 = n;
+  work.resize(n64 * nrhs);
+  std::vector<double> z;
+  double* y = work.data();
+  bool ooc = scratch.isOpened();
+
+  for (uint32 k = 0; k < n; k++) {
+    for (uint32 r = 0; r < nrhs; r++) {
+      y[static_cast<uint64>(k) * nrhs + r] = b[perm[k] + n64 * r];
+    }
+  }
+
+  auto gather = [&](uint32 f, uint32 nc, const uint32* lp) {
+    z.resize(static_cast<uint64>(nc) * nrhs);
+    for (uint32 i = 0; i < nc; i++) {
+      std::copy(y + static_cast<uint64>(f + lp[i]) * nrhs, y + static_cast<uint64>(f + lp[i] + 1) * nrhs,
+          &z[static_cast<uint64>(i) * nrhs]);
+    }
+  };
+  auto scatter = [&](uint32 f, uint32 nc, const uint32* lp) {
+    for (uint32 i = 0; i < nc; i++) {
+      std::copy(&z[static_cast<uint64>(i) * nrhs], &z[static_cast<uint64>(i + 1) * nrhs],
+          y + static_cast<uint64>(f + lp[i]) * nrhs);
+    }
+  };
+
+  // forward substitution: L * z = y
+  for (uint32 s = 0; s < ns; s++) {
+    uint32 f = superFirst[s];
+    uint32 nc = superFirst[s + 1] - f;
+    uint32 nr = rowPtr[s + 1] - rowPtr[s];
+    const uint32* rows = &rowIdx[rowPtr[s]];
+    const uint32* lp = &pivPerm[f];
+    const uint8* pt = &pivType[f];
+    const T* Ls = L + lxPtr[s];
+    if (ooc) scratch.acquire(superPanel[s]);
+    gather(f, nc, lp);
+    for (uint32 j = 0; j < nc; j++) {
+      const double* zj = &z[static_cast<uint64>(j) * nrhs];
+      const T* Lj = Ls + static_cast<uint64>(nr) * j;
+      for (uint32 i = (pt[j] == 2) ? j + 2 : j + 1; i < nc; i++) {
+        double lij = Lj[i];
+        if (lij == 0.0) continue;
+        double* zi = &z[static_cast<uint64>(i) * nrhs];
+        for (uint32 r = 0; r < nrhs; r++) {
+          zi[r] -= lij * zj[r];
+        }
+      }
+      for (uint32 i = nc; i < nr; i++) {
+        double lij = Lj[i];
+        if (lij == 0.0) continue;
+        double* yi = y + static_cast<uint64>(rows[i]) * nrhs;
+        for (uint32 r = 0; r < nrhs; r++) {
+          yi[r] -= lij * zj[r];
+        }
+      }
+    }
+    scatter(f, nc, lp);
+    if (ooc) scratch.release(superPanel[s], false);
+  }
+
+  // diagonal and backward substitution: D * L^T * z = y
+  for (int32 s = (int32) ns - 1; s >= 0; s--) {
+    uint32 f = superFirst[s];
+    uint32 nc = superFirst[s + 1] - f;
+    uint32 nr = rowPtr[s + 1] - rowPtr[s];
+    const uint32* rows = &rowIdx[rowPtr[s]];
+    const uint32* lp = &pivPerm[f];
+    const uint8* pt = &pivType[f];
+    const T* Ls = L + lxPtr[s];
+    if (ooc) scratch.acquire(superPanel[s]);
+    gather(f, nc, lp);
+    for (uint32 j = 0; j < nc; j++) {
+      double* zj = &z[static_cast<uint64>(j) * nrhs];
+      if (pt[j] == 1) {
+        double d = Ls[j + static_cast<uint64>(nr) * j];
+        for (uint32 r = 0; r < nrhs; r++) {
+          zj[r] /= d;
+        }
+      } else if (pt[j] == 2) {
+        double d11 = Ls[j + static_cast<uint64>(nr) * j];
+        double d21 = Ls[j + 1 + static_cast<uint64>(nr) * j];
+        double d22 = Ls[j + 1 + static_cast<uint64>(nr) * (j + 1)];
+        double det = d11 * d22 - d21 * d21;
+        double* zj1 = zj + nrhs;
+        for (uint32 r = 0; r < nrhs; r++) {
+          double z1 = zj[r];
+          double z2 = zj1[r];
+          zj[r] = (d22 * z1 - d21 * z2) / det;
+          zj1[r] = (d11 * z2 - d21 * z1) / det;
+        }
+      }
+    }
+    for (int32 j = (int32) nc - 1; j >= 0; j--) {
+      double* zj = &z[static_cast<uint64>(j) * nrhs];
+      const T* Lj = Ls + static_cast<uint64>(nr) * j;
+      for (uint32 i = (pt[j] == 2) ? j + 2 : j + 1; i < nc; i++) {
+        double lij = Lj[i];
+        if (lij == 0.0) continue;
+        const double* zi = &z[static_cast<uint64>(i) * nrhs];
+        for (uint32 r = 0; r < nrhs; r++) {
+          zj[r] -= lij * zi[r];
+        }
+      }
+      for (uint32 i = nc; i < nr; i++) {
+        double lij = Lj[i];
+        if (lij == 0.0) continue;
+        const double* yi = y + static_cast<uint64>(rows[i]) * nrhs;
+        for (uint32 r = 0; r < nrhs; r++) {
+          zj[r] -= lij * yi[r];
+        }
+      }
+    }
+    scatter(f, nc, lp);
+    if (ooc) scratch.release(superPanel[s], false);
+  }
+
+  for (uint32 k = 0; k < n; k++) {
+    for (uint32 r = 0; r < nrhs; r++) {
+      x[perm[k] + n64 * r] = y[static_cast<uint64>(k) * nrhs + r];
+    }
+  }
+}
+
+
+bool SupernodalLDLT::isAnalysed() {
+  return analysed;
+}
+
+
+bool SupernodalLDLT::isFactorized() {
+  return factorized;
+}
+
+
+void SupernodalLDLT::setNumberOfThreads(uint16 threads) {
+  numberOfThreads = threads;
+}
+
+
+uint16 SupernodalLDLT::getNumberOfThreads() {
+  if (numberOfThreads == 0) {
+    return ThreadPool::instance().getNumberOfThreads();
+  }
+  return numberOfThreads;
+}
+
+
+uint32 SupernodalLDLT::nRows() {
+  return n;
+}
+
+
+uint32 SupernodalLDLT::nSupernodes() {
+  return superFirst.empty() ? 0 : static_cast<uint32>(superFirst.size() - 1);
+}
+
+
+uint64 SupernodalLDLT::nonzerosInFactor() {
+  return nnzL;
+}
+
+
+double SupernodalLDLT::factorizationFlops() {
+  return flops;
+}
+
+
+uint64 SupernodalLDLT::factorMemory() {
+  if (scratch.isOpened()) {
+    return scratch.residentBytes();
+  }
+  return lx.size() * sizeof(double) + lxSingle.size() * sizeof(float);
+}
+
+
+uint64 SupernodalLDLT::factorSize() {
+  if (lxPtr.empty()) return 0;
+  return lxPtr.back() * (factorSingle ? sizeof(float) : sizeof(double));
+}
+
+
+void SupernodalLDLT::openScratch(uint64 valueSize) {
+  const uint64 budget = memoryBudget * 1024 * 1024;
+  // panels are small enough to keep a lot of them in memory, but not smaller than 64 KB to make
+  // I/O efficient
+  const uint64 panelSize = std::min<uint64>(4 * 1024 * 1024, std::max<uint64>(budget / 16, 64 * 1024));
+  uint32 ns = nSupernodes();
+  superPanel.resize(ns);
+  std::vector<uint64> panelPtr(1, 0);
+  for (uint32 s = 0; s < ns; s++) {
+    superPanel[s] = static_cast<uint32>(panelPtr.size() - 1);
+    if ((lxPtr[s + 1] * valueSize - panelPtr.back() >= panelSize) || s == ns - 1) {
+      panelPtr.push_back(lxPtr[s + 1] * valueSize);
+    }
+  }
+  if (ns == 0) panelPtr.push_back(0);
+  scratch.open(scratchDirectory, panelPtr, budget);
+}
+
+
+uint32 SupernodalLDLT::nParallelSupernodes() {
+  return parallelSupernodes;
+}
+
+
+uint32 SupernodalLDLT::nPerturbedPivots() {
+  return perturbedPivots;
+}
+
+
+uint32 SupernodalLDLT::nNegativePivots() {
+  return negativePivots;
+}
+
+
+uint32 SupernodalLDLT::n2x2Pivots() {
+  return twoByTwoPivots;
+}
+
+} // namespace math
+
+} // namespace nla3d
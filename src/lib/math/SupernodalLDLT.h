@@ -0,0 +1,219 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/BsrMatrix.h"
+#include "math/Ordering.h"
+#include "math/OutOfCoreStorage.h"
+
+namespace nla3d {
+
+namespace math {
+
+// SupernodalLDLT - native sparse direct solver for symmetric (possibly indefinite) matrices stored
+// in SparseSymMatrix (upper triangle, 3-array CSR). The matrix is factorized as
+//   Q * A * Q^T = L * D * L^T,
+// where L is unit lower triangular and D is block diagonal with 1x1 and 2x2 blocks. Bunch-Kaufman
+// pivoting is restricted to the diagonal block of every supernode, so the symbolic structure of L
+// doesn't depend on numerical values. Pivots that can't be stabilized inside of the supernode are
+// perturbed (like PARDISO does) and later corrected by iterative refinement in EquationSolver.
+//
+// The matrix could be also given in BSR format (BsrSymMatrix). Then the fill-reducing ordering is
+// computed for the graph of blocks and the entries are assembled into supernodes straight from
+// the blocks.
+//
+// Factorization is done in three steps:
+// 1. analyse(..) - symbolic phase: fill-reducing ordering, elimination tree, postordering, fundamental supernodes, row
+//    structure of L and the list of descendant supernodes which update every supernode. Depends
+//    only on the sparsity of the matrix.
+// 2. factorize(..) - numerical phase: left-looking supernodal factorization. Independent subtrees
+//    of the supernodal elimination tree are processed concurrently by numberOfThreads tasks of
+//    the ThreadPool. The top of the tree (supernodes larger than parallelPanelSize entries with
+//    all ancestors larger too) has little tree parallelism, these supernodes are processed one by
+//    one after the others: their descendant updates are split by columns and the panel rows below
+//    the diagonal block are split by rows between the threads. The result doesn't depend on the
+//    number of threads.
+// 3. solve(..) - forward/backward substitution.
+//
+// With singlePrecision = true the factor is computed and stored in float. It takes half of the
+// memory of the double factor, but the solution is accurate only to single precision and should
+// be improved by iterative refinement with the double matrix (see LDLTEquationSolver).
+//
+// With outOfCore = true the factor is kept in a scratch file (see OutOfCoreStorage) and only
+// memoryBudget megabytes of it are held in memory. Completed supernodes are written to the file
+// when the budget is exceeded and streamed back when they are needed by the ancestors' updates or
+// by the substitution. Supernodes are grouped into panels of consecutive supernodes which are
+// written and read as a whole. Volume and throughput of I/O are logged after every factorization
+// and substitution.
+class SupernodalLDLT {
+public:
+  SupernodalLDLT();
+  ~SupernodalLDLT();
+
+  // symbolic analysis of the matrix sparsity pattern
+  void analyse(SparseSymMatrix* matrix);
+  void analyse(BsrSymMatrix* matrix);
+  // numerical factorization. analyse(..) should be called before for the matrix with the same
+  // sparsity.
+  void factorize(SparseSymMatrix* matrix);
+  void factorize(BsrSymMatrix* matrix);
+  // solve A * x = b for nrhs right hand sides. Right hand sides (and solutions) are stored one
+  // after another: b[0..n-1] is the first rhs, b[n..2n-1] - the second one and so on. All right
+  // hand sides are substituted in one pass over the factor.
+  void solve(const double* b, double* x, uint32 nrhs = 1);
+
+  // drop all symbolic and numeric data
+  void clear();
+
+  bool isAnalysed();
+  bool isFactorized();
+
+  // number of threads to use in numerical factorization (0 means all threads of the ThreadPool)
+  void setNumberOfThreads(uint16 threads);
+  uint16 getNumberOfThreads();
+
+  // relative threshold for tiny pivots: |pivot| < pivotThreshold * max|A_ij| will be perturbed
+  double pivotThreshold = 1.0e-13;
+  // use Bunch-Kaufman pivoting. Could be switched off for positive definite matrices.
+  bool usePivoting = true;
+  // fill-reducing ordering used by analyse(..)
+  OrderingMethod ordering = OrderingMethod::Auto;
+  // compute and store the factor in single precision
+  bool singlePrecision = false;
+  // keep the factor in a scratch file in scratchDirectory. Only memoryBudget megabytes of the
+  // factor are kept in memory.
+  bool outOfCore = false;
+  std::string scratchDirectory = ".";
+  uint64 memoryBudget = 2048;
+  // minimal size (rows x columns) of a top supernode to be factorized by all threads together
+  uint64 parallelPanelSize = 65536;
+
+  // symbolic statistics
+  uint32 nRows();
+  uint32 nSupernodes();
+  uint64 nonzerosInFactor();
+  double factorizationFlops();
+
+  // numerical statistics of the last factorization
+  uint32 nPerturbedPivots();
+  uint32 nNegativePivots();
+  uint32 n2x2Pivots();
+  // number of top supernodes factorized by all threads together
+  uint32 nParallelSupernodes();
+
+  // memory occupied by the factor values (in bytes). For out-of-core factor only the part of
+  // the factor which is currently kept in memory is counted.
+  uint64 factorMemory();
+  // size of the factor values (in bytes)
+  uint64 factorSize();
+
+private:
+  // symbolic analysis of the pattern given by upper triangle 3-array CSR (1-based, as in
+  // SparseSymMatrix) with the fill-reducing ordering `order` (see fillReducingOrdering(..))
+  void analysePattern(uint32 nr, const uindex* iofeir, const uint32* columns,
+      const std::vector<uint32>& order);
+  // numerical factorization for the values of the analysed matrix
+  void factorizeValues(const double* values);
+  // numerical kernels are templated by the type of the factor values L (double or float)
+  // factorize all supernodes in elimination tree order (concurrently by numberOfThreads threads)
+  template <typename T>
+  void factorizeSupernodes(T* L, uint32* stats);
+  // factorize one supernode (all descendants have to be factorized already)
+  template <typename T>
+  void factorizeSupernode(uint32 s, T* L, std::vector<uint32>& relMap, std::vector<T>& W,
+      std::vector<T>& C, std::vector<uint32>& swaps, uint32* stats);
+  // the same by `threads` threads of the ThreadPool (W and C are work vectors of column chunks)
+  template <typename T>
+  void factorizeSupernodeParallel(uint32 s, T* L, std::vector<uint32>& relMap,
+      std::vector<std::vector<T> >& W, std::vector<std::vector<T> >& C,
+      std::vector<uint32>& swaps, uint32* stats, uint16 threads);
+  // put the matrix entries into the supernode panel and set relMap (global row -> panel row)
+  template <typename T>
+  void assembleSupernode(uint32 s, T* Ls, std::vector<uint32>& relMap);
+  // apply the updates of all descendants to columns [c0, c1) of the supernode
+  template <typename T>
+  void updateSupernode(uint32 s, T* L, const std::vector<uint32>& relMap, uint32 c0, uint32 c1,
+      std::vector<T>& W, std::vector<T>& C);
+  // dense restricted Bunch-Kaufman LDL^T of the diagonal block of the supernode panel (nr x nc
+  // column-major block), the interchanges are stored in swaps
+  template <typename T>
+  void factorizeDiagonalBlock(uint32 s, T* Ls, uint32 nr, uint32 nc, std::vector<uint32>& swaps,
+      uint32* stats);
+  // L21 for panel rows [i0, i1) (nc <= i0) after factorizeDiagonalBlock(..)
+  template <typename T>
+  void factorizePanelRows(uint32 s, T* Ls, uint32 nr, uint32 nc, const std::vector<uint32>& swaps,
+      uint32 i0, uint32 i1);
+  // forward/backward substitution with the factor L. Substitution is done in double precision.
+  template <typename T>
+  void substitute(const T* L, const double* b, double* x, uint32 nrhs);
+  // create the scratch file for the factor with values of valueSize bytes
+  void openScratch(uint64 valueSize);
+
+  uint32 n = 0;
+  uindex nnzA = 0;
+  // size of the values array of the analysed matrix (more than nnzA for BSR matrix)
+  uindex nValuesA = 0;
+  // values of the matrix being factorized
+  const double* aValues = nullptr;
+  uint16 numberOfThreads = 0;
+
+  // perm[k] - index (0-based) of the original equation which is placed on k-th position in
+  // the symbolic ordering (fill-reducing ordering + postordering of elimination tree)
+  std::vector<uint32> perm;
+
+  // supernodes: columns superFirst[s] .. superFirst[s+1]-1
+  std::vector<uint32> superFirst;
+  std::vector<int32> superParent;
+  // row structure of every supernode: rowIdx[rowPtr[s]] .. rowIdx[rowPtr[s+1]-1]. The first
+  // rows are always the supernode's columns itself.
+  std::vector<uint32> rowPtr;
+  std::vector<uint32> rowIdx;
+  // position of supernode's dense block (column-major, leading dimension is number of rows)
+  std::vector<uint64> lxPtr;
+
+  // descendants supernodes which update supernode s: updSuper[updPtr[s]] .. updSuper[updPtr[s+1]-1]
+  // and updOffset is the position of the first row of the descendant which falls into s
+  std::vector<uint32> updPtr;
+  std::vector<uint32> updSuper;
+  std::vector<uint32> updOffset;
+
+  // entries of A which should be assembled into supernode s:
+  // values[assSrc[k]] goes to lx[lxPtr[s] + assDst[k]] for assPtr[s] <= k < assPtr[s+1]
+  std::vector<uindex> assPtr;
+  std::vector<uindex> assSrc;
+  std::vector<uint32> assDst;
+
+  // numerical data
+  // L and D entries of all supernodes (lxSingle is used instead of lx if factorSingle is true)
+  std::vector<double> lx;
+  std::vector<float> lxSingle;
+  bool factorSingle = false;
+  // out-of-core factor values and the panel of every supernode
+  OutOfCoreStorage scratch;
+  std::vector<uint32> superPanel;
+  // local pivoting permutation inside of every supernode (indexes related to superFirst[s])
+  std::vector<uint32> pivPerm;
+  // 1 - 1x1 pivot, 2 - first column of 2x2 pivot, 0 - second column of 2x2 pivot
+  std::vector<uint8> pivType;
+  // work vector for solve(..)
+  std::vector<double> work;
+
+  uint64 nnzL = 0;
+  double flops = 0.0;
+  double tinyPivot = 0.0;
+
+  uint32 perturbedPivots = 0;
+  uint32 negativePivots = 0;
+  uint32 twoByTwoPivots = 0;
+  uint32 parallelSupernodes = 0;
+
+  bool analysed = false;
+  bool factorized = false;
+};
+
+} // namespace math
+
+} // namespace nla3d
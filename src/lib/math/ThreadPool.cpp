@@ -0,0 +1,201 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/ThreadPool.h"
+#include <chrono>
+
+namespace nla3d {
+
+namespace math {
+
+namespace {
+
+// index of the worker running on this thread (-1 for threads which aren't workers)
+thread_local int32 workerIndex = -1;
+
+} // namespace
+
+
+ThreadPool::ThreadPool() : queued(0), nextWorker(0) {
+#ifdef NLA3D_SINGLE_THREADED
+  start(1);
+#else
+  start(0);
+#endif
+}
+
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+
+ThreadPool& ThreadPool::instance() {
+  static ThreadPool pool;
+  return pool;
+}
+
+
+void ThreadPool::setNumberOfThreads(uint16 threads) {
+#ifdef NLA3D_SINGLE_THREADED
+  LOG_IF(threads != 1, WARNING) << "nla3d is built without nla3d_multithreaded, only one thread "
+    << "is used";
+#else
+  stop();
+  start(threads);
+#endif
+}
+
+
+uint16 ThreadPool::getNumberOfThreads() {
+  return static_cast<uint16>(workers.size() + 1);
+}
+
+
+void ThreadPool::start(uint16 nThreads) {
+  if (nThreads == 0) {
+    nThreads = static_cast<uint16>(std::max(std::thread::hardware_concurrency(), 1u));
+  }
+  stopping = false;
+  for (uint16 i = 0; i + 1 < nThreads; i++) {
+    workers.push_back(new Worker);
+  }
+  for (uint16 i = 0; i < workers.size(); i++) {
+    threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+  }
+}
+
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (auto& th : threads) {
+    th.join();
+  }
+  threads.clear();
+  for (auto w : workers) {
+    assert(w->tasks.empty());
+    delete w;
+  }
+  workers.clear();
+}
+
+
+void ThreadPool::push(Task&& task) {
+  assert(workers.size() > 0);
+  uint32 w = (workerIndex >= 0) ? workerIndex : nextWorker++ % workers.size();
+  {
+    std::lock_guard<std::mutex> lock(workers[w]->mtx);
+    workers[w]->tasks.push_back(std::move(task));
+  }
+  {
+    // under sleepMutex to not lose the wake up of a worker which is going to sleep
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    queued++;
+  }
+  wakeUp.notify_one();
+}
+
+
+bool ThreadPool::pop(Task& task) {
+  if (queued == 0) return false;
+  const uint32 nw = static_cast<uint32>(workers.size());
+  if (workerIndex >= 0) {
+    Worker* own = workers[workerIndex];
+    std::lock_guard<std::mutex> lock(own->mtx);
+    if (!own->tasks.empty()) {
+      task = std::move(own->tasks.back());
+      own->tasks.pop_back();
+      queued--;
+      return true;
+    }
+  }
+  // steal the oldest task of somebody else
+  uint32 first = (workerIndex >= 0) ? workerIndex + 1 : 0;
+  for (uint32 i = 0; i < nw; i++) {
+    Worker* victim = workers[(first + i) % nw];
+    std::lock_guard<std::mutex> lock(victim->mtx);
+    if (!victim->tasks.empty()) {
+      task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool ThreadPool::runPending() {
+  Task task;
+  if (!pop(task)) return false;
+  execute(task);
+  return true;
+}
+
+
+void ThreadPool::execute(Task& task) {
+  task.func();
+  task.group->done();
+}
+
+
+void ThreadPool::workerLoop(uint16 index) {
+  workerIndex = index;
+  while (true) {
+    if (runPending()) continue;
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping && queued == 0) break;
+  }
+  workerIndex = -1;
+}
+
+
+TaskGroup::TaskGroup(ThreadPool& _pool) : pool(_pool), pending(0) {
+}
+
+
+TaskGroup::~TaskGroup() {
+  wait();
+}
+
+
+void TaskGroup::run(std::function<void()> func) {
+  if (pool.workers.size() == 0) {
+    func();
+    return;
+  }
+  pending++;
+  pool.push(ThreadPool::Task{std::move(func), this});
+}
+
+
+void TaskGroup::wait() {
+  while (pending > 0) {
+    if (pool.runPending()) continue;
+    // all tasks of the group are taken by workers, wait for them (but check time to time if
+    // there is something to help with)
+    std::unique_lock<std::mutex> lock(mtx);
+    finished.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending == 0; });
+  }
+  // the last done() could still hold the mutex
+  std::lock_guard<std::mutex> lock(mtx);
+}
+
+
+void TaskGroup::done() {
+  // notify under the mutex: the group can be destroyed right after pending becomes zero
+  std::lock_guard<std::mutex> lock(mtx);
+  if (--pending == 0) {
+    finished.notify_all();
+  }
+}
+
+} // namespace math
+
+} // namespace nla3d
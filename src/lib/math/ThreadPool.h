@@ -0,0 +1,158 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace nla3d {
+
+namespace math {
+
+class TaskGroup;
+
+// ThreadPool - the pool of worker threads shared by all parallel parts of nla3d (element
+// assembly, sparse kernels, factorization, preconditioners). Parallel code doesn't create threads,
+// it splits the work into tasks of a TaskGroup (or uses parallelFor(..)/parallelReduce(..)
+// helpers below), so there is only one set of threads in the program whatever number of parallel
+// components are used at once.
+//
+// Scheduling is work stealing: every worker has its own deque of tasks, it takes tasks from the
+// back of its deque and steals from the front of the other deques when its deque is empty. Tasks
+// submitted from a worker go to its own deque, tasks submitted from outside are distributed
+// between workers round-robin. A thread waiting for a TaskGroup executes pending tasks too, so
+// nested parallel loops don't deadlock and the calling thread is the one more worker.
+//
+// The pool is created on the first use with hardware concurrency threads (the calling thread
+// plus getNumberOfThreads() - 1 workers). If nla3d is built without nla3d_multithreaded
+// (NLA3D_SINGLE_THREADED is defined) the pool doesn't have workers and every task is executed by
+// the calling thread.
+class ThreadPool {
+public:
+  ~ThreadPool();
+  // the pool shared by all nla3d
+  static ThreadPool& instance();
+
+  // number of threads (0 - hardware concurrency, 1 - no workers). Workers are restarted, so it
+  // shouldn't be called while some parallel work is in progress.
+  void setNumberOfThreads(uint16 threads);
+  // number of threads including the calling one
+  uint16 getNumberOfThreads();
+
+  friend class TaskGroup;
+private:
+  ThreadPool();
+  struct Task {
+    std::function<void()> func;
+    TaskGroup* group;
+  };
+  struct Worker {
+    std::deque<Task> tasks;
+    std::mutex mtx;
+  };
+
+  void start(uint16 threads);
+  void stop();
+  void push(Task&& task);
+  // take a task from the own deque (for workers) or steal it from others
+  bool pop(Task& task);
+  // execute one pending task if there is any
+  bool runPending();
+  void execute(Task& task);
+  void workerLoop(uint16 index);
+
+  std::vector<Worker*> workers;
+  std::vector<std::thread> threads;
+  // total number of tasks in all deques
+  std::atomic<uint32> queued;
+  std::atomic<uint32> nextWorker;
+  bool stopping = false;
+  // sleeping workers wait here for new tasks
+  std::mutex sleepMutex;
+  std::condition_variable wakeUp;
+};
+
+
+// TaskGroup - a set of tasks executed by the ThreadPool. run(..) submits a task, wait() returns
+// when all submitted tasks are done (the destructor waits too). Tasks can submit new tasks into
+// the same or another group.
+class TaskGroup {
+public:
+  TaskGroup(ThreadPool& _pool = ThreadPool::instance());
+  ~TaskGroup();
+
+  void run(std::function<void()> func);
+  void wait();
+
+  friend class ThreadPool;
+private:
+  void done();
+
+  ThreadPool& pool;
+  std::atomic<uint32> pending;
+  std::mutex mtx;
+  std::condition_variable finished;
+};
+
+
+// Split [0, n) into `chunks` equal ranges (0 - ThreadPool::getNumberOfThreads() ranges), but not
+// more than n / grain ranges, and call func(chunk, begin, end) for every range in parallel. The
+// last range is executed by the calling thread. Return the number of ranges.
+template <typename F>
+uint16 parallelForChunks(uint32 n, uint16 chunks, F func, uint32 grain = 1) {
+  if (chunks == 0) chunks = ThreadPool::instance().getNumberOfThreads();
+  uint32 maxChunks = std::max(n / std::max(grain, 1u), 1u);
+  if (chunks > maxChunks) chunks = static_cast<uint16>(maxChunks);
+  if (chunks <= 1) {
+    if (n > 0) func(0, 0, n);
+    return n > 0 ? 1 : 0;
+  }
+  uint32 size = (n + chunks - 1) / chunks;
+  uint16 used = static_cast<uint16>((n + size - 1) / size);
+  TaskGroup group;
+  for (uint16 c = 0; c + 1 < used; c++) {
+    group.run([&func, c, size] () {
+      func(c, c * size, (c + 1) * size);
+    });
+  }
+  func(static_cast<uint16>(used - 1), (used - 1) * size, n);
+  group.wait();
+  return used;
+}
+
+
+// parallelForChunks(..) for func(begin, end)
+template <typename F>
+void parallelFor(uint32 n, uint16 chunks, F func, uint32 grain = 1) {
+  parallelForChunks(n, chunks, [&func] (uint16, uint32 begin, uint32 end) {
+    func(begin, end);
+  }, grain);
+}
+
+
+// Reduction over [0, n) split into ranges as in parallelForChunks(..): every range is reduced by
+// func(begin, end), then range results are combined by reduce(a, b) in the order of ranges
+// starting from init. For fixed number of ranges the result doesn't depend on scheduling.
+template <typename T, typename F, typename R>
+T parallelReduce(uint32 n, uint16 chunks, T init, F func, R reduce, uint32 grain = 1) {
+  if (chunks == 0) chunks = ThreadPool::instance().getNumberOfThreads();
+  std::vector<T> partial(std::max<uint16>(chunks, 1), init);
+  uint16 used = parallelForChunks(n, chunks, [&] (uint16 c, uint32 begin, uint32 end) {
+    partial[c] = func(begin, end);
+  }, grain);
+  T result = init;
+  for (uint16 c = 0; c < used; c++) {
+    result = reduce(result, partial[c]);
+  }
+  return result;
+}
+
+} // namespace math
+
+} // namespace nla3d
@@ -58,6 +58,15 @@ typedef unsigned int uint32; // 0 to +4 294 967 295
 typedef long long int64; //-9 223 372 036 854 775 807 to +9 223 372 036 854 775 807
 typedef unsigned long long uint64; //0 to +18 446 744 073 709 551 615
 
+// uindex - positions of entries in sparse matrices and their number (SparsityInfo, values arrays,
+// interfaces of the equation solvers). Row, column and equation numbers are uint32. Build with
+// nla3d_64bit_index (NLA3D_64BIT_INDEX) for matrices with more than 2^31 non-zeros.
+#ifdef NLA3D_64BIT_INDEX
+typedef uint64 uindex;
+#else
+typedef uint32 uindex;
+#endif
+
 
 namespace nla3d {
 
@@ -9,6 +9,9 @@
 #include "ReactionProcessor.h"
 #include "materials/MaterialFactory.h"
 #include "FEReaders.h"
+#include "math/KrylovEquationSolver.h"
+#include "math/AMGPreconditioner.h"
+#include "math/ThreadPool.h"
 
 using namespace nla3d;
 
@@ -34,6 +37,20 @@ namespace options {
   uint32 rigidBodyMasterNode = 0;
   std::string rigidBodySlavesComponent = "";
   std::vector<Dof::dofType> rigidBodyDofs;
+
+  std::string eqSolverName = "";
+  std::string preconditionerName = "";
+  math::OrderingMethod ordering = math::OrderingMethod::Auto;
+  bool mixedPrecision = false;
+  bool outOfCore = false;
+  std::string scratchDirectory = ".";
+  uint64 memoryBudget = 2048;
+
+  NonlinearFESolver::IterationStrategy strategy = NonlinearFESolver::IterationStrategy::FullNewton;
+  uint16 refactorizationInterval = 5;
+
+  // 0 - hardware concurrency
+  uint16 numberOfThreads = 0;
 };
 
 bool parse_args (int argc, char* argv[]) {
@@ -120,6 +137,59 @@ bool parse_args (int argc, char* argv[]) {
     }
   }
 
+  vtmp = getCmdManyOptions(argv, argv + argc, "-eqsolver");
+  if (vtmp.size() > 0) {
+    options::eqSolverName = vtmp[0];
+    if (vtmp.size() > 1) {
+      options::preconditionerName = vtmp[1];
+    }
+  }
+
+  tmp = getCmdOption(argv, argv + argc, "-ordering");
+  if (tmp) {
+    options::ordering = math::orderingMethodFromName(tmp);
+    if (options::ordering == math::OrderingMethod::UNDEFINED) {
+      LOG(ERROR) << "Unknown fill-reducing ordering " << tmp;
+      return false;
+    }
+  }
+
+  if (cmdOptionExists(argv, argv + argc, "-mixedprecision")) {
+    options::mixedPrecision = true;
+  }
+
+  vtmp = getCmdManyOptions(argv, argv + argc, "-outofcore");
+  if (vtmp.size() > 0) {
+    options::outOfCore = true;
+    options::scratchDirectory = vtmp[0];
+    if (vtmp.size() > 1) {
+      options::memoryBudget = atoi(vtmp[1]);
+    }
+  }
+
+  vtmp = getCmdManyOptions(argv, argv + argc, "-newton");
+  if (vtmp.size() > 0) {
+    std::string name = vtmp[0];
+    if (name == "full") {
+      options::strategy = NonlinearFESolver::IterationStrategy::FullNewton;
+    } else if (name == "modified") {
+      options::strategy = NonlinearFESolver::IterationStrategy::ModifiedNewton;
+    } else if (name == "initial") {
+      options::strategy = NonlinearFESolver::IterationStrategy::InitialStiffness;
+    } else {
+      LOG(ERROR) << "Unknown iteration strategy " << name;
+      return false;
+    }
+    if (vtmp.size() > 1) {
+      options::refactorizationInterval = atoi(vtmp[1]);
+    }
+  }
+
+  tmp = getCmdOption(argv, argv + argc, "-threads");
+  if (tmp) {
+    options::numberOfThreads = atoi(tmp);
+  }
+
   return true;
 }
 
@@ -133,7 +203,13 @@ void usage () {
       << "\t[-refcurve 'file with curve']\n"
       << "\t[-threshold 'epsilob for comparison']\n"
       << "\t[-reaction 'component name' ['DoF' ..]]\n"
-      << "\t[-rigidbody 'master node' 'component of slaves' ['DoF' ..]]";
+      << "\t[-rigidbody 'master node' 'component of slaves' ['DoF' ..]]\n"
+      << "\t[-eqsolver 'LDLT|CG|MINRES|GMRES' ['Jacobi|BlockJacobi|IC0|ILDL0|AMG']]\n"
+      << "\t[-ordering 'Auto|Natural|AMD|ND']\n"
+      << "\t[-mixedprecision]\n"
+      << "\t[-outofcore 'scratch directory' ['memory budget in MB']]\n"
+      << "\t[-newton 'full|modified|initial' ['refactorization interval']]\n"
+      << "\t[-threads 'number of threads']";
 }
 
 int main (int argc, char* argv[]) {
@@ -146,6 +222,8 @@ int main (int argc, char* argv[]) {
     usage();
     exit(1);
   }
+  math::ThreadPool::instance().setNumberOfThreads(options::numberOfThreads);
+  LOG(INFO) << "Number of threads: " << math::ThreadPool::instance().getNumberOfThreads();
 
   // Load and show reference curve. This is used for automatic tests
   // and optimization (curve fitting) purpose.
@@ -186,11 +264,8 @@ int main (int argc, char* argv[]) {
   }
 
   // add nodes
-  auto sind = storage.createNodes(md.nodesNumbers.size());
+  auto sind = storage.createNodes(md.nodesPos);
   auto ind = md.nodesNumbers;
-  for (uint32 i = 0; i < sind.size(); i++) {
-    storage.getNode(sind[i]).pos = md.nodesPos[i];
-  }
 
 
   // add elements
@@ -224,12 +299,57 @@ int main (int argc, char* argv[]) {
   solver.attachFEStorage (&storage);
   solver.numberOfIterations = options::numberOfIterations;
   solver.numberOfLoadsteps = options::numberOfLoadsteps;
+  solver.strategy = options::strategy;
+  solver.refactorizationInterval = options::refactorizationInterval;
     // NOTE: use PARDISO eq. solver by default (if accessible..)
 #ifdef NLA3D_USE_MKL
     math::PARDISO_equationSolver eqSolver = math::PARDISO_equationSolver();
     solver.attachEquationSolver(&eqSolver);
 #endif
 
+  if (options::eqSolverName.length() > 0) {
+    math::EquationSolver* eqs = nullptr;
+    math::KrylovEquationSolver* krylov = nullptr;
+    if (options::eqSolverName == "LDLT") {
+      eqs = new math::LDLTEquationSolver;
+    } else if (options::eqSolverName == "CG") {
+      eqs = krylov = new math::CGEquationSolver;
+    } else if (options::eqSolverName == "MINRES") {
+      eqs = krylov = new math::MINRESEquationSolver;
+    } else if (options::eqSolverName == "GMRES") {
+      eqs = krylov = new math::GMRESEquationSolver;
+    } else {
+      LOG(FATAL) << "Unknown equation solver " << options::eqSolverName;
+    }
+
+    if (options::preconditionerName.length() > 0) {
+      LOG_IF(!krylov, FATAL) << "Preconditioner can be used only with iterative equation solvers";
+      if (options::preconditionerName == "Jacobi") {
+        krylov->attachPreconditioner(new math::JacobiPreconditioner);
+      } else if (options::preconditionerName == "BlockJacobi") {
+        krylov->attachPreconditioner(new math::BlockJacobiPreconditioner(3));
+      } else if (options::preconditionerName == "IC0") {
+        krylov->attachPreconditioner(new math::IncompleteLDLTPreconditioner(true));
+      } else if (options::preconditionerName == "ILDL0") {
+        krylov->attachPreconditioner(new math::IncompleteLDLTPreconditioner(false));
+      } else if (options::preconditionerName == "AMG") {
+        krylov->attachPreconditioner(new math::AMGPreconditioner);
+      } else {
+        LOG(FATAL) << "Unknown preconditioner " << options::preconditionerName;
+      }
+    }
+    solver.attachEquationSolver(eqs);
+  }
+  solver.getEquationSolver()->setOrdering(options::ordering);
+  if (options::mixedPrecision) {
+    auto ldlt = dynamic_cast<math::LDLTEquationSolver*>(solver.getEquationSolver());
+    LOG_IF(!ldlt, FATAL) << "Mixed precision factorization is supported only by LDLT equation solver";
+    ldlt->mixedPrecision = true;
+  }
+  if (options::outOfCore) {
+    solver.getEquationSolver()->setOutOfCore(true, options::scratchDirectory, options::memoryBudget);
+  }
+
 
   if (options::useVtk) {
     //obtain job name from path of a FE model file
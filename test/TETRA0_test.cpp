@@ -10,6 +10,8 @@
 #include "materials/MaterialFactory.h"
 #include "FEReaders.h"
 #include "elements/TETRA0.h"
+#include "math/KrylovEquationSolver.h"
+#include "math/AMGPreconditioner.h"
 #include <tuple>
 
 using namespace nla3d;
@@ -19,6 +21,9 @@ typedef std::vector<math::MatSym<3>> stress_vec_t;
 
 disp_vec_t readDispData (std::string filename);
 stress_vec_t readStressData (std::string filename);
+void buildModel (MeshData& md, FEStorage& storage);
+void solveWith (MeshData& md, FEStorage& storage, math::EquationSolver* eqSolver);
+void attachCg (math::CGEquationSolver& cg, math::Preconditioner* prec);
 
 int main (int argc, char* argv[]) {
     std::string cdb_filename;
@@ -44,47 +49,12 @@ int main (int argc, char* argv[]) {
     md.compressNumbers();
 
 	FEStorage storage;
-	LinearFESolver solver;
-
-	// add nodes
-	auto sind = storage.createNodes(md.nodesNumbers.size());
-	for (uint32 i = 0; i < sind.size(); i++) {
-		storage.getNode(sind[i]).pos = md.nodesPos[i];
-	}
-
-    auto ind = md.getCellsByAttribute("TYPE", 1);
-    sind = storage.createElements(ind.size(), ElementType::TETRA0);
-    for (uint32 i = 0; i < sind.size(); i++) {
-      ElementTETRA0& el = dynamic_cast<ElementTETRA0&>(storage.getElement(sind[i]));
-      el.getNodeNumber(0) = md.cellNodes[ind[i]][0];
-      el.getNodeNumber(1) = md.cellNodes[ind[i]][1];
-      el.getNodeNumber(2) = md.cellNodes[ind[i]][2];
-      el.getNodeNumber(3) = md.cellNodes[ind[i]][4];
-      el.E = 1.0e8;
-      el.my = 0.3;
-    }
-
-    // add loadBc
-    for (auto& v : md.loadBcs) {
-      solver.addLoad(v.node, v.node_dof, v.value);
-    }
-
-    // add fixBc
-    for (auto& v : md.fixBcs) {
-      solver.addFix(v.node, v.node_dof, v.value);
-    }
-
 #ifdef NLA3D_USE_MKL
     math::PARDISO_equationSolver eqSolver = math::PARDISO_equationSolver();
-    solver.attachEquationSolver(&eqSolver);
+    solveWith(md, storage, &eqSolver);
+#else
+    solveWith(md, storage, nullptr);
 #endif
-	solver.attachFEStorage (&storage);
-
-	// VtkProcessor* vtk = new VtkProcessor (&storage, "tetra");
-    // solver.addPostProcessor(vtk);
-    // vtk->writeAllResults();
-
-    solver.solve();
 
     // check displacements results with Ansys data
     if (res_disp_filename != "") {
@@ -110,6 +80,177 @@ int main (int argc, char* argv[]) {
             CHECK(mat.compare(ans_stresses[i - 1], 1.0e-3));
         }
     }
+
+    // solve the same model with several load cases at once:
+    // 1 - loads from cdb file, 2 - without loads, 3 - doubled loads from cdb file
+    FEStorage lcStorage;
+    LinearFESolver lcSolver;
+    buildModel(md, lcStorage);
+    for (auto& v : md.fixBcs) {
+      lcSolver.addFix(v.node, v.node_dof, v.value);
+    }
+    uint16 lc1 = lcSolver.addLoadCase();
+    uint16 lc2 = lcSolver.addLoadCase();
+    uint16 lc3 = lcSolver.addLoadCase();
+    for (auto& v : md.loadBcs) {
+      lcSolver.addLoadCaseLoad(lc1, v.node, v.node_dof, v.value);
+      lcSolver.addLoadCaseLoad(lc3, v.node, v.node_dof, 2.0 * v.value);
+    }
+#ifdef NLA3D_USE_MKL
+    lcSolver.attachEquationSolver(&eqSolver);
+#endif
+    lcSolver.attachFEStorage(&lcStorage);
+    lcSolver.solve();
+
+    CHECK(lcSolver.getNumberOfLoadCases() == 3);
+    CHECK(lcSolver.getLoadCaseU(lc1).compare(*storage.getU(), 1.0e-12));
+    CHECK(lcSolver.getLoadCaseR(lc1).compare(*storage.getR(), 1.0e-6));
+    dVec& U1 = lcSolver.getLoadCaseU(lc1);
+    dVec& U2 = lcSolver.getLoadCaseU(lc2);
+    dVec& U3 = lcSolver.getLoadCaseU(lc3);
+    for (uint32 i = 0; i < U1.size(); i++) {
+      CHECK_EQTH(U3[i], (2.0 * U1[i] - U2[i]), 1.0e-12);
+    }
+    // FEStorage keeps the results of the last load case
+    CHECK(lcStorage.getU()->compare(U3, 1.0e-12));
+
+    // solve the model by CG with AMG preconditioner (rigid body modes are the near-nullspace)
+    {
+      FEStorage amgStorage;
+      math::CGEquationSolver cg;
+      math::AMGPreconditioner amg;
+      amg.coarsestSize = 50;
+      attachCg(cg, &amg);
+      solveWith(md, amgStorage, &cg);
+      CHECK(cg.isConverged());
+      CHECK(amg.nLevels() > 1);
+      CHECK(amgStorage.getU()->compare(*storage.getU(), 1.0e-10));
+    }
+
+    // solve the model without the stiffness matrix: CG with Jacobi preconditioner and K * x
+    // computed element by element
+    {
+      FEStorage mfStorage;
+      mfStorage.setMatrixFree(true);
+      math::CGEquationSolver cg;
+      math::JacobiPreconditioner jacobi;
+      attachCg(cg, &jacobi);
+      solveWith(md, mfStorage, &cg);
+      CHECK(cg.isConverged());
+      CHECK(mfStorage.getK() == nullptr);
+      CHECK(mfStorage.getU()->compare(*storage.getU(), 1.0e-10));
+      CHECK(mfStorage.getR()->compare(*storage.getR(), 1.0e-4));
+    }
+
+    // parallel assembly in both modes (and parallel K * x in matrix-free mode)
+    for (auto mode : {FEStorage::AssemblyMode::Colored, FEStorage::AssemblyMode::ThreadLocal}) {
+      for (bool matrixFree : {false, true}) {
+        FEStorage parStorage;
+        parStorage.setAssemblyMode(mode);
+        parStorage.setNumberOfThreads(4);
+        parStorage.setMatrixFree(matrixFree);
+        math::CGEquationSolver cg;
+        math::JacobiPreconditioner jacobi;
+        attachCg(cg, &jacobi);
+        solveWith(md, parStorage, &cg);
+        CHECK(parStorage.nElementColors() > 1);
+        CHECK(cg.isConverged());
+        CHECK(parStorage.getU()->compare(*storage.getU(), 1.0e-10));
+        CHECK(parStorage.getR()->compare(*storage.getR(), 1.0e-4));
+      }
+    }
+
+    // coloured assembly gives bitwise identical results for any number of threads. Colours of
+    // the model have about 40 elements, so with the default 16 elements per thread a colour would
+    // get at most 2 threads.
+    std::vector<double> refU, refK;
+    for (uint16 threads : {1, 2, 4, 8}) {
+      FEStorage detStorage;
+      detStorage.setNumberOfThreads(threads);
+      detStorage.setMinElementsPerThread(2);
+      math::CGEquationSolver cg;
+      math::JacobiPreconditioner jacobi;
+      attachCg(cg, &jacobi);
+      solveWith(md, detStorage, &cg);
+      CHECK(cg.isConverged());
+      auto K = detStorage.getK()->block(2);
+      std::vector<double> values(K->getValuesArray(), K->getValuesArray() + K->nValues());
+      dVec& U = *detStorage.getU();
+      std::vector<double> u(U.ptr(), U.ptr() + U.size());
+      if (threads == 1) {
+        refU = u;
+        refK = values;
+        continue;
+      }
+      CHECK(values == refK);
+      CHECK(u == refU);
+    }
+
+    // block of unknowns of K stored in BSR format with nodal 3x3 blocks: LDLT, CG with block
+    // Jacobi and CG with AMG (nodes are taken from the blocks)
+    math::BlockJacobiPreconditioner bsrBlockJacobi;
+    math::AMGPreconditioner bsrAmg;
+    bsrAmg.coarsestSize = 50;
+    std::vector<math::Preconditioner*> bsrPrecs = {nullptr, &bsrBlockJacobi, &bsrAmg};
+    for (math::Preconditioner* prec : bsrPrecs) {
+      FEStorage bsrStorage;
+      bsrStorage.setBlockStorage(true);
+      math::LDLTEquationSolver ldlt;
+      math::CGEquationSolver cg;
+      attachCg(cg, prec);
+      solveWith(md, bsrStorage, prec ? static_cast<math::EquationSolver*>(&cg) : &ldlt);
+      auto bsr = bsrStorage.getK()->bsrBlock(2);
+      CHECK(bsr);
+      CHECK(bsr->nBlocks() < bsr->nRows());
+      CHECK(!prec || cg.isConverged());
+      CHECK(bsrStorage.getU()->compare(*storage.getU(), 1.0e-10));
+      CHECK(bsrStorage.getR()->compare(*storage.getR(), 1.0e-4));
+    }
+}
+
+void buildModel (MeshData& md, FEStorage& storage) {
+	// add nodes
+	auto sind = storage.createNodes(md.nodesNumbers.size());
+	for (uint32 i = 0; i < sind.size(); i++) {
+		storage.getNode(sind[i]).pos = md.nodesPos[i];
+	}
+
+    auto ind = md.getCellsByAttribute("TYPE", 1);
+    sind = storage.createElements(ind.size(), ElementType::TETRA0);
+    for (uint32 i = 0; i < sind.size(); i++) {
+      ElementTETRA0& el = dynamic_cast<ElementTETRA0&>(storage.getElement(sind[i]));
+      el.getNodeNumber(0) = md.cellNodes[ind[i]][0];
+      el.getNodeNumber(1) = md.cellNodes[ind[i]][1];
+      el.getNodeNumber(2) = md.cellNodes[ind[i]][2];
+      el.getNodeNumber(3) = md.cellNodes[ind[i]][4];
+      el.E = 1.0e8;
+      el.my = 0.3;
+    }
+}
+
+// build the model of md into storage (options of storage should be set before) and solve it
+// with the loads and fixes of md. eqSolver == nullptr means the default equation solver.
+void solveWith (MeshData& md, FEStorage& storage, math::EquationSolver* eqSolver) {
+    LinearFESolver solver;
+    buildModel(md, storage);
+    for (auto& v : md.loadBcs) {
+      solver.addLoad(v.node, v.node_dof, v.value);
+    }
+    for (auto& v : md.fixBcs) {
+      solver.addFix(v.node, v.node_dof, v.value);
+    }
+    if (eqSolver) {
+      solver.attachEquationSolver(eqSolver);
+    }
+    solver.attachFEStorage(&storage);
+    solver.solve();
+}
+
+// CG settings shared by all iterative solutions of the model
+void attachCg (math::CGEquationSolver& cg, math::Preconditioner* prec) {
+    cg.tolerance = 1.0e-12;
+    cg.maxIterations = 5000;
+    cg.attachPreconditioner(prec);
 }
 
 disp_vec_t readDispData (std::string filename) {
@@ -0,0 +1,69 @@
+// Test fixture shared by the sparse solver tests: a 3D grid matrix with optional Lagrange
+// multipliers and a smooth right hand side.
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+
+namespace nla3d {
+namespace math {
+
+// 3D grid Laplacian (7-point stencil) with shifted diagonal. Optionally nMpc Lagrange multiplier
+// rows are added which tie pairs of grid points together: x_a - x_b = 0. The multipliers are
+// numbered last, or first if mpcFirst = true.
+inline void buildGridMatrix(SparseSymMatrix& mat, uint32 nx, uint32 nMpc,
+                            bool mpcFirst = false) {
+  uint32 nGrid = nx * nx * nx;
+  uint32 n = nGrid + nMpc;
+  // equation number (1-based) of grid point / mpc row
+  auto eq = [&](uint32 i) -> uint32 { return (mpcFirst ? nMpc : 0) + i + 1; };
+  auto mpcEq = [&](uint32 m) -> uint32 { return (mpcFirst ? 0 : nGrid) + m + 1; };
+  auto id = [&](uint32 i, uint32 j, uint32 k) -> uint32 { return (k * nx + j) * nx + i; };
+  auto mpcNodes = [&](uint32 m) -> std::pair<uint32, uint32> {
+    return std::make_pair((m * 7) % nGrid, (m * 13 + nGrid / 2) % nGrid);
+  };
+
+  mat.reinit(n, 20);
+  for (uint32 k = 0; k < nx; k++)
+    for (uint32 j = 0; j < nx; j++)
+      for (uint32 i = 0; i < nx; i++) {
+        uint32 p = id(i, j, k);
+        mat.addEntry(eq(p), eq(p));
+        if (i + 1 < nx) mat.addEntry(eq(p), eq(id(i + 1, j, k)));
+        if (j + 1 < nx) mat.addEntry(eq(p), eq(id(i, j + 1, k)));
+        if (k + 1 < nx) mat.addEntry(eq(p), eq(id(i, j, k + 1)));
+      }
+  for (uint32 m = 0; m < nMpc; m++) {
+    auto nodes = mpcNodes(m);
+    mat.addEntry(mpcEq(m), mpcEq(m));
+    mat.addEntry(mpcEq(m), eq(nodes.first));
+    mat.addEntry(mpcEq(m), eq(nodes.second));
+  }
+  mat.compress();
+
+  for (uint32 k = 0; k < nx; k++)
+    for (uint32 j = 0; j < nx; j++)
+      for (uint32 i = 0; i < nx; i++) {
+        uint32 p = id(i, j, k);
+        mat.addValue(eq(p), eq(p), 6.1 + 0.01 * (p % 7));
+        if (i + 1 < nx) mat.addValue(eq(p), eq(id(i + 1, j, k)), -1.0);
+        if (j + 1 < nx) mat.addValue(eq(p), eq(id(i, j + 1, k)), -1.0);
+        if (k + 1 < nx) mat.addValue(eq(p), eq(id(i, j, k + 1)), -1.0);
+      }
+  for (uint32 m = 0; m < nMpc; m++) {
+    auto nodes = mpcNodes(m);
+    mat.addValue(mpcEq(m), eq(nodes.first), 1.0);
+    mat.addValue(mpcEq(m), eq(nodes.second), -1.0);
+  }
+}
+
+
+inline std::vector<double> makeRhs(uint32 n) {
+  std::vector<double> b(n);
+  for (uint32 i = 0; i < n; i++) {
+    b[i] = sin(0.1 * i) + 1.0;
+  }
+  return b;
+}
+
+} // namespace math
+} // namespace nla3d
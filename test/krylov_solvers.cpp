@@ -0,0 +1,152 @@
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/KrylovEquationSolver.h"
+#include "math/AMGPreconditioner.h"
+#include "grid_matrix.h"
+
+using namespace std;
+using namespace nla3d;
+using namespace nla3d::math;
+
+// ||b - A * x|| / ||b||
+double relResidual(SparseSymMatrix& mat, const vector<double>& b, const vector<double>& x) {
+  vector<double> r(b);
+  matBVprod(mat, x.data(), -1.0, r.data());
+  double rr = 0.0, bb = 0.0;
+  for (uint32 i = 0; i < b.size(); i++) {
+    rr += r[i] * r[i];
+    bb += b[i] * b[i];
+  }
+  return sqrt(rr / bb);
+}
+
+
+void checkSolver(KrylovEquationSolver& solver, SparseSymMatrix& mat) {
+  uint32 n = mat.nRows();
+  vector<double> b = makeRhs(n);
+  vector<double> x(n);
+  solver.solveEquations(&mat, b.data(), x.data());
+  CHECK(solver.isConverged());
+  CHECK(solver.getNumberOfIterations() > 0);
+  CHECK(solver.getResidualHistory().size() > 0);
+  CHECK(relResidual(mat, b, x) < 10.0 * solver.tolerance);
+}
+
+
+// the same checks for the matrix in BSR format, mat is the same matrix in CSR
+void checkSolver(KrylovEquationSolver& solver, BsrSymMatrix& bsr, SparseSymMatrix& mat) {
+  uint32 n = bsr.nRows();
+  vector<double> b = makeRhs(n);
+  vector<double> x(n);
+  solver.solveEquations(&bsr, b.data(), x.data());
+  CHECK(solver.isConverged());
+  CHECK(solver.getNumberOfIterations() > 0);
+  CHECK(relResidual(mat, b, x) < 10.0 * solver.tolerance);
+}
+
+
+// BSR copy of mat with groups of 3 consecutive rows
+void toBsr(SparseSymMatrix& mat, BsrSymMatrix& bsr) {
+  std::vector<uint32> first;
+  for (uint32 i = 0; i < mat.nRows(); i += 3) {
+    first.push_back(i);
+  }
+  first.push_back(mat.nRows());
+  bsr.reinit(&mat, first);
+  bsr.copyValues(&mat);
+}
+
+
+int main() {
+  cout << "CG on positive definite 3D grid" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 12, 0);
+
+    CGEquationSolver cg;
+    checkSolver(cg, mat);
+    uint32 plainIterations = cg.getNumberOfIterations();
+
+    JacobiPreconditioner jacobi;
+    BlockJacobiPreconditioner blockJacobi(3);
+    IncompleteLDLTPreconditioner ic0(true);
+    for (Preconditioner* prec : std::vector<Preconditioner*>{&jacobi, &blockJacobi, &ic0}) {
+      cg.attachPreconditioner(prec);
+      checkSolver(cg, mat);
+    }
+    // IC(0) should reduce number of iterations
+    CHECK(cg.getNumberOfIterations() < plainIterations);
+
+    // the matrix in BSR format gives (almost) the same iterations, block Jacobi takes the blocks
+    // from the groups of rows
+    BsrSymMatrix bsr;
+    toBsr(mat, bsr);
+    for (Preconditioner* prec : std::vector<Preconditioner*>{&jacobi, &blockJacobi}) {
+      cg.attachPreconditioner(prec);
+      checkSolver(cg, mat);
+      uint32 csrIterations = cg.getNumberOfIterations();
+      checkSolver(cg, bsr, mat);
+      CHECK(cg.getNumberOfIterations() <= csrIterations + 1);
+    }
+
+    // substitution with the changed matrix (modified Newton) uses its current values, the
+    // preconditioner is kept
+    for (uindex k = 0; k < mat.nValues(); k++) {
+      mat.getValuesArray()[k] *= 2.0;
+    }
+    for (uindex k = 0; k < bsr.nValues(); k++) {
+      bsr.getValuesArray()[k] *= 2.0;
+    }
+    vector<double> b = makeRhs(mat.nRows());
+    vector<double> x(mat.nRows());
+    cg.substituteEquations(&bsr, b.data(), x.data());
+    CHECK(cg.isConverged());
+    CHECK(relResidual(mat, b, x) < 10.0 * cg.tolerance);
+  }
+
+  cout << "CG with AMG on 3D grid" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 30, 0);
+
+    CGEquationSolver cg;
+    IncompleteLDLTPreconditioner ic0(true);
+    cg.attachPreconditioner(&ic0);
+    checkSolver(cg, mat);
+    uint32 ic0Iterations = cg.getNumberOfIterations();
+
+    AMGPreconditioner amg;
+    amg.coarsestSize = 100;
+    amg.setNumberOfThreads(2);
+    cg.attachPreconditioner(&amg);
+    checkSolver(cg, mat);
+    CHECK(amg.nLevels() > 2);
+    CHECK(amg.operatorComplexity() < 2.0);
+    CHECK(cg.getNumberOfIterations() < ic0Iterations);
+
+    // BSR matrix: groups of rows are aggregated as nodes
+    BsrSymMatrix bsr;
+    toBsr(mat, bsr);
+    checkSolver(cg, bsr, mat);
+    CHECK(amg.nLevels() > 2);
+    CHECK(cg.getNumberOfIterations() < ic0Iterations);
+  }
+
+  cout << "MINRES and GMRES on indefinite 3D grid with Lagrange multipliers" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 10, 30);
+
+    MINRESEquationSolver minres;
+    JacobiPreconditioner jacobi;
+    minres.attachPreconditioner(&jacobi);
+    checkSolver(minres, mat);
+
+    GMRESEquationSolver gmres;
+    IncompleteLDLTPreconditioner ildl0(false);
+    gmres.attachPreconditioner(&ildl0);
+    checkSolver(gmres, mat);
+  }
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include "sys.h"
+#include "FEStorage.h"
+#include "elements/SOLID81.h"
+#include "FESolver.h"
+#include "math/KrylovEquationSolver.h"
+
+using namespace std;
+using namespace nla3d;
+using namespace nla3d::math;
+
+// Nodal blocks of the unknowns block of K when the equations of nodes aren't aligned by 3: element
+// DoFs (HYDRO_PRESSURE of SOLID81) are numbered first, nodes on symmetry planes are fixed only in
+// one or two directions and an Mpc equation goes last.
+const uint32 nx = 3, ny = 2, nz = 2;
+
+
+uint32 nodeNumber(uint32 i, uint32 j, uint32 k) {
+  return (k * (ny + 1) + j) * (nx + 1) + i + 1;
+}
+
+
+void buildModel(FEStorage& storage) {
+  Material* mat = CHECK_NOTNULL(MaterialFactory::createMaterial("Neo-Hookean"));
+  mat->Ci(0) = 1.0;
+  mat->Ci(1) = 500.0;
+  storage.material = mat;
+
+  std::vector<Vec<3>> positions;
+  for (uint32 k = 0; k <= nz; k++) {
+    for (uint32 j = 0; j <= ny; j++) {
+      for (uint32 i = 0; i <= nx; i++) {
+        positions.push_back(Vec<3>(1.0 * i, 1.1 * j, 0.9 * k));
+      }
+    }
+  }
+  storage.createNodes(positions);
+  auto els = storage.createElements(nx * ny * nz, ElementType::SOLID81);
+  uint32 e = 0;
+  for (uint32 k = 0; k < nz; k++) {
+    for (uint32 j = 0; j < ny; j++) {
+      for (uint32 i = 0; i < nx; i++) {
+        const uint32 corners[8][3] = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+                                      {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}};
+        Element& el = storage.getElement(els[e++]);
+        for (uint16 c = 0; c < 8; c++) {
+          el.getNodeNumber(c) = nodeNumber(i + corners[c][0], j + corners[c][1], k + corners[c][2]);
+        }
+      }
+    }
+  }
+
+  // UY of two corner nodes are equal
+  Mpc* mpc = new Mpc;
+  mpc->eq.push_back(MpcTerm(nodeNumber(nx, ny, nz), Dof::UY, 1.0));
+  mpc->eq.push_back(MpcTerm(nodeNumber(0, ny, nz), Dof::UY, -1.0));
+  mpc->b = 0.0;
+  storage.addMpc(mpc);
+}
+
+
+// symmetry planes x = 0, y = 0, z = 0 and tension along x
+void addBcs(LinearFESolver& solver) {
+  for (uint32 k = 0; k <= nz; k++) {
+    for (uint32 j = 0; j <= ny; j++) {
+      for (uint32 i = 0; i <= nx; i++) {
+        if (i == 0) solver.addFix(nodeNumber(i, j, k), Dof::UX);
+        if (j == 0) solver.addFix(nodeNumber(i, j, k), Dof::UY);
+        if (k == 0) solver.addFix(nodeNumber(i, j, k), Dof::UZ);
+        if (i == nx) solver.addLoad(nodeNumber(i, j, k), Dof::UX, 0.1 + 0.01 * (j + k));
+      }
+    }
+  }
+}
+
+
+int main() {
+  // reference solution by LDLT
+  FEStorage refStorage;
+  LinearFESolver refSolver;
+  LDLTEquationSolver ldlt;
+  buildModel(refStorage);
+  addBcs(refSolver);
+  refSolver.attachEquationSolver(&ldlt);
+  refSolver.attachFEStorage(&refStorage);
+  refSolver.solve();
+
+  // MINRES with block Jacobi (the model is indefinite because of HYDRO_PRESSURE and the Mpc)
+  FEStorage storage;
+  LinearFESolver solver;
+  MINRESEquationSolver minres;
+  minres.tolerance = 1.0e-12;
+  minres.maxIterations = 5000;
+  BlockJacobiPreconditioner blockJacobi;
+  minres.attachPreconditioner(&blockJacobi);
+  buildModel(storage);
+  addBcs(solver);
+  solver.attachEquationSolver(&minres);
+  solver.attachFEStorage(&storage);
+  solver.solve();
+  CHECK(minres.isConverged());
+  CHECK(storage.getU()->compare(*refStorage.getU(), 1.0e-8));
+
+  SparseSymMatrix* K = storage.getK()->block(2);
+  const uint32 n = K->nRows();
+
+  // expected blocks: every element DoF and the Mpc equation alone, unknown DoFs of a node together
+  std::vector<uint32> nodal;
+  storage.getNodalBlocks(nodal);
+  CHECK_EQ(nodal.back(), n);
+  uint32 nSingle = 0, nDouble = 0;
+  for (uint32 b = 0; b + 1 < nodal.size(); b++) {
+    uint32 size = nodal[b + 1] - nodal[b];
+    if (size == 1) nSingle++;
+    if (size == 2) nDouble++;
+  }
+  // element DoFs, the Mpc equation and nodes of the edges of symmetry planes
+  CHECK(nSingle > nx * ny * nz + 1);
+  // nodes on symmetry planes
+  CHECK(nDouble > 0);
+  // FESolver gives the nodal blocks to the preconditioner
+  CHECK(blockJacobi.getBlocks() == nodal);
+
+  // M^-1 is the inverse of the diagonal blocks of the nodes: K_bb * z_b = r_b
+  std::vector<double> r(n), z(n);
+  for (uint32 i = 0; i < n; i++) {
+    r[i] = sin(0.7 * i) + 0.3;
+  }
+  blockJacobi.apply(r.data(), z.data());
+  for (uint32 b = 0; b + 1 < nodal.size(); b++) {
+    if (nodal[b] < storage.nElements() || nodal[b] >= storage.nUnknownDofs()) continue;
+    for (uint32 i = nodal[b]; i < nodal[b + 1]; i++) {
+      double s = 0.0;
+      for (uint32 j = nodal[b]; j < nodal[b + 1]; j++) {
+        s += K->value(i + 1, j + 1) * z[j];
+      }
+      CHECK_EQTH(s, r[i], 1.0e-10 * fabs(r[i]) + 1.0e-14);
+    }
+  }
+
+  // without given blocks they are found from the matrix structure: the rows of a node are split
+  // only if they have different entries (UY of the nodes in the Mpc), but never joined with the
+  // rows of other nodes
+  BlockJacobiPreconditioner found;
+  found.setup(K);
+  const std::vector<uint32>& blocks = found.getBlocks();
+  CHECK(blocks.size() > nodal.size());
+  for (uint32 b = 0; b + 1 < blocks.size(); b++) {
+    auto it = std::upper_bound(nodal.begin(), nodal.end(), blocks[b]);
+    CHECK(blocks[b + 1] <= *it);
+  }
+  return 0;
+}
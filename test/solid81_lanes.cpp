@@ -0,0 +1,144 @@
+#include "sys.h"
+#include "FEStorage.h"
+#include "elements/SOLID81.h"
+
+using namespace std;
+using namespace nla3d;
+using namespace nla3d::math;
+
+// Elements don't share nodes, so every entry of the global K and F gets a contribution of one
+// element only: K and F hold the entries of Ke and Fe of all elements.
+const uint32 nEl = 10;
+
+
+// distorted hexahedrons with pre-strained integration points
+void buildModel(FEStorage& storage, bool matrixFree = false) {
+  Material* mat = CHECK_NOTNULL(MaterialFactory::createMaterial("Neo-Hookean"));
+  mat->Ci(0) = 1.0;
+  mat->Ci(1) = 500.0;
+  storage.material = mat;
+
+  const double corners[8][3] = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+                                {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}};
+  std::vector<Vec<3>> positions;
+  for (uint32 e = 0; e < nEl; e++) {
+    for (uint16 i = 0; i < 8; i++) {
+      Vec<3> pos;
+      for (uint16 d = 0; d < 3; d++) {
+        pos[d] = corners[i][d] + 0.15 * sin(1.3 * e + 2.1 * i + 0.7 * d);
+      }
+      pos[0] += 3.0 * e;
+      positions.push_back(pos);
+    }
+  }
+  storage.createNodes(positions);
+  auto els = storage.createElements(nEl, ElementType::SOLID81);
+  for (uint32 e = 0; e < nEl; e++) {
+    Element& el = storage.getElement(els[e]);
+    for (uint16 i = 0; i < 8; i++) {
+      el.getNodeNumber(i) = e * 8 + i + 1;
+    }
+  }
+  storage.setMatrixFree(matrixFree);
+  storage.initDofs();
+  storage.assignEquationNumbers();
+  storage.initSolutionData();
+
+  for (uint32 e = 0; e < nEl; e++) {
+    ElementSOLID81& el = dynamic_cast<ElementSOLID81&>(storage.getElement(els[e]));
+    for (uint16 np = 0; np < el.nOfIntPoints(); np++) {
+      Mat<3,3> F;
+      for (uint16 i = 0; i < 9; i++) {
+        el.O[np][i] = 0.1 * sin(0.9 * e + 1.7 * np + 0.5 * i);
+        F.data[i / 3][i % 3] = (i / 3 == i % 3 ? 1.0 : 0.0) + el.O[np][i];
+      }
+      // C = F^T * F
+      uint16 k = 0;
+      for (uint16 i = 0; i < 3; i++) {
+        for (uint16 j = i; j < 3; j++) {
+          el.C[np][k++] = F.data[0][i] * F.data[0][j] + F.data[1][i] * F.data[1][j] +
+                          F.data[2][i] * F.data[2][j];
+        }
+      }
+      for (uint16 i = 0; i < 6; i++) {
+        el.S[np][i] = 0.3 * cos(1.1 * e + 0.3 * np + 0.8 * i);
+      }
+    }
+    uint32 eq = storage.getElementDofEqNumber(els[e], Dof::HYDRO_PRESSURE);
+    (*storage.getU())[eq - 1] = 0.05 * e - 0.2;
+  }
+}
+
+
+// K and F of the model
+void getKF(FEStorage& storage, vector<double>& K, vector<double>& F) {
+  auto matK = storage.getK()->block(2);
+  K.assign(matK->getValuesArray(), matK->getValuesArray() + matK->nValues());
+  F.assign(storage.getF()->ptr(), storage.getF()->ptr() + storage.getF()->size());
+}
+
+
+int main() {
+  FEStorage storage;
+  buildModel(storage);
+  vector<ElementSOLID81*> els(nEl);
+  for (uint32 e = 0; e < nEl; e++) {
+    els[e] = dynamic_cast<ElementSOLID81*>(&storage.getElement(e + 1));
+  }
+
+  // reference: single element buildK()
+  storage.zeroK();
+  storage.zeroF();
+  for (auto el : els) {
+    el->buildK();
+  }
+  vector<double> refK, refF;
+  getKF(storage, refK, refF);
+  CHECK(refK.size() == nEl * 25 * 26 / 2);
+  for (auto v : refK) {
+    CHECK(std::isfinite(v));
+  }
+
+  // Ke and Fe of lanes are the same bit to bit for both kernels: two full groups and the partial
+  // final group of two elements
+  for (bool avx2 : {true, false}) {
+    ElementSOLID81::useAvx2 = avx2;
+    storage.zeroK();
+    storage.zeroF();
+    for (uint32 e = 0; e < nEl; e += ElementSOLID81::numberOfLanes) {
+      uint16 n = static_cast<uint16>(std::min<uint32>(ElementSOLID81::numberOfLanes, nEl - e));
+      ElementSOLID81::buildKLanes(&els[e], n);
+    }
+    vector<double> K, F;
+    getKF(storage, K, F);
+    CHECK(K == refK);
+    CHECK(F == refF);
+
+    // the same through the element batches of FEStorage
+    storage.assembleGlobalEqMatrices();
+    getKF(storage, K, F);
+    CHECK(K == refK);
+    CHECK(F == refF);
+  }
+  ElementSOLID81::useAvx2 = true;
+
+  // ElementSOLID81::multiplyK(..) of the same model gives K * x without forming Ke
+  FEStorage mfStorage;
+  buildModel(mfStorage, true);
+  uint32 nEq = storage.nDofs() + storage.nMpc();
+  vector<double> x(nEq), y(nEq), refY(nEq);
+  for (uint32 i = 0; i < nEq; i++) {
+    x[i] = sin(0.37 * i) + 0.5;
+  }
+  mfStorage.multiplyK(x.data(), y.data());
+  matBVprod(*storage.getK()->block(2), x.data(), 1.0, refY.data());
+  double maxY = 0.0;
+  for (auto v : refY) {
+    maxY = std::max(maxY, fabs(v));
+  }
+  for (uint32 i = 0; i < nEq; i++) {
+    CHECK(fabs(y[i] - refY[i]) < 1.0e-12 * maxY);
+  }
+
+  return 0;
+}
@@ -0,0 +1,303 @@
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/EquationSolver.h"
+#include "grid_matrix.h"
+
+using namespace std;
+using namespace nla3d;
+using namespace nla3d::math;
+
+// max |b - A * x|
+double residual(SparseSymMatrix& mat, const vector<double>& b, const vector<double>& x) {
+  vector<double> r(b);
+  double* values = mat.getValuesArray();
+  uindex* iofeir = mat.getIofeirArray();
+  uint32* columns = mat.getColumnsArray();
+  for (uint32 i = 0; i < mat.nRows(); i++) {
+    for (uindex k = iofeir[i] - 1; k < iofeir[i + 1] - 1; k++) {
+      uint32 j = columns[k] - 1;
+      r[i] -= values[k] * x[j];
+      if (i != j) r[j] -= values[k] * x[i];
+    }
+  }
+  double res = 0.0;
+  for (auto v : r) res = std::max(res, fabs(v));
+  return res;
+}
+
+
+int main() {
+  cout << "Small indefinite matrix vs GaussDenseEquationSolver" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 4, 5, false);
+    uint32 n = mat.nRows();
+    vector<double> b = makeRhs(n);
+    vector<double> x(n), xg(n);
+
+    LDLTEquationSolver ldlt;
+    ldlt.setPositive(false);
+    ldlt.solveEquations(&mat, b.data(), x.data());
+
+    GaussDenseEquationSolver gauss;
+    vector<double> bg(b);
+    gauss.solveEquations(&mat, bg.data(), xg.data());
+
+    for (uint32 i = 0; i < n; i++) {
+      CHECK_EQTH(x[i], xg[i], 1.0e-10);
+    }
+
+    // substitution with the existing factorization
+    vector<double> b2(n, 1.0);
+    ldlt.substituteEquations(&mat, b2.data(), x.data());
+    gauss.substituteEquations(&mat, b2.data(), xg.data());
+    for (uint32 i = 0; i < n; i++) {
+      CHECK_EQTH(x[i], xg[i], 1.0e-10);
+    }
+  }
+
+  cout << "Positive definite 3D grid, 1 thread vs 4 threads" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 14, 0, false);
+    uint32 n = mat.nRows();
+    vector<double> b = makeRhs(n);
+    vector<double> x1(n), x4(n);
+
+    LDLTEquationSolver ldlt1;
+    ldlt1.setNumberOfThreads(1);
+    ldlt1.solveEquations(&mat, b.data(), x1.data());
+    CHECK(residual(mat, b, x1) < 1.0e-10);
+
+    LDLTEquationSolver ldlt4;
+    ldlt4.setNumberOfThreads(4);
+    ldlt4.solveEquations(&mat, b.data(), x4.data());
+    // the order of floating point operations doesn't depend on number of threads
+    for (uint32 i = 0; i < n; i++) {
+      CHECK_EQ(x1[i], x4[i]);
+    }
+
+    // refactorization with new values on the same sparsity
+    for (uint32 i = 1; i <= n; i++) {
+      mat.addValue(i, i, 1.0);
+    }
+    ldlt4.factorizeEquations(&mat);
+    ldlt4.substituteEquations(&mat, b.data(), x4.data());
+    CHECK(residual(mat, b, x4) < 1.0e-10);
+    // symbolic analysis is reused
+    CHECK(ldlt4.getNumberOfAnalyses() == 1);
+  }
+
+  cout << "Top supernodes factorized by all threads" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 16, 60, false);
+    uint32 n = mat.nRows();
+    // strongly indefinite: pivots are interchanged inside of the supernodes
+    for (uint32 i = 1; i <= 16 * 16 * 16; i++) {
+      mat.addValue(i, i, -6.0);
+    }
+    vector<double> b = makeRhs(n);
+    vector<double> x(n), xp(n);
+
+    // reference: tree parallelism only
+    SupernodalLDLT serial;
+    serial.setNumberOfThreads(1);
+    serial.analyse(&mat);
+    serial.factorize(&mat);
+    serial.solve(b.data(), x.data());
+    CHECK(serial.nParallelSupernodes() == 0);
+    CHECK(serial.n2x2Pivots() > 0);
+    CHECK(residual(mat, b, x) < 1.0e-8);
+
+    // the updates and the panel rows of the top supernodes are split between the threads, pivots
+    // are the same, so the factor is the same bit to bit
+    for (uint16 threads : {2, 4}) {
+      SupernodalLDLT parallel;
+      parallel.setNumberOfThreads(threads);
+      parallel.parallelPanelSize = 4096;
+      parallel.analyse(&mat);
+      parallel.factorize(&mat);
+      CHECK(parallel.nParallelSupernodes() > 1);
+      CHECK(parallel.nParallelSupernodes() < parallel.nSupernodes());
+      CHECK(parallel.n2x2Pivots() == serial.n2x2Pivots());
+      CHECK(parallel.nNegativePivots() == serial.nNegativePivots());
+      parallel.solve(b.data(), xp.data());
+      for (uint32 i = 0; i < n; i++) {
+        CHECK_EQ(x[i], xp[i]);
+      }
+    }
+  }
+
+  cout << "Indefinite 3D grid with Lagrange multipliers" << endl;
+  {
+    for (bool mpcFirst : {false, true}) {
+      SparseSymMatrix mat;
+      buildGridMatrix(mat, 12, 40, mpcFirst);
+      uint32 n = mat.nRows();
+      vector<double> b = makeRhs(n);
+      vector<double> x(n);
+
+      LDLTEquationSolver ldlt;
+      ldlt.setPositive(false);
+      ldlt.solveEquations(&mat, b.data(), x.data());
+      CHECK(residual(mat, b, x) < 1.0e-8);
+    }
+  }
+
+  cout << "Fill-reducing orderings" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 12, 40, true);
+    uint32 n = mat.nRows();
+    vector<double> b = makeRhs(n);
+    vector<double> x(n);
+
+    uint64 natural = 0;
+    for (auto method : {OrderingMethod::Natural, OrderingMethod::AMD,
+                        OrderingMethod::NestedDissection}) {
+      vector<uint32> order;
+      fillReducingOrdering(&mat, method, order);
+      // order should be a permutation
+      vector<uint32> count(n, 0);
+      for (auto v : order) count[v]++;
+      for (auto c : count) CHECK(c == 1);
+
+      SupernodalLDLT ldlt;
+      ldlt.ordering = method;
+      ldlt.analyse(&mat);
+      if (method == OrderingMethod::Natural) {
+        natural = ldlt.nonzerosInFactor();
+        continue;
+      }
+      CHECK(ldlt.nonzerosInFactor() < natural / 2);
+      // Lagrange multipliers are placed after their neighbours, so no pivots are perturbed
+      ldlt.factorize(&mat);
+      CHECK(ldlt.nPerturbedPivots() == 0);
+      ldlt.solve(b.data(), x.data());
+      CHECK(residual(mat, b, x) < 1.0e-8);
+    }
+  }
+
+  cout << "Multiple right hand sides" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 10, 30, false);
+    uint32 n = mat.nRows();
+    const uint32 nrhs = 4;
+    vector<double> b(n * nrhs);
+    for (uint32 i = 0; i < b.size(); i++) {
+      b[i] = sin(0.1 * i) + 0.5 * (i / n);
+    }
+    vector<double> x(n * nrhs);
+
+    LDLTEquationSolver ldlt;
+    ldlt.setPositive(false);
+    ldlt.factorizeEquations(&mat);
+    ldlt.setNumberOfRhs(nrhs);
+    ldlt.substituteEquations(&mat, b.data(), x.data());
+    // every column should be the same as the single rhs solution
+    ldlt.setNumberOfRhs(1);
+    vector<double> x1(n);
+    for (uint32 r = 0; r < nrhs; r++) {
+      vector<double> br(b.begin() + n * r, b.begin() + n * (r + 1));
+      vector<double> xr(x.begin() + n * r, x.begin() + n * (r + 1));
+      CHECK(residual(mat, br, xr) < 1.0e-8);
+      ldlt.substituteEquations(&mat, br.data(), x1.data());
+      for (uint32 i = 0; i < n; i++) {
+        CHECK_EQTH(x1[i], xr[i], 1.0e-12);
+      }
+    }
+  }
+
+  cout << "Mixed precision factorization" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 12, 40, false);
+    uint32 n = mat.nRows();
+    vector<double> b = makeRhs(n);
+    vector<double> x(n);
+
+    LDLTEquationSolver ldlt;
+    ldlt.setPositive(false);
+    ldlt.mixedPrecision = true;
+    ldlt.solveEquations(&mat, b.data(), x.data());
+    CHECK(!ldlt.isFallenBackToDouble());
+    CHECK(ldlt.getNumberOfRefinementSteps() > 0);
+    CHECK(residual(mat, b, x) < 1.0e-10);
+
+    // modified Newton reuses the factor for the next matrices: the solution is refined against
+    // the factorized matrix, not against the one passed to substituteEquations(..)
+    SparseSymMatrix next;
+    buildGridMatrix(next, 12, 40, false);
+    double* values = next.getValuesArray();
+    for (uindex k = 0; k < next.nValues(); k++) {
+      values[k] *= 1.3;
+    }
+    vector<double> xr(n);
+    ldlt.substituteEquations(&next, b.data(), xr.data());
+    CHECK(!ldlt.isFallenBackToDouble());
+    CHECK(residual(mat, b, xr) < 1.0e-10);
+
+    // 1D Laplacian with free ends and tiny shift is too ill-conditioned for single precision
+    // factor, the solver should fall back to double precision
+    SparseSymMatrix ill;
+    uint32 m = 200;
+    ill.reinit(m, 2);
+    for (uint32 i = 1; i <= m; i++) {
+      ill.addEntry(i, i);
+      if (i < m) ill.addEntry(i, i + 1);
+    }
+    ill.compress();
+    for (uint32 i = 1; i <= m; i++) {
+      ill.addValue(i, i, ((i == 1 || i == m) ? 1.0 : 2.0) + 1.0e-9);
+      if (i < m) ill.addValue(i, i + 1, -1.0);
+    }
+    vector<double> bi = makeRhs(m);
+    vector<double> xi(m);
+    LDLTEquationSolver ldltIll;
+    ldltIll.mixedPrecision = true;
+    ldltIll.solveEquations(&ill, bi.data(), xi.data());
+    CHECK(ldltIll.isFallenBackToDouble());
+    CHECK(residual(ill, bi, xi) < 1.0e-6);
+  }
+
+  cout << "Out-of-core factorization" << endl;
+  {
+    SparseSymMatrix mat;
+    buildGridMatrix(mat, 22, 0, false);
+    uint32 n = mat.nRows();
+    vector<double> b = makeRhs(n);
+    vector<double> x(n), xo(n);
+
+    SupernodalLDLT inCore;
+    inCore.analyse(&mat);
+    inCore.factorize(&mat);
+    inCore.solve(b.data(), x.data());
+
+    // the factor doesn't fit into the memory budget, so it's written to the scratch file
+    SupernodalLDLT outOfCore;
+    outOfCore.outOfCore = true;
+    outOfCore.memoryBudget = 4;
+    outOfCore.setNumberOfThreads(2);
+    outOfCore.analyse(&mat);
+    outOfCore.factorize(&mat);
+    CHECK(outOfCore.factorSize() > 2 * outOfCore.memoryBudget * 1024 * 1024);
+    CHECK(outOfCore.factorMemory() <= outOfCore.memoryBudget * 1024 * 1024);
+    outOfCore.solve(b.data(), xo.data());
+    CHECK(outOfCore.factorMemory() <= outOfCore.memoryBudget * 1024 * 1024);
+    for (uint32 i = 0; i < n; i++) {
+      CHECK_EQ(x[i], xo[i]);
+    }
+
+    // the same through EquationSolver interface with refactorization
+    LDLTEquationSolver ldlt;
+    ldlt.setOutOfCore(true, ".", 4);
+    ldlt.solveEquations(&mat, b.data(), xo.data());
+    ldlt.factorizeEquations(&mat);
+    ldlt.substituteEquations(&mat, b.data(), xo.data());
+    CHECK(residual(mat, b, xo) < 1.0e-10);
+  }
+
+  return 0;
+}
@@ -1,6 +1,9 @@
 #include "sys.h"
 #include "math/Vec.h"
 #include "math/SparseMatrix.h"
+#include "math/BlockSparseMatrix.h"
+#include "math/BsrMatrix.h"
+#include "math/ThreadPool.h"
 
 using namespace std;
 using namespace nla3d::math;
@@ -477,4 +480,178 @@ int main() {
     CHECK(res2.compare(res));
   }
 
+  cout << "BlockSparseSymMatrix<2> with exact sparsity built in two passes" << endl;
+  // tridiagonal matrix with the first row (like Mpc equation) coupled with all others. The first
+  // row is wider than the default max_in_row = 100.
+  {
+    const uint32 n = 300;
+    const uint32 m = 20;
+    BlockSparseSymMatrix<2> A({m, n - m}, 0);
+    A.buildSparsity([&](uint32 i, std::vector<uint32>& cols) {
+      cols.push_back(i);
+      if (i > 1) cols.push_back(i - 1);
+      if (i < n) cols.push_back(i + 1);
+      if (i == 1) {
+        for (uint32 j = 1; j <= n; j++) cols.push_back(j);
+      } else {
+        cols.push_back(1);
+      }
+      // duplicates are allowed
+      cols.push_back(i);
+    });
+    CHECK(A.isCompressed());
+
+    // the same matrix by addEntry(..)
+    BlockSparseSymMatrix<2> B({m, n - m}, n);
+    for (uint32 i = 1; i <= n; i++) {
+      B.addEntry(i, i);
+      if (i < n) B.addEntry(i, i + 1);
+      B.addEntry(1, i);
+    }
+    B.compress();
+
+    CHECK(A.block(1)->compare(*B.block(1)));
+    CHECK(A.block(1, 2)->compare(*B.block(1, 2)));
+    CHECK(A.block(2)->compare(*B.block(2)));
+    // memory is exact: n entries in the first row, 2 entries in rows 2..n-1, 1 entry in the last
+    CHECK_EQ(A.block(1)->nValues() + A.block(1, 2)->nValues() + A.block(2)->nValues(),
+        n + 2 * (n - 2) + 1);
+    CHECK_EQ(A.block(1, 2)->getSparsityInfo()->nElementsInRow(1), n - m);
+  }
+
+  cout << "BsrSymMatrix from SparseSymMatrix with 3-DoF nodes and single rows" << endl;
+  // chain of nodes with 3 DoFs each (node couples with the next one) and two more rows (like Mpc
+  // equations) coupled with all DoFs of the first and the last nodes
+  {
+    const uint32 nNodes = 50;
+    const uint32 n = nNodes * 3 + 2;
+    SparseSymMatrix A(n);
+    auto couple = [&](uint32 i, uint32 j, double v) {
+      if (A.isCompressed()) A.addValue(i, j, v); else A.addEntry(i, j);
+    };
+    auto fill = [&]() {
+      for (uint32 node = 0; node < nNodes; node++) {
+        for (uint32 di = 1; di <= 3; di++) {
+          uint32 i = node * 3 + di;
+          for (uint32 j = i; j <= std::min(node * 3 + 6, n - 2); j++) {
+            couple(i, j, (i == j) ? 10.0 + i % 7 : 1.0 / (1.0 + i + 2 * j));
+          }
+        }
+      }
+      for (uint32 d = 1; d <= 3; d++) {
+        couple(d, n - 1, 0.5 * d);
+        couple(n - 5 + d, n, -0.25 * d);
+      }
+      couple(n - 1, n - 1, 0.0);
+      couple(n, n, 0.0);
+    };
+    fill();
+    A.compress();
+    fill();
+
+    BsrSymMatrix bsr;
+    bsr.reinit(&A);
+    CHECK_EQ(bsr.nBlocks(), nNodes + 2);
+    CHECK_EQ(bsr.getBlockFirst(nNodes), n - 2);
+    CHECK(bsr.nBlockEntries() * 3 < A.nValues());
+    bsr.copyValues(&A);
+
+    // the same groups given explicitly, but single rows only
+    std::vector<uint32> first(n + 1);
+    for (uint32 i = 0; i <= n; i++) first[i] = i;
+    BsrSymMatrix single;
+    single.reinit(&A, first);
+    single.copyValues(&A);
+    CHECK_EQ(single.nBlocks(), n);
+
+    dVec x(n), ref(n), y(n), d(n);
+    for (uint32 i = 0; i < n; i++) x[i] = 1.0 + (i % 5) - 0.1 * i;
+    matBVprod(A, x, 1.0, ref);
+    for (BsrSymMatrix* M : {&bsr, &single}) {
+      M->multiply(x.ptr(), y.ptr());
+      for (uint32 i = 0; i < n; i++) {
+        CHECK_EQTH(y[i], ref[i], 1.0e-12);
+      }
+      M->diagonal(d.ptr());
+      for (uint32 i = 0; i < n; i++) {
+        CHECK_EQ(d[i], A.value(i + 1, i + 1));
+      }
+    }
+
+    // add values directly
+    bsr.addValue(5, 4, 2.0);
+    bsr.addValue(2, n - 1, 1.0);
+    // only the upper triangle of diagonal blocks is stored
+    CHECK_EQ(bsr.getBlock(1, 1)[0 * 3 + 1], A.value(4, 5) + 2.0);
+    CHECK_EQ(bsr.getBlock(1, 1)[1 * 3 + 0], 0.0);
+    CHECK_EQ(bsr.getBlock(0, nNodes)[1 * 3 + 0], A.value(2, n - 1) + 1.0);
+    CHECK(bsr.getBlock(0, 2) == nullptr);
+  }
+
+  cout << "Parallel products of big sparse matrices" << endl;
+  // big enough to use parallel kernels, compare with the products entry by entry
+  {
+    const uint32 n = 20000;
+    const uint32 m = 10000;
+    auto entries = [&](uint32 i, std::function<void(uint32, double)> add) {
+      for (uint32 d : {0u, 1u, 2u, 7u, 31u, 500u}) {
+        uint32 j = i + d;
+        if (j <= n) add(j, 1.0 / (1.0 + i % 13 + j % 11));
+      }
+    };
+    SparseSymMatrix A(n, 10);
+    SparseMatrix C(m, n, 10);
+    for (uint32 pass = 0; pass < 2; pass++) {
+      for (uint32 i = 1; i <= n; i++) {
+        entries(i, [&](uint32 j, double v) {
+          if (pass == 0) A.addEntry(i, j); else A.addValue(i, j, v);
+          if (i <= m) {
+            if (pass == 0) C.addEntry(i, j); else C.addValue(i, j, v);
+          }
+        });
+      }
+      if (pass == 0) {
+        A.compress();
+        C.compress();
+      }
+    }
+
+    dVec x(n), xm(m), refA(n), refC(m), refCT(n);
+    for (uint32 i = 0; i < n; i++) x[i] = sin(0.01 * i);
+    for (uint32 i = 0; i < m; i++) xm[i] = cos(0.02 * i);
+    for (uint32 i = 1; i <= n; i++) {
+      entries(i, [&](uint32 j, double v) {
+        refA[i - 1] += v * x[j - 1];
+        if (i != j) refA[j - 1] += v * x[i - 1];
+        if (i <= m) {
+          refC[i - 1] += v * x[j - 1];
+          refCT[j - 1] += v * xm[i - 1];
+        }
+      });
+    }
+
+    std::vector<dVec> resA, resC, resCT;
+    for (uint16 threads : {1, 4}) {
+      ThreadPool::instance().setNumberOfThreads(threads);
+      resA.push_back(dVec(n));
+      resC.push_back(dVec(m));
+      resCT.push_back(dVec(n));
+      matBVprod(A, x, 2.0, resA.back());
+      matBVprod(C, x, 2.0, resC.back());
+      matBTVprod(C, xm, 2.0, resCT.back());
+      for (uint32 i = 0; i < n; i++) {
+        CHECK_EQTH(resA.back()[i], 2.0 * refA[i], 1.0e-12);
+        CHECK_EQTH(resCT.back()[i], 2.0 * refCT[i], 1.0e-12);
+      }
+      for (uint32 i = 0; i < m; i++) {
+        CHECK_EQTH(resC.back()[i], 2.0 * refC[i], 1.0e-12);
+      }
+    }
+    ThreadPool::instance().setNumberOfThreads(0);
+    // the same result bit to bit for any number of threads
+    CHECK(std::equal(resA[0].ptr(), resA[0].ptr() + n, resA[1].ptr()));
+    CHECK(std::equal(resC[0].ptr(), resC[0].ptr() + m, resC[1].ptr()));
+    CHECK(std::equal(resCT[0].ptr(), resCT[0].ptr() + n, resCT[1].ptr()));
+  }
+
 }
@@ -0,0 +1,74 @@
+#include "sys.h"
+#include "math/ThreadPool.h"
+#include <numeric>
+
+using namespace nla3d;
+using namespace nla3d::math;
+
+int main() {
+  ThreadPool& pool = ThreadPool::instance();
+
+  for (uint16 threads : {1, 2, 4, 7}) {
+    pool.setNumberOfThreads(threads);
+    CHECK(pool.getNumberOfThreads() == threads);
+
+    // every index is visited exactly once
+    const uint32 n = 100003;
+    std::vector<uint32> visits(n, 0);
+    parallelFor(n, 0, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) visits[i]++;
+    });
+    CHECK(std::count(visits.begin(), visits.end(), 1u) == n);
+
+    // ranges are not smaller than grain
+    uint16 chunks = parallelForChunks(n, 16, [&](uint16, uint32 begin, uint32 end) {
+      CHECK(end - begin >= 10000 || end == n);
+    }, 10000);
+    CHECK(chunks == 10);
+    CHECK(parallelForChunks(5, 0, [](uint16, uint32, uint32) { }, 10) == 1);
+    CHECK(parallelForChunks(0, 0, [](uint16, uint32, uint32) { }) == 0);
+
+    // reduction with fixed number of ranges is bitwise reproducible
+    std::vector<double> x(n);
+    for (uint32 i = 0; i < n; i++) x[i] = 1.0 / (1.0 + i);
+    auto sum = [&](uint16 chunks) {
+      return parallelReduce(n, chunks, 0.0, [&](uint32 begin, uint32 end) {
+        double s = 0.0;
+        for (uint32 i = begin; i < end; i++) s += x[i];
+        return s;
+      }, [](double a, double b) { return a + b; });
+    };
+    double ref = std::accumulate(x.begin(), x.end(), 0.0);
+    CHECK_EQTH(sum(0), ref, 1.0e-12);
+    CHECK(sum(8) == sum(8));
+    CHECK(parallelReduce(1000u, 0, 0u, [](uint32 begin, uint32 end) { return end - begin; },
+          [](uint32 a, uint32 b) { return a + b; }) == 1000u);
+
+    // nested parallel loops and tasks submitting tasks don't deadlock
+    std::atomic<uint32> counter(0);
+    parallelFor(64, 0, [&](uint32 begin, uint32 end) {
+      for (uint32 i = begin; i < end; i++) {
+        parallelFor(1000, 0, [&](uint32 b, uint32 e) {
+          counter += e - b;
+        });
+      }
+    });
+    CHECK(counter == 64000);
+
+    counter = 0;
+    {
+      TaskGroup group;
+      std::function<void(uint32)> spawn = [&](uint32 depth) {
+        counter++;
+        if (depth == 0) return;
+        group.run([&spawn, depth] { spawn(depth - 1); });
+        group.run([&spawn, depth] { spawn(depth - 1); });
+      };
+      spawn(10);
+      group.wait();
+    }
+    CHECK(counter == 2047);
+  }
+  pool.setNumberOfThreads(0);
+  return 0;
+}